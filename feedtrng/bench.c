@@ -0,0 +1,108 @@
+/*
+ * Process helpers of the benchmarks running feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/* the descriptors closed in the process, above the standard ones */
+#define BENCH_MAXFD (64)
+
+double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+pid_t bench_spawn(const char *path, char *const args[], int infd, int outfd,
+                  const char *errpath) {
+  pid_t pid;
+  int fd;
+
+  if ((pid = fork()) == -1) {
+    err(EX_OSERR, "fork");
+  }
+  if (pid != 0) {
+    return pid;
+  }
+  if (infd != -1) {
+    dup2(infd, STDIN_FILENO);
+  }
+  dup2(outfd, STDOUT_FILENO);
+  if (errpath != NULL) {
+    if ((fd = open(errpath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+      err(EX_CANTCREAT, "%s", errpath);
+    }
+    dup2(fd, STDERR_FILENO);
+  }
+  /* not the write end of an input pipe, which would never end */
+  for (fd = STDERR_FILENO + 1; fd < BENCH_MAXFD; fd++) {
+    close(fd);
+  }
+  execv(path, args);
+  err(EX_UNAVAILABLE, "cannot run %s", path);
+}
+
+/* the read and write calls of the process, Linux only */
+static void bench_io(pid_t pid, struct bench_proc *bp) {
+  char path[64], line[128];
+  long long v;
+  FILE *f;
+
+  bp->syscr = bp->syscw = -1;
+  snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+  if ((f = fopen(path, "r")) == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "syscr: %lld", &v) == 1) {
+      bp->syscr = v;
+    } else if (sscanf(line, "syscw: %lld", &v) == 1) {
+      bp->syscw = v;
+    }
+  }
+  fclose(f);
+}
+
+int bench_reap(pid_t pid, struct bench_proc *bp) {
+  struct rusage ru;
+  siginfo_t si;
+  int status;
+
+  /* the counters of the exited process, before it is reaped */
+  if (waitid(P_PID, pid, &si, WEXITED | WNOWAIT) == -1) {
+    err(EX_OSERR, "waitid");
+  }
+  bench_io(pid, bp);
+  if (wait4(pid, &status, 0, &ru) == -1) {
+    err(EX_OSERR, "wait4");
+  }
+  bp->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+            ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+  bp->nvcsw = ru.ru_nvcsw;
+  bp->nivcsw = ru.ru_nivcsw;
+  return status;
+}
+
+void bench_per(FILE *out, const char *name, double count, double units,
+               int prec, const char *sep) {
+  if ((count >= 0) && (units > 0)) {
+    fprintf(out, "\"%s\": %.*f%s", name, prec, count / units, sep);
+  } else {
+    fprintf(out, "\"%s\": null%s", name, sep);
+  }
+}
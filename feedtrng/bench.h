@@ -0,0 +1,40 @@
+/*
+ * Process helpers of the benchmarks running feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_BENCH_H_
+#define _FEEDTRNG_BENCH_H_
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* what a process took, once it has exited */
+struct bench_proc {
+  double cpu;             /* user and system time [s] */
+  long long syscr, syscw; /* read and write calls, -1 without /proc */
+  long nvcsw, nivcsw;     /* voluntary and involuntary context switches */
+};
+
+extern double bench_now(void);
+
+/*
+ * bench_spawn() runs path with args, with infd as its standard input
+ * unless -1, outfd as its standard output, and its standard error
+ * into errpath, kept as it is when NULL, closing the other descriptors;
+ * bench_reap() waits for it to exit, and returns its status
+ */
+extern pid_t bench_spawn(const char *path, char *const args[], int infd,
+                         int outfd, const char *errpath);
+extern int bench_reap(pid_t pid, struct bench_proc *bp);
+
+/*
+ * bench_per() writes "name": count / units with prec digits into the JSON,
+ * or null when count is negative (unknown) or there are no units
+ */
+extern void bench_per(FILE *out, const char *name, double count,
+                      double units, int prec, const char *sep);
+
+#endif /* _FEEDTRNG_BENCH_H_ */
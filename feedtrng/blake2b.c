@@ -0,0 +1,171 @@
+/*
+ * BLAKE2b (RFC 7693) for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * A straightforward C version of RFC 7693 Appendix C;
+ * the last block is kept in the buffer until blake2b_final(),
+ * since it is compressed with the final flag.
+ */
+
+#include <string.h>
+
+#include "blake2b.h"
+
+static const uint64_t blake2b_iv[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL,
+    0xA54FF53A5F1D36F1ULL, 0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+static const uint8_t sigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+static inline uint64_t rotr64(uint64_t x, int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t load64le(const uint8_t *p) {
+  return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+         ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) |
+         ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) |
+         ((uint64_t)p[7] << 56);
+}
+
+#define G(a, b, c, d, x, y)                                                    \
+  do {                                                                         \
+    v[a] = v[a] + v[b] + (x);                                                  \
+    v[d] = rotr64(v[d] ^ v[a], 32);                                            \
+    v[c] = v[c] + v[d];                                                        \
+    v[b] = rotr64(v[b] ^ v[c], 24);                                            \
+    v[a] = v[a] + v[b] + (y);                                                  \
+    v[d] = rotr64(v[d] ^ v[a], 16);                                            \
+    v[c] = v[c] + v[d];                                                        \
+    v[b] = rotr64(v[b] ^ v[c], 63);                                            \
+  } while (0)
+
+static void blake2b_compress(blake2b_ctx *ctx, const uint8_t *block,
+                             int last) {
+  uint64_t v[16], m[16];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    v[i] = ctx->h[i];
+    v[i + 8] = blake2b_iv[i];
+  }
+  v[12] ^= ctx->t[0];
+  v[13] ^= ctx->t[1];
+  if (last) {
+    v[14] = ~v[14];
+  }
+  for (i = 0; i < 16; i++) {
+    m[i] = load64le(block + i * 8);
+  }
+  for (i = 0; i < 12; i++) {
+    G(0, 4, 8, 12, m[sigma[i][0]], m[sigma[i][1]]);
+    G(1, 5, 9, 13, m[sigma[i][2]], m[sigma[i][3]]);
+    G(2, 6, 10, 14, m[sigma[i][4]], m[sigma[i][5]]);
+    G(3, 7, 11, 15, m[sigma[i][6]], m[sigma[i][7]]);
+    G(0, 5, 10, 15, m[sigma[i][8]], m[sigma[i][9]]);
+    G(1, 6, 11, 12, m[sigma[i][10]], m[sigma[i][11]]);
+    G(2, 7, 8, 13, m[sigma[i][12]], m[sigma[i][13]]);
+    G(3, 4, 9, 14, m[sigma[i][14]], m[sigma[i][15]]);
+  }
+  for (i = 0; i < 8; i++) {
+    ctx->h[i] ^= v[i] ^ v[i + 8];
+  }
+}
+
+static inline void blake2b_count(blake2b_ctx *ctx, uint64_t n) {
+  ctx->t[0] += n;
+  if (ctx->t[0] < n) {
+    ctx->t[1]++;
+  }
+}
+
+int blake2b_init(blake2b_ctx *ctx, size_t outlen, const void *key,
+                 size_t keylen) {
+  int i;
+
+  if ((outlen == 0) || (outlen > BLAKE2B_DIGEST_LENGTH) ||
+      (keylen > BLAKE2B_KEY_LENGTH)) {
+    return -1;
+  }
+  for (i = 0; i < 8; i++) {
+    ctx->h[i] = blake2b_iv[i];
+  }
+  /* the parameter block: digest length, key length, fanout 1, depth 1 */
+  ctx->h[0] ^= 0x01010000ULL ^ ((uint64_t)keylen << 8) ^ outlen;
+  ctx->t[0] = ctx->t[1] = 0;
+  ctx->buflen = 0;
+  ctx->outlen = (uint32_t)outlen;
+  if (keylen > 0) {
+    memset(ctx->buf, 0, sizeof(ctx->buf));
+    memcpy(ctx->buf, key, keylen);
+    ctx->buflen = BLAKE2B_BLOCK_LENGTH;
+  }
+  return 0;
+}
+
+void blake2b_update(blake2b_ctx *ctx, const void *data, size_t len) {
+  const uint8_t *p = data;
+  size_t n;
+
+  while (len > 0) {
+    if (ctx->buflen == BLAKE2B_BLOCK_LENGTH) {
+      /* more data follows, so the buffered block is not the last */
+      blake2b_count(ctx, BLAKE2B_BLOCK_LENGTH);
+      blake2b_compress(ctx, ctx->buf, 0);
+      ctx->buflen = 0;
+    }
+    if ((ctx->buflen == 0) && (len > BLAKE2B_BLOCK_LENGTH)) {
+      /* full blocks straight from the caller's buffer */
+      blake2b_count(ctx, BLAKE2B_BLOCK_LENGTH);
+      blake2b_compress(ctx, p, 0);
+      p += BLAKE2B_BLOCK_LENGTH;
+      len -= BLAKE2B_BLOCK_LENGTH;
+      continue;
+    }
+    n = BLAKE2B_BLOCK_LENGTH - ctx->buflen;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(ctx->buf + ctx->buflen, p, n);
+    ctx->buflen += (uint32_t)n;
+    p += n;
+    len -= n;
+  }
+}
+
+void blake2b_final(blake2b_ctx *ctx, uint8_t *out) {
+  uint32_t i;
+
+  blake2b_count(ctx, ctx->buflen);
+  memset(ctx->buf + ctx->buflen, 0, BLAKE2B_BLOCK_LENGTH - ctx->buflen);
+  blake2b_compress(ctx, ctx->buf, 1);
+  for (i = 0; i < ctx->outlen; i++) {
+    out[i] = (uint8_t)(ctx->h[i / 8] >> ((i % 8) * 8));
+  }
+}
+
+int blake2b(uint8_t *out, size_t outlen, const void *key, size_t keylen,
+            const void *data, size_t len) {
+  blake2b_ctx ctx;
+
+  if (blake2b_init(&ctx, outlen, key, keylen) != 0) {
+    return -1;
+  }
+  blake2b_update(&ctx, data, len);
+  blake2b_final(&ctx, out);
+  return 0;
+}
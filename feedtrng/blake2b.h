@@ -0,0 +1,36 @@
+/*
+ * BLAKE2b (RFC 7693) for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_BLAKE2B_H_
+#define _FEEDTRNG_BLAKE2B_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE2B_BLOCK_LENGTH (128)
+#define BLAKE2B_DIGEST_LENGTH (64)
+#define BLAKE2B_KEY_LENGTH (64)
+
+typedef struct blake2b_ctx {
+  uint64_t h[8];
+  uint64_t t[2];                     /* total bytes so far */
+  uint8_t buf[BLAKE2B_BLOCK_LENGTH]; /* pending block, may be full */
+  uint32_t buflen;
+  uint32_t outlen;
+} blake2b_ctx;
+
+/*
+ * outlen is 1 to 64 bytes of digest, keylen 0 to 64 bytes of key;
+ * blake2b_init() returns -1 when either is out of range
+ */
+extern int blake2b_init(blake2b_ctx *ctx, size_t outlen, const void *key,
+                        size_t keylen);
+extern void blake2b_update(blake2b_ctx *ctx, const void *data, size_t len);
+extern void blake2b_final(blake2b_ctx *ctx, uint8_t *out);
+extern int blake2b(uint8_t *out, size_t outlen, const void *key,
+                   size_t keylen, const void *data, size_t len);
+
+#endif /* _FEEDTRNG_BLAKE2B_H_ */
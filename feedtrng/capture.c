@@ -0,0 +1,305 @@
+/*
+ * Feeder for /dev/trng: capture and replay of the raw tty input
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+/* the index follows the last record at this alignment */
+#define CAP_ALIGN (8)
+
+/*
+ * allocate the blocks of a new part of the file,
+ * so that a full disk fails here instead of faulting a mapped page;
+ * file systems without posix_fallocate(2) (such as ZFS) get a sparse file
+ */
+static void cap_extend(struct capture *cap, off_t off, off_t len) {
+  int error;
+
+  if ((error = posix_fallocate(cap->fd, off, len)) == 0) {
+    return;
+  }
+  if ((error != EINVAL) && (error != EOPNOTSUPP)) {
+    errno = error;
+    err(EX_IOERR, "cannot extend the capture file");
+  }
+  if (ftruncate(cap->fd, off + len) == -1) {
+    err(EX_IOERR, "cannot extend the capture file");
+  }
+}
+
+static void cap_newchunk(struct capture *cap) {
+  off_t off = CAP_HDRSIZE + (off_t)cap->hdr->nchunks * CAP_CHUNKSIZE;
+  struct cap_index *e;
+
+  if ((cap->map != NULL) && (munmap(cap->map, CAP_CHUNKSIZE) == -1)) {
+    err(EX_OSERR, "cannot unmap the capture chunk");
+  }
+  cap_extend(cap, off, CAP_CHUNKSIZE);
+  if ((cap->map = mmap(NULL, CAP_CHUNKSIZE, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, cap->fd, off)) == MAP_FAILED) {
+    err(EX_OSERR, "cannot map the capture chunk");
+  }
+  if (cap->nindex == cap->maxindex) {
+    cap->maxindex = (cap->maxindex == 0) ? 64 : cap->maxindex * 2;
+    if ((cap->index = realloc(cap->index, cap->maxindex *
+                                              sizeof(*cap->index))) == NULL) {
+      err(EX_OSERR, "cannot allocate the capture index");
+    }
+  }
+  e = &cap->index[cap->nindex++];
+  e->offset = (uint64_t)off;
+  e->time = 0;
+  e->bytes = cap->hdr->bytes;
+  e->records = 0;
+  e->used = 0;
+  cap->used = 0;
+  cap->hdr->nchunks++;
+}
+
+void cap_create(struct capture *cap, const char *path) {
+  struct timespec ts;
+
+  memset(cap, 0, sizeof(*cap));
+  pthread_mutex_init(&cap->lock, NULL);
+  if ((cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+    err(EX_CANTCREAT, "cannot create %s", path);
+  }
+  cap_extend(cap, 0, CAP_HDRSIZE);
+  if ((cap->hdr = mmap(NULL, CAP_HDRSIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       cap->fd, 0)) == MAP_FAILED) {
+    err(EX_OSERR, "cannot map %s", path);
+  }
+  memset(cap->hdr, 0, CAP_HDRSIZE);
+  memcpy(cap->hdr->magic, CAP_MAGIC, sizeof(CAP_MAGIC));
+  cap->hdr->version = CAP_VERSION;
+  cap->hdr->chunksize = CAP_CHUNKSIZE;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  cap->hdr->start = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+  /* a record is appended to a new chunk first */
+  cap->used = CAP_CHUNKSIZE;
+}
+
+void cap_source(struct capture *cap, unsigned src, const char *name,
+                long speed) {
+  if (src >= CAP_MAXSOURCES) {
+    errx(EX_SOFTWARE, "too many sources to capture");
+  }
+  snprintf(cap->hdr->src[src].name, CAP_NAMELEN, "%s", name);
+  cap->hdr->src[src].speed = speed;
+  cap->hdr->nsources = MAX(cap->hdr->nsources, src + 1);
+}
+
+/* a read of len bytes from the source at t [ns, CLOCK_MONOTONIC] */
+void cap_append(struct capture *cap, unsigned src, const uint8_t *data,
+                size_t len, uint64_t t) {
+  struct cap_record rec;
+  struct cap_index *e;
+  uint64_t us, delta;
+  size_t n;
+
+  pthread_mutex_lock(&cap->lock);
+  if (cap->fd == -1) {
+    /* closed */
+    pthread_mutex_unlock(&cap->lock);
+    return;
+  }
+  if (cap->t0 == 0) {
+    cap->t0 = t;
+  }
+  us = (t - cap->t0) / 1000;
+  delta = MIN(us - MIN(us, cap->time), UINT32_MAX);
+  while (len > 0) {
+    if (cap->used + sizeof(rec) >= CAP_CHUNKSIZE) {
+      cap_newchunk(cap);
+    }
+    n = MIN(MIN(len, CAP_MAXLEN), CAP_CHUNKSIZE - cap->used - sizeof(rec));
+    rec.delta = (uint32_t)delta;
+    rec.src = (uint16_t)src;
+    rec.len = (uint16_t)n;
+    memcpy(cap->map + cap->used, &rec, sizeof(rec));
+    memcpy(cap->map + cap->used + sizeof(rec), data, n);
+    cap->used += (uint32_t)(sizeof(rec) + n);
+    cap->time += delta;
+    e = &cap->index[cap->nindex - 1];
+    if (e->records == 0) {
+      e->time = cap->time;
+    }
+    e->records++;
+    e->used = cap->used;
+    cap->hdr->records++;
+    cap->hdr->bytes += n;
+    cap->hdr->duration = cap->time;
+    data += n;
+    len -= n;
+    /* the rest of a split read comes at the same time */
+    delta = 0;
+  }
+  pthread_mutex_unlock(&cap->lock);
+}
+
+/* append the index after the last record, and cut the file there */
+void cap_close(struct capture *cap) {
+  uint64_t off = CAP_HDRSIZE;
+  size_t len;
+
+  pthread_mutex_lock(&cap->lock);
+  if (cap->fd == -1) {
+    pthread_mutex_unlock(&cap->lock);
+    return;
+  }
+  len = cap->nindex * sizeof(*cap->index);
+  if (cap->nindex > 0) {
+    off = cap->index[cap->nindex - 1].offset + cap->index[cap->nindex - 1].used;
+    off = (off + CAP_ALIGN - 1) & ~(uint64_t)(CAP_ALIGN - 1);
+  }
+  if ((cap->map != NULL) && (munmap(cap->map, CAP_CHUNKSIZE) == -1)) {
+    err(EX_OSERR, "cannot unmap the capture chunk");
+  }
+  cap->map = NULL;
+  if ((pwrite(cap->fd, cap->index, len, (off_t)off) != (ssize_t)len) ||
+      (ftruncate(cap->fd, (off_t)(off + len)) == -1)) {
+    err(EX_IOERR, "cannot write the capture index");
+  }
+  /* the index is valid from here */
+  cap->hdr->nindex = cap->nindex;
+  cap->hdr->indexoff = off;
+  if ((msync(cap->hdr, CAP_HDRSIZE, MS_SYNC) == -1) ||
+      (munmap(cap->hdr, CAP_HDRSIZE) == -1)) {
+    err(EX_IOERR, "cannot write the capture header");
+  }
+  close(cap->fd);
+  cap->fd = -1;
+  free(cap->index);
+  cap->index = NULL;
+  pthread_mutex_unlock(&cap->lock);
+}
+
+/* index a capture not closed, from the records in each chunk */
+static void cap_scan(struct capture *cap) {
+  struct cap_record rec;
+  struct cap_index *e;
+  uint64_t k, time = 0, bytes = 0, end;
+  uint32_t off;
+
+  if ((cap->index = calloc(MAX(cap->hdr->nchunks, 1), sizeof(*cap->index))) ==
+      NULL) {
+    err(EX_OSERR, "cannot allocate the capture index");
+  }
+  for (k = 0; k < cap->hdr->nchunks; k++) {
+    e = &cap->index[k];
+    e->offset = CAP_HDRSIZE + k * CAP_CHUNKSIZE;
+    if (e->offset >= cap->maplen) {
+      break;
+    }
+    end = MIN(CAP_CHUNKSIZE, cap->maplen - e->offset);
+    e->time = time;
+    e->bytes = bytes;
+    for (off = 0; off + sizeof(rec) <= end; off += sizeof(rec) + rec.len) {
+      memcpy(&rec, cap->map + e->offset + off, sizeof(rec));
+      if ((rec.len == 0) || (rec.src >= cap->hdr->nsources) ||
+          (off + sizeof(rec) + rec.len > end)) {
+        break;
+      }
+      time += rec.delta;
+      bytes += rec.len;
+      if (e->records++ == 0) {
+        e->time = time;
+      }
+    }
+    e->used = off;
+  }
+  cap->nindex = k;
+}
+
+void cap_open(struct capture *cap, const char *path) {
+  struct cap_header *h;
+  struct stat st;
+  uint64_t k;
+
+  memset(cap, 0, sizeof(*cap));
+  pthread_mutex_init(&cap->lock, NULL);
+  if ((cap->fd = open(path, O_RDONLY)) == -1) {
+    err(EX_NOINPUT, "cannot open %s", path);
+  }
+  if (fstat(cap->fd, &st) == -1) {
+    err(EX_IOERR, "cannot stat %s", path);
+  }
+  if (st.st_size < CAP_HDRSIZE) {
+    errx(EX_DATAERR, "%s is not a capture file", path);
+  }
+  cap->maplen = (size_t)st.st_size;
+  if ((cap->map = mmap(NULL, cap->maplen, PROT_READ, MAP_SHARED, cap->fd,
+                       0)) == MAP_FAILED) {
+    err(EX_OSERR, "cannot map %s", path);
+  }
+  madvise(cap->map, cap->maplen, MADV_SEQUENTIAL);
+  cap->hdr = h = (struct cap_header *)cap->map;
+  if ((memcmp(h->magic, CAP_MAGIC, sizeof(CAP_MAGIC)) != 0) ||
+      (h->version != CAP_VERSION) || (h->chunksize != CAP_CHUNKSIZE) ||
+      (h->nsources == 0) || (h->nsources > CAP_MAXSOURCES)) {
+    errx(EX_DATAERR, "%s is not a capture file of version %d", path,
+         CAP_VERSION);
+  }
+  if ((h->indexoff == 0) || (h->indexoff > cap->maplen) ||
+      (h->nindex > (cap->maplen - h->indexoff) / sizeof(*cap->index))) {
+    warnx("%s was not closed, scanning %ju chunks", path,
+          (uintmax_t)h->nchunks);
+    cap_scan(cap);
+  } else {
+    cap->index = (struct cap_index *)(cap->map + h->indexoff);
+    cap->nindex = h->nindex;
+  }
+  for (k = 0; k < cap->nindex; k++) {
+    if ((cap->index[k].used > CAP_CHUNKSIZE) ||
+        (cap->index[k].offset + cap->index[k].used > cap->maplen)) {
+      errx(EX_DATAERR, "%s: broken index of chunk %ju", path, (uintmax_t)k);
+    }
+  }
+}
+
+int cap_next(struct capture *cap, struct cap_read *r) {
+  struct cap_record rec;
+  const struct cap_index *e;
+
+  for (; cap->chunk < cap->nindex; cap->chunk++, cap->off = 0) {
+    e = &cap->index[cap->chunk];
+    if (cap->off + sizeof(rec) > e->used) {
+      continue;
+    }
+    memcpy(&rec, cap->map + e->offset + cap->off, sizeof(rec));
+    if (rec.len == 0) {
+      continue;
+    }
+    if ((rec.src >= cap->hdr->nsources) ||
+        (cap->off + sizeof(rec) + rec.len > e->used)) {
+      errx(EX_DATAERR, "broken capture record in chunk %ju",
+           (uintmax_t)cap->chunk);
+    }
+    cap->time += rec.delta;
+    r->src = rec.src;
+    r->data = cap->map + e->offset + cap->off + sizeof(rec);
+    r->len = rec.len;
+    r->time = cap->time;
+    cap->off += (uint32_t)(sizeof(rec) + rec.len);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Feeder for /dev/trng: capture and replay of the raw tty input
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * A capture file is a header page followed by chunks of CAP_CHUNKSIZE
+ * bytes of records, one record per read(2) from a tty:
+ *   struct cap_record, then len bytes of the input
+ * Records never span chunks; a zero len ends a chunk early.
+ * The chunks are written through mmap(2), and appended as they fill up.
+ * On close, the index of the chunks follows the last record,
+ * and the file is cut there; a capture not closed is indexed again
+ * by scanning the chunks when opened.
+ * All the fields are in the host byte order.
+ */
+
+#ifndef _FEEDTRNG_CAPTURE_H_
+#define _FEEDTRNG_CAPTURE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAP_MAGIC "TRNGCAP"
+#define CAP_VERSION (1)
+
+#define CAP_HDRSIZE (4096)
+#define CAP_CHUNKSIZE (1 << 20)
+
+#define CAP_MAXSOURCES (16)
+#define CAP_NAMELEN (64)
+
+/* the longest record; a longer read is split */
+#define CAP_MAXLEN (UINT16_MAX)
+
+struct cap_header {
+  char magic[8];      /* CAP_MAGIC */
+  uint32_t version;   /* CAP_VERSION */
+  uint32_t chunksize; /* CAP_CHUNKSIZE */
+  uint32_t nsources;
+  uint32_t pad;
+  uint64_t start;    /* CLOCK_REALTIME at the start [ns] */
+  uint64_t nchunks;  /* chunks written, the last one may be partly filled */
+  uint64_t indexoff; /* offset of the index, 0 until closed */
+  uint64_t nindex;
+  uint64_t records;
+  uint64_t bytes;    /* input bytes */
+  uint64_t duration; /* time of the last read [us] */
+  struct {
+    char name[CAP_NAMELEN];
+    int64_t speed;
+  } src[CAP_MAXSOURCES];
+};
+
+struct cap_record {
+  uint32_t delta; /* since the previous read of any source [us] */
+  uint16_t src;
+  uint16_t len;
+};
+
+/* an index entry per chunk */
+struct cap_index {
+  uint64_t offset;  /* of the chunk in the file */
+  uint64_t time;    /* of the first read in the chunk [us] */
+  uint64_t bytes;   /* input bytes before the chunk */
+  uint32_t records; /* in the chunk */
+  uint32_t used;    /* bytes of the records in the chunk */
+};
+
+/* a read given back by cap_next() */
+struct cap_read {
+  unsigned src;
+  const uint8_t *data;
+  size_t len;
+  uint64_t time; /* since the start [us] */
+};
+
+struct capture {
+  pthread_mutex_t lock; /* the writer closes the capture from main() */
+  int fd;
+  struct cap_header *hdr; /* mapped */
+  uint8_t *map;           /* the current chunk, or the whole file */
+  size_t maplen;
+  struct cap_index *index;
+  uint64_t nindex;
+  uint64_t maxindex;
+  uint32_t used;  /* bytes used in the current chunk */
+  uint64_t t0;    /* the first read [ns, CLOCK_MONOTONIC] */
+  uint64_t time;  /* the previous read [us] */
+  uint64_t chunk; /* the reader: the index entry being read */
+  uint32_t off;   /* the reader: the next record in the chunk */
+};
+
+/* the writer, in the reader thread */
+extern void cap_create(struct capture *cap, const char *path);
+extern void cap_source(struct capture *cap, unsigned src, const char *name,
+                       long speed);
+extern void cap_append(struct capture *cap, unsigned src, const uint8_t *data,
+                       size_t len, uint64_t t);
+extern void cap_close(struct capture *cap);
+
+/* the reader for replay; cap_next() returns 0 at the end */
+extern void cap_open(struct capture *cap, const char *path);
+extern int cap_next(struct capture *cap, struct cap_read *r);
+
+#endif /* _FEEDTRNG_CAPTURE_H_ */
@@ -0,0 +1,193 @@
+/*
+ * Conditioner benchmark for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * For each conditioner and input block size, conditions the blocks
+ * into 64 output bytes as the feedtrng pipeline does
+ * (ceil(64 / outlen) chained segments per block),
+ * and reports the input throughput (MiB/s), cycles per input byte
+ * (rdtsc on x86), the time per 64 output bytes,
+ * and the CPU time relative to the default sha512.
+ *
+ * To compile (on amd64):
+ * cc -O2 -DSHA512_X8664 -o condbench condbench.c conditioner.c blake2b.c \
+ *   sha512.c sha512-avx2.c sha512-x8664.S sha512-select.c sha512-api.c
+ *
+ * Usage: condbench [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "conditioner.h"
+
+/* output bytes per block, as the default output ratio of 512 to 64 */
+#define OUTLEN (64)
+
+static const char *conds[] = {"sha512", "sha512-256", "blake2b",
+                              "hmac-sha512"};
+#define NCONDS (sizeof(conds) / sizeof(conds[0]))
+
+static const uint32_t sizes[] = {128, 512, 4096, 65536};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+#define MAXSIZE (65536)
+
+static double seconds = 0.5;
+/* keeps the output alive */
+static volatile uint8_t sink;
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/* one block conditioned into OUTLEN bytes, as conditioner_main() */
+static void condition(const struct conditioner *cd, const uint8_t *data,
+                      uint32_t size, uint64_t chain[8], uint8_t *out) {
+  uint32_t nseg, seg, off, len, i;
+
+  nseg = (OUTLEN + cd->outlen - 1) / cd->outlen;
+  seg = size / nseg;
+  for (i = 0, off = 0; i < nseg; i++, off += len) {
+    len = (i == nseg - 1) ? size - off : seg;
+    cond_hash(cd, data + off, len, chain);
+    memcpy(out + i * cd->outlen, chain, cd->outlen);
+  }
+}
+
+struct result {
+  double mibs;
+  double cpb;
+  double ns;
+  uint64_t blocks;
+};
+
+static void run_case(const struct conditioner *cd, const uint8_t *data,
+                     uint32_t size, struct result *r) {
+  uint64_t chain[8] = {0};
+  uint8_t out[OUTLEN * 2];
+  uint64_t blocks = 0, c0;
+  double t0, t;
+  int i;
+
+  t0 = now();
+  c0 = cycles();
+  do {
+    for (i = 0; i < 16; i++) {
+      condition(cd, data, size, chain, out);
+    }
+    blocks += 16;
+    t = now() - t0;
+  } while (t < seconds);
+  r->blocks = blocks;
+  r->mibs = (double)blocks * size / t / 1048576;
+  r->cpb = (double)(cycles() - c0) / ((double)blocks * size);
+  r->ns = t / blocks * 1e9;
+  sink = out[0];
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  const struct conditioner *cd;
+  struct result r;
+  uint8_t key[COND_MAXKEY];
+  uint8_t *data;
+  double base;
+  FILE *out;
+  size_t i, j;
+  int ch, first = 1;
+
+  while ((ch = getopt(argc, argv, "t:o:")) != -1) {
+    switch (ch) {
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  if ((data = malloc(MAXSIZE)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  for (i = 0; i < MAXSIZE; i++) {
+    data[i] = (uint8_t)(i * 7 + 1);
+  }
+  for (i = 0; i < sizeof(key); i++) {
+    key[i] = (uint8_t)(i + 1);
+  }
+  cond_setkey(key, 64);
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  sha512_select("auto");
+  fprintf(out,
+          "{\n  \"benchmark\": \"condbench\",\n  \"sha512_impl\": \"%s\",\n"
+          "  \"output_bytes\": %d,\n  \"rdtsc\": %s,\n"
+          "  \"seconds_per_case\": %.3f,\n  \"results\": [",
+          sha512_name(), OUTLEN,
+#ifdef HAVE_RDTSC
+          "true",
+#else
+          "false",
+#endif
+          seconds);
+  for (j = 0; j < NSIZES; j++) {
+    base = 0;
+    for (i = 0; i < NCONDS; i++) {
+      cd = cond_find(conds[i]);
+      run_case(cd, data, sizes[j], &r);
+      if (i == 0) {
+        base = r.ns;
+      }
+      fprintf(out,
+              "%s\n    {\"conditioner\": \"%s\", \"vetted\": %s, "
+              "\"size\": %u, \"blocks\": %llu, \"mib_per_s\": %.2f, "
+              "\"cycles_per_byte\": %.3f, \"ns_per_output\": %.1f, "
+              "\"relative_cpu\": %.3f}",
+              first ? "" : ",", cd->name, cd->vetted ? "true" : "false",
+              sizes[j], (unsigned long long)r.blocks, r.mibs, r.cpb, r.ns,
+              r.ns / base);
+      first = 0;
+      fprintf(stderr,
+              "%-11s %6u B: %9.1f MiB/s %7.2f cpb %9.1f ns/64 B (x%.2f)\n",
+              cd->name, sizes[j], r.mibs, r.cpb, r.ns, r.ns / base);
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(data);
+  return 0;
+}
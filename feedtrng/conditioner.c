@@ -0,0 +1,185 @@
+/*
+ * Feeder for /dev/trng: conditioning functions
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * sha512: SHA-512, the output in host-order words as before
+ * sha512-256: SHA-512/256 (FIPS 180-4), 32 bytes per segment
+ * blake2b: BLAKE2b-512 (RFC 7693), not vetted by SP 800-90B
+ * hmac-sha512: HMAC-SHA-512 with the key of cond_setkey()
+ * The outputs other than sha512 are the digests in the standard byte order.
+ */
+
+#include <string.h>
+
+#include "conditioner.h"
+
+/* the initial chain of lane 0: the SHA-512 initial hash value */
+static const uint64_t chain_iv[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL,
+    0xA54FF53A5F1D36F1ULL, 0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+/* SHA-512/256 initial hash value (FIPS 180-4 5.3.6.2) */
+static const uint64_t sha512_256_iv[8] = {
+    0x22312194FC2BF72CULL, 0x9F555FA3C84C64C2ULL, 0x2393B86B6F53B151ULL,
+    0x963877195940EABDULL, 0x96283EE2A88EFFE3ULL, 0xBE5E1E2553863992ULL,
+    0x2B0199FC2C85B8AAULL, 0x0EB72DDC81C52CA2ULL};
+
+/* the HMAC-SHA-512 states after the inner and outer padded keys */
+static sha512_ctx hmac_inner, hmac_outer;
+
+/* big-endian bytes of the host-order digest words */
+static void store_be(uint8_t *out, const uint64_t *w, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    out[i] = (uint8_t)(w[i / 8] >> (56 - (i % 8) * 8));
+  }
+}
+
+/* sha512 */
+
+static void sha512_cinit(struct cond_ctx *c) { sha512_init(&c->u.sha512); }
+
+static void sha512_absorb(struct cond_ctx *c, const void *data, size_t len) {
+  sha512_update(&c->u.sha512, data, len);
+}
+
+static void sha512_emit(struct cond_ctx *c, uint64_t chain[8]) {
+  sha512_final(&c->u.sha512, chain);
+}
+
+static void sha512_chain(const uint8_t *data, uint32_t len,
+                         uint64_t chain[8]) {
+  sha512_hash_chain(data, len, chain, COND_CHAINLEN / sizeof(uint64_t), chain);
+}
+
+/* sha512-256 */
+
+static void sha512_256_init(struct cond_ctx *c) {
+  sha512_init(&c->u.sha512);
+  memcpy(c->u.sha512.state, sha512_256_iv, sizeof(sha512_256_iv));
+}
+
+static void sha512_256_emit(struct cond_ctx *c, uint64_t chain[8]) {
+  uint64_t h[8];
+
+  sha512_final(&c->u.sha512, h);
+  store_be((uint8_t *)chain, h, 32);
+}
+
+/* blake2b */
+
+static void blake2b_cinit(struct cond_ctx *c) {
+  blake2b_init(&c->u.blake2b, BLAKE2B_DIGEST_LENGTH, NULL, 0);
+}
+
+static void blake2b_absorb(struct cond_ctx *c, const void *data, size_t len) {
+  blake2b_update(&c->u.blake2b, data, len);
+}
+
+static void blake2b_emit(struct cond_ctx *c, uint64_t chain[8]) {
+  blake2b_final(&c->u.blake2b, (uint8_t *)chain);
+}
+
+/* hmac-sha512 */
+
+static void hmac_init(struct cond_ctx *c) { c->u.sha512 = hmac_inner; }
+
+static void hmac_emit(struct cond_ctx *c, uint64_t chain[8]) {
+  uint64_t h[8];
+  uint8_t inner[SHA512_DIGEST_LENGTH];
+
+  sha512_final(&c->u.sha512, h);
+  store_be(inner, h, sizeof(inner));
+  c->u.sha512 = hmac_outer;
+  sha512_update(&c->u.sha512, inner, sizeof(inner));
+  sha512_final(&c->u.sha512, h);
+  store_be((uint8_t *)chain, h, SHA512_DIGEST_LENGTH);
+}
+
+static const struct conditioner conditioners[] = {
+    {"sha512", SHA512_DIGEST_LENGTH, 1, sha512_cinit, sha512_absorb,
+     sha512_emit, sha512_chain},
+    {"sha512-256", 32, 1, sha512_256_init, sha512_absorb, sha512_256_emit,
+     NULL},
+    {"blake2b", BLAKE2B_DIGEST_LENGTH, 0, blake2b_cinit, blake2b_absorb,
+     blake2b_emit, NULL},
+    {"hmac-sha512", SHA512_DIGEST_LENGTH, 1, hmac_init, sha512_absorb,
+     hmac_emit, NULL},
+};
+#define NCONDS (sizeof(conditioners) / sizeof(conditioners[0]))
+
+const struct conditioner *cond_find(const char *name) {
+  size_t i;
+
+  for (i = 0; i < NCONDS; i++) {
+    if (strcmp(conditioners[i].name, name) == 0) {
+      return &conditioners[i];
+    }
+  }
+  return NULL;
+}
+
+const char *cond_names(void) { return "sha512 sha512-256 blake2b hmac-sha512"; }
+
+/* set the HMAC-SHA-512 key (RFC 2104); returns -1 for an empty key */
+int cond_setkey(const uint8_t *key, size_t len) {
+  uint8_t k[SHA512_BLOCK_LENGTH], pad[SHA512_BLOCK_LENGTH];
+  uint64_t h[8];
+  size_t i;
+
+  if (len == 0) {
+    return -1;
+  }
+  memset(k, 0, sizeof(k));
+  if (len > sizeof(k)) {
+    sha512_init(&hmac_inner);
+    sha512_update(&hmac_inner, key, len);
+    sha512_final(&hmac_inner, h);
+    store_be(k, h, SHA512_DIGEST_LENGTH);
+  } else {
+    memcpy(k, key, len);
+  }
+  for (i = 0; i < sizeof(pad); i++) {
+    pad[i] = k[i] ^ 0x36;
+  }
+  sha512_init(&hmac_inner);
+  sha512_update(&hmac_inner, pad, sizeof(pad));
+  for (i = 0; i < sizeof(pad); i++) {
+    pad[i] = k[i] ^ 0x5c;
+  }
+  sha512_init(&hmac_outer);
+  sha512_update(&hmac_outer, pad, sizeof(pad));
+  return 0;
+}
+
+/* chain = F(data || chain[0..COND_CHAINLEN-1]) */
+void cond_hash(const struct conditioner *cd, const uint8_t *data,
+               uint32_t len, uint64_t chain[8]) {
+  struct cond_ctx c;
+
+  if (cd->hash != NULL) {
+    cd->hash(data, len, chain);
+    return;
+  }
+  cd->init(&c);
+  cd->absorb(&c, data, len);
+  cd->absorb(&c, chain, COND_CHAINLEN);
+  cd->emit(&c, chain);
+}
+
+/*
+ * the initial chains of nlanes lanes:
+ * lane 0 starts as the single chain always did,
+ * and lane i from the same value with i in the last word
+ */
+void cond_lanes(uint64_t (*chain)[8], unsigned nlanes) {
+  unsigned i;
+
+  for (i = 0; i < nlanes; i++) {
+    memcpy(chain[i], chain_iv, sizeof(chain_iv));
+    chain[i][7] ^= i;
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * Feeder for /dev/trng: conditioning functions
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * A conditioner hashes each segment of a block together with
+ * the first COND_CHAINLEN bytes of the previous output of the same source
+ * (the chain), and the output becomes the next chain:
+ *   chain = F(segment || chain[0..31])
+ * The output is the first outlen bytes of the chain.
+ * F is given as init/absorb/emit, and may have a faster one-shot hash.
+ * With n lanes, the segments of a source are dealt to n chains in turn,
+ * segment k to lane k % n, so that the lanes can be hashed in parallel;
+ * the outputs stay in the order of the segments.
+ */
+
+#ifndef _FEEDTRNG_CONDITIONER_H_
+#define _FEEDTRNG_CONDITIONER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blake2b.h"
+#include "sha512.h"
+
+/* maximum output bytes per segment, and the chain size */
+#define COND_MAXOUT (64)
+
+/* bytes of the chain hashed into the next segment */
+#define COND_CHAINLEN (32)
+
+/* the most lanes of the chain */
+#define COND_MAXLANES (64)
+
+/* the maximum HMAC key length; longer keys are hashed first */
+#define COND_MAXKEY (SHA512_BLOCK_LENGTH)
+
+struct cond_ctx {
+  union {
+    sha512_ctx sha512;
+    blake2b_ctx blake2b;
+  } u;
+};
+
+struct conditioner {
+  const char *name;
+  uint32_t outlen; /* output bytes per segment */
+  int vetted;      /* a vetted conditioning component of SP 800-90B */
+  void (*init)(struct cond_ctx *c);
+  void (*absorb)(struct cond_ctx *c, const void *data, size_t len);
+  void (*emit)(struct cond_ctx *c, uint64_t chain[8]);
+  /* optional one-shot F, the same as init/absorb/emit */
+  void (*hash)(const uint8_t *data, uint32_t len, uint64_t chain[8]);
+};
+
+/* the default: the SHA-512 chain of the former feedtrng */
+#define COND_DEFAULT "sha512"
+
+extern const struct conditioner *cond_find(const char *name);
+extern const char *cond_names(void);
+extern int cond_setkey(const uint8_t *key, size_t len);
+extern void cond_hash(const struct conditioner *cd, const uint8_t *data,
+                      uint32_t len, uint64_t chain[8]);
+extern void cond_lanes(uint64_t (*chain)[8], unsigned nlanes);
+
+#endif /* _FEEDTRNG_CONDITIONER_H_ */
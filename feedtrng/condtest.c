@@ -0,0 +1,271 @@
+/*
+ * Known-answer tests of the feedtrng conditioners
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * For each SHA-512 compression backend supported by the CPU:
+ * the digests of SHA-512, SHA-512/256 (FIPS 180-4 examples),
+ * BLAKE2b-512 (RFC 7693 and the reference KAT, keyed and unkeyed)
+ * and HMAC-SHA-512 (RFC 4231) through init/absorb/emit,
+ * the same digests absorbed in pieces of every size up to 300 bytes,
+ * and three chained segments through cond_hash(),
+ * against the values computed with Python hashlib and hmac.
+ *
+ * To compile (on amd64):
+ * cc -O2 -DSHA512_X8664 -o condtest condtest.c conditioner.c blake2b.c \
+ *   sha512.c sha512-avx2.c sha512-x8664.S sha512-select.c sha512-api.c
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "conditioner.h"
+
+struct kat {
+  const char *cond;
+  const char *key; /* for hmac-sha512, or NULL */
+  size_t keylen;
+  const char *msg;
+  size_t msglen;
+  const char *digest; /* hex */
+};
+
+static uint8_t bytes256[256 * 3];
+static char aa131[131], b20[20];
+
+#define STR(s) s, sizeof(s) - 1
+
+static const char abc56[] =
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+static const char hmac6[] =
+    "This is a test using a larger than block-size key and a larger than "
+    "block-size data. The key needs to be hashed before being used by the "
+    "HMAC algorithm.";
+
+static const struct kat kats[] = {
+    {"sha512", NULL, 0, STR("abc"),
+     "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+     "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"},
+    {"sha512-256", NULL, 0, STR(""),
+     "c672b8d1ef56ed28ab87c3622c5114069bdd3ad7b8f9737498d0c01ecef0967a"},
+    {"sha512-256", NULL, 0, STR("abc"),
+     "53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f13107e7af23"},
+    {"sha512-256", NULL, 0, STR(abc56),
+     "3928e184fb8690f840da3988121d31be65cb9d3ef83ee6146feac861e19b563a"},
+    {"blake2b", NULL, 0, STR(""),
+     "786a02f742015903c6c6fd852552d272912f4740e15847618a86e217f71f5419"
+     "d25e1031afee585313896444934eb04b903a685b1448b755d56f701afe9be2ce"},
+    {"blake2b", NULL, 0, STR("abc"),
+     "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+     "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923"},
+    {"blake2b", NULL, 0, (const char *)bytes256, sizeof(bytes256),
+     "323e97a7a859ee63c9013debb0ca995811e73117a2f574723416e596ebc184e3"
+     "7a59b66d2f597df4a7c1b0d1d41a1a7f28774f46a6864d56c57b9d6c5f7302fb"},
+    {"hmac-sha512", b20, sizeof(b20), STR("Hi There"),
+     "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+     "daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854"},
+    {"hmac-sha512", STR("Jefe"), STR("what do ya want for nothing?"),
+     "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+     "9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737"},
+    {"hmac-sha512", aa131, sizeof(aa131),
+     STR("Test Using Larger Than Block-Size Key - Hash Key First"),
+     "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+     "6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598"},
+    {"hmac-sha512", aa131, sizeof(aa131), STR(hmac6),
+     "e37b6a775dc87dbaa4dfa9f96e5e3ffddebd71f8867289865df5a32d20cdc944"
+     "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58"},
+};
+#define NKATS (sizeof(kats) / sizeof(kats[0]))
+
+/* the chained segments of 512, 128 and 300 bytes, from a zero chain */
+static const uint32_t segs[] = {512, 128, 300};
+#define CHAINKEY_LEN (64)
+
+static const struct {
+  const char *cond;
+  const char *chain; /* hex of the last output */
+} chains[] = {
+    {"sha512-256",
+     "314bb99e5184986acc253dfbd930af66ff4657f035499c7c6294406bd898ddd2"},
+    {"blake2b",
+     "1e43d77b6e7f8d54357e568067a39d7fb2282262c093dbc6e58ed57e10eb410a"
+     "86dde99ae977472cf69662f52aef06f90652d8340dc9c41655ea3d07a97df710"},
+    {"hmac-sha512",
+     "77431ef2fc7420c27cde26ba219c7b8824c058bce66dd175d0c1c2ea2c620893"
+     "b4afa80319506627b8a6729b3b8825aeb598b7abd03775bfc86b6ebcf80912f7"},
+};
+#define NCHAINS (sizeof(chains) / sizeof(chains[0]))
+
+static const char *backends[] = {"c", "x8664", "avx2"};
+#define NBACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static void hex(const uint8_t *p, size_t len, char *out) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    sprintf(out + i * 2, "%02x", p[i]);
+  }
+}
+
+/* the digest bytes of an output; sha512 gives host-order words */
+static void output(const struct conditioner *cd, const uint64_t chain[8],
+                   uint8_t *out) {
+  uint32_t i;
+
+  if (strcmp(cd->name, "sha512") != 0) {
+    memcpy(out, chain, cd->outlen);
+    return;
+  }
+  for (i = 0; i < cd->outlen; i++) {
+    out[i] = (uint8_t)(chain[i / 8] >> (56 - (i % 8) * 8));
+  }
+}
+
+/* the digest absorbed in pieces of step bytes (all at once for 0) */
+static void digest(const struct conditioner *cd, const struct kat *k,
+                   size_t step, char *out) {
+  struct cond_ctx c;
+  uint64_t chain[8];
+  uint8_t d[COND_MAXOUT];
+  size_t off, n;
+
+  cd->init(&c);
+  for (off = 0; off < k->msglen; off += n) {
+    n = ((step == 0) || (step > k->msglen - off)) ? k->msglen - off : step;
+    cd->absorb(&c, k->msg + off, n);
+  }
+  cd->emit(&c, chain);
+  output(cd, chain, d);
+  hex(d, cd->outlen, out);
+}
+
+static int check_kats(void) {
+  const struct conditioner *cd;
+  char out[COND_MAXOUT * 2 + 1];
+  size_t i, step;
+  int fails = 0;
+
+  for (i = 0; i < NKATS; i++) {
+    cd = cond_find(kats[i].cond);
+    if (kats[i].key != NULL) {
+      cond_setkey((const uint8_t *)kats[i].key, kats[i].keylen);
+    }
+    for (step = 0; step <= 300; step++) {
+      digest(cd, &kats[i], step, out);
+      if (strcmp(out, kats[i].digest) != 0) {
+        printf("%s KAT %zu (%zu-byte pieces): got %s\n", cd->name, i, step,
+               out);
+        fails++;
+        break;
+      }
+    }
+  }
+  return fails;
+}
+
+/* keyed BLAKE2b-512 of the reference KAT, key 00..3f */
+static int check_keyed(void) {
+  static const struct {
+    size_t msglen;
+    const char *digest;
+  } keyed[] = {
+      {0, "10ebb67700b1868efb4417987acf4690ae9d972fb7a590c2f02871799aaa4786"
+          "b5e996e8f0f4eb981fc214b005f42d2ff4233499391653df7aefcbc13fc51568"},
+      {255, "142709d62e28fcccd0af97fad0f8465b971e82201dc51070faa0372aa43e9248"
+            "4be1c1e73ba10906d5d1853db6a4106e0a7bf9800d373d6dee2d46d62ef2a461"},
+  };
+  uint8_t d[BLAKE2B_DIGEST_LENGTH];
+  char out[BLAKE2B_DIGEST_LENGTH * 2 + 1];
+  size_t i;
+  int fails = 0;
+
+  for (i = 0; i < sizeof(keyed) / sizeof(keyed[0]); i++) {
+    blake2b(d, sizeof(d), bytes256, BLAKE2B_KEY_LENGTH, bytes256,
+            keyed[i].msglen);
+    hex(d, sizeof(d), out);
+    if (strcmp(out, keyed[i].digest) != 0) {
+      printf("keyed blake2b of %zu bytes: got %s\n", keyed[i].msglen, out);
+      fails++;
+    }
+  }
+  return fails;
+}
+
+static int check_chains(const uint8_t *data) {
+  const struct conditioner *cd;
+  struct cond_ctx c;
+  uint8_t key[CHAINKEY_LEN], d[COND_MAXOUT];
+  uint64_t chain[8], chain2[8];
+  char out[COND_MAXOUT * 2 + 1];
+  uint32_t off;
+  size_t i, j;
+  int fails = 0;
+
+  for (i = 0; i < sizeof(key); i++) {
+    key[i] = (uint8_t)(i + 1);
+  }
+  cond_setkey(key, sizeof(key));
+  for (i = 0; i < NCHAINS; i++) {
+    cd = cond_find(chains[i].cond);
+    memset(chain, 0, sizeof(chain));
+    for (j = 0, off = 0; j < sizeof(segs) / sizeof(segs[0]); off += segs[j++]) {
+      cond_hash(cd, data + off, segs[j], chain);
+    }
+    hex((const uint8_t *)chain, cd->outlen, out);
+    if (strcmp(out, chains[i].chain) != 0) {
+      printf("%s chain: got %s\n", cd->name, out);
+      fails++;
+    }
+  }
+  /* the one-shot sha512 against its init/absorb/emit */
+  cd = cond_find("sha512");
+  memset(chain, 0, sizeof(chain));
+  memset(chain2, 0, sizeof(chain2));
+  for (j = 0, off = 0; j < sizeof(segs) / sizeof(segs[0]); off += segs[j++]) {
+    cond_hash(cd, data + off, segs[j], chain);
+    cd->init(&c);
+    cd->absorb(&c, data + off, segs[j]);
+    cd->absorb(&c, chain2, COND_CHAINLEN);
+    cd->emit(&c, chain2);
+  }
+  if (memcmp(chain, chain2, sizeof(chain)) != 0) {
+    output(cd, chain, d);
+    hex(d, cd->outlen, out);
+    printf("sha512 chain differs from init/absorb/emit: %s\n", out);
+    fails++;
+  }
+  return fails;
+}
+
+int main(void) {
+  uint8_t data[940];
+  size_t i, b;
+  int fails = 0;
+
+  for (i = 0; i < sizeof(bytes256); i++) {
+    bytes256[i] = (uint8_t)i;
+  }
+  memset(aa131, 0xaa, sizeof(aa131));
+  memset(b20, 0x0b, sizeof(b20));
+  for (i = 0; i < sizeof(data); i++) {
+    data[i] = (uint8_t)(i * 7 + 3);
+  }
+  for (b = 0; b < NBACKENDS; b++) {
+    if (sha512_select(backends[b]) != 0) {
+      printf("%s: not supported\n", backends[b]);
+      continue;
+    }
+    fails += check_kats();
+    fails += check_keyed();
+    fails += check_chains(data);
+    printf("%s: %s\n", backends[b], (fails == 0) ? "Test passed" : "failed");
+  }
+  if (fails != 0) {
+    errx(EX_SOFTWARE, "%d tests failed", fails);
+  }
+  return EXIT_SUCCESS;
+}
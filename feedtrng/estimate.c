@@ -0,0 +1,248 @@
+/*
+ * Feeder for /dev/trng: streaming min-entropy estimators
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The most common value estimate (SP 800-90B 6.3.1) of the bytes,
+ * and the collision (6.3.2) and Markov (6.3.3) estimates of the bits
+ * (most significant bit first), over a sliding window of the byte stream.
+ * As for non-binary samples in SP 800-90B, the estimate per byte is
+ * the minimum of the byte estimate and 8 times the bit estimates.
+ *
+ * The window is updated incrementally by chunks: the counts of the bytes
+ * are added to the current chunk, and a completed chunk is added to the sum
+ * while the oldest chunk is subtracted from it. The bit counts of each byte
+ * come from tables, accumulated in packed 12-bit fields
+ * and unpacked every 256 bytes.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "estimate.h"
+
+/* packed fields of bittab[]: zero bits, transitions 00, 01, 10, 11 */
+#define FIELD(v, i) (((v) >> ((i)*12)) & 0xfff)
+#define FLUSHBYTES (256)
+
+/*
+ * bittab[prev][b]: the bit counts owned by byte b,
+ * i.e., its 8 bits, its 7 inner transitions,
+ * and the transition from the last bit of the previous byte prev
+ * (2 when there is no previous byte)
+ */
+static uint64_t bittab[3][256];
+
+/*
+ * The collision walk on bits: starting from a bit, the segment ends
+ * at the second bit when both are equal, or at the third bit otherwise.
+ * Walk states: 0 = no pending bit, 1 = pending 0, 2 = pending 1,
+ * 3 = pending 01 or 10.
+ * walktab[state][b]: segments of 2 bits (bits 0-3) and 3 bits (bits 4-7)
+ * ending in byte b, and the next state (bits 8-9)
+ */
+static uint16_t walktab[4][256];
+static int tables;
+
+static void est_tables(void) {
+  unsigned prev, b, i, bit, last, state, n2, n3;
+  uint64_t v;
+
+  for (prev = 0; prev < 3; prev++) {
+    for (b = 0; b < 256; b++) {
+      v = 0;
+      last = prev;
+      for (i = 0; i < 8; i++) {
+        bit = (b >> (7 - i)) & 1;
+        v += (uint64_t)(bit == 0);
+        if (last < 2) {
+          v += (uint64_t)1 << ((1 + last * 2 + bit) * 12);
+        }
+        last = bit;
+      }
+      bittab[prev][b] = v;
+    }
+  }
+  for (prev = 0; prev < 4; prev++) {
+    for (b = 0; b < 256; b++) {
+      state = prev;
+      n2 = n3 = 0;
+      for (i = 0; i < 8; i++) {
+        bit = (b >> (7 - i)) & 1;
+        if (state == 0) {
+          state = 1 + bit;
+        } else if (state == 3) {
+          n3++;
+          state = 0;
+        } else if (state == 1 + bit) {
+          n2++;
+          state = 0;
+        } else {
+          state = 3;
+        }
+      }
+      walktab[prev][b] = (uint16_t)(n2 | (n3 << 4) | (state << 8));
+    }
+  }
+  tables = 1;
+}
+
+int est_init(struct estimator *e, uint32_t window) {
+  if (!tables) {
+    est_tables();
+  }
+  memset(e, 0, sizeof(*e));
+  e->nchunks = (window + EST_CHUNK - 1) / EST_CHUNK;
+  if ((e->nchunks == 0) ||
+      ((e->chunk = calloc(e->nchunks, sizeof(struct est_counts))) == NULL)) {
+    return -1;
+  }
+  e->lastbit = 2;
+  return 0;
+}
+
+void est_free(struct estimator *e) {
+  free(e->chunk);
+  e->chunk = NULL;
+}
+
+/* to += from, or to -= from when sign is -1 */
+static void est_add(struct est_counts *to, const struct est_counts *from,
+                    int sign) {
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    to->count[i] += (uint32_t)sign * from->count[i];
+  }
+  to->zeros += (uint64_t)sign * from->zeros;
+  for (i = 0; i < 4; i++) {
+    to->pairs[i] += (uint64_t)sign * from->pairs[i];
+  }
+  to->t2 += (uint64_t)sign * from->t2;
+  to->t3 += (uint64_t)sign * from->t3;
+}
+
+static void est_flush(struct est_counts *c, uint64_t bits, uint64_t segs) {
+  int i;
+
+  c->zeros += FIELD(bits, 0);
+  for (i = 0; i < 4; i++) {
+    c->pairs[i] += FIELD(bits, i + 1);
+  }
+  c->t2 += segs & 0xffffffff;
+  c->t3 += segs >> 32;
+}
+
+/* the current chunk replaces the oldest one in the window */
+static void est_complete(struct estimator *e) {
+  struct est_counts *old = &e->chunk[e->head];
+
+  if (e->full == e->nchunks) {
+    est_add(&e->sum, old, -1);
+  } else {
+    e->full++;
+  }
+  est_add(&e->sum, &e->cur, 1);
+  memcpy(old, &e->cur, sizeof(*old));
+  memset(&e->cur, 0, sizeof(e->cur));
+  e->head = (e->head + 1 == e->nchunks) ? 0 : e->head + 1;
+  e->fill = 0;
+}
+
+void est_update(struct estimator *e, const uint8_t *data, size_t len) {
+  uint64_t bits, segs;
+  size_t i, n;
+  uint16_t w;
+  uint8_t b;
+
+  while (len > 0) {
+    /* up to the end of the chunk, and FLUSHBYTES at a time */
+    n = MIN(MIN(len, EST_CHUNK - e->fill), FLUSHBYTES);
+    bits = segs = 0;
+    for (i = 0; i < n; i++) {
+      b = data[i];
+      e->cur.count[b]++;
+      bits += bittab[e->lastbit][b];
+      e->lastbit = b & 1;
+      w = walktab[e->walk][b];
+      e->walk = (uint8_t)(w >> 8);
+      segs += (w & 0xf) | ((uint64_t)((w >> 4) & 0xf) << 32);
+    }
+    est_flush(&e->cur, bits, segs);
+    data += n;
+    len -= n;
+    if ((e->fill += (uint32_t)n) == EST_CHUNK) {
+      est_complete(e);
+    }
+  }
+}
+
+/* log2 of a probability, -inf for 0 */
+static double lg(double p) { return (p > 0) ? log2(p) : -INFINITY; }
+
+int est_result(const struct estimator *e, struct est_result *r) {
+  struct est_counts c;
+  double n, p, sd, x, pq, p0, p1, p00, p01, p10, p11, lmax;
+  double seq[6];
+  uint64_t v;
+  uint32_t max = 0;
+  int i;
+
+  if (e->full < e->nchunks) {
+    return -1;
+  }
+  memcpy(&c, &e->sum, sizeof(c));
+  est_add(&c, &e->cur, 1);
+  /* most common value, with the upper bound of 99% confidence */
+  n = (double)e->nchunks * EST_CHUNK + e->fill;
+  for (i = 0; i < 256; i++) {
+    max = (c.count[i] > max) ? c.count[i] : max;
+  }
+  p = max / n;
+  p = fmin(1, p + 2.576 * sqrt(p * (1 - p) / (n - 1)));
+  r->mcv = -log2(p);
+
+  /*
+   * collision: for bits, the mean segment length is 2 + 2pq,
+   * solved for p >= 1/2 at the lower bound of the mean
+   */
+  v = c.t2 + c.t3;
+  x = (2.0 * c.t2 + 3.0 * c.t3) / v;
+  sd = sqrt(fmax(0, (4.0 * c.t2 + 9.0 * c.t3 - v * x * x) / (v - 1)));
+  x -= 2.576 * sd / sqrt(v);
+  pq = (x - 2) / 2;
+  if (pq <= 0) {
+    p = 1;
+  } else if (pq >= 0.25) {
+    p = 0.5;
+  } else {
+    p = (1 + sqrt(1 - 4 * pq)) / 2;
+  }
+  r->collision = -log2(p) * 8;
+
+  /* Markov: the most likely 128-bit sequence of the first-order chain */
+  p0 = c.zeros / (n * 8);
+  p1 = 1 - p0;
+  p00 = (double)c.pairs[0] / fmax(1, c.pairs[0] + c.pairs[1]);
+  p01 = 1 - p00;
+  p10 = (double)c.pairs[2] / fmax(1, c.pairs[2] + c.pairs[3]);
+  p11 = 1 - p10;
+  seq[0] = lg(p0) + 127 * lg(p00);
+  seq[1] = lg(p0) + 64 * lg(p01) + 63 * lg(p10);
+  seq[2] = lg(p0) + lg(p01) + 126 * lg(p11);
+  seq[3] = lg(p1) + lg(p10) + 126 * lg(p00);
+  seq[4] = lg(p1) + 64 * lg(p10) + 63 * lg(p01);
+  seq[5] = lg(p1) + 127 * lg(p11);
+  lmax = seq[0];
+  for (i = 1; i < 6; i++) {
+    lmax = fmax(lmax, seq[i]);
+  }
+  r->markov = fmin(-lmax / 128, 1) * 8;
+
+  r->entropy = fmin(r->mcv, fmin(r->collision, r->markov));
+  return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Feeder for /dev/trng: streaming min-entropy estimators
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_ESTIMATE_H_
+#define _FEEDTRNG_ESTIMATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* default sliding window of the estimators [bytes] */
+#define EST_WINDOW (65536)
+
+/* the window slides by chunks of this size [bytes] */
+#define EST_CHUNK (4096)
+
+/* counts of a chunk of the window */
+struct est_counts {
+  uint32_t count[256]; /* most common value: byte histogram */
+  uint64_t zeros;      /* Markov: number of 0 bits */
+  uint64_t pairs[4];   /* Markov: bit transitions 00, 01, 10, 11 */
+  uint64_t t2, t3;     /* collision: walk segments of 2 and 3 bits */
+};
+
+/*
+ * Estimator state over the last window bytes of a source,
+ * kept as the counts of each chunk of the window and their sum;
+ * the memory is fixed at est_init(), whatever the stream length
+ */
+struct estimator {
+  uint32_t nchunks;         /* chunks in the window */
+  uint32_t full;            /* chunks completed, up to nchunks */
+  uint32_t head;            /* index of the oldest chunk */
+  uint32_t fill;            /* bytes in the current chunk */
+  struct est_counts *chunk; /* the completed chunks */
+  struct est_counts cur;    /* the current chunk */
+  struct est_counts sum;    /* sum of the completed chunks */
+  uint8_t walk;             /* collision: state of the walk */
+  uint8_t lastbit;          /* last bit of the previous byte, 2 if none */
+};
+
+/* estimates in bits per byte */
+struct est_result {
+  double mcv;       /* most common value, of bytes */
+  double collision; /* collision, of bits, times 8 */
+  double markov;    /* Markov, of bits, times 8 */
+  double entropy;   /* minimum of the above */
+};
+
+/*
+ * est_init() allocates the chunks of the window
+ * (rounded up to EST_CHUNK bytes), and returns -1 on error.
+ * est_update() slides the window over len bytes.
+ * est_result() computes the estimates of the window
+ * and the current chunk, and returns -1 until the window is full.
+ */
+extern int est_init(struct estimator *e, uint32_t window);
+extern void est_free(struct estimator *e);
+extern void est_update(struct estimator *e, const uint8_t *data, size_t len);
+extern int est_result(const struct estimator *e, struct est_result *r);
+
+#endif /* _FEEDTRNG_ESTIMATE_H_ */
@@ -0,0 +1,116 @@
+/*
+ * Feeder for /dev/trng: event loop over kqueue(2) or epoll(7)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#endif
+
+#include "event.h"
+
+/* maximum events returned by one evl_wait() */
+#define EVL_MAXEVENTS (64)
+
+#ifdef __linux__
+
+int evl_open(void) { return epoll_create1(EPOLL_CLOEXEC); }
+
+int evl_set(int evl, int fd, int oldflags, int flags, void *udata) {
+  struct epoll_event ev;
+  int op;
+
+  if (flags == 0) {
+    return (oldflags == 0) ? 0 : epoll_ctl(evl, EPOLL_CTL_DEL, fd, NULL);
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ((flags & EVL_READ) ? EPOLLIN : 0) |
+              ((flags & EVL_WRITE) ? EPOLLOUT : 0) |
+              ((flags & EVL_ONESHOT) ? EPOLLONESHOT : 0);
+  ev.data.ptr = udata;
+  op = (oldflags == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  return epoll_ctl(evl, op, fd, &ev);
+}
+
+int evl_wait(int evl, struct evl_event *ev, int nev, int timeout) {
+  struct epoll_event events[EVL_MAXEVENTS];
+  int i, n;
+
+  if (nev > EVL_MAXEVENTS) {
+    nev = EVL_MAXEVENTS;
+  }
+  if ((n = epoll_wait(evl, events, nev, timeout)) == -1) {
+    return (errno == EINTR) ? 0 : -1;
+  }
+  for (i = 0; i < n; i++) {
+    ev[i].udata = events[i].data.ptr;
+    ev[i].flags = 0;
+    /* errors and hangups are reported as readable */
+    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+      ev[i].flags |= EVL_READ;
+    }
+    if (events[i].events & EPOLLOUT) {
+      ev[i].flags |= EVL_WRITE;
+    }
+  }
+  return n;
+}
+
+#else /* kqueue */
+
+int evl_open(void) { return kqueue(); }
+
+int evl_set(int evl, int fd, int oldflags, int flags, void *udata) {
+  struct kevent kev[2];
+  /* EV_ADD also enables a filter disabled by EV_DISPATCH */
+  int add = EV_ADD | ((flags & EVL_ONESHOT) ? EV_DISPATCH : 0);
+  int n = 0;
+
+  if (((flags ^ oldflags) & EVL_READ) ||
+      ((flags & EVL_ONESHOT) && (flags & EVL_READ))) {
+    EV_SET(&kev[n++], fd, EVFILT_READ, (flags & EVL_READ) ? add : EV_DELETE,
+           0, 0, udata);
+  }
+  if (((flags ^ oldflags) & EVL_WRITE) ||
+      ((flags & EVL_ONESHOT) && (flags & EVL_WRITE))) {
+    EV_SET(&kev[n++], fd, EVFILT_WRITE, (flags & EVL_WRITE) ? add : EV_DELETE,
+           0, 0, udata);
+  }
+  return (n == 0) ? 0 : kevent(evl, kev, n, NULL, 0, NULL);
+}
+
+int evl_wait(int evl, struct evl_event *ev, int nev, int timeout) {
+  struct kevent events[EVL_MAXEVENTS];
+  struct timespec ts, *tsp = NULL;
+  int i, n;
+
+  if (nev > EVL_MAXEVENTS) {
+    nev = EVL_MAXEVENTS;
+  }
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    tsp = &ts;
+  }
+  if ((n = kevent(evl, NULL, 0, events, nev, tsp)) == -1) {
+    return (errno == EINTR) ? 0 : -1;
+  }
+  for (i = 0; i < n; i++) {
+    ev[i].udata = events[i].udata;
+    /* EOF and errors are reported as readable */
+    ev[i].flags = (events[i].filter == EVFILT_WRITE) ? EVL_WRITE : EVL_READ;
+  }
+  return n;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,32 @@
+/*
+ * Feeder for /dev/trng: event loop over kqueue(2) or epoll(7)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_EVENT_H_
+#define _FEEDTRNG_EVENT_H_
+
+/* interest and readiness flags */
+#define EVL_READ (0x01)
+#define EVL_WRITE (0x02)
+/* the interest is disabled after each event, until set again */
+#define EVL_ONESHOT (0x04)
+
+struct evl_event {
+  void *udata;
+  int flags; /* EVL_READ and/or EVL_WRITE */
+};
+
+/*
+ * evl_open() returns the event loop descriptor.
+ * evl_set() replaces the interest for fd with flags (0 to remove),
+ * and also enables it again after an event with EVL_ONESHOT.
+ * evl_wait() waits up to timeout milliseconds (-1: forever)
+ * and returns the number of events, or -1 on error.
+ */
+extern int evl_open(void);
+extern int evl_set(int evl, int fd, int oldflags, int flags, void *udata);
+extern int evl_wait(int evl, struct evl_event *ev, int nev, int timeout);
+
+#endif /* _FEEDTRNG_EVENT_H_ */
@@ -0,0 +1,304 @@
+/*
+ * End-to-end benchmark of feedtrng on simulated TRNGs
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * For each device profile of the simulator (see trngsim.c),
+ * runs feedtrng -o on ptys written at the rate and in the bursts
+ * of the devices, reads its output from a pipe, and reports:
+ *   the sustained input and output throughput,
+ *   the CPU time of feedtrng per MiB of input (from wait4(2)),
+ *   its read(2) and write(2) calls per KiB of input
+ *   (from /proc/<pid>/io on Linux, null elsewhere),
+ *   and the context switches,
+ *   the latency of the blocks from the write of the last input byte
+ *   into the pty to the read of the output from the pipe.
+ * Without health failures, the n-th output of -c bytes is from the n-th
+ * input block filled over all the devices, so the latency is only right
+ * for fixed blocks: the options after -- go to feedtrng as they are,
+ * but the adaptive ones (-a, -A) make the latency meaningless.
+ *
+ * To compile (add -D_GNU_SOURCE on Linux):
+ * cc -O2 -o feedbench feedbench.c bench.c sim.c -lpthread
+ *
+ * Usage: feedbench [-f path-to-feedtrng] [-p profile,...] [-n devices]
+ *   [-t seconds-per-case] [-b blocksize] [-c outputsize] [-v]
+ *   [-o output.json] [-- feedtrng options]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "sim.h"
+
+#define MAXDEVICES (16)
+#define MAXARGS (64)
+#define READSIZE (65536)
+
+/* the time for feedtrng to open the ttys before the devices start */
+#define STARTUP (300000000)
+
+static const char *feedtrng = "./feedtrng";
+static double seconds = 10;
+static int ndevices = 1;
+static uint32_t bsize = 512, osize = 64;
+static int verbose = 0;
+static char **extra = NULL;
+static int nextra = 0;
+
+struct result {
+  double secs;
+  uint64_t in, out;
+  struct bench_proc proc;
+  uint64_t blocks; /* paired for the latency */
+  double p50, p99, max; /* [ms] */
+};
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void append(uint64_t **v, size_t *n, size_t *max, uint64_t x) {
+  if (*n == *max) {
+    *max = (*max == 0) ? 4096 : *max * 2;
+    if ((*v = realloc(*v, *max * sizeof(**v))) == NULL) {
+      err(EX_OSERR, "realloc");
+    }
+  }
+  (*v)[(*n)++] = x;
+}
+
+static pid_t spawn(struct sim_device *dev, int outfd) {
+  char *args[MAXARGS];
+  char bstr[16], cstr[16];
+  int i, n = 0;
+
+  args[n++] = (char *)feedtrng;
+  args[n++] = "-o";
+  for (i = 0; i < ndevices; i++) {
+    args[n++] = "-d";
+    args[n++] = dev[i].name;
+  }
+  snprintf(bstr, sizeof(bstr), "%u", bsize);
+  snprintf(cstr, sizeof(cstr), "%u", osize);
+  args[n++] = "-b";
+  args[n++] = bstr;
+  args[n++] = "-c";
+  args[n++] = cstr;
+  for (i = 0; (i < nextra) && (n < MAXARGS - 1); i++) {
+    args[n++] = extra[i];
+  }
+  args[n] = NULL;
+  return bench_spawn(feedtrng, args, -1, outfd, verbose ? NULL : "/dev/null");
+}
+
+static double percentile(const uint64_t *v, size_t n, double q) {
+  size_t i = (size_t)(q * (double)(n - 1) + 0.5);
+
+  return (n == 0) ? 0 : (double)v[i] / 1e6;
+}
+
+static void run_case(const struct sim_profile *p, struct result *r) {
+  static struct sim_device dev[MAXDEVICES];
+  static uint8_t buf[READSIZE];
+  uint64_t *done = NULL, *outs = NULL, *lat = NULL;
+  size_t ndone = 0, maxdone = 0, nouts = 0, maxouts = 0, i, k, n;
+  uint64_t t0, t, stop, next;
+  struct pollfd pfd;
+  struct timespec ts;
+  int fds[2], status, d;
+  ssize_t len;
+  pid_t pid;
+
+  memset(r, 0, sizeof(*r));
+  for (d = 0; d < ndevices; d++) {
+    sim_open(&dev[d], p, 0x9e3779b97f4a7c15ULL * (uint64_t)(d + 1), 1);
+  }
+  if (pipe(fds) == -1) {
+    err(EX_OSERR, "pipe");
+  }
+  pid = spawn(dev, fds[1]);
+  close(fds[1]);
+  ts.tv_sec = 0;
+  ts.tv_nsec = STARTUP;
+  nanosleep(&ts, NULL);
+  if (waitpid(pid, &status, WNOHANG) == pid) {
+    errx(EX_SOFTWARE, "%s exited at the start (see -v)", feedtrng);
+  }
+  for (d = 0; d < ndevices; d++) {
+    sim_start(&dev[d]);
+  }
+  t0 = sim_now();
+  stop = t0 + (uint64_t)(seconds * 1e9);
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  next = osize;
+  while ((t = sim_now()) < stop) {
+    if (poll(&pfd, 1, (int)((stop - t) / 1000000 + 1)) <= 0) {
+      continue;
+    }
+    if ((len = read(fds[0], buf, sizeof(buf))) <= 0) {
+      if ((len == -1) && (errno == EINTR)) {
+        continue;
+      }
+      errx(EX_SOFTWARE, "%s exited (see -v)", feedtrng);
+    }
+    t = sim_now();
+    r->out += (uint64_t)len;
+    for (; next <= r->out; next += osize) {
+      append(&outs, &nouts, &maxouts, t);
+    }
+  }
+  r->secs = (double)(sim_now() - t0) / 1e9;
+  for (d = 0; d < ndevices; d++) {
+    sim_stop(&dev[d]);
+  }
+  kill(pid, SIGTERM);
+  close(fds[0]);
+  (void)bench_reap(pid, &r->proc);
+  /* the times when the blocks were filled, over all the devices */
+  for (d = 0; d < ndevices; d++) {
+    r->in += atomic_load(&dev[d].written);
+    for (i = 0, k = bsize; i < dev[d].nlog; i++) {
+      for (; k <= dev[d].log[i].end; k += bsize) {
+        append(&done, &ndone, &maxdone, dev[d].log[i].t);
+      }
+    }
+    sim_close(&dev[d]);
+  }
+  qsort(done, ndone, sizeof(*done), cmp_u64);
+  n = (nouts < ndone) ? nouts : ndone;
+  if ((n > 0) && ((lat = malloc(n * sizeof(*lat))) == NULL)) {
+    err(EX_OSERR, "malloc");
+  }
+  for (i = 0; i < n; i++) {
+    lat[i] = (outs[i] > done[i]) ? outs[i] - done[i] : 0;
+  }
+  qsort(lat, n, sizeof(*lat), cmp_u64);
+  r->blocks = n;
+  r->p50 = percentile(lat, n, 0.5);
+  r->p99 = percentile(lat, n, 0.99);
+  r->max = (n == 0) ? 0 : (double)lat[n - 1] / 1e6;
+  free(lat);
+  free(done);
+  free(outs);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: feedbench [-f path-to-feedtrng] [-p profile,...] "
+          "[-n devices]\n"
+          "  [-t seconds-per-case] [-b blocksize] [-c outputsize] [-v]\n"
+          "  [-o output.json] [-- feedtrng options]\n");
+  exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  char defaults[] = "avrhwrng,truerng,onerng,neug";
+  char *profiles = defaults, *name;
+  const struct sim_profile *p;
+  struct result r;
+  double kib, mib;
+  FILE *out;
+  int ch, first = 1;
+
+  while ((ch = getopt(argc, argv, "f:p:n:t:b:c:vo:")) != -1) {
+    switch (ch) {
+    case 'f':
+      feedtrng = optarg;
+      break;
+    case 'p':
+      profiles = optarg;
+      break;
+    case 'n':
+      ndevices = atoi(optarg);
+      if ((ndevices < 1) || (ndevices > MAXDEVICES)) {
+        errx(EX_USAGE, "devices must be from 1 to %d", MAXDEVICES);
+      }
+      break;
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'b':
+      bsize = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      osize = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  extra = argv + optind;
+  nextra = argc - optind;
+  if ((seconds <= 0) || (bsize == 0) || (osize == 0)) {
+    errx(EX_USAGE, "seconds, blocksize and outputsize must be positive");
+  }
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(out,
+          "{\n  \"benchmark\": \"feedbench\",\n  \"devices\": %d,\n"
+          "  \"block_size\": %u,\n  \"output_size\": %u,\n"
+          "  \"seconds_per_case\": %.3f,\n  \"results\": [",
+          ndevices, bsize, osize, seconds);
+  for (name = strtok(profiles, ","); name != NULL;
+       name = strtok(NULL, ",")) {
+    if ((p = sim_find(name)) == NULL) {
+      errx(EX_USAGE, "unknown profile %s (see trngsim -l)", name);
+    }
+    run_case(p, &r);
+    kib = (double)r.in / 1024;
+    mib = kib / 1024;
+    fprintf(out,
+            "%s\n    {\"profile\": \"%s\", \"device_rate\": %.0f, "
+            "\"input_bytes_per_s\": %.0f, \"output_bytes_per_s\": %.0f, ",
+            first ? "" : ",", p->name, p->rate * ndevices, r.in / r.secs,
+            r.out / r.secs);
+    /* null without input, as when the devices never started */
+    bench_per(out, "cpu_ms_per_mib", r.proc.cpu * 1e3, mib, 2, ", ");
+    bench_per(out, "reads_per_kib", r.proc.syscr, kib, 3, ", ");
+    bench_per(out, "writes_per_kib", r.proc.syscw, kib, 3, ", ");
+    fprintf(out,
+            "\"voluntary_switches\": %ld, \"involuntary_switches\": %ld, "
+            "\"blocks\": %llu, \"latency_p50_ms\": %.2f, "
+            "\"latency_p99_ms\": %.2f, \"latency_max_ms\": %.2f}",
+            r.proc.nvcsw, r.proc.nivcsw, (unsigned long long)r.blocks, r.p50,
+            r.p99, r.max);
+    first = 0;
+    fprintf(stderr,
+            "%-9s in %9.0f B/s out %8.0f B/s %8.2f ms/MiB "
+            "%7.3f reads/KiB latency %.1f/%.1f/%.1f ms\n",
+            p->name, r.in / r.secs, r.out / r.secs,
+            (r.in > 0) ? r.proc.cpu * 1e3 / mib : 0,
+            ((r.in > 0) && (r.proc.syscr >= 0)) ? r.proc.syscr / kib : 0,
+            r.p50, r.p99, r.max);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
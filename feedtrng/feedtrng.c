@@ -32,96 +32,242 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <libgen.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sysexits.h>
-#include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#define OUTPUTFILE "/dev/trng"
+#include "capture.h"
+#include "conditioner.h"
+#include "feedtrng.h"
+#include "server.h"
+#include "sha512.h"
+#include "trng_ring.h"
+#include "uring.h"
 
-/*
- * buffer size
- * for fetching from the TRNG tty device
- * designed for NeuG (~80kbytes/sec)
- * change the value for a higher-speed device
- */
-
-#define BUFFERSIZE (512)
-
-/* external hash function */
-
-extern void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]);
 
 void usage(void) {
   errx(EX_USAGE,
-       "Usage: %s [-d cua-device] [-s speed] [-o] [-t] [-h]\n"
+       "Usage: %s {-d [kind:]device[:speed] [-d ...] [-W capture] [-U] |\n"
+       "       -P capture [-F]} [-s speed] [-o] [-t]\n"
+       "       [-b block-size] [-c output-size] [-a min:max [-L ms | -R rate]]\n"
+       "       [-e entropy] [-A] [-G seconds] [-B batch-size | -m | -S socket] [-D ms]\n"
+       "       [-O output [-O ...]]\n"
+       "       [-C conditioner [-K keyfile] [-N lanes]] [-H sha512-impl]\n"
+       "       [-q queue-depth]\n"
+       "       [-I ms] [-M file[:seconds]] [-h]\n"
+#ifdef __linux__
+       "tty devices under /dev/ are accepted\n"
+#else
        "Only cua[.+] and /dev/cua[.+] are accepted\n"
+#endif
+       "Up to %d devices are read at once, each chained separately\n"
+       "-d: a tty, or by the kind prefix, fd:number, fifo:path,\n"
+       "    file:path or hwrng:path for an inherited descriptor,\n"
+       "    a named pipe, a regular file or a character device;\n"
+       "    the end of a pipe or a file ends the run\n"
+       "-U: read the pipes, files and devices over io_uring (Linux)\n"
+       "-W: capture the reads of the devices into a file\n"
+       "-P: replay a capture instead of reading the devices,\n"
+       "    at the recorded times or as fast as possible with -F,\n"
+       "    and exit at its end\n"
        "Speed range: 9600 to 1000000 [bps] (default: 115200)\n"
+       "(-s sets the speed of the devices without :speed)\n"
        "Default output device: %s (use -o to output to stdout)\n"
-       "The first %d bytes from tty input are discarded when without -o\n"
-       "The output will be hashed with SHA512 without -t\n"
+       "The first block from tty input is discarded when without -o\n"
+       "The output will be hashed with the conditioner of -C without -t\n"
        "(when with -t, output is transparent to tty input)\n"
+       "Conditioners for -C: %s (default: %s)\n"
+       "(blake2b is not a vetted conditioning component of SP 800-90B)\n"
+       "-K: the key file of hmac-sha512 (default: a random key)\n"
+       "-N: deal the hashed segments of each device to 1 to %d chains\n"
+       "    in turn (default: 1), as trngcond conditions a capture\n"
+       "Block size: %d to %d bytes, a multiple of %d (default: %d)\n"
+       "Output size: 1 to block size bytes per block (default: %d)\n"
+       "-a: adapt the block size within min:max to the input rate,\n"
+       "    keeping the ratio of -c to -b, so that a block is filled\n"
+       "    in -L milliseconds (default: %d), or so that the output\n"
+       "    is written -R times per second from all the devices\n"
+       "Blocks failing the SP 800-90B repetition count or\n"
+       "adaptive proportion test are dropped; the test cutoffs are set\n"
+       "by the claimed min-entropy per byte of -e (0 to 8, default: %.1f)\n"
+       "-A: set the raw bytes per 64-byte output from the min-entropy\n"
+       "    estimate of the last %d bytes of each device, instead of -c\n"
+       "-G: screen the input with the FIPS 140-2 tests of rndtest(4)\n"
+       "    on a %d-byte sample of each device every -G seconds\n"
+       "    (0 for every sample, as kern.rndtest.retest: %d),\n"
+       "    holding the blocks of a sample until it is tested,\n"
+       "    and drop the blocks from a failing sample until one passes\n"
+       "The output is written in batches of -B bytes (1 to %d, default: %d),\n"
+       "or after waiting for -D milliseconds (default: %d)\n"
+       "The reads of a device taking more than %d reads per block\n"
+       "are held off for the rest of the block to arrive,\n"
+       "up to -I milliseconds (default: %d, 0 for none)\n"
+       "-m: write the output into the mmap ring of %s instead,\n"
+       "    and have it drained when half full or after -D milliseconds\n"
+       "-S: serve the output to local clients of the EGD protocol\n"
+       "    on the Unix domain socket instead, up to %d at once\n"
+       "-O: write the output to trng, stdout, file:path, socket:path,\n"
+       "    random[:bits] or mock[:bits] instead, each batch to a single\n"
+       "    output in turn (up to %d outputs, with -o and -S);\n"
+       "    random adds the batches to the input pool of Linux\n"
+       "    with ioctl(RNDADDENTROPY), crediting bits of entropy per byte\n"
+       "    (default: the -e entropy times the raw bytes per output byte,\n"
+       "    up to 8, and none with a conditioner not vetted),\n"
+       "    and mock counts the calls it would make\n"
+       "SHA512 implementations for -H: %s\n"
+       "(default: the fastest one supported by the CPU)\n"
+       "Queue depth range: 3 to %d blocks (default: %d)\n"
+       "(plus one block being filled per device, and those held by -G)\n"
+       "Send SIGUSR1 (or SIGINFO) for the pipeline statistics\n"
+       "-M: also write them in the Prometheus text format into the file\n"
+       "    every few seconds (default: %d) and at exit\n"
        "Use -h for help",
-       getprogname(), OUTPUTFILE, BUFFERSIZE);
+       getprogname(), MAXSOURCES, OUTPUTFILE, cond_names(), COND_DEFAULT,
+       COND_MAXLANES, MINBUFFERSIZE, MAXBUFFERSIZE,
+       SHA512_BLOCK_LENGTH, BUFFERSIZE, OUTPUTSIZE, LATENCY, HEALTH_ENTROPY,
+       EST_WINDOW, RNDTEST_NBYTES, RNDTEST_RETEST, MAXBATCHSIZE, MAXWRITESIZE,
+       DEADLINE, HOLDREADS, READWAIT, OUTPUTFILE,
+       SERVER_MAXCLIENTS, MAXOUTPUTS, sha512_names(),
+       MAXQUEUEDEPTH, QUEUEDEPTH, METRICSINTERVAL);
+}
+
+/* parse a decimal number in the range of min to max */
+static long number(const char *arg, const char *what, long min, long max) {
+  char *end;
+  long val;
+
+  errno = 0;
+  val = strtol(arg, &end, 10);
+  if (errno > 0) {
+    err(EX_OSERR, "strtol for %s failed", what);
+  }
+  if ((end == arg) || (*end != '\0')) {
+    errx(EX_USAGE, "%s %s is not a number", what, arg);
+  }
+  if ((val < min) || (val > max)) {
+    errx(EX_USAGE, "%s %ld out of range", what, val);
+  }
+  return val;
+}
+
+/* set the HMAC key from a file, or a random key */
+static void hmackey(const char *keyfile) {
+  uint8_t key[4096];
+  ssize_t len;
+  int fd;
+
+  if (keyfile == NULL) {
+    if (getentropy(key, SHA512_DIGEST_LENGTH) != 0) {
+      err(EX_OSERR, "getentropy failed");
+    }
+    len = SHA512_DIGEST_LENGTH;
+  } else {
+    if ((fd = open(keyfile, O_RDONLY)) == -1) {
+      err(EX_NOINPUT, "cannot open %s", keyfile);
+    }
+    if ((len = read(fd, key, sizeof(key))) == -1) {
+      err(EX_IOERR, "cannot read %s", keyfile);
+    }
+    close(fd);
+  }
+  if (cond_setkey(key, (size_t)len) != 0) {
+    errx(EX_DATAERR, "key file %s is empty", keyfile);
+  }
+  memset(key, 0, sizeof(key));
+}
+
+/* parse a block size */
+static uint32_t blocksize(const char *arg, const char *what) {
+  long val = number(arg, what, MINBUFFERSIZE, MAXBUFFERSIZE);
+
+  if ((val % SHA512_BLOCK_LENGTH) != 0) {
+    errx(EX_USAGE, "%s %ld is not a multiple of %d", what, val,
+         SHA512_BLOCK_LENGTH);
+  }
+  return (uint32_t)val;
 }
 
 int main(int argc, char *argv[]) {
 
-  uint8_t rbuf[BUFFERSIZE], *p;
-  int ttyfd, trngfd;
-  struct termios ttyconfig;
-  ssize_t rsize, wsize;
-  int i;
+  int trngfd = -1;
   int dflag = 0;
-  int ch;
-  char *input;
-  char *inputbase;
-  char devname[MAXPATHLEN];
+  int ch, i;
+  char *devarg[MAXSOURCES];
+  char *outarg[MAXOUTPUTS];
+  int nout = 0;
   long speedval = 115200L;
   int oflag = 0;
+  int mflag = 0;
+  void *map;
   /* discard the first output buffer block as default */
   int discard = 1;
   /* if set, no SHA512 compression */
   int transparent = 0;
-  /* sha512 */
-  uint8_t hashbuf[BUFFERSIZE + (sizeof(uint64_t) * 4)];
-  uint64_t hash[8];
+  long depth = QUEUEDEPTH;
+  uint32_t bsize = BUFFERSIZE;
+  long osize = OUTPUTSIZE;
+  /* adaptive mode */
+  char *colon;
+  uint32_t minblock = 0, maxblock = 0;
+  long latency = LATENCY, rate = 0;
+  double entropy = HEALTH_ENTROPY;
+  int autoratio = 0;
+  long batchsize = MAXWRITESIZE, deadline = DEADLINE, readwait = READWAIT;
+  const struct conditioner *cond = cond_find(COND_DEFAULT);
+  long nlanes = 1;
+  long retest = -1;
+  char *keyfile = NULL;
+  char *sockpath = NULL;
+  static struct server srv;
+  char *capfile = NULL, *replayfile = NULL;
+  static struct capture cap;
+  int fast = 0;
+  int uflag = 0;
+  static struct uring ur;
+  struct timespec t0, t1;
+  double secs;
+  char *end;
+  static struct pipeline pl;
+  char *metricsfile = NULL;
+  long interval = METRICSINTERVAL;
+  struct timespec next, wait;
+  sigset_t sigs;
+  int sig;
 
   if (argc < 2) {
     usage();
   }
-  while ((ch = getopt(argc, argv, "d:s:oth")) != -1) {
+  while ((ch = getopt(argc, argv, "d:W:P:FUs:otb:c:a:L:R:e:AG:B:D:I:M:mS:O:C:K:N:H:q:h")) != -1) {
     switch (ch) {
     case 'd':
-      dflag = 1;
-      if ((input = strndup(optarg, MAXPATHLEN)) == NULL) {
-        errx(EX_USAGE, "device input string error");
-      }
-      if ((inputbase = strndup(basename(input), MAXPATHLEN)) == NULL) {
-        errx(EX_OSERR, "device input basename failed");
-      }
-      if ((*inputbase == '/') || (*inputbase == '.')) {
-        errx(EX_USAGE, "illegal path in inputbase");
+      if (dflag >= MAXSOURCES) {
+        errx(EX_USAGE, "too many devices (max %d)", MAXSOURCES);
       }
+      devarg[dflag++] = optarg;
+      break;
+    case 'W':
+      capfile = optarg;
+      break;
+    case 'P':
+      replayfile = optarg;
+      break;
+    case 'F':
+      fast = 1;
+      break;
+    case 'U':
+      uflag = 1;
       break;
     case 's':
-      errno = 0;
-      speedval = strtol(optarg, NULL, 10);
-      if (errno > 0) {
-        err(EX_OSERR, "strtol for speedval failed");
-      }
-      if ((speedval < 9600) || (speedval > 1000000)) {
-        errx(EX_USAGE, "speedval %ld out of range", speedval);
-      }
+      speedval = source_speed(optarg);
       break;
     case 'o':
       oflag = 1;
@@ -131,6 +277,95 @@ int main(int argc, char *argv[]) {
     case 't':
       transparent = 1;
       break;
+    case 'b':
+      bsize = blocksize(optarg, "block size");
+      break;
+    case 'c':
+      osize = number(optarg, "output size", 1, MAXBUFFERSIZE);
+      break;
+    case 'a':
+      if ((colon = strchr(optarg, ':')) == NULL) {
+        errx(EX_USAGE, "adaptive bounds %s are not min:max", optarg);
+      }
+      *colon = '\0';
+      minblock = blocksize(optarg, "minimum block size");
+      maxblock = blocksize(colon + 1, "maximum block size");
+      if (minblock > maxblock) {
+        errx(EX_USAGE, "adaptive bounds %u:%u are not min:max", minblock,
+             maxblock);
+      }
+      break;
+    case 'L':
+      latency = number(optarg, "latency", 1, 60000);
+      rate = 0;
+      break;
+    case 'R':
+      rate = number(optarg, "write rate", 1, 100000);
+      break;
+    case 'e':
+      errno = 0;
+      entropy = strtod(optarg, &end);
+      if (errno > 0) {
+        err(EX_OSERR, "strtod for entropy failed");
+      }
+      if ((end == optarg) || (*end != '\0') ||
+          (health_cutoffs(entropy, &pl.cutoff) != 0)) {
+        errx(EX_USAGE, "entropy %s out of range", optarg);
+      }
+      break;
+    case 'A':
+      autoratio = 1;
+      break;
+    case 'G':
+      retest = number(optarg, "retest interval", 0, 86400);
+      break;
+    case 'B':
+      batchsize = number(optarg, "batch size", 1, MAXBATCHSIZE);
+      break;
+    case 'D':
+      deadline = number(optarg, "deadline", 0, 60000);
+      break;
+    case 'I':
+      readwait = number(optarg, "read wait", 0, 1000);
+      break;
+    case 'M':
+      metricsfile = optarg;
+      if ((colon = strrchr(optarg, ':')) != NULL) {
+        *colon = '\0';
+        interval = number(colon + 1, "metrics interval", 1, 3600);
+      }
+      break;
+    case 'm':
+      mflag = 1;
+      break;
+    case 'S':
+      sockpath = optarg;
+      break;
+    case 'O':
+      if (nout >= MAXOUTPUTS) {
+        errx(EX_USAGE, "too many outputs (max %d)", MAXOUTPUTS);
+      }
+      outarg[nout++] = optarg;
+      break;
+    case 'C':
+      if ((cond = cond_find(optarg)) == NULL) {
+        errx(EX_USAGE, "conditioner %s not supported", optarg);
+      }
+      break;
+    case 'K':
+      keyfile = optarg;
+      break;
+    case 'N':
+      nlanes = number(optarg, "lanes", 1, COND_MAXLANES);
+      break;
+    case 'H':
+      if (sha512_select(optarg) != 0) {
+        errx(EX_USAGE, "SHA512 implementation %s not supported", optarg);
+      }
+      break;
+    case 'q':
+      depth = number(optarg, "queue depth", 3, MAXQUEUEDEPTH);
+      break;
     case 'h':
       usage();
       break;
@@ -139,142 +374,222 @@ int main(int argc, char *argv[]) {
       usage();
     }
   }
-  if (dflag == 0) {
+  if ((dflag == 0) && (replayfile == NULL)) {
     errx(EX_USAGE, "no device name given");
   }
-  if (strnlen(inputbase, 4) < 4) {
-    errx(EX_USAGE, "input basename less than four letters");
+  if ((replayfile != NULL) && ((dflag > 0) || (capfile != NULL))) {
+    errx(EX_USAGE, "-P is exclusive with -d and -W");
+  }
+  if (fast && (replayfile == NULL)) {
+    errx(EX_USAGE, "-F is only for -P");
+  }
+  if (uflag && (replayfile != NULL)) {
+    errx(EX_USAGE, "-U is exclusive with -P");
   }
-  if ((inputbase[0] != 'c') || (inputbase[1] != 'u') || (inputbase[2] != 'a')) {
-    errx(EX_USAGE, "not a /dev/cua* device");
+  if ((keyfile != NULL) && (strcmp(cond->name, "hmac-sha512") != 0)) {
+    errx(EX_USAGE, "-K is only for hmac-sha512");
   }
-  if ((strlcpy(devname, "/dev/", MAXPATHLEN)) >= MAXPATHLEN) {
-    errx(EX_OSERR, "strlcpy devname failed");
+  if (strcmp(cond->name, "hmac-sha512") == 0) {
+    hmackey(keyfile);
   }
-  if ((strlcat(devname, inputbase, MAXPATHLEN)) >= MAXPATHLEN) {
-    errx(EX_OSERR, "strlcat devname failed");
+  if ((mflag + oflag + (sockpath != NULL)) > 1) {
+    errx(EX_USAGE, "-m, -o and -S are exclusive");
+  }
+  if (mflag && (nout > 0)) {
+    errx(EX_USAGE, "-m is exclusive with -O");
+  }
+  if (nout + oflag + (sockpath != NULL) > MAXOUTPUTS) {
+    errx(EX_USAGE, "too many outputs (max %d)", MAXOUTPUTS);
+  }
+  if (osize > (long)bsize) {
+    errx(EX_USAGE, "output size %ld larger than block size %u", osize, bsize);
   }
 #ifdef DEBUG
-  fprintf(stderr, "feedtrng: device name: %s\n", devname);
+  fprintf(stderr, "feedtrng: conditioner %s, SHA512 implementation: %s\n",
+          cond->name, sha512_name());
   fflush(stderr);
 #endif
-  /* open TRNG tty */
-  if ((ttyfd = open(devname, O_RDONLY)) == -1) {
-    err(EX_IOERR, "cannot open tty file");
-  }
-  /* check if really a tty */
-  if (0 == isatty(ttyfd)) {
-    err(EX_IOERR, "input not a tty");
-  }
-  /* set exclusive access */
-  if (-1 == ioctl(ttyfd, TIOCEXCL, 0)) {
-    err(EX_IOERR, "input ioctl(TIOCEXCL) failed");
-  }
-  /* get tty discipline */
-  if (-1 == tcgetattr(ttyfd, &ttyconfig)) {
-    err(EX_IOERR, "input tcgetattr failed");
-  }
-  /* set RAW mode (see cfmakeraw(4)) */
-  /* and set all transparency flags */
-  /* no CTS/RTS flow control */
-  /* CLOCAL cleared (modem control enabled) */
-  ttyconfig.c_iflag &= ~(IMAXBEL | IXOFF | INPCK | BRKINT | PARMRK | ISTRIP |
-                         INLCR | IGNCR | ICRNL | IXON | IGNPAR);
-  ttyconfig.c_iflag |= IGNBRK;
-  ttyconfig.c_oflag &= ~OPOST;
-  ttyconfig.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHOKE | ECHOCTL | ECHONL |
-                         ICANON | ISIG | IEXTEN | NOFLSH | TOSTOP | PENDIN);
-  ttyconfig.c_cflag &= ~(CSIZE | PARENB | CRTS_IFLOW | CCTS_OFLOW | MDMBUF);
-  ttyconfig.c_cflag |= CS8 | CREAD;
-  ttyconfig.c_cflag &= ~CLOCAL;
-  ttyconfig.c_cc[VMIN] = 1;
-  ttyconfig.c_cc[VTIME] = 0;
-  /* set speed */
-  if (-1 == cfsetspeed(&ttyconfig, (speed_t)speedval)) {
-    err(EX_IOERR, "input cfsetspeed to %ld failed", speedval);
-  }
-  if (-1 == tcsetattr(ttyfd, TCSANOW, &ttyconfig)) {
-    err(EX_IOERR, "input tcsetattr for raw and speed %ld failed", speedval);
+  if (replayfile != NULL) {
+    /* the sources of the capture, without ttys */
+    cap_open(&cap, replayfile);
+    pl.nsources = (int)cap.hdr->nsources;
+    for (i = 0; i < pl.nsources; i++) {
+      snprintf(pl.src[i].devname, sizeof(pl.src[i].devname), "%s",
+               cap.hdr->src[i].name);
+      pl.src[i].speed = (long)cap.hdr->src[i].speed;
+      pl.src[i].fd = -1;
+    }
+    pl.replay = &cap;
+    pl.fast = fast;
+  } else {
+    /* open TRNG ttys and the other sources */
+    for (i = 0; i < dflag; i++) {
+      source_name(&pl.src[i], devarg[i], speedval);
+      source_open(&pl.src[i]);
+    }
+    pl.nsources = dflag;
+    if (uflag) {
+      if (uring_open(&ur, MAXSOURCES) == -1) {
+        err(EX_OSERR, "cannot set up io_uring");
+      }
+      pl.uring = &ur;
+    }
+  }
+  if (capfile != NULL) {
+    cap_create(&cap, capfile);
+    for (i = 0; i < pl.nsources; i++) {
+      cap_source(&cap, (unsigned)i, pl.src[i].devname, pl.src[i].speed);
+    }
+    pl.capture = &cap;
   }
 
-  /* open trng output device */
+  /* open the outputs */
+  if (sockpath != NULL) {
+    /* the sink writes into the pipe to the server, counting the entropy */
+    output_fd(&pl.out[pl.noutputs], sockpath, server_open(&srv, sockpath));
+    server_credit(&srv, &pl.out[pl.noutputs].stats.bytes,
+                  &pl.out[pl.noutputs].stats.credits);
+    pl.noutputs++;
+  }
   if (oflag) {
     /* use stdout */
-    if ((trngfd = fcntl(STDOUT_FILENO, F_DUPFD, 0)) == -1) {
-      err(EX_IOERR, "cannot open stdout");
-    }
-  } else {
+    output_name(&pl.out[pl.noutputs++], "stdout");
+  }
+  for (i = 0; i < nout; i++) {
+    output_name(&pl.out[pl.noutputs++], outarg[i]);
+  }
+  if ((pl.noutputs == 0) && !mflag) {
     /* use default output file */
-    if ((trngfd = open(OUTPUTFILE, O_WRONLY)) == -1) {
+    output_name(&pl.out[pl.noutputs++], "trng");
+  }
+  for (i = 0; i < pl.noutputs; i++) {
+    output_open(&pl.out[i]);
+  }
+  if (mflag) {
+    /* the trng output device, read-write for mmap() */
+    if ((trngfd = open(OUTPUTFILE, O_RDWR)) == -1) {
       errx(EX_IOERR, "cannot open %s", OUTPUTFILE);
     }
+    if ((map = mmap(NULL, TRNG_RING_MAPSIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, trngfd, 0)) == MAP_FAILED) {
+      err(EX_IOERR, "cannot mmap %s", OUTPUTFILE);
+    }
+    pl.ring = map;
+    pl.ringdata = (uint8_t *)map + TRNG_RING_HDRSIZE;
+    if ((pl.ring->version != TRNG_RING_VERSION) ||
+        (pl.ring->size != TRNG_RING_SIZE)) {
+      errx(EX_IOERR, "%s ring version %u size %u not supported", OUTPUTFILE,
+           pl.ring->version, pl.ring->size);
+    }
   }
 
-  /* initialize sha512 hash data */
-  hash[0] = UINT64_C(0x6A09E667F3BCC908);
-  hash[1] = UINT64_C(0xBB67AE8584CAA73B);
-  hash[2] = UINT64_C(0x3C6EF372FE94F82B);
-  hash[3] = UINT64_C(0xA54FF53A5F1D36F1);
-  hash[4] = UINT64_C(0x510E527FADE682D1);
-  hash[5] = UINT64_C(0x9B05688C2B3E6C1F);
-  hash[6] = UINT64_C(0x1F83D9ABFB41BD6B);
-  hash[7] = UINT64_C(0x5BE0CD19137E2179);
-
-  /* infinite loop */
-  while (1) {
-    /* fill the receive buffer first */
-    for (i = 0, p = rbuf; i < BUFFERSIZE;) {
-      /* try reading from tty */
-      if ((rsize = read(ttyfd, p + i, BUFFERSIZE - i)) < 1) {
-        err(EX_IOERR, "read from tty failed");
-      }
-#ifdef DEBUG
-      fprintf(stderr, "feedtrng: rsize %d after read\n", (int)rsize);
-      fflush(stderr);
-#endif
-      /* add the number of bytes read */
-      i += rsize;
-#ifdef DEBUG
-      fprintf(stderr, "feedtrng: i %d after read\n", (int)i);
-      fflush(stderr);
-#endif
-    }
-    if (discard == 0) {
-      if (transparent == 0) {
-        memcpy(hashbuf, rbuf, BUFFERSIZE);
-        /* copy half of hashed output into hashbuf */
-        memcpy(hashbuf + BUFFERSIZE, &hash, sizeof(uint64_t) * 4);
-        /* compute sha512 hash */
-        sha512_hash(hashbuf, sizeof(hashbuf), hash);
+  /* run the reader, conditioner and sink threads */
+  pl.trngfd = trngfd;
+  pl.transparent = transparent;
+  pl.cond = cond;
+  pl.nlanes = (unsigned)nlanes;
+  pl.discard = discard;
+  pl.blocksize = bsize;
+  pl.entropy = entropy;
+  health_cutoffs(entropy, &pl.cutoff);
+  pl.autoratio = autoratio;
+  pl.gate = (retest >= 0);
+  pl.retest = (retest > 0) ? (uint64_t)retest * 1000000000 : 0;
+  pl.batchsize = (size_t)batchsize;
+  pl.deadline = (uint64_t)deadline * 1000000;
+  pl.readwait = (uint64_t)readwait * 1000000;
 #ifdef DEBUG
-        fprintf(stderr, "feedtrng: Compute sha512 of %d bytes\n",
-                (int)sizeof(hashbuf));
-        fflush(stderr);
-#endif
-        /* write hash to output */
-        if ((wsize = write(trngfd, &hash, sizeof(uint64_t) * 8)) == -1) {
-          err(EX_IOERR, "trng hash write failed");
-        }
-#ifdef DEBUG
-        fprintf(stderr, "feedtrng: write %d hashed bytes ", (int)wsize);
-        fprintf(stderr, "hash[0] = %" PRIu64 "\n", hash[0]);
-        fflush(stderr);
+  fprintf(stderr, "feedtrng: health test cutoffs: rct %u apt %u/%d (%s)\n",
+          pl.cutoff.rct, pl.cutoff.apt, HEALTH_WINDOW, health_name());
+  if (pl.gate) {
+    fprintf(stderr, "feedtrng: rndtest retest %ld s (%s)\n", retest,
+            rndtest_name());
+  }
+  fflush(stderr);
 #endif
-      } else {
-        /* writing transparently */
-        if ((wsize = write(trngfd, rbuf, (size_t)BUFFERSIZE)) == -1) {
-          err(EX_IOERR, "trng write failed");
-        }
-#ifdef DEBUG
-        fprintf(stderr, "feedtrng: write %d bytes transparently\n", (int)wsize);
-        fflush(stderr);
+  pl.outsize = (uint32_t)osize;
+  if (maxblock != 0) {
+    pl.minblock = minblock;
+    pl.maxblock = maxblock;
+    /* -R: each device fills its share of the writes */
+    pl.latency = (rate != 0) ? (uint64_t)pl.nsources * 1000000000 /
+                                   (uint64_t)rate
+                             : (uint64_t)latency * 1000000;
+  }
+  /* each source also holds a block being filled */
+  pl.depth = (unsigned)depth + (unsigned)pl.nsources;
+  pipeline_init(&pl);
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGUSR1);
+#ifdef SIGINFO
+  sigaddset(&sigs, SIGINFO);
 #endif
+  sigaddset(&sigs, SIGHUP);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+  if (sockpath != NULL) {
+    server_start(&srv);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pipeline_start(&pl);
+
+  /* infinite loop, or until the end of the input */
+  next = t0;
+  next.tv_sec += interval;
+  while (1) {
+    if (metricsfile == NULL) {
+      if (sigwait(&sigs, &sig) != 0) {
+        continue;
       }
     } else {
-      /* clear discarding flag */
-      discard = 0;
+      /* wait for a signal until the metrics are due */
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      wait.tv_sec = next.tv_sec - t1.tv_sec;
+      wait.tv_nsec = next.tv_nsec - t1.tv_nsec;
+      if (wait.tv_nsec < 0) {
+        wait.tv_sec--;
+        wait.tv_nsec += 1000000000;
+      }
+      if (wait.tv_sec < 0) {
+        wait.tv_sec = wait.tv_nsec = 0;
+      }
+      if ((sig = sigtimedwait(&sigs, NULL, &wait)) == -1) {
+        if (errno == EAGAIN) {
+          metrics_write(&pl, metricsfile);
+          next.tv_sec += interval;
+        }
+        continue;
+      }
     }
+    if ((sig == SIGHUP) || (sig == SIGINT) || (sig == SIGTERM)) {
+      break;
+    }
+    pipeline_stats(&pl, stderr);
+    if (sockpath != NULL) {
+      server_stats(&srv, stderr);
+    }
+  }
+  if (metricsfile != NULL) {
+    metrics_write(&pl, metricsfile);
+  }
+  if (sockpath != NULL) {
+    server_close(&srv);
+  }
+  if (capfile != NULL) {
+    cap_close(&cap);
+  }
+  if (atomic_load(&pl.done)) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    pipeline_stats(&pl, stderr);
+    fprintf(stderr,
+            "feedtrng: %s of %s: %" PRIuFAST64 " bytes in %.3f s"
+            " (%.1f KiB/s)\n",
+            (replayfile != NULL) ? "replay" : "input",
+            (replayfile != NULL) ? replayfile : pl.src[0].devname,
+            STAT_GET(pl.reader.bytes), secs,
+            STAT_GET(pl.reader.bytes) / secs / 1024);
   }
-  /* notreached */
   return 0;
 }
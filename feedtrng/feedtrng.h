@@ -0,0 +1,386 @@
+/*
+ * Feeder for /dev/trng: shared definitions
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_H_
+#define _FEEDTRNG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "conditioner.h"
+#include "estimate.h"
+#include "health.h"
+#include "latency.h"
+#include "ring.h"
+#include "rndtest.h"
+
+struct capture;
+struct output;
+struct output_pool;
+struct source;
+struct trng_ring;
+struct uring;
+
+/*
+ * default block size
+ * for fetching from the TRNG tty device
+ * designed for NeuG (~80kbytes/sec)
+ * use -b for a higher-speed device, or -a to adapt to the input rate
+ */
+
+#define BUFFERSIZE (512)
+
+/* range of the block size; a multiple of SHA512_BLOCK_LENGTH */
+#define MINBUFFERSIZE (128)
+#define MAXBUFFERSIZE (65536)
+
+/* default output bytes per block (compression ratio: 1/8) */
+#define OUTPUTSIZE (64)
+
+/*
+ * raw bytes per 64-byte output with the entropy estimate (-A):
+ * 512 + 64 bits of estimated min-entropy for each 512-bit output,
+ * as for a vetted conditioning function in SP 800-90B 3.1.5.1.2,
+ * from 72 bytes at 8 bits per byte up to MAXPEROUT bytes
+ */
+#define OUTPUTENTROPY (512 + 64)
+#define MAXPEROUT (65536)
+
+/* default target time to fill a block in the adaptive mode [ms] */
+#define LATENCY (100)
+
+/*
+ * default maximum time for the input to wait in the tty
+ * before the reader takes it in a single read(2) [ms]
+ */
+#define READWAIT (20)
+
+/*
+ * the reads per block of a device above which its reads are held off,
+ * as for a serial port interrupting every few bytes, not for the bursts
+ * of a USB device, and the blocks held off before one read without it,
+ * to measure the reads per block again
+ */
+#define HOLDREADS (4)
+#define HOLDPROBE (64)
+
+/* the most input expected to wait, well within the tty input queue */
+#define READBATCH (2048)
+
+/*
+ * time to wait before reading again a device read directly
+ * which had nothing to read, a tick of the event loop wait [ms]
+ */
+#define READRETRY (1)
+
+/* number of the previous hash words chained into the next hash */
+#define CHAINWORDS (4)
+
+/* maximum number of input devices */
+#define MAXSOURCES (16)
+
+/*
+ * maximum bytes per write();
+ * trng_write() accepted up to 1024 bytes before the bulk harvest path
+ */
+#define MAXWRITESIZE (1024)
+
+/* maximum bytes per batch of the sink (-B), coalesced into a single call */
+#define MAXBATCHSIZE (65536)
+
+/* maximum number of outputs (-O) */
+#define MAXOUTPUTS (8)
+
+/* the default output device */
+#define OUTPUTFILE "/dev/trng"
+
+/* default maximum time for the output to wait in the sink [ms] */
+#define DEADLINE (50)
+
+/* default interval of writing the metrics file (-M) [s] */
+#define METRICSINTERVAL (10)
+
+/* the src of the block ending the input of a replay */
+#define NOSOURCE (UINT32_MAX)
+
+/* default and maximum number of blocks in the pipeline */
+#define QUEUEDEPTH (16)
+#define MAXQUEUEDEPTH (4096)
+
+/*
+ * the most blocks of a device held with -G until the sample is tested:
+ * the blocks of MINBUFFERSIZE bytes covering a sample, and a partial one
+ */
+#define GATEHOLD (RNDTEST_NBYTES / MINBUFFERSIZE + 2)
+
+/*
+ * A block passed between the pipeline stages;
+ * preallocated and aligned to the cache line
+ */
+struct block {
+  uint8_t *data;      /* raw tty input, maxblock bytes */
+  uint64_t *hash;     /* conditioned output, maxout rounded up to digests */
+  uint32_t len;       /* bytes in data */
+  uint32_t src;       /* index of the source */
+  uint32_t outlen;    /* bytes to write, 0 to discard */
+  const uint8_t *out; /* data or hash */
+  double credit;      /* entropy of each output byte [bits] */
+  /* when the first byte was read, the block was full and conditioned [ns] */
+  uint64_t tfirst;
+  uint64_t tfull;
+  uint64_t tcond;
+} __attribute__((aligned(CACHELINE)));
+
+/* per-stage counters, written by the stage thread only */
+struct stage_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t blocks;
+  atomic_uint_fast64_t bytes;
+  atomic_uint_fast64_t writes;
+  atomic_uint_fast64_t drops;     /* blocks failing the health tests */
+  atomic_uint_fast64_t deadlines; /* writes flushed by the deadline */
+  atomic_uint_fast64_t discards;  /* first blocks discarded */
+  atomic_uint_fast64_t reads;     /* read(2) calls of the reader */
+  atomic_uint_fast64_t enters;    /* io_uring_enter(2) calls of the reader */
+  atomic_uint_fast64_t wakeups;   /* returns from the event loop wait */
+};
+
+/* blocks stamped in a batch before it is written */
+#define BATCHBLOCKS (1024)
+
+/* the output staging buffer of the sink */
+struct batch {
+  uint8_t stage[MAXBATCHSIZE] __attribute__((aligned(CACHELINE)));
+  size_t len;
+  double bits;              /* entropy of the staged bytes */
+  struct timespec deadline; /* CLOCK_REALTIME, for sem_timedwait() */
+  /* the blocks with their last bytes in the batch, for the latency */
+  struct {
+    uint64_t tfirst;
+    uint64_t tcond;
+  } stamp[BATCHBLOCKS];
+  unsigned nstamp;
+};
+
+/*
+ * latency histograms of the blocks: from the first byte read to full,
+ * from full to conditioned, from conditioned to written, and in total
+ */
+enum { LAT_FILL, LAT_COND, LAT_WRITE, LAT_TOTAL, LAT_NHIST };
+extern const char *const lat_names[LAT_NHIST];
+
+/*
+ * per-source entropy estimates [millibits per byte]
+ * and raw bytes per 64-byte output (0 until estimated),
+ * written by the conditioner only
+ */
+struct est_stats {
+  _Alignas(CACHELINE) atomic_uint mcv;
+  atomic_uint collision;
+  atomic_uint markov;
+  atomic_uint perout;
+};
+
+/* per-source health test counters, written by the conditioner only */
+struct health_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t rctfails;
+  atomic_uint_fast64_t aptfails;
+  atomic_uint_fast64_t drops;
+};
+
+/*
+ * per-source rndtest counters as kern.rndtest.stats,
+ * written by the conditioner only
+ */
+struct rndtest_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t discard; /* bytes discarded */
+  atomic_uint_fast64_t tests;
+  atomic_uint_fast64_t monobit;
+  atomic_uint_fast64_t runs;
+  atomic_uint_fast64_t longruns;
+  atomic_uint_fast64_t chi;
+};
+
+/*
+ * An input backend (see source.c), by the prefix of the argument of -d
+ * SRC_POLL: watched by the event loop, or else read directly
+ * SRC_AVAIL: the bytes waiting are known by FIONREAD, for the hold-off
+ * SRC_EOF: the end of the input ends the run, or else is an error
+ * SRC_ASYNC: read over io_uring with -U
+ */
+#define SRC_POLL (0x01)
+#define SRC_AVAIL (0x02)
+#define SRC_EOF (0x04)
+#define SRC_ASYNC (0x08)
+
+struct source_backend {
+  const char *name;
+  int flags;
+  void (*open)(struct source *s);
+};
+
+/*
+ * An input device; each source has its own block assembly
+ * in the reader and its own hash chain in the conditioner
+ */
+struct source {
+  /* configuration */
+  char devname[MAXPATHLEN];
+  long speed;
+  int fd;
+  const struct source_backend *be; /* NULL for the replay */
+  /* reader */
+  int eof; /* the input has ended */
+  struct block *cur;
+  uint32_t fill;
+  uint32_t want;    /* size of the block being filled */
+  uint64_t last;    /* time when the previous block was full [ns] */
+  double rate;      /* estimated input rate [bytes/s] */
+  double pace;      /* estimated time per input byte [ns] */
+  uint64_t wake;    /* when to read the waiting input, 0 if not held [ns] */
+  uint64_t seen;    /* when the next block was first seen waiting [ns] */
+  size_t held;      /* the input waiting when held off */
+  uint32_t reads;   /* reads into the block being filled */
+  double frags;     /* reads per block without the hold-off, averaged */
+  uint32_t probe;   /* blocks held off before the next one read without */
+  uint64_t retry;   /* when to read a device read directly again [ns] */
+  struct stage_stats stats;
+  _Atomic uint32_t blocksize; /* for the statistics */
+  /* conditioner */
+  _Alignas(CACHELINE) int discard;
+  uint64_t hash[COND_MAXLANES][8]; /* the chain of each lane */
+  unsigned lane;                   /* of the next segment */
+  struct health health;
+  struct health_stats hstats;
+  struct rndtest gate;
+  struct rndtest_stats rstats;
+  struct block *gated[GATEHOLD]; /* held for the sample being collected */
+  unsigned ngated;
+  struct estimator est;
+  uint32_t perout; /* raw bytes per 64-byte output, 0 for -b and -c */
+  struct est_stats estats;
+};
+
+/*
+ * An output backend (see output.c), by the prefix of the argument of -O;
+ * write() takes a batch in one or two iovecs with the bits of entropy
+ * in it, and returns the bytes written
+ */
+struct output_backend {
+  const char *name;
+  void (*open)(struct output *o);
+  size_t (*write)(struct output *o, const struct iovec *iov, int n,
+                  double bits);
+};
+
+/* per-output counters, written by the sink only */
+struct output_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t calls; /* writes or ioctls */
+  atomic_uint_fast64_t bytes;
+  atomic_uint_fast64_t credits; /* entropy credited [bits] */
+};
+
+struct output {
+  char name[MAXPATHLEN];
+  const struct output_backend *be;
+  int fd;
+  double credit;             /* entropy credited per byte, or -1 [bits] */
+  struct output_pool *pool;  /* the buffer of ioctl(RNDADDENTROPY) */
+  struct output_stats stats;
+};
+
+/*
+ * The pipeline:
+ * reader -> rawq -> conditioner -> outq -> sink -> freeq -> reader
+ * The reader multiplexes all sources in a single event loop,
+ * or replays a capture of the reads of all sources.
+ * The conditioner is a single thread,
+ * so the blocks of each source are health-tested, hashed and chained
+ * in the order read.
+ * The sink batches the output of all sources into shared writes.
+ */
+struct pipeline {
+  /* configuration */
+  struct source src[MAXSOURCES];
+  int nsources;
+  int trngfd;
+  int transparent;
+  const struct conditioner *cond;
+  unsigned nlanes; /* chains per source */
+  int discard;
+  unsigned depth;
+  uint32_t blocksize; /* input bytes per block */
+  uint32_t outsize;   /* output bytes per block */
+  uint32_t minblock;  /* bounds of the block size in the adaptive mode */
+  uint32_t maxblock;
+  uint64_t latency;   /* target time to fill a block [ns], 0 if fixed size */
+  uint64_t readwait;  /* maximum hold-off of the reads [ns], 0 for none */
+  double entropy; /* claimed min-entropy of the input [bits per byte] */
+  struct health_cutoff cutoff;
+  int gate;        /* screen the input with the rndtest(4) tests (-G) */
+  uint64_t retest; /* retest interval of the gate [ns], 0 for every sample */
+  int autoratio; /* set perout from the entropy estimate */
+  size_t batchsize;  /* output bytes per write */
+  uint64_t deadline; /* maximum wait of the staged output [ns] */
+  struct output out[MAXOUTPUTS]; /* handed the batches in turn */
+  int noutputs;
+  int nextout;
+  struct trng_ring *ring; /* the mmap ring of /dev/trng (-m), or NULL */
+  uint8_t *ringdata;
+  struct capture *capture; /* the capture of the input (-W), or NULL */
+  struct capture *replay;  /* replayed instead of the ttys (-P), or NULL */
+  int fast;                /* replay as fast as possible (-F) */
+  struct uring *uring;     /* the asynchronous reads (-U), or NULL */
+  atomic_int done;         /* the sink has written the end of the input */
+  /* block pool and queues */
+  struct block *blocks;
+  uint8_t *data;
+  uint64_t *hashes;
+  struct ring freeq;
+  struct ring rawq;
+  struct ring outq;
+  /* statistics */
+  uint64_t start; /* [ns, CLOCK_MONOTONIC] */
+  struct stage_stats reader;
+  struct stage_stats conditioner;
+  struct stage_stats sink;
+  struct lat_hist lat[LAT_NHIST];
+  /* threads */
+  pthread_t tid[3];
+};
+
+/* source.c */
+extern void source_name(struct source *s, const char *arg, long speed);
+extern long source_speed(const char *arg);
+extern void source_open(struct source *s);
+
+/* output.c */
+extern void output_name(struct output *o, const char *arg);
+extern void output_fd(struct output *o, const char *name, int fd);
+extern void output_open(struct output *o);
+extern size_t output_write(struct output *o, const struct iovec *iov, int n,
+                           double bits);
+
+/* pipeline.c */
+extern uint32_t pipeline_outsize(const struct pipeline *p, uint32_t perout,
+                                 uint32_t len);
+extern void pipeline_init(struct pipeline *p);
+extern void pipeline_start(struct pipeline *p);
+extern void pipeline_stats(struct pipeline *p, FILE *fp);
+
+/* metrics.c */
+extern void metrics_write(struct pipeline *p, const char *path);
+
+/* compatibility */
+#ifdef __linux__
+#include <errno.h>
+#define getprogname() (program_invocation_short_name)
+#endif
+
+#endif /* _FEEDTRNG_H_ */
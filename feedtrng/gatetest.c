@@ -0,0 +1,165 @@
+/*
+ * Test of the rndtest(4) gate of feedtrng (-G)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Writes a capture of pseudorandom samples with a biased one in the middle,
+ * failing the monobit test but not the health tests, and not aligned
+ * to the blocks, so that it spans several blocks of each size tried;
+ * replays it through feedtrng -t -G 0, and checks that the output
+ * is exactly the blocks of the input whose samples all passed:
+ * no byte of a block going into the failing sample is written,
+ * including those read before the sample was complete.
+ *
+ * To compile (add -D_GNU_SOURCE on Linux):
+ * cc -O2 -o gatetest gatetest.c capture.c rndtest.c -lpthread
+ *
+ * Usage: gatetest [-f path-to-feedtrng]
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "rndtest.h"
+
+/* samples of the capture, the biased one, and the bytes of a record */
+#define NSAMPLES (12)
+#define BADSAMPLE (5)
+#define DATASIZE (RNDTEST_NBYTES * NSAMPLES + 300)
+#define RECORDSIZE (100)
+
+static const unsigned bsizes[] = {128, 512, 1024};
+#define NBSIZES (sizeof(bsizes) / sizeof(bsizes[0]))
+
+static const char *feedtrng = "./feedtrng";
+static uint8_t data[DATASIZE], out[DATASIZE];
+static int pass[NSAMPLES];
+
+/* xorshift64*, for reproducible test data */
+static uint64_t rng = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint8_t next(void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint8_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 56);
+}
+
+/* the capture of the data, in reads of RECORDSIZE bytes 1ms apart */
+static void make_capture(const char *path) {
+  struct capture cap;
+  size_t off;
+  int i;
+
+  for (off = 0; off < DATASIZE; off++) {
+    data[off] = next();
+    if (off / RNDTEST_NBYTES == BADSAMPLE) {
+      /* 56% ones: fails the monobit test, with 7 bits per byte */
+      data[off] |= 0x01;
+    }
+  }
+  for (i = 0; i < NSAMPLES; i++) {
+    pass[i] = (rndtest_sample(data + RNDTEST_NBYTES * i) == 0);
+  }
+  if (pass[BADSAMPLE]) {
+    errx(EX_SOFTWARE, "the biased sample passed");
+  }
+  cap_create(&cap, path);
+  cap_source(&cap, 0, "gatetest", 115200);
+  for (off = 0; off < DATASIZE; off += RECORDSIZE) {
+    cap_append(&cap, 0, data + off, MIN(RECORDSIZE, DATASIZE - off),
+               (uint64_t)(off / RECORDSIZE + 1) * 1000000);
+  }
+  cap_close(&cap);
+}
+
+/*
+ * the output expected: the full blocks within the passing samples,
+ * of the samples completed by the full blocks
+ */
+static size_t expect(unsigned bsize, uint8_t *x) {
+  size_t end = DATASIZE / bsize * bsize;
+  size_t off, len = 0, first, last, i;
+  int ok;
+
+  for (off = 0; off < end; off += bsize) {
+    first = off / RNDTEST_NBYTES;
+    last = (off + bsize - 1) / RNDTEST_NBYTES;
+    for (ok = 1, i = first; i <= last; i++) {
+      ok = ok && ((i + 1) * RNDTEST_NBYTES <= end) && pass[i];
+    }
+    if (ok) {
+      memcpy(x + len, data + off, bsize);
+      len += bsize;
+    }
+  }
+  return len;
+}
+
+/* the output of feedtrng replaying the capture */
+static size_t run(const char *path, unsigned bsize) {
+  char cmd[1024];
+  size_t len = 0, n;
+  FILE *fp;
+
+  snprintf(cmd, sizeof(cmd), "%s -P %s -F -o -t -b %u -e 1 -G 0 2>/dev/null",
+           feedtrng, path, bsize);
+  if ((fp = popen(cmd, "r")) == NULL) {
+    err(EX_OSERR, "cannot run %s", feedtrng);
+  }
+  while ((n = fread(out + len, 1, sizeof(out) - len, fp)) > 0) {
+    len += n;
+  }
+  if (pclose(fp) != 0) {
+    errx(EX_SOFTWARE, "%s failed", cmd);
+  }
+  return len;
+}
+
+int main(int argc, char **argv) {
+  static uint8_t want[DATASIZE];
+  char dir[] = "/tmp/gatetest.XXXXXX", path[64];
+  size_t i, wlen, len;
+  int ch, fails = 0;
+
+  while ((ch = getopt(argc, argv, "f:")) != -1) {
+    switch (ch) {
+    case 'f':
+      feedtrng = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-f path-to-feedtrng]", argv[0]);
+    }
+  }
+  if (mkdtemp(dir) == NULL) {
+    err(EX_CANTCREAT, "mkdtemp");
+  }
+  snprintf(path, sizeof(path), "%s/capture", dir);
+  make_capture(path);
+  for (i = 0; i < NBSIZES; i++) {
+    wlen = expect(bsizes[i], want);
+    len = run(path, bsizes[i]);
+    if ((len != wlen) || (memcmp(out, want, len) != 0)) {
+      fprintf(stderr, "gatetest: block size %u: %zu bytes, expected %zu\n",
+              bsizes[i], len, wlen);
+      fails++;
+      continue;
+    }
+    fprintf(stderr, "gatetest: block size %u: %zu of %d bytes written\n",
+            bsizes[i], len, DATASIZE);
+  }
+  unlink(path);
+  rmdir(dir);
+  if (fails > 0) {
+    errx(EX_SOFTWARE, "%d of %zu block sizes failed", fails, NBSIZES);
+  }
+  fprintf(stderr, "gatetest: passed\n");
+  return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * Feeder for /dev/trng: SP 800-90B continuous health tests
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The repetition count test (RCT) and the adaptive proportion test (APT)
+ * of NIST SP 800-90B Section 4.4, for 8-bit samples.
+ * Both tests scan the bytes with SIMD kernels:
+ * the RCT looks for the next pair of equal adjacent bytes,
+ * which is rare for a working source,
+ * and the APT counts the bytes equal to the first one of the window.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "health.h"
+
+/* index of the first x[i] == x[i - 1] from start (>= 1), or len */
+static size_t adjacent_c(const uint8_t *x, size_t start, size_t len) {
+  size_t i;
+
+  for (i = start; i < len; i++) {
+    if (x[i] == x[i - 1]) {
+      break;
+    }
+  }
+  return i;
+}
+
+/* number of bytes equal to v */
+static size_t count_c(const uint8_t *x, size_t n, uint8_t v) {
+  size_t i, c = 0;
+
+  for (i = 0; i < n; i++) {
+    c += (x[i] == v);
+  }
+  return c;
+}
+
+#if defined(__x86_64__)
+static size_t adjacent_sse2(const uint8_t *x, size_t start, size_t len) {
+  size_t i;
+  unsigned m;
+
+  for (i = start; i + 16 <= len; i += 16) {
+    m = (unsigned)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(x + i)),
+                       _mm_loadu_si128((const __m128i *)(x + i - 1))));
+    if (m != 0) {
+      return i + (size_t)__builtin_ctz(m);
+    }
+  }
+  return adjacent_c(x, i, len);
+}
+
+static size_t count_sse2(const uint8_t *x, size_t n, uint8_t v) {
+  __m128i vv = _mm_set1_epi8((char)v);
+  size_t i, c = 0;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    c += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(x + i)), vv)));
+  }
+  return c + count_c(x + i, n - i, v);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+adjacent_avx2(const uint8_t *x, size_t start, size_t len) {
+  size_t i;
+  unsigned m;
+
+  for (i = start; i + 32 <= len; i += 32) {
+    m = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(x + i)),
+                          _mm256_loadu_si256((const __m256i *)(x + i - 1))));
+    if (m != 0) {
+      return i + (size_t)__builtin_ctz(m);
+    }
+  }
+  return adjacent_c(x, i, len);
+}
+
+/* two vectors per iteration to hide the latency of popcnt */
+__attribute__((target("avx2,popcnt"))) static size_t
+count_avx2(const uint8_t *x, size_t n, uint8_t v) {
+  __m256i vv = _mm256_set1_epi8((char)v);
+  uint64_t m;
+  size_t i, c = 0;
+
+  for (i = 0; i + 64 <= n; i += 64) {
+    m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(x + i)), vv)) |
+        ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+             _mm256_loadu_si256((const __m256i *)(x + i + 32)), vv))
+         << 32);
+    c += (size_t)__builtin_popcountll(m);
+  }
+  return c + count_c(x + i, n - i, v);
+}
+
+static int health_always(void) { return 1; }
+
+static int health_has_avx2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+#endif
+
+static const struct health_kernel {
+  const char *name;
+  size_t (*adjacent)(const uint8_t *x, size_t start, size_t len);
+  size_t (*count)(const uint8_t *x, size_t n, uint8_t v);
+  int (*supported)(void);
+} health_kernels[] = {
+#if defined(__x86_64__)
+    {"avx2", adjacent_avx2, count_avx2, health_has_avx2},
+    {"sse2", adjacent_sse2, count_sse2, health_always},
+#endif
+    {"c", adjacent_c, count_c, NULL},
+};
+
+#define NKERNELS (sizeof(health_kernels) / sizeof(health_kernels[0]))
+
+static const struct health_kernel *health_current = NULL;
+
+static const struct health_kernel *health_kernel(void) {
+  size_t i;
+
+  if (health_current == NULL) {
+    for (i = 0; i < NKERNELS; i++) {
+      if ((health_kernels[i].supported == NULL) ||
+          health_kernels[i].supported()) {
+        health_current = &health_kernels[i];
+        break;
+      }
+    }
+  }
+  return health_current;
+}
+
+int health_select(const char *name) {
+  size_t i;
+
+  if ((name == NULL) || (strcmp(name, "auto") == 0)) {
+    health_current = NULL;
+    health_kernel();
+    return 0;
+  }
+  for (i = 0; i < NKERNELS; i++) {
+    if (strcmp(name, health_kernels[i].name) == 0) {
+      if ((health_kernels[i].supported != NULL) &&
+          !health_kernels[i].supported()) {
+        return -1;
+      }
+      health_current = &health_kernels[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *health_name(void) { return health_kernel()->name; }
+
+const char *health_names(void) {
+#if defined(__x86_64__)
+  return "avx2 sse2 c";
+#else
+  return "c";
+#endif
+}
+
+/*
+ * The smallest k such that P(X > k) <= 2^-HEALTH_ALPHA_LOG2
+ * for X ~ B(n, p), i.e., CRITBINOM(n, p, 1 - alpha) of SP 800-90B;
+ * the upper tail is summed from n downwards
+ */
+static uint32_t critbinom(uint32_t n, double p) {
+  double alpha = ldexp(1.0, -HEALTH_ALPHA_LOG2);
+  double tail = 0, lp = log(p), lq = log1p(-p);
+  double lnf = lgamma((double)n + 1);
+  uint32_t k;
+
+  for (k = n; k > 0; k--) {
+    tail += exp(lnf - lgamma((double)k + 1) - lgamma((double)(n - k) + 1) +
+                k * lp + (n - k) * lq);
+    if (tail > alpha) {
+      return k;
+    }
+  }
+  return 0;
+}
+
+int health_cutoffs(double entropy, struct health_cutoff *c) {
+  if (!(entropy > 0) || (entropy > 8)) {
+    return -1;
+  }
+  /* SP 800-90B 4.4.1: C = 1 + ceil(-log2(alpha) / H) */
+  c->rct = 1 + (uint32_t)ceil(HEALTH_ALPHA_LOG2 / entropy);
+  /* SP 800-90B 4.4.2: C = 1 + CRITBINOM(W, 2^-H, 1 - alpha) */
+  c->apt = 1 + critbinom(HEALTH_WINDOW, exp2(-entropy));
+  return 0;
+}
+
+void health_init(struct health *h) { memset(h, 0, sizeof(*h)); }
+
+int health_test(struct health *h, const struct health_cutoff *c,
+                const uint8_t *data, size_t len) {
+  const struct health_kernel *k = health_kernel();
+  int fail = 0;
+  size_t i, j, n;
+
+  if (len == 0) {
+    return 0;
+  }
+  /* repetition count test, continuing the run of the previous block */
+  h->run = ((h->run > 0) && (data[0] == h->last)) ? h->run + 1 : 1;
+  if (h->run >= c->rct) {
+    fail |= HEALTH_RCT;
+  }
+  for (i = 1; i < len; i = j + 1) {
+    j = k->adjacent(data, i, len);
+    if (j > i) {
+      /* data[j - 1] starts a new run */
+      h->run = 1;
+    }
+    if (j == len) {
+      break;
+    }
+    if (++h->run >= c->rct) {
+      fail |= HEALTH_RCT;
+    }
+  }
+  h->last = data[len - 1];
+
+  /* adaptive proportion test, over the windows of HEALTH_WINDOW bytes */
+  for (i = 0; i < len; i += n) {
+    if (h->pos == 0) {
+      h->first = data[i];
+      h->count = 1;
+      h->pos = 1;
+      n = 1;
+      continue;
+    }
+    n = HEALTH_WINDOW - h->pos;
+    if (n > len - i) {
+      n = len - i;
+    }
+    h->count += (uint32_t)k->count(data + i, n, h->first);
+    h->pos += (uint32_t)n;
+    if (h->pos == HEALTH_WINDOW) {
+      if (h->count >= c->apt) {
+        fail |= HEALTH_APT;
+      }
+      h->pos = 0;
+    }
+  }
+  return fail;
+}
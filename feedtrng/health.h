@@ -0,0 +1,64 @@
+/*
+ * Feeder for /dev/trng: SP 800-90B continuous health tests
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_HEALTH_H_
+#define _FEEDTRNG_HEALTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* false positive probability of each test: 2^-20 */
+#define HEALTH_ALPHA_LOG2 (20)
+
+/* window size of the adaptive proportion test for non-binary samples */
+#define HEALTH_WINDOW (512)
+
+/* default claimed min-entropy per byte [bits] */
+#define HEALTH_ENTROPY (4.0)
+
+/* failure flags returned by health_test() */
+#define HEALTH_RCT (0x01)
+#define HEALTH_APT (0x02)
+
+/* cutoff values derived from the claimed min-entropy */
+struct health_cutoff {
+  uint32_t rct; /* repetition count test */
+  uint32_t apt; /* adaptive proportion test */
+};
+
+/*
+ * Test state of a source; the tests run over the whole byte stream,
+ * continuing from one block to the next
+ */
+struct health {
+  /* repetition count test: length of the run of last */
+  uint32_t run;
+  uint8_t last;
+  /* adaptive proportion test: occurrences of first in the window */
+  uint8_t first;
+  uint32_t pos;
+  uint32_t count;
+};
+
+/*
+ * health_cutoffs() computes the cutoff values
+ * for the claimed min-entropy per byte (0 < entropy <= 8),
+ * and returns -1 when out of range.
+ * health_test() runs both tests over len bytes,
+ * and returns the failure flags.
+ * health_select() chooses the byte comparison kernel by name
+ * ("avx2", "sse2", "c" or "auto"), and returns -1
+ * when the kernel is unknown or not supported.
+ */
+extern int health_cutoffs(double entropy, struct health_cutoff *c);
+extern void health_init(struct health *h);
+extern int health_test(struct health *h, const struct health_cutoff *c,
+                       const uint8_t *data, size_t len);
+extern int health_select(const char *name);
+extern const char *health_name(void);
+extern const char *health_names(void);
+
+#endif /* _FEEDTRNG_HEALTH_H_ */
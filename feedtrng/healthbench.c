@@ -0,0 +1,261 @@
+/*
+ * Health test benchmark for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Checks that the SIMD kernels of the SP 800-90B health tests
+ * give the same results as the portable C kernel,
+ * then reports the throughput of the health tests for each kernel
+ * and block size, and their overhead relative to the SHA512 conditioner
+ * on the same block size.
+ *
+ * To compile (on amd64):
+ * cc -O2 -DSHA512_X8664 -o healthbench healthbench.c health.c sha512.c \
+ *   sha512-avx2.c sha512-x8664.S sha512-select.c sha512-api.c -lm
+ *
+ * Usage: healthbench [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "health.h"
+#include "sha512.h"
+
+/* number of the previous hash words chained, as in feedtrng */
+#define CHAINWORDS (4)
+
+static const char *kernels[] = {"c", "sse2", "avx2"};
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const uint32_t sizes[] = {128, 512, 4096, 65536};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+#define MAXSIZE (65536)
+/* bytes of test data for the self-check */
+#define CHECKSIZE (1 << 20)
+
+static double seconds = 0.5;
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift64*, for reproducible test data */
+static uint64_t rng = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint8_t next(void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint8_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 56);
+}
+
+/*
+ * random bytes with runs and biased stretches,
+ * so that both tests pass and fail
+ */
+static void fill(uint8_t *buf, size_t len) {
+  size_t i, j, n;
+  uint8_t v;
+
+  for (i = 0; i < len; i += n) {
+    n = 1 + next() % 64;
+    if (n > len - i) {
+      n = len - i;
+    }
+    switch (next() % 8) {
+    case 0: /* a run */
+      memset(buf + i, next(), n);
+      break;
+    case 1: /* a biased stretch */
+      v = next();
+      for (j = 0; j < n; j++) {
+        buf[i + j] = (next() & 1) ? v : next();
+      }
+      break;
+    default:
+      for (j = 0; j < n; j++) {
+        buf[i + j] = next();
+      }
+    }
+  }
+}
+
+/* run the tests over the data in pieces of random lengths */
+static uint64_t check_kernel(const uint8_t *data, const struct health_cutoff *c,
+                             uint64_t seed) {
+  struct health h;
+  uint64_t sum = 0;
+  size_t i, n;
+
+  health_init(&h);
+  rng = seed;
+  for (i = 0; i < CHECKSIZE; i += n) {
+    n = next() * 8 + next() % 8;
+    if (n > CHECKSIZE - i) {
+      n = CHECKSIZE - i;
+    }
+    sum = sum * 31 + (uint64_t)health_test(&h, c, data + i, n) * (i + 1);
+  }
+  return sum * 31 + h.run * 7 + h.pos * 5 + h.count * 3 + h.last + h.first;
+}
+
+static void self_check(void) {
+  struct health_cutoff c;
+  uint8_t *data;
+  uint64_t expect, got;
+  double entropy;
+  size_t i;
+
+  if ((data = malloc(CHECKSIZE)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  fill(data, CHECKSIZE);
+  for (entropy = 0.5; entropy <= 8; entropy *= 2) {
+    health_cutoffs(entropy, &c);
+    health_select("c");
+    expect = check_kernel(data, &c, 1);
+    for (i = 1; i < NKERNELS; i++) {
+      if (health_select(kernels[i]) != 0) {
+        continue;
+      }
+      if ((got = check_kernel(data, &c, 1)) != expect) {
+        errx(EX_SOFTWARE, "kernel %s mismatch at entropy %.1f", kernels[i],
+             entropy);
+      }
+    }
+  }
+  /* a stuck source fails both tests */
+  health_cutoffs(HEALTH_ENTROPY, &c);
+  for (i = 0; i < NKERNELS; i++) {
+    struct health h;
+    if (health_select(kernels[i]) != 0) {
+      continue;
+    }
+    health_init(&h);
+    memset(data, 0x55, 1024);
+    if (health_test(&h, &c, data, 1024) != (HEALTH_RCT | HEALTH_APT)) {
+      errx(EX_SOFTWARE, "kernel %s passes a stuck source", kernels[i]);
+    }
+  }
+  free(data);
+  health_select("auto");
+  fprintf(stderr, "health: self-check passed\n");
+}
+
+/* MiB/s of the health tests, or of the chained hash when kernel is NULL */
+static double run_case(const char *kernel, const uint8_t *data,
+                       uint32_t size, const struct health_cutoff *c) {
+  struct health h;
+  uint64_t hash[8] = {0};
+  uint64_t calls = 0;
+  double t0, t;
+  int i, fail = 0;
+
+  health_init(&h);
+  t0 = now();
+  do {
+    for (i = 0; i < 16; i++) {
+      if (kernel != NULL) {
+        fail |= health_test(&h, c, data, size);
+      } else {
+        sha512_hash_chain(data, size, hash, CHAINWORDS, hash);
+      }
+    }
+    calls += 16;
+    t = now() - t0;
+  } while (t < seconds);
+  if (fail || (hash[0] == 1)) {
+    fprintf(stderr, "health: (failure %d)\n", fail);
+  }
+  return (double)calls * size / t / 1048576;
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  struct health_cutoff c;
+  uint8_t *data;
+  double hashmibs, mibs;
+  FILE *out;
+  size_t i, j;
+  int ch, first = 1;
+
+  while ((ch = getopt(argc, argv, "t:o:")) != -1) {
+    switch (ch) {
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  self_check();
+
+  /* random data passing the tests */
+  if ((data = malloc(MAXSIZE)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  rng = UINT64_C(0x9E3779B97F4A7C15);
+  data[0] = next();
+  for (i = 1; i < MAXSIZE; i++) {
+    do {
+      data[i] = next();
+    } while (data[i] == data[i - 1]);
+  }
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  health_cutoffs(HEALTH_ENTROPY, &c);
+  fprintf(out,
+          "{\n  \"benchmark\": \"healthbench\",\n  \"default_kernel\": \"%s\",\n"
+          "  \"sha512_impl\": \"%s\",\n  \"entropy\": %.1f,\n"
+          "  \"rct_cutoff\": %u,\n  \"apt_cutoff\": %u,\n"
+          "  \"seconds_per_case\": %.3f,\n  \"results\": [",
+          health_name(), sha512_name(), HEALTH_ENTROPY, c.rct, c.apt, seconds);
+  for (j = 0; j < NSIZES; j++) {
+    hashmibs = run_case(NULL, data, sizes[j], &c);
+    fprintf(stderr, "sha512 %-5s %6u B: %9.1f MiB/s\n", sha512_name(),
+            sizes[j], hashmibs);
+    for (i = 0; i < NKERNELS; i++) {
+      if (health_select(kernels[i]) != 0) {
+        continue;
+      }
+      mibs = run_case(kernels[i], data, sizes[j], &c);
+      /* health test time per byte relative to hash time per byte */
+      fprintf(out,
+              "%s\n    {\"kernel\": \"%s\", \"size\": %u, \"mib_per_s\": %.2f, "
+              "\"sha512_mib_per_s\": %.2f, \"overhead\": %.4f}",
+              first ? "" : ",", kernels[i], sizes[j], mibs, hashmibs,
+              hashmibs / mibs);
+      first = 0;
+      fprintf(stderr,
+              "health %-5s %6u B: %9.1f MiB/s (%.2f%% of the hash time)\n",
+              kernels[i], sizes[j], mibs, hashmibs / mibs * 100);
+    }
+    health_select("auto");
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(data);
+  return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Benchmark of the input backends of feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Runs feedtrng -o -t on a regular file (file:), a pipe on its standard
+ * input (fd:0), a named pipe (fifo:) and a character device (hwrng:,
+ * /dev/urandom by default), each with read(2) and with io_uring (-U),
+ * reads its output from a pipe, and reports:
+ *   the throughput of the input through feedtrng,
+ *   the CPU time of feedtrng per MiB of input (from wait4(2)),
+ *   the system calls of its reader per MiB of input, from its statistics:
+ *   read(2), io_uring_enter(2), event loop waits, and their total,
+ *   the read calls of the process per MiB (syscr of /proc/<pid>/io,
+ *   null off Linux), which miss the reads done by io_uring.
+ * The file and the pipes carry the same size of pseudorandom data
+ * and end the run; the device is read for the seconds of -t.
+ * The -U cases are skipped where io_uring is not available.
+ *
+ * To compile (add -D_GNU_SOURCE on Linux):
+ * cc -O2 -o inputbench inputbench.c bench.c
+ *
+ * Usage: inputbench [-f path-to-feedtrng] [-s MiB] [-t seconds]
+ *   [-b blocksize] [-d device] [-v] [-o output.json]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define READSIZE (65536)
+
+enum kind { K_FILE, K_PIPE, K_FIFO, K_HWRNG };
+static const char *kinds[] = {"file", "fd", "fifo", "hwrng"};
+#define NKINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+static const char *feedtrng = "./feedtrng";
+static const char *device = "/dev/urandom";
+static size_t mib = 256;
+static double seconds = 3;
+static unsigned bsize = 65536;
+static int verbose = 0;
+static char dir[] = "/tmp/inputbench.XXXXXX";
+static char datafile[64], fifofile[64], errfile[64];
+
+struct result {
+  double secs;
+  uint64_t out;
+  struct bench_proc proc;
+  /* the system calls of the reader, by feedtrng, or -1 */
+  long long reads, enters, waits;
+};
+
+/* xorshift64*, for reproducible test data */
+static uint64_t rng = UINT64_C(0x9E3779B97F4A7C15);
+
+static void fill(uint8_t *x, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    x[i] = (uint8_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 56);
+  }
+}
+
+/* the data file, also written into the pipes */
+static void make_data(void) {
+  static uint8_t buf[READSIZE];
+  size_t i;
+  int fd;
+
+  if (mkdtemp(dir) == NULL) {
+    err(EX_CANTCREAT, "mkdtemp");
+  }
+  snprintf(datafile, sizeof(datafile), "%s/data", dir);
+  snprintf(fifofile, sizeof(fifofile), "%s/fifo", dir);
+  snprintf(errfile, sizeof(errfile), "%s/stderr", dir);
+  if ((fd = open(datafile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+    err(EX_CANTCREAT, "%s", datafile);
+  }
+  for (i = 0; i < mib * 1048576 / READSIZE; i++) {
+    fill(buf, sizeof(buf));
+    if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+      err(EX_IOERR, "%s", datafile);
+    }
+  }
+  close(fd);
+  if (mkfifo(fifofile, 0600) == -1) {
+    err(EX_CANTCREAT, "%s", fifofile);
+  }
+}
+
+/* copy the data file into path (a FIFO) or the descriptor fd */
+static pid_t writer(const char *path, int fd) {
+  static uint8_t buf[READSIZE];
+  ssize_t n;
+  pid_t pid;
+  int in;
+
+  if ((pid = fork()) == -1) {
+    err(EX_OSERR, "fork");
+  }
+  if (pid != 0) {
+    return pid;
+  }
+  if ((path != NULL) && ((fd = open(path, O_WRONLY)) == -1)) {
+    err(EX_IOERR, "%s", path);
+  }
+  if ((in = open(datafile, O_RDONLY)) == -1) {
+    err(EX_IOERR, "%s", datafile);
+  }
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    if (write(fd, buf, (size_t)n) != n) {
+      _exit(1);
+    }
+  }
+  _exit(0);
+}
+
+static pid_t spawn(enum kind k, int async, int infd, int outfd) {
+  char *args[16];
+  char spec[128], bstr[16];
+  int n = 0;
+
+  switch (k) {
+  case K_FILE:
+    snprintf(spec, sizeof(spec), "file:%s", datafile);
+    break;
+  case K_PIPE:
+    snprintf(spec, sizeof(spec), "fd:0");
+    break;
+  case K_FIFO:
+    snprintf(spec, sizeof(spec), "fifo:%s", fifofile);
+    break;
+  default:
+    snprintf(spec, sizeof(spec), "hwrng:%s", device);
+  }
+  snprintf(bstr, sizeof(bstr), "%u", bsize);
+  args[n++] = (char *)feedtrng;
+  args[n++] = "-d";
+  args[n++] = spec;
+  args[n++] = "-o";
+  args[n++] = "-t";
+  args[n++] = "-b";
+  args[n++] = bstr;
+  if (async) {
+    args[n++] = "-U";
+  }
+  args[n] = NULL;
+  /* the statistics, read by reader_calls() */
+  return bench_spawn(feedtrng, args, infd, outfd, errfile);
+}
+
+/*
+ * the system calls of the reader from the last statistics of feedtrng,
+ * copied to stderr with -v
+ */
+static void reader_calls(struct result *r) {
+  char line[256];
+  long long calls;
+  FILE *f;
+
+  r->reads = r->enters = r->waits = -1;
+  if ((f = fopen(errfile, "r")) == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (verbose) {
+      fputs(line, stderr);
+    }
+    (void)sscanf(line,
+                 "feedtrng: reader %lld system calls (%lld read, "
+                 "%lld io_uring_enter, %lld wait)",
+                 &calls, &r->reads, &r->enters, &r->waits);
+  }
+  fclose(f);
+}
+
+/* returns -1 when feedtrng fails, as for -U without io_uring */
+static int run_case(enum kind k, int async, struct result *r) {
+  static uint8_t buf[READSIZE];
+  int fds[2], in[2] = {-1, -1};
+  pid_t pid, wpid = -1;
+  double t0, stop;
+  ssize_t len;
+
+  memset(r, 0, sizeof(*r));
+  if (pipe(fds) == -1) {
+    err(EX_OSERR, "pipe");
+  }
+  if ((k == K_PIPE) && (pipe(in) == -1)) {
+    err(EX_OSERR, "pipe");
+  }
+  t0 = bench_now();
+  stop = t0 + seconds;
+  pid = spawn(k, async, in[0], fds[1]);
+  close(fds[1]);
+  if (k == K_PIPE) {
+    close(in[0]);
+    wpid = writer(NULL, in[1]);
+    close(in[1]);
+  } else if (k == K_FIFO) {
+    wpid = writer(fifofile, -1);
+  }
+  while ((len = read(fds[0], buf, sizeof(buf))) != 0) {
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(EX_IOERR, "read");
+    }
+    r->out += (uint64_t)len;
+    if ((k == K_HWRNG) && (bench_now() >= stop)) {
+      break;
+    }
+  }
+  r->secs = bench_now() - t0;
+  if (k == K_HWRNG) {
+    /* the statistics are written at the end of the input, or on SIGUSR1 */
+    kill(pid, SIGUSR1);
+    usleep(100000);
+    kill(pid, SIGTERM);
+  }
+  close(fds[0]);
+  (void)bench_reap(pid, &r->proc);
+  if (wpid != -1) {
+    kill(wpid, SIGTERM);
+    waitpid(wpid, NULL, 0);
+  }
+  reader_calls(r);
+  return (r->out == 0) ? -1 : 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: inputbench [-f path-to-feedtrng] [-s MiB] [-t seconds]\n"
+          "  [-b blocksize] [-d device] [-v] [-o output.json]\n");
+  exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  struct result r;
+  double m;
+  FILE *out;
+  size_t k;
+  int ch, async, first = 1;
+
+  while ((ch = getopt(argc, argv, "f:s:t:b:d:vo:")) != -1) {
+    switch (ch) {
+    case 'f':
+      feedtrng = optarg;
+      break;
+    case 's':
+      mib = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'b':
+      bsize = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      device = optarg;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((mib == 0) || (seconds <= 0) || (bsize == 0)) {
+    errx(EX_USAGE, "MiB, seconds and blocksize must be positive");
+  }
+  signal(SIGPIPE, SIG_IGN);
+  make_data();
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(out,
+          "{\n  \"benchmark\": \"inputbench\",\n  \"block_size\": %u,\n"
+          "  \"data_mib\": %zu,\n  \"device\": \"%s\",\n  \"results\": [",
+          bsize, mib, device);
+  for (k = 0; k < NKINDS; k++) {
+    for (async = 0; async <= 1; async++) {
+      if (run_case((enum kind)k, async, &r) == -1) {
+        fprintf(stderr, "%-5s %-7s failed (see -v)\n", kinds[k],
+                async ? "io_uring" : "read");
+        continue;
+      }
+      m = (double)r.out / 1048576;
+      fprintf(out,
+              "%s\n    {\"backend\": \"%s\", \"io_uring\": %s, "
+              "\"mib_per_s\": %.1f, \"cpu_ms_per_mib\": %.3f, ",
+              first ? "" : ",", kinds[k], async ? "true" : "false",
+              m / r.secs, r.proc.cpu * 1e3 / m);
+      bench_per(out, "reads_per_mib", r.reads, m, 2, ", ");
+      bench_per(out, "io_uring_enters_per_mib", r.enters, m, 2, ", ");
+      bench_per(out, "waits_per_mib", r.waits, m, 2, ", ");
+      bench_per(out, "syscalls_per_mib",
+                (r.reads >= 0) ? r.reads + r.enters + r.waits : -1, m, 2,
+                ", ");
+      bench_per(out, "proc_syscr_per_mib", r.proc.syscr, m, 2, "}");
+      first = 0;
+      fprintf(stderr,
+              "%-5s %-8s %8.1f MiB/s %7.3f ms/MiB %8.2f syscalls/MiB "
+              "(%.2f read, %.2f io_uring_enter, %.2f wait)\n",
+              kinds[k], async ? "io_uring" : "read", m / r.secs,
+              r.proc.cpu * 1e3 / m,
+              (r.reads >= 0) ? (r.reads + r.enters + r.waits) / m : 0,
+              (r.reads >= 0) ? r.reads / m : 0,
+              (r.reads >= 0) ? r.enters / m : 0,
+              (r.reads >= 0) ? r.waits / m : 0);
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  unlink(datafile);
+  unlink(fifofile);
+  unlink(errfile);
+  rmdir(dir);
+  return 0;
+}
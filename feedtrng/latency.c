@@ -0,0 +1,54 @@
+/*
+ * Feeder for /dev/trng: latency histograms of the blocks
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <stdint.h>
+
+#include "latency.h"
+
+uint64_t lat_high(unsigned bucket) {
+  unsigned e;
+
+  if (bucket < LAT_SUB) {
+    return bucket + 1;
+  }
+  if (bucket >= LAT_BUCKETS - 1) {
+    return UINT64_MAX;
+  }
+  e = bucket / LAT_SUB + LAT_SUBBITS - 1;
+  return (uint64_t)(LAT_SUB + bucket % LAT_SUB + 1) << (e - LAT_SUBBITS);
+}
+
+uint64_t lat_quantile(struct lat_hist *h, double q) {
+  uint64_t count = STAT_GET(h->count), rank, seen = 0;
+  unsigned i;
+
+  if (count == 0) {
+    return 0;
+  }
+  rank = (uint64_t)(q * (double)count);
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  for (i = 0; i < LAT_BUCKETS; i++) {
+    if ((seen += STAT_GET(h->bucket[i])) > rank) {
+      /* not beyond the largest value seen */
+      return (lat_high(i) < STAT_GET(h->max)) ? lat_high(i)
+                                              : STAT_GET(h->max);
+    }
+  }
+  /* the buckets were read while being written */
+  return STAT_GET(h->max);
+}
+
+uint64_t lat_below(struct lat_hist *h, uint64_t le) {
+  uint64_t n = 0;
+  unsigned i;
+
+  for (i = 0; (i < LAT_BUCKETS) && (lat_high(i) - 1 <= le); i++) {
+    n += STAT_GET(h->bucket[i]);
+  }
+  return n;
+}
@@ -0,0 +1,65 @@
+/*
+ * Feeder for /dev/trng: latency histograms of the blocks
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The buckets are log-linear as in HdrHistogram: LAT_SUB buckets
+ * for each power of two of nanoseconds, so that a bucket is within
+ * 1/LAT_SUB (12.5%) of its values, from 1ns up to 2^LAT_MAXEXP ns
+ * (about 18 minutes), in a fixed array of counters.
+ * A histogram is written by a single thread, without locks or
+ * atomic read-modify-write, and read by any.
+ */
+
+#ifndef _FEEDTRNG_LATENCY_H_
+#define _FEEDTRNG_LATENCY_H_
+
+#include <stdint.h>
+
+#include "ring.h"
+
+#define LAT_SUBBITS (3)
+#define LAT_SUB (1 << LAT_SUBBITS)
+#define LAT_MAXEXP (40)
+#define LAT_BUCKETS ((LAT_MAXEXP - LAT_SUBBITS + 1) * LAT_SUB)
+
+struct lat_hist {
+  _Alignas(CACHELINE) atomic_uint_fast64_t count;
+  atomic_uint_fast64_t sum; /* [ns] */
+  atomic_uint_fast64_t max; /* [ns] */
+  atomic_uint_fast64_t bucket[LAT_BUCKETS];
+};
+
+/* the bucket of a value [ns] */
+static inline unsigned lat_bucket(uint64_t v) {
+  unsigned e;
+
+  if (v < LAT_SUB) {
+    return (unsigned)v;
+  }
+  if (v >= (UINT64_C(1) << LAT_MAXEXP)) {
+    return LAT_BUCKETS - 1;
+  }
+  e = 63 - (unsigned)__builtin_clzll(v);
+  return (e - LAT_SUBBITS + 1) * LAT_SUB +
+         (unsigned)((v >> (e - LAT_SUBBITS)) & (LAT_SUB - 1));
+}
+
+/* add a value [ns], from the single writer of the histogram */
+static inline void lat_add(struct lat_hist *h, uint64_t v) {
+  STAT_ADD(h->bucket[lat_bucket(v)], 1);
+  STAT_ADD(h->count, 1);
+  STAT_ADD(h->sum, v);
+  if (v > STAT_GET(h->max)) {
+    atomic_store_explicit(&h->max, v, memory_order_relaxed);
+  }
+}
+
+/* the values of a bucket are below this [ns] */
+extern uint64_t lat_high(unsigned bucket);
+/* the value [ns] at the quantile q (0 to 1), as the bucket high */
+extern uint64_t lat_quantile(struct lat_hist *h, double q);
+/* the number of values up to le [ns], by the buckets entirely below it */
+extern uint64_t lat_below(struct lat_hist *h, uint64_t le);
+
+#endif /* _FEEDTRNG_LATENCY_H_ */
@@ -0,0 +1,306 @@
+/*
+ * Feeder for /dev/trng: the statistics in the Prometheus text format
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The file is written for the textfile collector of node_exporter,
+ * or for any scraper reading it; it is written into path.tmp first,
+ * and renamed over path, so that it is never read half written.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "feedtrng.h"
+
+/* the upper bounds of the latency buckets [ns], 1-2-5 from 100us to 10s */
+static const uint64_t metrics_le[] = {
+    100000,    200000,    500000,     1000000,    2000000,
+    5000000,   10000000,  20000000,   50000000,   100000000,
+    200000000, 500000000, 1000000000, 2000000000, 5000000000,
+    10000000000};
+#define NLE (sizeof(metrics_le) / sizeof(metrics_le[0]))
+
+static void metrics_help(FILE *fp, const char *name, const char *type,
+                         const char *help) {
+  fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_stages(FILE *fp, struct pipeline *p) {
+  metrics_help(fp, "feedtrng_blocks_total", "counter",
+               "Blocks through each stage of the pipeline.");
+  fprintf(fp,
+          "feedtrng_blocks_total{stage=\"reader\"} %" PRIuFAST64 "\n"
+          "feedtrng_blocks_total{stage=\"conditioner\"} %" PRIuFAST64 "\n"
+          "feedtrng_blocks_total{stage=\"sink\"} %" PRIuFAST64 "\n",
+          STAT_GET(p->reader.blocks), STAT_GET(p->conditioner.blocks),
+          STAT_GET(p->sink.blocks));
+  metrics_help(fp, "feedtrng_bytes_total", "counter",
+               "Bytes read, conditioned and written.");
+  fprintf(fp,
+          "feedtrng_bytes_total{stage=\"reader\"} %" PRIuFAST64 "\n"
+          "feedtrng_bytes_total{stage=\"conditioner\"} %" PRIuFAST64 "\n"
+          "feedtrng_bytes_total{stage=\"sink\"} %" PRIuFAST64 "\n",
+          STAT_GET(p->reader.bytes), STAT_GET(p->conditioner.bytes),
+          STAT_GET(p->sink.bytes));
+  metrics_help(fp, "feedtrng_stalls_total", "counter",
+               "Waits of a stage for a block from the queue before it.");
+  fprintf(fp,
+          "feedtrng_stalls_total{queue=\"free\"} %" PRIuFAST64 "\n"
+          "feedtrng_stalls_total{queue=\"raw\"} %" PRIuFAST64 "\n"
+          "feedtrng_stalls_total{queue=\"out\"} %" PRIuFAST64 "\n",
+          STAT_GET(p->freeq.stalls), STAT_GET(p->rawq.stalls),
+          STAT_GET(p->outq.stalls));
+  metrics_help(fp, "feedtrng_queue_blocks", "gauge",
+               "Blocks in each queue of the pipeline.");
+  fprintf(fp,
+          "feedtrng_queue_blocks{queue=\"free\"} %u\n"
+          "feedtrng_queue_blocks{queue=\"raw\"} %u\n"
+          "feedtrng_queue_blocks{queue=\"out\"} %u\n",
+          ring_depth(&p->freeq), ring_depth(&p->rawq), ring_depth(&p->outq));
+  metrics_help(fp, "feedtrng_discarded_blocks_total", "counter",
+               "First blocks of the devices discarded.");
+  fprintf(fp, "feedtrng_discarded_blocks_total %" PRIuFAST64 "\n",
+          STAT_GET(p->conditioner.discards));
+  metrics_help(fp, "feedtrng_reader_wakeups_total", "counter",
+               "Returns of the reader from the event loop.");
+  fprintf(fp, "feedtrng_reader_wakeups_total %" PRIuFAST64 "\n",
+          STAT_GET(p->reader.wakeups));
+  metrics_help(fp, "feedtrng_reader_syscalls_total", "counter",
+               "System calls of the reader, by the call.");
+  fprintf(fp,
+          "feedtrng_reader_syscalls_total{call=\"read\"} %" PRIuFAST64 "\n"
+          "feedtrng_reader_syscalls_total{call=\"io_uring_enter\"} %" PRIuFAST64
+          "\n"
+          "feedtrng_reader_syscalls_total{call=\"wait\"} %" PRIuFAST64 "\n",
+          STAT_GET(p->reader.reads), STAT_GET(p->reader.enters),
+          STAT_GET(p->reader.wakeups));
+  metrics_help(fp, "feedtrng_writes_total", "counter",
+               "Writes of the sink.");
+  fprintf(fp, "feedtrng_writes_total %" PRIuFAST64 "\n",
+          STAT_GET(p->sink.writes));
+  metrics_help(fp, "feedtrng_deadline_writes_total", "counter",
+               "Writes of the sink flushed by the deadline.");
+  fprintf(fp, "feedtrng_deadline_writes_total %" PRIuFAST64 "\n",
+          STAT_GET(p->sink.deadlines));
+}
+
+/* the metric name and the labels of the output i */
+static void metrics_output(FILE *fp, struct pipeline *p, const char *name,
+                           int i) {
+  fprintf(fp, "%s{index=\"%d\",output=\"%s\",kind=\"%s\"} ", name, i,
+          p->out[i].name, p->out[i].be->name);
+}
+
+/* the calls, bytes and entropy credits of each output */
+static void metrics_outputs(FILE *fp, struct pipeline *p) {
+  int i;
+
+  if (p->noutputs == 0) {
+    return;
+  }
+  metrics_help(fp, "feedtrng_output_calls_total", "counter",
+               "Writes or ioctls of the sink to each output.");
+  for (i = 0; i < p->noutputs; i++) {
+    metrics_output(fp, p, "feedtrng_output_calls_total", i);
+    fprintf(fp, "%" PRIuFAST64 "\n", STAT_GET(p->out[i].stats.calls));
+  }
+  metrics_help(fp, "feedtrng_output_bytes_total", "counter",
+               "Bytes written to each output.");
+  for (i = 0; i < p->noutputs; i++) {
+    metrics_output(fp, p, "feedtrng_output_bytes_total", i);
+    fprintf(fp, "%" PRIuFAST64 "\n", STAT_GET(p->out[i].stats.bytes));
+  }
+  metrics_help(fp, "feedtrng_output_credits_bits_total", "counter",
+               "Entropy credited with ioctl(RNDADDENTROPY).");
+  for (i = 0; i < p->noutputs; i++) {
+    metrics_output(fp, p, "feedtrng_output_credits_bits_total", i);
+    fprintf(fp, "%" PRIuFAST64 "\n", STAT_GET(p->out[i].stats.credits));
+  }
+}
+
+/* the counters of kern.rndtest.stats for each device */
+static void metrics_rndtest(FILE *fp, struct pipeline *p) {
+  static const char *tests[RNDTEST_NTESTS] = {"monobit", "runs", "longruns",
+                                              "chi"};
+  uint_fast64_t fails[RNDTEST_NTESTS];
+  struct source *s;
+  int i, j;
+
+  metrics_help(fp, "feedtrng_rndtest_tests_total", "counter",
+               "Samples of each device tested by the rndtest(4) tests.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp,
+            "feedtrng_rndtest_tests_total{device=\"%s\"} %" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->rstats.tests));
+  }
+  metrics_help(fp, "feedtrng_rndtest_failures_total", "counter",
+               "Samples of each device failing each rndtest(4) test.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fails[0] = STAT_GET(s->rstats.monobit);
+    fails[1] = STAT_GET(s->rstats.runs);
+    fails[2] = STAT_GET(s->rstats.longruns);
+    fails[3] = STAT_GET(s->rstats.chi);
+    for (j = 0; j < RNDTEST_NTESTS; j++) {
+      fprintf(fp,
+              "feedtrng_rndtest_failures_total{device=\"%s\",test=\"%s\"} "
+              "%" PRIuFAST64 "\n",
+              s->devname, tests[j], fails[j]);
+    }
+  }
+  metrics_help(fp, "feedtrng_rndtest_discarded_bytes_total", "counter",
+               "Bytes of each device discarded by the rndtest(4) tests.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp,
+            "feedtrng_rndtest_discarded_bytes_total{device=\"%s\"} "
+            "%" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->rstats.discard));
+  }
+}
+
+static void metrics_sources(FILE *fp, struct pipeline *p) {
+  struct source *s;
+  int i;
+
+  metrics_help(fp, "feedtrng_source_bytes_total", "counter",
+               "Bytes read from each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp, "feedtrng_source_bytes_total{device=\"%s\"} %" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->stats.bytes));
+  }
+  metrics_help(fp, "feedtrng_source_blocks_total", "counter",
+               "Blocks filled from each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp,
+            "feedtrng_source_blocks_total{device=\"%s\"} %" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->stats.blocks));
+  }
+  metrics_help(fp, "feedtrng_source_reads_total", "counter",
+               "Reads from each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp, "feedtrng_source_reads_total{device=\"%s\"} %" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->stats.reads));
+  }
+  metrics_help(fp, "feedtrng_source_block_size_bytes", "gauge",
+               "The current block size of each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp, "feedtrng_source_block_size_bytes{device=\"%s\"} %u\n",
+            s->devname, (unsigned)STAT_GET(s->blocksize));
+  }
+  metrics_help(fp, "feedtrng_health_failures_total", "counter",
+               "SP 800-90B health test failures of each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp,
+            "feedtrng_health_failures_total{device=\"%s\",test=\"rct\"} "
+            "%" PRIuFAST64 "\n"
+            "feedtrng_health_failures_total{device=\"%s\",test=\"apt\"} "
+            "%" PRIuFAST64 "\n",
+            s->devname, STAT_GET(s->hstats.rctfails), s->devname,
+            STAT_GET(s->hstats.aptfails));
+  }
+  metrics_help(fp, "feedtrng_source_dropped_blocks_total", "counter",
+               "Blocks of each device dropped by the health tests.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    fprintf(fp,
+            "feedtrng_source_dropped_blocks_total{device=\"%s\"} %" PRIuFAST64
+            "\n",
+            s->devname, STAT_GET(s->hstats.drops));
+  }
+  if (p->gate) {
+    metrics_rndtest(fp, p);
+  }
+  metrics_help(fp, "feedtrng_source_entropy_bits", "gauge",
+               "The min-entropy estimate per byte of each device.");
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    if ((STAT_GET(s->estats.mcv) | STAT_GET(s->estats.collision) |
+         STAT_GET(s->estats.markov)) == 0) {
+      /* not yet estimated */
+      continue;
+    }
+    fprintf(fp,
+            "feedtrng_source_entropy_bits{device=\"%s\",estimator=\"mcv\"} "
+            "%.3f\n"
+            "feedtrng_source_entropy_bits{device=\"%s\","
+            "estimator=\"collision\"} %.3f\n"
+            "feedtrng_source_entropy_bits{device=\"%s\",estimator=\"markov\"} "
+            "%.3f\n",
+            s->devname, STAT_GET(s->estats.mcv) / 1000.0, s->devname,
+            STAT_GET(s->estats.collision) / 1000.0, s->devname,
+            STAT_GET(s->estats.markov) / 1000.0);
+  }
+}
+
+static void metrics_latency(FILE *fp, struct pipeline *p) {
+  struct lat_hist *h;
+  unsigned j;
+  int i;
+
+  metrics_help(fp, "feedtrng_block_latency_seconds", "histogram",
+               "Latency of the blocks: fill from the first byte read, "
+               "condition, write, and total from the first byte read "
+               "to the write.");
+  for (i = 0; i < LAT_NHIST; i++) {
+    h = &p->lat[i];
+    for (j = 0; j < NLE; j++) {
+      fprintf(fp,
+              "feedtrng_block_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} "
+              "%ju\n",
+              lat_names[i], metrics_le[j] / 1e9,
+              (uintmax_t)lat_below(h, metrics_le[j]));
+    }
+    fprintf(fp,
+            "feedtrng_block_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} "
+            "%" PRIuFAST64 "\n"
+            "feedtrng_block_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+            "feedtrng_block_latency_seconds_count{stage=\"%s\"} %" PRIuFAST64
+            "\n",
+            lat_names[i], STAT_GET(h->count), lat_names[i],
+            STAT_GET(h->sum) / 1e9, lat_names[i], STAT_GET(h->count));
+  }
+}
+
+/*
+ * write the statistics into path; a failure is warned of,
+ * and feedtrng goes on feeding
+ */
+void metrics_write(struct pipeline *p, const char *path) {
+  char tmp[PATH_MAX];
+  FILE *fp;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+    warnx("metrics file name %s too long", path);
+    return;
+  }
+  if ((fp = fopen(tmp, "w")) == NULL) {
+    warn("cannot open %s", tmp);
+    return;
+  }
+  metrics_stages(fp, p);
+  metrics_outputs(fp, p);
+  metrics_sources(fp, p);
+  metrics_latency(fp, p);
+  if (fclose(fp) != 0) {
+    warn("cannot write %s", tmp);
+    unlink(tmp);
+    return;
+  }
+  if (rename(tmp, path) != 0) {
+    warn("cannot rename %s to %s", tmp, path);
+    unlink(tmp);
+  }
+}
@@ -0,0 +1,265 @@
+/*
+ * Feeder for /dev/trng: output sinks
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The backends of the output, by the prefix of the argument of -O:
+ * trng: /dev/trng, the default;
+ * stdout: the standard output, as -o;
+ * file:path: a file, appended to;
+ * socket:path: a Unix domain stream socket, connected to;
+ * random[:bits]: the input pool of Linux with ioctl(RNDADDENTROPY),
+ * crediting bits of entropy per byte, or else the entropy of the batch
+ * as conditioned;
+ * mock[:bits]: counts the ioctl(RNDADDENTROPY) calls without making them,
+ * for benchmarking the sink without privileges.
+ * The sink hands each batch to a single output, in turn.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/random.h>
+#endif
+
+#include "feedtrng.h"
+
+/* the pool of Linux accepting the output of -O random */
+#define RANDOMFILE "/dev/random"
+
+/* as struct rand_pool_info of linux/random.h */
+struct output_pool {
+  int entropy_count; /* [bits] */
+  int buf_size;      /* [bytes] */
+  uint32_t buf[];
+};
+
+static void trng_open(struct output *o);
+static void stdout_open(struct output *o);
+static void file_open(struct output *o);
+static void socket_open(struct output *o);
+static void random_open(struct output *o);
+static void mock_open(struct output *o);
+static size_t fd_write(struct output *o, const struct iovec *iov, int n,
+                       double bits);
+static size_t pool_write(struct output *o, const struct iovec *iov, int n,
+                         double bits);
+
+static const struct output_backend output_backends[] = {
+    {"trng", trng_open, fd_write},     {"stdout", stdout_open, fd_write},
+    {"file", file_open, fd_write},     {"socket", socket_open, fd_write},
+    {"random", random_open, pool_write}, {"mock", mock_open, pool_write},
+};
+
+/* the output of -S, writing into the pipe to the server */
+static size_t server_write(struct output *o, const struct iovec *iov, int n,
+                           double bits);
+static const struct output_backend output_server = {"server", NULL,
+                                                    server_write};
+
+#define NBACKENDS (sizeof(output_backends) / sizeof(output_backends[0]))
+
+/* parse the entropy credit of random: and mock: [bits per byte] */
+static double output_credit(const char *arg) {
+  char *end;
+  double bits;
+
+  errno = 0;
+  bits = strtod(arg, &end);
+  if ((errno > 0) || (*end != '\0') || (end == arg) || !(bits >= 0) ||
+      (bits > 8)) {
+    errx(EX_USAGE, "illegal entropy credit %s (0 to 8 bits per byte)", arg);
+  }
+  return bits;
+}
+
+/*
+ * Set the backend and the name of an output from the argument of -O:
+ * trng, stdout, file:path, socket:path, random[:bits] or mock[:bits];
+ * the credit is left negative when not given, for the entropy of the batch
+ */
+void output_name(struct output *o, const char *arg) {
+  const struct output_backend *be = NULL;
+  const char *rest = NULL;
+  size_t i, n;
+
+  for (i = 0; i < NBACKENDS; i++) {
+    n = strlen(output_backends[i].name);
+    if ((strncmp(arg, output_backends[i].name, n) == 0) &&
+        ((arg[n] == '\0') || (arg[n] == ':'))) {
+      be = &output_backends[i];
+      rest = (arg[n] == ':') ? arg + n + 1 : NULL;
+      break;
+    }
+  }
+  if (be == NULL) {
+    errx(EX_USAGE, "unknown output %s", arg);
+  }
+  o->be = be;
+  o->fd = -1;
+  o->credit = -1;
+  if ((be->open == file_open) || (be->open == socket_open)) {
+    if ((rest == NULL) || (*rest == '\0')) {
+      errx(EX_USAGE, "no path in %s", arg);
+    }
+    if (snprintf(o->name, sizeof(o->name), "%s", rest) >=
+        (int)sizeof(o->name)) {
+      errx(EX_USAGE, "output name too long");
+    }
+    return;
+  }
+  if ((be->write == pool_write) && (rest != NULL)) {
+    o->credit = output_credit(rest);
+  } else if (rest != NULL) {
+    errx(EX_USAGE, "no argument for %s", be->name);
+  }
+  snprintf(o->name, sizeof(o->name), "%s",
+           (be->open == trng_open)     ? OUTPUTFILE
+           : (be->open == random_open) ? RANDOMFILE
+                                       : be->name);
+}
+
+/* an output writing into an open descriptor, as the pipe of -S */
+void output_fd(struct output *o, const char *name, int fd) {
+  o->be = &output_server;
+  o->fd = fd;
+  o->credit = -1;
+  snprintf(o->name, sizeof(o->name), "%s", name);
+}
+
+void output_open(struct output *o) {
+#ifdef DEBUG
+  fprintf(stderr, "feedtrng: output: %s (%s)\n", o->name, o->be->name);
+  fflush(stderr);
+#endif
+  if (o->be->open != NULL) {
+    o->be->open(o);
+  }
+}
+
+/* write a batch of the iovecs holding bits of entropy, and count it */
+size_t output_write(struct output *o, const struct iovec *iov, int n,
+                    double bits) {
+  size_t len = o->be->write(o, iov, n, bits);
+
+  STAT_ADD(o->stats.calls, 1);
+  STAT_ADD(o->stats.bytes, len);
+  return len;
+}
+
+static void trng_open(struct output *o) {
+  if ((o->fd = open(OUTPUTFILE, O_WRONLY)) == -1) {
+    errx(EX_IOERR, "cannot open %s", OUTPUTFILE);
+  }
+}
+
+static void stdout_open(struct output *o) {
+  if ((o->fd = fcntl(STDOUT_FILENO, F_DUPFD, 0)) == -1) {
+    err(EX_IOERR, "cannot open stdout");
+  }
+}
+
+static void file_open(struct output *o) {
+  if ((o->fd = open(o->name, O_WRONLY | O_CREAT | O_APPEND, 0600)) == -1) {
+    err(EX_CANTCREAT, "cannot open %s", o->name);
+  }
+}
+
+static void socket_open(struct output *o) {
+  struct sockaddr_un sun;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if (strlen(o->name) >= sizeof(sun.sun_path)) {
+    errx(EX_USAGE, "socket path too long: %s", o->name);
+  }
+  strcpy(sun.sun_path, o->name);
+  if ((o->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    err(EX_OSERR, "socket");
+  }
+  if (connect(o->fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+    err(EX_UNAVAILABLE, "cannot connect to %s", o->name);
+  }
+}
+
+/* the buffer of the ioctl, for the largest batch */
+static void pool_alloc(struct output *o) {
+  if ((o->pool = malloc(sizeof(struct output_pool) + MAXBATCHSIZE)) == NULL) {
+    err(EX_OSERR, "cannot allocate the pool buffer of %s", o->name);
+  }
+}
+
+static void random_open(struct output *o) {
+#ifdef RNDADDENTROPY
+  if ((o->fd = open(RANDOMFILE, O_WRONLY)) == -1) {
+    err(EX_IOERR, "cannot open %s", RANDOMFILE);
+  }
+  pool_alloc(o);
+#else
+  errx(EX_UNAVAILABLE, "ioctl(RNDADDENTROPY) is only on Linux");
+#endif
+}
+
+static void mock_open(struct output *o) { pool_alloc(o); }
+
+/* write(2) or writev(2) the batch */
+static size_t fd_write(struct output *o, const struct iovec *iov, int n,
+                       double bits) {
+  ssize_t wsize;
+
+  (void)bits;
+  if ((wsize = (n == 1) ? write(o->fd, iov[0].iov_base, iov[0].iov_len)
+                        : writev(o->fd, iov, n)) == -1) {
+    err(EX_IOERR, "write to %s failed", o->name);
+  }
+  return (size_t)wsize;
+}
+
+/* write the batch into the pipe, counting its bits for the server */
+static size_t server_write(struct output *o, const struct iovec *iov, int n,
+                           double bits) {
+  size_t len = fd_write(o, iov, n, bits);
+
+  STAT_ADD(o->stats.credits, (uint64_t)MIN(bits, len * 8.0));
+  return len;
+}
+
+/*
+ * pack the batch into a single ioctl(RNDADDENTROPY),
+ * crediting o->credit bits per byte, or the bits of the batch;
+ * the mock stops short of the call
+ */
+static size_t pool_write(struct output *o, const struct iovec *iov, int n,
+                         double bits) {
+  struct output_pool *pool = o->pool;
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    memcpy((uint8_t *)pool->buf + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  pool->buf_size = (int)len;
+  pool->entropy_count =
+      (int)((o->credit >= 0) ? (double)len * o->credit : MIN(bits, len * 8.0));
+#ifdef RNDADDENTROPY
+  if ((o->fd != -1) && (ioctl(o->fd, RNDADDENTROPY, pool) == -1)) {
+    err(EX_IOERR, "ioctl(RNDADDENTROPY) on %s failed", o->name);
+  }
+#endif
+  STAT_ADD(o->stats.credits, (uint64_t)pool->entropy_count);
+  return len;
+}
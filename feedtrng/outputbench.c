@@ -0,0 +1,226 @@
+/*
+ * Benchmark of the output sinks of feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Writes batches of each size through the outputs of -O:
+ * mock (the packing of ioctl(RNDADDENTROPY) without the call),
+ * file:/dev/null, socket: (a Unix domain socket drained by a thread),
+ * and random:0 (the input pool of Linux, when run as root on Linux,
+ * crediting no entropy for the fixed pattern written),
+ * each batch in two iovecs as the sink passes the staged bytes
+ * and the rest of a block, after checking that the mock credits
+ * the entropy of the batch, up to 8 bits per byte, or the bits per byte
+ * of mock:bits, and reports for each output and batch size
+ * the throughput, the calls per MiB, and the CPU time per call.
+ *
+ * To compile (add -D_GNU_SOURCE on Linux):
+ * cc -O2 -I../trng -o outputbench outputbench.c output.c -lpthread
+ *
+ * Usage: outputbench [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "feedtrng.h"
+
+static const size_t sizes[] = {64, 1024, 16384, MAXBATCHSIZE};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static double seconds = 0.5;
+static uint8_t data[MAXBATCHSIZE];
+static char sockdir[] = "/tmp/outputbench.XXXXXX";
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cputime(void) {
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+/* the reader of the socket, discarding all */
+static void *drain(void *arg) {
+  static uint8_t buf[MAXBATCHSIZE];
+  int fd;
+
+  if ((fd = accept(*(int *)arg, NULL, NULL)) == -1) {
+    err(EX_OSERR, "accept");
+  }
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  return NULL;
+}
+
+/* listen on a socket in a temporary directory, and drain it */
+static void listener(char *path, size_t size, pthread_t *tid) {
+  static int lfd;
+  struct sockaddr_un sun;
+
+  if (mkdtemp(sockdir) == NULL) {
+    err(EX_CANTCREAT, "mkdtemp");
+  }
+  snprintf(path, size, "socket:%s/sock", sockdir);
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/sock", sockdir);
+  if (((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) ||
+      (bind(lfd, (struct sockaddr *)&sun, sizeof(sun)) == -1) ||
+      (listen(lfd, 1) == -1)) {
+    err(EX_OSERR, "%s", sun.sun_path);
+  }
+  if (pthread_create(tid, NULL, drain, &lfd) != 0) {
+    errx(EX_OSERR, "pthread_create");
+  }
+}
+
+static void run_case(struct output *o, size_t size, double *mibs,
+                     double *cpu_us) {
+  struct iovec iov[2];
+  uint64_t calls0 = STAT_GET(o->stats.calls);
+  uint64_t bytes0 = STAT_GET(o->stats.bytes);
+  double t0, c0, t;
+
+  iov[0].iov_base = data;
+  iov[0].iov_len = size / 2;
+  iov[1].iov_base = data + size / 2;
+  iov[1].iov_len = size - size / 2;
+  t0 = now();
+  c0 = cputime();
+  do {
+    /* the pattern is known: no entropy in it */
+    output_write(o, iov, 2, 0);
+  } while ((t = now() - t0) < seconds);
+  *mibs = (double)(STAT_GET(o->stats.bytes) - bytes0) / t / 1048576;
+  *cpu_us = (cputime() - c0) * 1e6 / (STAT_GET(o->stats.calls) - calls0);
+}
+
+/* the entropy credited by the mock for a batch of size bytes with bits */
+static uint64_t credited(struct output *o, size_t size, double bits) {
+  uint64_t credits0 = STAT_GET(o->stats.credits);
+  struct iovec iov;
+
+  iov.iov_base = data;
+  iov.iov_len = size;
+  output_write(o, &iov, 1, bits);
+  return STAT_GET(o->stats.credits) - credits0;
+}
+
+/*
+ * the mock credits the entropy of the batch, as the sink counts it
+ * for -e 4 with -b 512 -c 512, or for -e 6 with -b 512 -c 64 (up to 8),
+ * none from blake2b, or the bits per byte of mock:bits whatever the batch
+ */
+static void check_credit(void) {
+  static struct output o, fixed;
+
+  output_name(&o, "mock");
+  output_name(&fixed, "mock:2");
+  output_open(&o);
+  output_open(&fixed);
+  if ((credited(&o, 4096, 4096 * 4.0) != 4096 * 4) ||
+      (credited(&o, 4096, 4096 * MIN(8, 6.0 * 512 / 64)) != 4096 * 8) ||
+      (credited(&o, 4096, 0) != 0) ||
+      (credited(&fixed, 4096, 4096 * 8.0) != 4096 * 2)) {
+    errx(EX_SOFTWARE, "mock entropy credit mismatch");
+  }
+  free(o.pool);
+  free(fixed.pool);
+  fprintf(stderr, "outputbench: entropy credit check passed\n");
+}
+
+int main(int argc, char **argv) {
+  static struct output out[4];
+  const char *outname = NULL;
+  char sockarg[MAXPATHLEN];
+  pthread_t tid;
+  double mibs, cpu_us;
+  int ch, i, sock, nout = 0, first = 1;
+  size_t j;
+  FILE *fp;
+
+  while ((ch = getopt(argc, argv, "t:o:")) != -1) {
+    switch (ch) {
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  for (j = 0; j < sizeof(data); j++) {
+    data[j] = (uint8_t)(j * 0x9E + (j >> 8));
+  }
+  check_credit();
+  output_name(&out[nout++], "mock");
+  output_name(&out[nout++], "file:/dev/null");
+  listener(sockarg, sizeof(sockarg), &tid);
+  sock = nout;
+  output_name(&out[nout++], sockarg);
+#ifdef __linux__
+  if (geteuid() == 0) {
+    output_name(&out[nout++], "random:0");
+  }
+#endif
+  for (i = 0; i < nout; i++) {
+    output_open(&out[i]);
+  }
+  fp = stdout;
+  if ((outname != NULL) && ((fp = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(fp,
+          "{\n  \"benchmark\": \"outputbench\",\n"
+          "  \"seconds_per_case\": %.3f,\n  \"results\": [",
+          seconds);
+  for (i = 0; i < nout; i++) {
+    for (j = 0; j < NSIZES; j++) {
+      run_case(&out[i], sizes[j], &mibs, &cpu_us);
+      fprintf(fp,
+              "%s\n    {\"output\": \"%s\", \"batch_bytes\": %zu, "
+              "\"mib_per_s\": %.1f, \"calls_per_mib\": %.2f, "
+              "\"cpu_us_per_call\": %.3f}",
+              first ? "" : ",", out[i].be->name, sizes[j], mibs,
+              1048576.0 / sizes[j], cpu_us);
+      first = 0;
+      fprintf(stderr,
+              "%-6s %6zu bytes: %9.1f MiB/s %9.2f calls/MiB %8.3f us/call\n",
+              out[i].be->name, sizes[j], mibs, 1048576.0 / sizes[j], cpu_us);
+    }
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  if (fp != stdout) {
+    fclose(fp);
+  }
+  close(out[sock].fd);
+  pthread_join(tid, NULL);
+  unlink(out[sock].name);
+  rmdir(sockdir);
+  return 0;
+}
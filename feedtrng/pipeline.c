@@ -0,0 +1,1180 @@
+/*
+ * Feeder for /dev/trng: reader, conditioner and sink threads
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "conditioner.h"
+#include "event.h"
+#include "feedtrng.h"
+#include "sha512.h"
+#include "trng_ring.h"
+#include "uring.h"
+
+const char *const lat_names[LAT_NHIST] = {"fill", "condition", "write",
+                                          "total"};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * output bytes for a block of len bytes,
+ * a 64-byte output per whole perout raw bytes (none for a shorter block),
+ * or keeping the compression ratio of -b and -c when perout is 0
+ */
+uint32_t pipeline_outsize(const struct pipeline *p, uint32_t perout,
+                          uint32_t len) {
+  uint64_t out;
+
+  if (perout != 0) {
+    return len / perout * SHA512_DIGEST_LENGTH;
+  }
+  out = (uint64_t)len * p->outsize / p->blocksize;
+  return (out > 0) ? (uint32_t)out : 1;
+}
+
+/* the time of the reads replayed, as CLOCK_MONOTONIC never gives 0 */
+#define REPLAY_EPOCH (UINT64_C(1000000000))
+
+/*
+ * adaptive mode: choose the size of the next block
+ * from the input rate of the source,
+ * so that it is filled in the target latency
+ */
+static void reader_adapt(struct pipeline *p, struct source *s) {
+  double size = s->rate * (double)p->latency / 1e9;
+
+  if (size < p->minblock) {
+    size = p->minblock;
+  } else if (size > p->maxblock) {
+    size = p->maxblock;
+  }
+  /* round down to the SHA512 block length */
+  s->want = (uint32_t)size & ~(uint32_t)(SHA512_BLOCK_LENGTH - 1);
+  if (s->want < p->minblock) {
+    s->want = p->minblock;
+  }
+  atomic_store_explicit(&s->blocksize, s->want, memory_order_relaxed);
+}
+
+/* the block being filled for the source */
+static struct block *reader_block(struct pipeline *p, struct source *s) {
+  if (s->cur == NULL) {
+    /* stalls here when all blocks are in flight */
+    s->cur = ring_pop(&p->freeq);
+    s->fill = 0;
+  }
+  return s->cur;
+}
+
+/*
+ * the reads of the source are held off: only when it takes more than
+ * HOLDREADS reads per block without, but for a block every HOLDPROBE
+ */
+static int reader_holding(const struct source *s) {
+  return (s->frags > HOLDREADS) && (s->probe > 0);
+}
+
+/* add rsize bytes read at t [ns] to the block, and pass it on when full */
+static void reader_add(struct pipeline *p, struct source *s, uint32_t rsize,
+                       uint64_t t) {
+  struct block *b = s->cur;
+  /* the latency is of the replay, not of the reads replayed */
+  uint64_t now = (p->replay != NULL) ? now_ns() : t;
+  double rate, pace;
+
+  if (s->fill == 0) {
+    /* from when the input was first seen waiting in the tty, if held off */
+    b->tfirst = ((s->seen != 0) && (s->seen < now)) ? s->seen : now;
+    s->seen = 0;
+  }
+  /* add the number of bytes read */
+  s->fill += rsize;
+  STAT_ADD(s->stats.bytes, rsize);
+  if (s->fill < s->want) {
+    return;
+  }
+  /* the block is full */
+  b->tfull = now;
+  lat_add(&p->lat[LAT_FILL], now - b->tfirst);
+  b->len = s->want;
+  b->src = (uint32_t)(s - p->src);
+  s->cur = NULL;
+  STAT_ADD(s->stats.blocks, 1);
+  STAT_ADD(p->reader.blocks, 1);
+  STAT_ADD(p->reader.bytes, b->len);
+  ring_push(&p->rawq, b);
+  if (reader_holding(s)) {
+    s->probe--;
+  } else {
+    /* the reads per block of the device, measured without the hold-off */
+    s->frags = (s->frags == 0) ? s->reads
+                               : s->frags + (s->reads - s->frags) / 4;
+    s->probe = HOLDPROBE;
+  }
+  s->reads = 0;
+  /* estimate the input rate from the time between the full blocks */
+  if ((s->last != 0) && (t > s->last)) {
+    rate = (double)b->len * 1e9 / (double)(t - s->last);
+    /* exponentially weighted moving average, 1/4 for the new value */
+    s->rate = (s->rate == 0) ? rate : s->rate + (rate - s->rate) / 4;
+    /* the same for the time per byte, not thrown off by bursts */
+    pace = (double)(t - s->last) / (double)b->len;
+    s->pace = (s->pace == 0) ? pace : s->pace + (pace - s->pace) / 4;
+    if (p->latency != 0) {
+      reader_adapt(p, s);
+    }
+  }
+  s->last = t;
+}
+
+/* count a read of rsize bytes at t into the block, and add them */
+static void reader_got(struct pipeline *p, struct source *s, size_t rsize,
+                       uint64_t t) {
+  STAT_ADD(s->stats.reads, 1);
+  s->reads++;
+  if (p->capture != NULL) {
+    cap_append(p->capture, (unsigned)(s - p->src), s->cur->data + s->fill,
+               rsize, t);
+  }
+  reader_add(p, s, (uint32_t)rsize, t);
+}
+
+/* the input of the source has ended, which is an error for a device */
+static void reader_end(struct source *s) {
+  if (!(s->be->flags & SRC_EOF)) {
+    errx(EX_IOERR, "end of input from %s", s->devname);
+  }
+  s->eof = 1;
+#ifdef DEBUG
+  fprintf(stderr, "feedtrng: %s: end of input\n", s->devname);
+  fflush(stderr);
+#endif
+}
+
+/* the input waiting in the tty or the pipe */
+static size_t reader_avail(struct source *s) {
+  int n = 0;
+
+  if (ioctl(s->fd, FIONREAD, &n) == -1) {
+    err(EX_IOERR, "ioctl(FIONREAD) on %s failed", s->devname);
+  }
+  return (n > 0) ? (size_t)n : 0;
+}
+
+/* the input to take in with a read: the rest of the block, up to READBATCH */
+static size_t reader_need(struct source *s) {
+  return MIN((s->cur == NULL) ? s->want : s->want - s->fill, READBATCH);
+}
+
+/*
+ * read avail bytes waiting in the tty into the blocks,
+ * leaving a part short of the next block in the tty for a later read,
+ * or with avail 0, up to the rest of the block in a single read(2),
+ * which also reports the end of the input in s->eof;
+ * returns the bytes left in the tty
+ */
+static size_t reader_read(struct pipeline *p, struct source *s,
+                          size_t avail) {
+  struct block *b;
+  ssize_t rsize;
+  size_t len;
+  uint64_t t;
+
+  do {
+    b = reader_block(p, s);
+    len = s->want - s->fill;
+    if (avail > 0) {
+      len = MIN(len, avail);
+    }
+    /* try reading from the source */
+    STAT_ADD(p->reader.reads, 1);
+    if ((rsize = read(s->fd, b->data + s->fill, len)) == -1) {
+      if (errno != EAGAIN) {
+        err(EX_IOERR, "read from %s failed", s->devname);
+      }
+      /* a device with nothing to read: tried again at the next tick */
+      s->retry = now_ns() + READRETRY * 1000000;
+      return 0;
+    }
+    s->retry = 0;
+#ifdef DEBUG
+    fprintf(stderr, "feedtrng: %s: rsize %d after read\n", s->devname,
+            (int)rsize);
+    fflush(stderr);
+#endif
+    if (rsize == 0) {
+      reader_end(s);
+      return 0;
+    }
+    t = now_ns();
+    reader_got(p, s, (size_t)rsize, t);
+    avail -= MIN(avail, (size_t)rsize);
+  } while ((avail > 0) && (avail >= reader_need(s)));
+  /* the input left starts the next block */
+  s->seen = ((avail > 0) && (s->cur == NULL)) ? t : 0;
+  return avail;
+}
+
+/* watch the source for the next input */
+static void reader_watch(int evl, struct source *s) {
+  s->wake = 0;
+  if (evl_set(evl, s->fd, EVL_READ | EVL_ONESHOT, EVL_READ | EVL_ONESHOT, s) ==
+      -1) {
+    err(EX_OSERR, "cannot watch %s", s->devname);
+  }
+}
+
+/*
+ * with avail bytes waiting in the tty at t, hold off the read
+ * until the rest of the block (or READBATCH bytes) has arrived
+ * at the input rate, checking at least every p->readwait,
+ * when the source is held off at all (see reader_holding());
+ * returns 0 to read now instead, also when the wait would be well short
+ * of the millisecond of the event loop wait
+ */
+static int reader_hold(struct pipeline *p, struct source *s, size_t avail,
+                       uint64_t t) {
+  size_t need = reader_need(s);
+  double wait;
+
+  if ((s->pace == 0) || (avail >= need) || !reader_holding(s)) {
+    return 0;
+  }
+  wait = (double)(need - avail) * s->pace;
+  if (wait > (double)p->readwait) {
+    wait = (double)p->readwait;
+  }
+  if (wait < 5e5) {
+    return 0;
+  }
+  s->wake = t + MAX((uint64_t)wait, 1000000);
+  s->held = avail;
+  return 1;
+}
+
+/* stop watching a source at the end of its input */
+static void reader_close(int evl, struct source *s, int flags) {
+  s->wake = 0;
+  if (evl_set(evl, s->fd, flags, 0, s) == -1) {
+    err(EX_OSERR, "cannot unwatch %s", s->devname);
+  }
+}
+
+/* after a read at t leaving left bytes, hold off the next one, or watch */
+static void reader_next(struct pipeline *p, int evl, struct source *s,
+                        size_t left, uint64_t t) {
+  if (s->eof) {
+    reader_close(evl, s, EVL_READ | EVL_ONESHOT);
+  } else if (!reader_hold(p, s, left, t)) {
+    reader_watch(evl, s);
+  }
+}
+
+/* the source is read over io_uring (-U) */
+static int reader_async(const struct pipeline *p, const struct source *s) {
+  return (p->uring != NULL) && (s->be->flags & SRC_ASYNC);
+}
+
+/* queue a read of the rest of the block */
+static void reader_submit(struct pipeline *p, struct source *s) {
+  struct block *b = reader_block(p, s);
+
+  if (uring_read(p->uring, s->fd, b->data + s->fill, s->want - s->fill, s) ==
+      -1) {
+    errx(EX_SOFTWARE, "io_uring queue full");
+  }
+}
+
+/* add the reads completed over io_uring, and queue the next ones */
+static void reader_reap(struct pipeline *p) {
+  struct source *s;
+  void *udata;
+  int res, n;
+
+  while (uring_reap(p->uring, &udata, &res)) {
+    s = udata;
+    if (res < 0) {
+      errno = -res;
+      err(EX_IOERR, "read from %s failed", s->devname);
+    }
+    if (res == 0) {
+      reader_end(s);
+      continue;
+    }
+    reader_got(p, s, (size_t)res, now_ns());
+    reader_submit(p, s);
+  }
+  if ((n = uring_submit(p->uring)) == -1) {
+    err(EX_OSERR, "cannot submit reads");
+  }
+  STAT_ADD(p->reader.enters, n);
+}
+
+/*
+ * reader: a single event loop over all sources,
+ * filling a free block per source,
+ * so that the ttys are read while the previous blocks
+ * are hashed and written;
+ * with p->readwait, the input of a device taking more than HOLDREADS
+ * reads per block is left in the tty until the rest of the block is there,
+ * and taken in with a single read(2) per block,
+ * instead of a wakeup and a read for each fragment of the input;
+ * the files and the devices which cannot be watched are read
+ * between the waits, a device with nothing to read again a tick later
+ * so that it never holds up the others, and with -U, the sources
+ * which can be are read over io_uring, with a read of the rest of the block
+ * always in flight and the completions watched by the event loop;
+ * at the end of the input of all sources, it is passed down the pipeline
+ */
+static void *reader_main(void *arg) {
+  struct pipeline *p = arg;
+  struct evl_event ev[MAXSOURCES + 1];
+  struct source *s;
+  uint64_t t, next;
+  size_t avail;
+  int evl, i, n, timeout, live, direct, ready;
+  int flags = (p->readwait != 0) ? EVL_READ | EVL_ONESHOT : EVL_READ;
+  struct block *b;
+
+  if ((evl = evl_open()) == -1) {
+    err(EX_OSERR, "cannot open event loop");
+  }
+  for (i = 0; i < p->nsources; i++) {
+    s = &p->src[i];
+    if (reader_async(p, s)) {
+      /* the reads over io_uring wait for the device in the kernel */
+      if (fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        err(EX_OSERR, "cannot set %s blocking", s->devname);
+      }
+      reader_submit(p, s);
+    } else if ((s->be->flags & SRC_POLL) &&
+               (evl_set(evl, s->fd, 0, flags, s) == -1)) {
+      err(EX_OSERR, "cannot watch %s", s->devname);
+    }
+  }
+  if (p->uring != NULL) {
+    if ((n = uring_submit(p->uring)) == -1) {
+      err(EX_OSERR, "cannot submit reads");
+    }
+    STAT_ADD(p->reader.enters, n);
+    if (evl_set(evl, p->uring->fd, 0, EVL_READ, p->uring) == -1) {
+      err(EX_OSERR, "cannot watch io_uring");
+    }
+  }
+  while (1) {
+    /*
+     * until the first hold-off ends, or a device read directly
+     * with nothing to read is to be tried again;
+     * the other sources read directly are always ready
+     */
+    next = 0;
+    live = direct = ready = 0;
+    t = now_ns();
+    for (i = 0; i < p->nsources; i++) {
+      s = &p->src[i];
+      if ((s->wake != 0) && ((next == 0) || (s->wake < next))) {
+        next = s->wake;
+      }
+      live += !s->eof;
+      if (s->eof || (s->be->flags & SRC_POLL) || reader_async(p, s)) {
+        continue;
+      }
+      direct++;
+      if (s->retry <= t) {
+        ready++;
+      } else if ((next == 0) || (s->retry < next)) {
+        next = s->retry;
+      }
+    }
+    if (live == 0) {
+      break;
+    }
+    timeout = -1;
+    if (next != 0) {
+      timeout = (next > t) ? (int)((next - t + 999999) / 1000000) : 0;
+    }
+    n = 0;
+    if (ready == 0) {
+      if ((n = evl_wait(evl, ev, MAXSOURCES + 1, timeout)) == -1) {
+        err(EX_OSERR, "event loop wait failed");
+      }
+      STAT_ADD(p->reader.wakeups, 1);
+    } else if (direct < live) {
+      /* a look at the watched sources between the direct reads */
+      if ((n = evl_wait(evl, ev, MAXSOURCES + 1, 0)) == -1) {
+        err(EX_OSERR, "event loop wait failed");
+      }
+      STAT_ADD(p->reader.wakeups, 1);
+    }
+    t = now_ns();
+    for (i = 0; i < n; i++) {
+      if (ev[i].udata == p->uring) {
+        reader_reap(p);
+        continue;
+      }
+      s = ev[i].udata;
+      if (s->seen == 0) {
+        s->seen = t;
+      }
+      if ((p->readwait == 0) || !(s->be->flags & SRC_AVAIL)) {
+        reader_read(p, s, 0);
+        if (s->eof) {
+          reader_close(evl, s, flags);
+        }
+        continue;
+      }
+      if (!reader_holding(s)) {
+        /* as without the hold-off, but watched again after each read */
+        reader_next(p, evl, s, reader_read(p, s, 0), t);
+        continue;
+      }
+      /* nothing waiting: read(2) reports the end of the input */
+      if (((avail = reader_avail(s)) > 0) && reader_hold(p, s, avail, t)) {
+        continue;
+      }
+      reader_next(p, evl, s, reader_read(p, s, avail), t);
+    }
+    for (i = 0; i < p->nsources; i++) {
+      s = &p->src[i];
+      if ((s->wake == 0) || (s->wake > t)) {
+        continue;
+      }
+      if ((avail = reader_avail(s)) == 0) {
+        /* the input has paused */
+        reader_watch(evl, s);
+      } else if ((s->be->flags & SRC_EOF) && (avail == s->held)) {
+        /* the writer may have gone: take the rest, and watch for the end */
+        reader_read(p, s, avail);
+        reader_watch(evl, s);
+      } else if (!reader_hold(p, s, avail, t)) {
+        reader_next(p, evl, s, reader_read(p, s, avail), t);
+      }
+    }
+    for (i = 0; i < p->nsources; i++) {
+      s = &p->src[i];
+      if (!s->eof && !(s->be->flags & SRC_POLL) && !reader_async(p, s) &&
+          (s->retry <= t)) {
+        reader_read(p, s, 0);
+      }
+    }
+  }
+  /* the blocks partly filled are dropped, as at the end of a replay */
+  b = ring_pop(&p->freeq);
+  b->src = NOSOURCE;
+  b->len = 0;
+  ring_push(&p->rawq, b);
+  close(evl);
+  return NULL;
+}
+
+/*
+ * replay: feed the reads of a capture (-P) to the sources as the reader,
+ * at the recorded times or as fast as possible (-F),
+ * then pass the end of the input down the pipeline;
+ * the adaptive mode sees the recorded times in both cases,
+ * so the output only depends on the capture and the options
+ */
+static void *replay_main(void *arg) {
+  struct pipeline *p = arg;
+  struct cap_read r;
+  struct source *s;
+  struct block *b;
+  struct timespec ts;
+  uint64_t start = now_ns(), t;
+  size_t off, n;
+
+  while (cap_next(p->replay, &r)) {
+    s = &p->src[r.src];
+    if (!p->fast) {
+      t = start + r.time * 1000;
+      ts.tv_sec = (time_t)(t / 1000000000);
+      ts.tv_nsec = (long)(t % 1000000000);
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+             EINTR)
+        ;
+    }
+    t = REPLAY_EPOCH + r.time * 1000;
+    for (off = 0; off < r.len; off += n) {
+      b = reader_block(p, s);
+      n = MIN(r.len - off, s->want - s->fill);
+      memcpy(b->data + s->fill, r.data + off, n);
+      reader_add(p, s, (uint32_t)n, t);
+    }
+  }
+  /* the blocks partly filled are dropped as at the end of a tty */
+  b = ring_pop(&p->freeq);
+  b->src = NOSOURCE;
+  b->len = 0;
+  ring_push(&p->rawq, b);
+  return NULL;
+}
+
+/*
+ * update the entropy estimate of the source with a block,
+ * and the raw bytes per 64-byte output with -A
+ */
+static void conditioner_estimate(struct pipeline *p, struct source *s,
+                                 const struct block *b) {
+  struct est_result r;
+  double perout;
+
+  est_update(&s->est, b->data, b->len);
+  if (est_result(&s->est, &r) != 0) {
+    return;
+  }
+  atomic_store_explicit(&s->estats.mcv, (unsigned)(r.mcv * 1000),
+                        memory_order_relaxed);
+  atomic_store_explicit(&s->estats.collision, (unsigned)(r.collision * 1000),
+                        memory_order_relaxed);
+  atomic_store_explicit(&s->estats.markov, (unsigned)(r.markov * 1000),
+                        memory_order_relaxed);
+  if (p->autoratio) {
+    perout = (r.entropy > 0) ? ceil(OUTPUTENTROPY / r.entropy) : MAXPEROUT;
+    s->perout = (perout < MAXPEROUT) ? (uint32_t)perout : MAXPEROUT;
+    atomic_store_explicit(&s->estats.perout, s->perout, memory_order_relaxed);
+  }
+}
+
+/*
+ * screen a block with the rndtest(4) tests, as of the time it was full;
+ * returns the failure flags of the samples completed in the block,
+ * or -1 when none was
+ */
+static int conditioner_gate(struct pipeline *p, struct source *s,
+                            const struct block *b) {
+  int fail;
+
+  if ((fail = rndtest_block(&s->gate, b->data, b->len, b->tfull,
+                            p->retest)) == -1) {
+    return -1;
+  }
+  STAT_ADD(s->rstats.tests, s->gate.tests);
+  STAT_ADD(s->rstats.monobit, s->gate.fails[0]);
+  STAT_ADD(s->rstats.runs, s->gate.fails[1]);
+  STAT_ADD(s->rstats.longruns, s->gate.fails[2]);
+  STAT_ADD(s->rstats.chi, s->gate.fails[3]);
+#ifdef DEBUG
+  if (fail) {
+    fprintf(stderr, "feedtrng: %s: rndtest failure %d\n", s->devname, fail);
+    fflush(stderr);
+  }
+#endif
+  return fail;
+}
+
+/*
+ * the entropy of each output byte of a source [bits]:
+ * the claimed entropy of the raw bytes going into it, up to 8,
+ * as -e for -t, and none from a conditioner not vetted
+ */
+static double conditioner_credit(const struct pipeline *p,
+                                 const struct source *s) {
+  double ratio;
+
+  if (p->transparent) {
+    return p->entropy;
+  }
+  if (!p->cond->vetted) {
+    return 0;
+  }
+  ratio = (s->perout != 0) ? (double)s->perout / p->cond->outlen
+                           : (double)p->blocksize / p->outsize;
+  return MIN(8, p->entropy * ratio);
+}
+
+/*
+ * hash and chain a block of a source into its output,
+ * or pass the raw input through with -t
+ * A block is split into as many segments as the SHA512 digests needed
+ * for the output bytes, and each segment is hashed and chained in turn;
+ * with the default 512-byte block and 64-byte output,
+ * this is a single hash of the whole block.
+ */
+static void conditioner_hash(struct pipeline *p, struct source *s,
+                             struct block *b) {
+  const struct conditioner *cd = p->cond;
+  uint32_t outlen, nseg, seg, off, len, i;
+
+  b->credit = conditioner_credit(p, s);
+  if (p->transparent) {
+    b->out = b->data;
+    b->outlen = b->len;
+    return;
+  }
+  outlen = pipeline_outsize(p, s->perout, b->len);
+  if (s->perout != 0) {
+    /* -A: segments of perout bytes, the remainder in the last one */
+    nseg = b->len / s->perout;
+    seg = s->perout;
+    outlen = nseg * cd->outlen;
+  } else {
+    nseg = (outlen + cd->outlen - 1) / cd->outlen;
+    seg = b->len / nseg;
+  }
+  if (nseg == 0) {
+    /* short of perout bytes: chained for the next output of the lane */
+    cond_hash(cd, b->data, b->len, s->hash[s->lane]);
+  }
+  for (i = 0, off = 0; i < nseg; i++, off += len) {
+    len = (i == nseg - 1) ? b->len - off : seg;
+    /* hash the segment and half of the previous output of the lane */
+    /* directly from both, without copying them together */
+    cond_hash(cd, b->data + off, len, s->hash[s->lane]);
+#ifdef DEBUG
+    fprintf(stderr, "feedtrng: Compute %s of %d bytes\n", cd->name,
+            (int)(len + sizeof(uint64_t) * CHAINWORDS));
+    fflush(stderr);
+#endif
+    memcpy((uint8_t *)b->hash + i * cd->outlen, s->hash[s->lane],
+           cd->outlen);
+    s->lane = (s->lane + 1 == p->nlanes) ? 0 : s->lane + 1;
+  }
+  b->out = (const uint8_t *)b->hash;
+  b->outlen = outlen;
+}
+
+/* pass a block to the sink, which only recycles it when b->outlen is 0 */
+static void conditioner_push(struct pipeline *p, struct block *b) {
+  b->tcond = now_ns();
+  lat_add(&p->lat[LAT_COND], b->tcond - b->tfull);
+  STAT_ADD(p->conditioner.blocks, 1);
+  STAT_ADD(p->conditioner.bytes, b->outlen);
+  ring_push(&p->outq, b);
+}
+
+/* drop a block of a failing or untested sample without chaining it */
+static void conditioner_drop(struct pipeline *p, struct source *s,
+                             struct block *b) {
+  STAT_ADD(s->rstats.discard, b->len);
+  STAT_ADD(p->conditioner.drops, 1);
+  b->outlen = 0;
+  conditioner_push(p, b);
+}
+
+/*
+ * the blocks held for a sample of -G, in the order read,
+ * are hashed when the sample has passed, or dropped when it failed
+ */
+static void conditioner_release(struct pipeline *p, struct source *s,
+                                int fail) {
+  unsigned i;
+
+  for (i = 0; i < s->ngated; i++) {
+    if (fail) {
+      conditioner_drop(p, s, s->gated[i]);
+    } else {
+      conditioner_hash(p, s, s->gated[i]);
+      conditioner_push(p, s->gated[i]);
+    }
+  }
+  s->ngated = 0;
+}
+
+/*
+ * conditioner: hash and chain the blocks of each source in the order read
+ * With -G, the blocks going into a sample are held until it is tested,
+ * so that no byte of a failing sample is written.
+ */
+static void *conditioner_main(void *arg) {
+  struct pipeline *p = arg;
+  struct source *s;
+  struct block *b;
+  int fail, gate = -1, i;
+
+  while (1) {
+    b = ring_pop(&p->rawq);
+    if (b->src == NOSOURCE) {
+      /* the samples not completed are not tested */
+      for (i = 0; i < p->nsources; i++) {
+        conditioner_release(p, &p->src[i], 1);
+      }
+      b->outlen = 0;
+      ring_push(&p->outq, b);
+      continue;
+    }
+    s = &p->src[b->src];
+    /* run the health tests on the raw input of every block */
+    fail = health_test(&s->health, &p->cutoff, b->data, b->len);
+    if (fail & HEALTH_RCT) {
+      STAT_ADD(s->hstats.rctfails, 1);
+    }
+    if (fail & HEALTH_APT) {
+      STAT_ADD(s->hstats.aptfails, 1);
+    }
+    if (!fail) {
+      conditioner_estimate(p, s, b);
+    }
+    if (p->gate && ((gate = conditioner_gate(p, s, b)) != -1)) {
+      conditioner_release(p, s, gate);
+    }
+    if (s->discard) {
+      /* clear discarding flag */
+      s->discard = 0;
+      STAT_ADD(p->conditioner.discards, 1);
+      b->outlen = 0;
+    } else if (fail) {
+      /* drop the failing block without chaining it */
+#ifdef DEBUG
+      fprintf(stderr, "feedtrng: %s: health test failure %d\n", s->devname,
+              fail);
+      fflush(stderr);
+#endif
+      STAT_ADD(s->hstats.drops, 1);
+      STAT_ADD(p->conditioner.drops, 1);
+      b->outlen = 0;
+    } else if (p->gate && (gate > 0)) {
+      /* in a failing sample, as the blocks held for it */
+      conditioner_drop(p, s, b);
+      continue;
+    } else if (p->gate && s->gate.collect && (s->gate.fill > 0)) {
+      /* held until the sample it went into is tested */
+      s->gated[s->ngated++] = b;
+      continue;
+    } else if (p->gate && s->gate.discard) {
+      /* after a failing sample until the next one passes */
+      conditioner_drop(p, s, b);
+      continue;
+    } else {
+      conditioner_hash(p, s, b);
+    }
+    conditioner_push(p, b);
+  }
+  /* notreached */
+  return NULL;
+}
+
+/* the blocks of the batch are written at t [ns] */
+static void sink_record(struct pipeline *p, struct batch *bt, uint64_t t) {
+  unsigned i;
+
+  for (i = 0; i < bt->nstamp; i++) {
+    lat_add(&p->lat[LAT_WRITE], t - bt->stamp[i].tcond);
+    lat_add(&p->lat[LAT_TOTAL], t - bt->stamp[i].tfirst);
+  }
+  bt->nstamp = 0;
+}
+
+/* the last bytes of the block go into the batch */
+static void sink_stamp(struct pipeline *p, struct batch *bt,
+                       const struct block *b) {
+  if (bt->nstamp == BATCHBLOCKS) {
+    /* more blocks than expected in a batch: taken as written now */
+    sink_record(p, bt, now_ns());
+  }
+  bt->stamp[bt->nstamp].tfirst = b->tfirst;
+  bt->stamp[bt->nstamp].tcond = b->tcond;
+  bt->nstamp++;
+}
+
+/*
+ * write the staged bytes followed by len bytes of buf (if any)
+ * in a single call to the next output, or drain the mmap ring
+ * of /dev/trng (-m)
+ */
+static void sink_write(struct pipeline *p, struct batch *bt, const uint8_t *buf,
+                       size_t len, int deadline) {
+  struct iovec iov[2];
+  ssize_t wsize;
+  int n = 0;
+
+  if (p->ring != NULL) {
+    /* the bytes are in the ring (-m); have the driver harvest them */
+    if (ioctl(p->trngfd, TRNGIOC_DRAIN) == -1) {
+      err(EX_IOERR, "trng drain failed");
+    }
+    wsize = (ssize_t)bt->len;
+  } else {
+    if (bt->len > 0) {
+      iov[n].iov_base = bt->stage;
+      iov[n++].iov_len = bt->len;
+    }
+    if (len > 0) {
+      iov[n].iov_base = (void *)(uintptr_t)buf;
+      iov[n++].iov_len = len;
+    }
+    if (n == 0) {
+      return;
+    }
+    /* write hash or raw data to output */
+    wsize = (ssize_t)output_write(&p->out[p->nextout], iov, n, bt->bits);
+    p->nextout = (p->nextout + 1 == p->noutputs) ? 0 : p->nextout + 1;
+  }
+#ifdef DEBUG
+  fprintf(stderr, "feedtrng: write %d bytes\n", (int)wsize);
+  fflush(stderr);
+#endif
+  STAT_ADD(p->sink.writes, 1);
+  STAT_ADD(p->sink.bytes, wsize);
+  if (deadline) {
+    STAT_ADD(p->sink.deadlines, 1);
+  }
+  sink_record(p, bt, now_ns());
+  bt->len = 0;
+  bt->bits = 0;
+}
+
+/* the deadline starts from the first byte staged */
+static void sink_deadline(struct pipeline *p, struct batch *bt) {
+  clock_gettime(CLOCK_REALTIME, &bt->deadline);
+  bt->deadline.tv_sec += p->deadline / 1000000000;
+  bt->deadline.tv_nsec += p->deadline % 1000000000;
+  if (bt->deadline.tv_nsec >= 1000000000) {
+    bt->deadline.tv_sec++;
+    bt->deadline.tv_nsec -= 1000000000;
+  }
+}
+
+/*
+ * add the output of a block to the mmap ring of /dev/trng (-m);
+ * bt->len counts the bytes not yet drained, which are drained
+ * when the ring is half full, when it is full, or at the deadline
+ */
+static void sink_ring(struct pipeline *p, struct batch *bt,
+                      const struct block *b) {
+  size_t off, n;
+
+  for (off = 0; off < b->outlen; off += n) {
+    if (bt->len == 0) {
+      sink_deadline(p, bt);
+    }
+    n = trng_ring_produce(p->ring, p->ringdata, b->out + off, b->outlen - off);
+    bt->len += n;
+    if (off + n < b->outlen) {
+      sink_write(p, bt, NULL, 0, 0);
+    }
+  }
+  sink_stamp(p, bt, b);
+  if (trng_ring_used(p->ring) >= TRNG_RING_SIZE / 2) {
+    sink_write(p, bt, NULL, 0, 0);
+  }
+}
+
+/*
+ * add the output of a block to the batch,
+ * writing out a full batch of p->batchsize bytes;
+ * the part of the output completing a batch is written with writev()
+ * together with the staged bytes, instead of being copied
+ */
+static void sink_add(struct pipeline *p, struct batch *bt,
+                     const struct block *b) {
+  size_t off, n;
+
+  for (off = 0; off < b->outlen; off += n) {
+    n = MIN(b->outlen - off, p->batchsize - bt->len);
+    bt->bits += n * b->credit;
+    if (off + n == b->outlen) {
+      sink_stamp(p, bt, b);
+    }
+    if (bt->len + n == p->batchsize) {
+      sink_write(p, bt, b->out + off, n, 0);
+      continue;
+    }
+    if (bt->len == 0) {
+      sink_deadline(p, bt);
+    }
+    memcpy(bt->stage + bt->len, b->out + off, n);
+    bt->len += n;
+  }
+}
+
+/*
+ * sink: batch the conditioned output of all sources
+ * into writes of p->batchsize bytes, or less when the oldest staged byte
+ * has waited for p->deadline, and recycle the blocks
+ */
+static void *sink_main(void *arg) {
+  struct pipeline *p = arg;
+  static struct batch bt;
+  struct block *b;
+
+  bt.len = 0;
+  bt.bits = 0;
+  bt.nstamp = 0;
+  while (1) {
+    if (bt.len == 0) {
+      b = ring_pop(&p->outq);
+    } else if ((b = ring_timedpop(&p->outq, &bt.deadline)) == NULL) {
+      sink_write(p, &bt, NULL, 0, 1);
+      continue;
+    }
+    if (b->src == NOSOURCE) {
+      /* the end of the input: write out the batch, and stop feedtrng */
+      sink_write(p, &bt, NULL, 0, 0);
+      ring_push(&p->freeq, b);
+      atomic_store(&p->done, 1);
+      kill(getpid(), SIGTERM);
+      continue;
+    }
+    if ((b->outlen > 0) && (p->ring != NULL)) {
+      sink_ring(p, &bt, b);
+      STAT_ADD(p->sink.blocks, 1);
+    } else if (b->outlen > 0) {
+      sink_add(p, &bt, b);
+      STAT_ADD(p->sink.blocks, 1);
+    }
+    ring_push(&p->freeq, b);
+  }
+  /* notreached */
+  return NULL;
+}
+
+/*
+ * all blocks are allocated here for the largest block size,
+ * so that the block size can change without reallocation
+ */
+void pipeline_init(struct pipeline *p) {
+  size_t hashwords;
+  unsigned i;
+
+  if (p->latency == 0) {
+    p->minblock = p->maxblock = p->blocksize;
+  }
+  if (p->gate) {
+    /* the blocks held for the samples of -G being collected */
+    p->depth += (unsigned)p->nsources * (RNDTEST_NBYTES / p->minblock + 2);
+  }
+  /* room for the digests of the largest output */
+  hashwords = pipeline_outsize(p, 0, p->maxblock);
+  if (p->autoratio) {
+    hashwords = MAX(hashwords, pipeline_outsize(p, OUTPUTENTROPY / 8,
+                                                p->maxblock));
+  }
+  hashwords = (hashwords + SHA512_DIGEST_LENGTH - 1) / SHA512_DIGEST_LENGTH * 8;
+  if (((p->blocks = aligned_alloc(CACHELINE, sizeof(struct block) *
+                                                 p->depth)) == NULL) ||
+      ((p->data = aligned_alloc(CACHELINE, (size_t)p->maxblock * p->depth)) ==
+       NULL) ||
+      ((p->hashes = aligned_alloc(CACHELINE, sizeof(uint64_t) * hashwords *
+                                                 p->depth)) == NULL)) {
+    err(EX_OSERR, "cannot allocate %u blocks", p->depth);
+  }
+  memset(p->blocks, 0, sizeof(struct block) * p->depth);
+  for (i = 0; i < p->depth; i++) {
+    p->blocks[i].data = p->data + (size_t)p->maxblock * i;
+    p->blocks[i].hash = p->hashes + hashwords * i;
+  }
+  if ((ring_init(&p->freeq, p->depth) == -1) ||
+      (ring_init(&p->rawq, p->depth) == -1) ||
+      (ring_init(&p->outq, p->depth) == -1)) {
+    err(EX_OSERR, "cannot initialize queues");
+  }
+  for (i = 0; i < (unsigned)p->nsources; i++) {
+    p->src[i].cur = NULL;
+    /* the adaptive mode starts from -b, within the bounds */
+    p->src[i].want = MIN(MAX(p->blocksize, p->minblock), p->maxblock);
+    p->src[i].last = 0;
+    p->src[i].rate = 0;
+    p->src[i].pace = 0;
+    p->src[i].reads = 0;
+    p->src[i].frags = 0;
+    p->src[i].probe = 0;
+    p->src[i].wake = 0;
+    p->src[i].seen = 0;
+    p->src[i].retry = 0;
+    atomic_init(&p->src[i].blocksize, p->src[i].want);
+    p->src[i].discard = p->discard;
+    memset(&p->src[i].stats, 0, sizeof(p->src[i].stats));
+    memset(&p->src[i].hstats, 0, sizeof(p->src[i].hstats));
+    health_init(&p->src[i].health);
+    memset(&p->src[i].rstats, 0, sizeof(p->src[i].rstats));
+    rndtest_init(&p->src[i].gate);
+    p->src[i].ngated = 0;
+    if (est_init(&p->src[i].est, EST_WINDOW) == -1) {
+      err(EX_OSERR, "cannot allocate the entropy estimator");
+    }
+    p->src[i].perout = 0;
+    memset(&p->src[i].estats, 0, sizeof(p->src[i].estats));
+    /* initialize the hash chains */
+    cond_lanes(p->src[i].hash, p->nlanes);
+    p->src[i].lane = 0;
+  }
+  memset(&p->reader, 0, sizeof(p->reader));
+  memset(&p->conditioner, 0, sizeof(p->conditioner));
+  memset(&p->sink, 0, sizeof(p->sink));
+  memset(p->lat, 0, sizeof(p->lat));
+  atomic_init(&p->done, 0);
+  /* all blocks are free at first */
+  for (i = 0; i < p->depth; i++) {
+    ring_push(&p->freeq, &p->blocks[i]);
+  }
+}
+
+/* start the threads with all signals blocked; main thread handles them */
+void pipeline_start(struct pipeline *p) {
+  void *(*stage[3])(void *) = {reader_main, conditioner_main, sink_main};
+  sigset_t all, old;
+  int i, error;
+
+  if (p->replay != NULL) {
+    stage[0] = replay_main;
+  }
+  p->start = now_ns();
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (i = 0; i < 3; i++) {
+    if ((error = pthread_create(&p->tid[i], NULL, stage[i], p)) != 0) {
+      errno = error;
+      err(EX_OSERR, "cannot create pipeline thread");
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void pipeline_stats(struct pipeline *p, FILE *fp) {
+  unsigned perout, mcv, col, markov;
+  uint_fast64_t writes, reads, wakeups, count, calls;
+  struct lat_hist *h;
+  struct output *o;
+  int i;
+
+  fprintf(fp, "feedtrng: queue depth %u (raw %u, out %u, free %u)\n", p->depth,
+          ring_depth(&p->rawq), ring_depth(&p->outq), ring_depth(&p->freeq));
+  for (i = 0; i < p->nsources; i++) {
+    fprintf(fp,
+            "feedtrng: source %s %" PRIuFAST64 " blocks %" PRIuFAST64
+            " bytes block size %u\n",
+            p->src[i].devname, STAT_GET(p->src[i].stats.blocks),
+            STAT_GET(p->src[i].stats.bytes),
+            (unsigned)STAT_GET(p->src[i].blocksize));
+    if ((reads = STAT_GET(p->src[i].stats.reads)) > 0) {
+      fprintf(fp,
+              "feedtrng: source %s %" PRIuFAST64
+              " reads, %.2f per block, %.1f bytes per read (%s%s)\n",
+              p->src[i].devname, reads,
+              (double)reads / MAX(STAT_GET(p->src[i].stats.blocks), 1),
+              (double)STAT_GET(p->src[i].stats.bytes) / reads,
+              (p->src[i].be != NULL) ? p->src[i].be->name : "replay",
+              ((p->src[i].be != NULL) && reader_async(p, &p->src[i]))
+                  ? ", io_uring"
+                  : "");
+    }
+    fprintf(fp,
+            "feedtrng: source %s health %" PRIuFAST64 " rct %" PRIuFAST64
+            " apt failures %" PRIuFAST64 " blocks dropped\n",
+            p->src[i].devname, STAT_GET(p->src[i].hstats.rctfails),
+            STAT_GET(p->src[i].hstats.aptfails),
+            STAT_GET(p->src[i].hstats.drops));
+    if (p->gate) {
+      fprintf(fp,
+              "feedtrng: source %s rndtest %" PRIuFAST64 " tests, failures"
+              " monobit %" PRIuFAST64 " runs %" PRIuFAST64
+              " longruns %" PRIuFAST64 " chi %" PRIuFAST64 ", %" PRIuFAST64
+              " bytes discarded\n",
+              p->src[i].devname, STAT_GET(p->src[i].rstats.tests),
+              STAT_GET(p->src[i].rstats.monobit),
+              STAT_GET(p->src[i].rstats.runs),
+              STAT_GET(p->src[i].rstats.longruns),
+              STAT_GET(p->src[i].rstats.chi),
+              STAT_GET(p->src[i].rstats.discard));
+    }
+    mcv = STAT_GET(p->src[i].estats.mcv);
+    col = STAT_GET(p->src[i].estats.collision);
+    markov = STAT_GET(p->src[i].estats.markov);
+    if ((mcv | col | markov) == 0) {
+      fprintf(fp, "feedtrng: source %s entropy not yet estimated\n",
+              p->src[i].devname);
+      continue;
+    }
+    if ((perout = STAT_GET(p->src[i].estats.perout)) == 0) {
+      perout = p->blocksize * SHA512_DIGEST_LENGTH / p->outsize;
+    }
+    fprintf(fp,
+            "feedtrng: source %s entropy %.3f bits/byte (mcv %.3f collision "
+            "%.3f markov %.3f) %u bytes per output\n",
+            p->src[i].devname, MIN(mcv, MIN(col, markov)) / 1000.0,
+            mcv / 1000.0, col / 1000.0, markov / 1000.0, perout);
+  }
+  fprintf(fp,
+          "feedtrng: reader %" PRIuFAST64 " blocks %" PRIuFAST64
+          " bytes %" PRIuFAST64 " stalls\n"
+          "feedtrng: conditioner %" PRIuFAST64 " blocks %" PRIuFAST64
+          " bytes %" PRIuFAST64 " dropped %" PRIuFAST64 " stalls\n"
+          "feedtrng: sink %" PRIuFAST64 " blocks %" PRIuFAST64
+          " bytes %" PRIuFAST64 " writes (%" PRIuFAST64
+          " by deadline) %" PRIuFAST64 " stalls\n",
+          STAT_GET(p->reader.blocks), STAT_GET(p->reader.bytes),
+          STAT_GET(p->freeq.stalls), STAT_GET(p->conditioner.blocks),
+          STAT_GET(p->conditioner.bytes), STAT_GET(p->conditioner.drops),
+          STAT_GET(p->rawq.stalls),
+          STAT_GET(p->sink.blocks), STAT_GET(p->sink.bytes),
+          STAT_GET(p->sink.writes), STAT_GET(p->sink.deadlines),
+          STAT_GET(p->outq.stalls));
+  if ((wakeups = STAT_GET(p->reader.wakeups)) > 0) {
+    fprintf(fp, "feedtrng: reader %" PRIuFAST64 " wakeups, %.1f per second\n",
+            wakeups, wakeups * 1e9 / (double)MAX(now_ns() - p->start, 1));
+  }
+  if ((calls = STAT_GET(p->reader.reads) + STAT_GET(p->reader.enters) +
+               wakeups) > 0) {
+    /* io_uring completes reads without a read(2) but not without a call */
+    fprintf(fp,
+            "feedtrng: reader %" PRIuFAST64 " system calls (%" PRIuFAST64
+            " read, %" PRIuFAST64 " io_uring_enter, %" PRIuFAST64
+            " wait), %.2f per MiB\n",
+            calls, STAT_GET(p->reader.reads), STAT_GET(p->reader.enters),
+            wakeups,
+            calls * 1048576.0 / MAX(STAT_GET(p->reader.bytes), 1));
+  }
+  if ((writes = STAT_GET(p->sink.writes)) > 0) {
+    fprintf(fp, "feedtrng: sink %.1f bytes per write, %.3f writes per KiB\n",
+            (double)STAT_GET(p->sink.bytes) / writes,
+            writes * 1024.0 / STAT_GET(p->sink.bytes));
+  }
+  for (i = 0; i < p->noutputs; i++) {
+    o = &p->out[i];
+    if ((calls = STAT_GET(o->stats.calls)) == 0) {
+      continue;
+    }
+    fprintf(fp,
+            "feedtrng: output %s (%s) %" PRIuFAST64 " calls %" PRIuFAST64
+            " bytes, %.1f bytes per call",
+            o->name, o->be->name, calls, STAT_GET(o->stats.bytes),
+            (double)STAT_GET(o->stats.bytes) / calls);
+    /* the pool of the ioctl, or of the EGD server */
+    if ((o->pool != NULL) || (STAT_GET(o->stats.credits) > 0)) {
+      fprintf(fp, ", %" PRIuFAST64 " bits credited",
+              STAT_GET(o->stats.credits));
+    }
+    fputc('\n', fp);
+  }
+  if (STAT_GET(p->conditioner.discards) > 0) {
+    fprintf(fp, "feedtrng: conditioner %" PRIuFAST64 " blocks discarded\n",
+            STAT_GET(p->conditioner.discards));
+  }
+  for (i = 0; i < LAT_NHIST; i++) {
+    h = &p->lat[i];
+    if ((count = STAT_GET(h->count)) == 0) {
+      continue;
+    }
+    fprintf(fp,
+            "feedtrng: latency %-9s p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f "
+            "max %.3f mean %.3f ms (%" PRIuFAST64 " blocks)\n",
+            lat_names[i], lat_quantile(h, 0.5) / 1e6,
+            lat_quantile(h, 0.9) / 1e6, lat_quantile(h, 0.99) / 1e6,
+            lat_quantile(h, 0.999) / 1e6, STAT_GET(h->max) / 1e6,
+            (double)STAT_GET(h->sum) / count / 1e6, count);
+  }
+  fflush(fp);
+}
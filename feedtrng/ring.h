@@ -0,0 +1,149 @@
+/*
+ * Single-producer/single-consumer lock-free ring for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_RING_H_
+#define _FEEDTRNG_RING_H_
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CACHELINE (64)
+
+/*
+ * The producer only writes head, the consumer only writes tail;
+ * both are on their own cache lines.
+ * The ring never overflows because it is only used to pass around
+ * the blocks of a fixed pool, no larger than the ring.
+ * A consumer finding the ring empty counts a stall,
+ * then sleeps on the semaphore until the producer wakes it up.
+ */
+
+struct ring {
+  _Alignas(CACHELINE) atomic_uint head;
+  _Alignas(CACHELINE) atomic_uint tail;
+  _Alignas(CACHELINE) atomic_int waiting;
+  sem_t wake;
+  unsigned mask;
+  void **slot;
+  /* written by the consumer only */
+  _Alignas(CACHELINE) atomic_uint_fast64_t stalls;
+};
+
+/* count up a statistics counter written by a single thread */
+#define STAT_ADD(c, n)                                                         \
+  atomic_store_explicit(&(c), atomic_load_explicit(&(c), memory_order_relaxed) \
+                                  + (n),                                       \
+                        memory_order_relaxed)
+#define STAT_GET(c) atomic_load_explicit(&(c), memory_order_relaxed)
+
+/* size is rounded up to a power of two; returns -1 on error */
+static inline int ring_init(struct ring *r, unsigned size) {
+  unsigned n = 1;
+  while (n < size) {
+    n <<= 1;
+  }
+  if ((r->slot = calloc(n, sizeof(void *))) == NULL) {
+    return -1;
+  }
+  r->mask = n - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->waiting, 0);
+  atomic_init(&r->stalls, 0);
+  return sem_init(&r->wake, 0, 0);
+}
+
+static inline void ring_destroy(struct ring *r) {
+  sem_destroy(&r->wake);
+  free(r->slot);
+}
+
+/* number of items queued */
+static inline unsigned ring_depth(struct ring *r) {
+  return atomic_load_explicit(&r->head, memory_order_acquire) -
+         atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+static inline void ring_push(struct ring *r, void *p) {
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  r->slot[head & r->mask] = p;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  /* pairs with the store to waiting in ring_pop() */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&r->waiting, memory_order_relaxed) &&
+      atomic_exchange(&r->waiting, 0)) {
+    sem_post(&r->wake);
+  }
+}
+
+/* returns NULL when empty */
+static inline void *ring_trypop(struct ring *r) {
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  void *p;
+  if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) {
+    return NULL;
+  }
+  p = r->slot[tail & r->mask];
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return p;
+}
+
+/* waits until an item is available */
+static inline void *ring_pop(struct ring *r) {
+  void *p;
+  if ((p = ring_trypop(r)) != NULL) {
+    return p;
+  }
+  STAT_ADD(r->stalls, 1);
+  for (;;) {
+    atomic_store(&r->waiting, 1);
+    if ((p = ring_trypop(r)) != NULL) {
+      atomic_store(&r->waiting, 0);
+      return p;
+    }
+    while (sem_wait(&r->wake) == -1 && errno == EINTR)
+      ;
+    if ((p = ring_trypop(r)) != NULL) {
+      return p;
+    }
+  }
+}
+
+/*
+ * waits until an item is available, or returns NULL
+ * when the absolute time abstime (CLOCK_REALTIME) has passed
+ */
+static inline void *ring_timedpop(struct ring *r,
+                                  const struct timespec *abstime) {
+  void *p;
+  if ((p = ring_trypop(r)) != NULL) {
+    return p;
+  }
+  STAT_ADD(r->stalls, 1);
+  for (;;) {
+    atomic_store(&r->waiting, 1);
+    if ((p = ring_trypop(r)) != NULL) {
+      atomic_store(&r->waiting, 0);
+      return p;
+    }
+    while (sem_timedwait(&r->wake, abstime) == -1) {
+      if (errno == ETIMEDOUT) {
+        /* a wakeup posted after this is taken as spurious later */
+        atomic_store(&r->waiting, 0);
+        return ring_trypop(r);
+      }
+    }
+    if ((p = ring_trypop(r)) != NULL) {
+      return p;
+    }
+  }
+}
+
+#endif /* _FEEDTRNG_RING_H_ */
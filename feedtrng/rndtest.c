@@ -0,0 +1,407 @@
+/*
+ * Feeder for /dev/trng: the statistical tests of rndtest(4)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The bits of a sample are taken from the least significant bit
+ * of each byte, as rndtest(4) does.
+ * The popcnt and AVX2 kernels count a sample 64 bits at a time
+ * in two bit streams, of the ones and of the zeros:
+ * the ones of a stream where a run starts are the ones
+ * after a zero, and the runs of k bits or more are those starts
+ * still set after ANDing the stream shifted by 1 to k - 1 bits,
+ * so that the runs of each length are counted by popcount
+ * without a branch; the poker test nibbles are counted
+ * in byte counters of compare results with AVX2.
+ * The portable C kernel goes bit by bit.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "rndtest.h"
+
+/* the bounds of the runs of each length, FIPS 140-2 Change Notice 1 */
+static const struct {
+  uint32_t min, max;
+} rndtest_runs_tab[6] = {
+    {2315, 2685}, {1114, 1386}, {527, 723}, {240, 384}, {103, 209}, {103, 209},
+};
+
+/*
+ * 64-bit words of a sample, the last one partly filled;
+ * a stream has a zero word before and zero words after them,
+ * three more than one for the AVX2 kernel
+ */
+#define NWORDS ((RNDTEST_NBYTES + 7) / 8)
+#define NPAD (NWORDS + 5)
+
+static void count_c(const uint8_t *x, struct rndtest_counts *c) {
+  uint32_t i, run = 0;
+  int bit, prev = x[0] & 1;
+
+  memset(c, 0, sizeof(*c));
+  for (i = 0; i < RNDTEST_NBYTES * 8; i++) {
+    bit = (x[i / 8] >> (i % 8)) & 1;
+    c->ones += (uint32_t)bit;
+    if (bit != prev) {
+      c->runs[prev][MIN(run, 6) - 1]++;
+      c->longruns += (run >= RNDTEST_LONGRUNS);
+      prev = bit;
+      run = 0;
+    }
+    run++;
+  }
+  c->runs[prev][MIN(run, 6) - 1]++;
+  c->longruns += (run >= RNDTEST_LONGRUNS);
+  for (i = 0; i < RNDTEST_NBYTES; i++) {
+    c->nibbles[x[i] & 0x0f]++;
+    c->nibbles[x[i] >> 4]++;
+  }
+}
+
+#if defined(__x86_64__)
+/* the streams of the zeros (0) and the ones (1) of a sample */
+static void streams(const uint8_t *x, uint64_t a[2][NPAD]) {
+  uint64_t w, m;
+  int i;
+
+  memset(a, 0, sizeof(uint64_t) * 2 * NPAD);
+  for (i = 0; i < NWORDS; i++) {
+    w = 0;
+    m = ~UINT64_C(0);
+    if ((i + 1) * 8 > RNDTEST_NBYTES) {
+      memcpy(&w, x + i * 8, RNDTEST_NBYTES - i * 8);
+      m >>= 64 - (RNDTEST_NBYTES - i * 8) * 8;
+    } else {
+      memcpy(&w, x + i * 8, 8);
+    }
+#if BYTE_ORDER == BIG_ENDIAN
+    w = __builtin_bswap64(w);
+#endif
+    a[0][i + 1] = ~w & m;
+    a[1][i + 1] = w & m;
+  }
+}
+
+/*
+ * a run of RNDTEST_LONGRUNS bits covers two whole bytes of the same bits,
+ * so only the samples with such bytes are looked into for the long runs
+ */
+static uint32_t longruns(const uint8_t *x, uint64_t a[2][NPAD]) {
+  uint64_t w, y, start;
+  uint32_t n = 0;
+  int i, j, b;
+
+  for (i = 0; i < RNDTEST_NBYTES - 1; i++) {
+    if ((x[i] == x[i + 1]) && ((uint8_t)(x[i] + 1) <= 1)) {
+      break;
+    }
+  }
+  if (i == RNDTEST_NBYTES - 1) {
+    return 0;
+  }
+  for (b = 0; b < 2; b++) {
+    for (i = 1; i <= NWORDS; i++) {
+      w = a[b][i];
+      start = w & ~((w << 1) | (a[b][i - 1] >> 63));
+      for (y = start, j = 1; (y != 0) && (j < RNDTEST_LONGRUNS); j++) {
+        y &= (w >> j) | (a[b][i + 1] << (64 - j));
+      }
+      n += (uint32_t)__builtin_popcountll(y);
+    }
+  }
+  return n;
+}
+
+/* the runs of exactly k bits from those of k bits or more */
+static void runs_from(struct rndtest_counts *c, uint64_t atleast[2][6]) {
+  int b, k;
+
+  for (b = 0; b < 2; b++) {
+    for (k = 0; k < 5; k++) {
+      c->runs[b][k] = (uint32_t)(atleast[b][k] - atleast[b][k + 1]);
+    }
+    c->runs[b][5] = (uint32_t)atleast[b][5];
+  }
+}
+
+__attribute__((target("popcnt"))) static void
+count_popcnt(const uint8_t *x, struct rndtest_counts *c) {
+  uint64_t a[2][NPAD], atleast[2][6], w, y, next;
+  int i, b, k;
+
+  memset(c, 0, sizeof(*c));
+  memset(atleast, 0, sizeof(atleast));
+  streams(x, a);
+  for (b = 0; b < 2; b++) {
+    for (i = 1; i <= NWORDS; i++) {
+      w = a[b][i];
+      next = a[b][i + 1];
+      y = w & ~((w << 1) | (a[b][i - 1] >> 63));
+      atleast[b][0] += (uint64_t)__builtin_popcountll(y);
+      for (k = 1; k < 6; k++) {
+        y &= (w >> k) | (next << (64 - k));
+        atleast[b][k] += (uint64_t)__builtin_popcountll(y);
+      }
+    }
+  }
+  for (i = 1; i <= NWORDS; i++) {
+    c->ones += (uint32_t)__builtin_popcountll(a[1][i]);
+  }
+  runs_from(c, atleast);
+  c->longruns = longruns(x, a);
+  for (i = 0; i < RNDTEST_NBYTES; i++) {
+    c->nibbles[x[i] & 0x0f]++;
+    c->nibbles[x[i] >> 4]++;
+  }
+}
+
+/* the popcount of each 64-bit lane by a nibble lookup with pshufb */
+__attribute__((target("avx2"))) static inline __m256i popcnt256(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                       3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                       2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  return _mm256_sad_epu8(
+      _mm256_add_epi8(
+          _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+          _mm256_shuffle_epi8(lut,
+                              _mm256_and_si256(_mm256_srli_epi16(v, 4), low))),
+      _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) static inline uint64_t sum256(__m256i v) {
+  uint64_t sum[4];
+
+  _mm256_storeu_si256((__m256i *)sum, v);
+  return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+/*
+ * the streams four words at a time, with the zero words after them,
+ * and the nibbles by subtracting the compare results from byte counters,
+ * which hold up to 2 * 78 counts of the 78 vectors of a sample
+ */
+__attribute__((target("avx2,popcnt"))) static void
+count_avx2(const uint8_t *x, struct rndtest_counts *c) {
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  uint64_t a[2][NPAD], atleast[2][6];
+  __m256i w, y, prev, next, ones, acc[16], cnt[6];
+  __m128i n;
+  size_t i;
+  int b, k;
+
+  memset(c, 0, sizeof(*c));
+  streams(x, a);
+  for (b = 0; b < 2; b++) {
+    for (k = 0; k < 6; k++) {
+      cnt[k] = _mm256_setzero_si256();
+    }
+    for (i = 1; i <= NWORDS; i += 4) {
+      w = _mm256_loadu_si256((const __m256i *)&a[b][i]);
+      prev = _mm256_loadu_si256((const __m256i *)&a[b][i - 1]);
+      next = _mm256_loadu_si256((const __m256i *)&a[b][i + 1]);
+      y = _mm256_andnot_si256(
+          _mm256_or_si256(_mm256_slli_epi64(w, 1), _mm256_srli_epi64(prev, 63)),
+          w);
+      cnt[0] = _mm256_add_epi64(cnt[0], popcnt256(y));
+      for (k = 1; k < 6; k++) {
+        n = _mm_cvtsi32_si128(k);
+        y = _mm256_and_si256(
+            y, _mm256_or_si256(_mm256_srl_epi64(w, n),
+                               _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - k))));
+        cnt[k] = _mm256_add_epi64(cnt[k], popcnt256(y));
+      }
+    }
+    for (k = 0; k < 6; k++) {
+      atleast[b][k] = sum256(cnt[k]);
+    }
+  }
+  runs_from(c, atleast);
+  c->longruns = longruns(x, a);
+  ones = _mm256_setzero_si256();
+  for (k = 0; k < 16; k++) {
+    acc[k] = _mm256_setzero_si256();
+  }
+  for (i = 0; i + 32 <= RNDTEST_NBYTES; i += 32) {
+    w = _mm256_loadu_si256((const __m256i *)(x + i));
+    ones = _mm256_add_epi64(ones, popcnt256(w));
+    prev = _mm256_and_si256(w, low);
+    next = _mm256_and_si256(_mm256_srli_epi16(w, 4), low);
+    for (k = 0; k < 16; k++) {
+      acc[k] = _mm256_sub_epi8(
+          _mm256_sub_epi8(acc[k],
+                          _mm256_cmpeq_epi8(prev, _mm256_set1_epi8((char)k))),
+          _mm256_cmpeq_epi8(next, _mm256_set1_epi8((char)k)));
+    }
+  }
+  c->ones = (uint32_t)sum256(ones);
+  for (k = 0; k < 16; k++) {
+    c->nibbles[k] =
+        (uint32_t)sum256(_mm256_sad_epu8(acc[k], _mm256_setzero_si256()));
+  }
+  for (; i < RNDTEST_NBYTES; i++) {
+    c->ones += (uint32_t)__builtin_popcount(x[i]);
+    c->nibbles[x[i] & 0x0f]++;
+    c->nibbles[x[i] >> 4]++;
+  }
+}
+
+static int rndtest_has_popcnt(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("popcnt");
+}
+
+static int rndtest_has_avx2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+#endif
+
+static const struct rndtest_kernel {
+  const char *name;
+  void (*count)(const uint8_t *x, struct rndtest_counts *c);
+  int (*supported)(void);
+} rndtest_kernels[] = {
+#if defined(__x86_64__)
+    {"avx2", count_avx2, rndtest_has_avx2},
+    {"popcnt", count_popcnt, rndtest_has_popcnt},
+#endif
+    {"c", count_c, NULL},
+};
+
+#define NKERNELS (sizeof(rndtest_kernels) / sizeof(rndtest_kernels[0]))
+
+static const struct rndtest_kernel *rndtest_current = NULL;
+
+static const struct rndtest_kernel *rndtest_kernel(void) {
+  size_t i;
+
+  if (rndtest_current == NULL) {
+    for (i = 0; i < NKERNELS; i++) {
+      if ((rndtest_kernels[i].supported == NULL) ||
+          rndtest_kernels[i].supported()) {
+        rndtest_current = &rndtest_kernels[i];
+        break;
+      }
+    }
+  }
+  return rndtest_current;
+}
+
+int rndtest_select(const char *name) {
+  size_t i;
+
+  if ((name == NULL) || (strcmp(name, "auto") == 0)) {
+    rndtest_current = NULL;
+    rndtest_kernel();
+    return 0;
+  }
+  for (i = 0; i < NKERNELS; i++) {
+    if (strcmp(name, rndtest_kernels[i].name) == 0) {
+      if ((rndtest_kernels[i].supported != NULL) &&
+          !rndtest_kernels[i].supported()) {
+        return -1;
+      }
+      rndtest_current = &rndtest_kernels[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *rndtest_name(void) { return rndtest_kernel()->name; }
+
+const char *rndtest_names(void) {
+#if defined(__x86_64__)
+  return "avx2 popcnt c";
+#else
+  return "c";
+#endif
+}
+
+void rndtest_count(const uint8_t *x, struct rndtest_counts *c) {
+  rndtest_kernel()->count(x, c);
+}
+
+int rndtest_sample(const uint8_t *x) {
+  struct rndtest_counts c;
+  uint64_t sum = 0;
+  int fail = 0, i, b;
+
+  rndtest_count(x, &c);
+  if ((c.ones <= RNDTEST_MONOBIT_MINONES) ||
+      (c.ones >= RNDTEST_MONOBIT_MAXONES)) {
+    fail |= RNDTEST_FAIL_MONOBIT;
+  }
+  for (b = 0; b < 2; b++) {
+    for (i = 0; i < 6; i++) {
+      if ((c.runs[b][i] < rndtest_runs_tab[i].min) ||
+          (c.runs[b][i] > rndtest_runs_tab[i].max)) {
+        fail |= RNDTEST_FAIL_RUNS;
+      }
+    }
+  }
+  if (c.longruns > 0) {
+    fail |= RNDTEST_FAIL_LONGRUNS;
+  }
+  for (i = 0; i < 16; i++) {
+    sum += (uint64_t)c.nibbles[i] * c.nibbles[i];
+  }
+  sum = sum * 16 - (uint64_t)RNDTEST_CHI4_Q * RNDTEST_CHI4_Q;
+  if ((sum <= RNDTEST_CHI4_S_MIN) || (sum >= RNDTEST_CHI4_S_MAX)) {
+    fail |= RNDTEST_FAIL_CHI;
+  }
+  return fail;
+}
+
+void rndtest_init(struct rndtest *r) {
+  r->fill = 0;
+  r->collect = 1;
+  r->discard = 1;
+  r->next = 0;
+  r->tests = 0;
+  memset(r->fails, 0, sizeof(r->fails));
+}
+
+int rndtest_block(struct rndtest *r, const uint8_t *data, size_t len,
+                  uint64_t now, uint64_t retest) {
+  size_t off, n;
+  int fail = -1, f, i;
+
+  r->tests = 0;
+  memset(r->fails, 0, sizeof(r->fails));
+  if (!r->collect && (now >= r->next)) {
+    r->collect = 1;
+  }
+  for (off = 0; r->collect && (off < len); off += n) {
+    n = MIN(len - off, RNDTEST_NBYTES - r->fill);
+    memcpy(r->buf + r->fill, data + off, n);
+    r->fill += (uint32_t)n;
+    if (r->fill < RNDTEST_NBYTES) {
+      break;
+    }
+    r->fill = 0;
+    f = rndtest_sample(r->buf);
+    r->tests++;
+    for (i = 0; i < RNDTEST_NTESTS; i++) {
+      r->fails[i] += (uint32_t)((f >> i) & 1);
+    }
+    fail = (fail == -1) ? f : fail | f;
+    /* a block holding a failing sample is discarded as a whole */
+    r->discard = (fail != 0);
+    if (retest > 0) {
+      r->collect = 0;
+      r->next = now + retest;
+    }
+  }
+  return fail;
+}
@@ -0,0 +1,89 @@
+/*
+ * Feeder for /dev/trng: the statistical tests of rndtest(4)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The FIPS 140-2 monobit, runs, long runs and poker (chi-square)
+ * tests on samples of 20000 bits, with the bounds of rndtest(4),
+ * which screened the input of the kernel driver before 0.5.0.
+ * As rndtest(4), a sample is collected every retest interval
+ * (or continuously with 0), and the input is discarded
+ * from a failing sample until the next sample passes.
+ * The conditioner holds the blocks going into a sample until it is tested,
+ * so that they are dropped as a whole with a failing sample;
+ * r->collect and r->fill tell whether a block went into a sample
+ * not yet completed.
+ */
+
+#ifndef _FEEDTRNG_RNDTEST_H_
+#define _FEEDTRNG_RNDTEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* bytes of a sample */
+#define RNDTEST_NBYTES (2500)
+
+/* default retest interval [s], as kern.rndtest.retest */
+#define RNDTEST_RETEST (120)
+
+/* monobit: the ones must be within (MINONES, MAXONES) */
+#define RNDTEST_MONOBIT_MINONES (9725)
+#define RNDTEST_MONOBIT_MAXONES (10275)
+
+/* long runs: a run of this length or longer fails */
+#define RNDTEST_LONGRUNS (26)
+
+/* poker: 16 * sum(f^2) - Q^2 of the Q nibbles within (S_MIN, S_MAX) */
+#define RNDTEST_CHI4_Q (5000)
+#define RNDTEST_CHI4_S_MIN (10800)
+#define RNDTEST_CHI4_S_MAX (230850)
+
+/* failure flags returned by rndtest_sample(), bit i for fails[i] */
+#define RNDTEST_FAIL_MONOBIT (0x01)
+#define RNDTEST_FAIL_RUNS (0x02)
+#define RNDTEST_FAIL_LONGRUNS (0x04)
+#define RNDTEST_FAIL_CHI (0x08)
+#define RNDTEST_NTESTS (4)
+
+/* the counts of a sample, by the kernels */
+struct rndtest_counts {
+  uint32_t ones;
+  uint32_t runs[2][6]; /* of zeros and of ones, by length 1 to 6 and more */
+  uint32_t longruns; /* of RNDTEST_LONGRUNS bits or more */
+  uint32_t nibbles[16];
+};
+
+/* the screening state of a source */
+struct rndtest {
+  uint8_t buf[RNDTEST_NBYTES];
+  uint32_t fill;
+  int collect;   /* collecting a sample */
+  int discard;   /* the last sample failed, or none has passed yet */
+  uint64_t next; /* when to collect the next sample [ns] */
+  /* the samples tested in the last block, and their failures */
+  uint32_t tests;
+  uint32_t fails[RNDTEST_NTESTS];
+};
+
+/*
+ * rndtest_init() starts collecting the first sample.
+ * rndtest_block() adds a block of input at now [ns],
+ * tests the samples completed, counts them in r->tests and r->fails,
+ * and sets r->discard for the block;
+ * returns the failure flags of the samples, or -1 when none was tested.
+ * rndtest_sample() tests a sample of RNDTEST_NBYTES bytes.
+ * rndtest_count() counts a sample with the current kernel.
+ * rndtest_select() chooses the kernel by name ("avx2", "popcnt", "c"
+ * or "auto"), and returns -1 when the kernel is unknown or not supported.
+ */
+extern void rndtest_init(struct rndtest *r);
+extern int rndtest_block(struct rndtest *r, const uint8_t *data, size_t len,
+                         uint64_t now, uint64_t retest);
+extern int rndtest_sample(const uint8_t *x);
+extern void rndtest_count(const uint8_t *x, struct rndtest_counts *c);
+extern int rndtest_select(const char *name);
+extern const char *rndtest_name(void);
+extern const char *rndtest_names(void);
+
+#endif /* _FEEDTRNG_RNDTEST_H_ */
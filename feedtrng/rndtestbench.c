@@ -0,0 +1,197 @@
+/*
+ * rndtest benchmark for feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Checks that the popcnt and AVX2 kernels of the rndtest(4) tests
+ * count the samples as the portable C kernel does,
+ * and that the tests pass random samples and fail broken ones,
+ * then reports the throughput of screening every sample
+ * for each kernel.
+ *
+ * To compile:
+ * cc -O2 -o rndtestbench rndtestbench.c rndtest.c
+ *
+ * Usage: rndtestbench [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rndtest.h"
+
+static const char *kernels[] = {"c", "popcnt", "avx2"};
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/* samples of the self-check, and of the benchmark data */
+#define CHECKSAMPLES (1000)
+#define DATASIZE (RNDTEST_NBYTES * 64)
+
+static double seconds = 0.5;
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift64*, for reproducible test data */
+static uint64_t rng = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint8_t next(void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint8_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 56);
+}
+
+/* a sample of the kind k: random, biased, with runs, or constant */
+static void fill(uint8_t *x, int k) {
+  size_t i;
+
+  for (i = 0; i < RNDTEST_NBYTES; i++) {
+    switch (k) {
+    case 0:
+      x[i] = next();
+      break;
+    case 1: /* about 53% ones */
+      x[i] = next() | ((next() < 64) ? (uint8_t)(1 << (next() % 8)) : 0);
+      break;
+    case 2: /* runs of 0 to 31 bits here and there */
+      x[i] = next();
+      if ((i % 512 == 0) && (i + 4 <= RNDTEST_NBYTES)) {
+        memset(x + i, (next() & 1) ? 0xff : 0, next() % 4);
+      }
+      break;
+    default: /* nibbles, or a stuck source */
+      x[i] = (k == 3) ? 0x0f : 0xff;
+    }
+  }
+}
+
+static void self_check(void) {
+  struct rndtest_counts expect, got;
+  uint8_t x[RNDTEST_NBYTES];
+  int fails[2] = {0, 0};
+  size_t i, j;
+
+  for (i = 0; i < CHECKSAMPLES; i++) {
+    fill(x, (int)(i % 5));
+    rndtest_select("c");
+    rndtest_count(x, &expect);
+    if ((i % 5) == 0) {
+      fails[0] += (rndtest_sample(x) != 0);
+    } else if ((i % 5) == 4) {
+      fails[1] += (rndtest_sample(x) != 0);
+    }
+    for (j = 1; j < NKERNELS; j++) {
+      if (rndtest_select(kernels[j]) != 0) {
+        continue;
+      }
+      rndtest_count(x, &got);
+      if (memcmp(&expect, &got, sizeof(got)) != 0) {
+        errx(EX_SOFTWARE, "kernel %s mismatch at sample %zu", kernels[j], i);
+      }
+    }
+  }
+  /* 1 - 0.9999^4 of random samples fail by chance; allow a few */
+  if (fails[0] > 5) {
+    errx(EX_SOFTWARE, "%d of %d random samples failed", fails[0],
+         CHECKSAMPLES / 5);
+  }
+  if (fails[1] != CHECKSAMPLES / 5) {
+    errx(EX_SOFTWARE, "constant samples passed");
+  }
+  rndtest_select("auto");
+  fprintf(stderr, "rndtest: self-check passed (%d random samples failed)\n",
+          fails[0]);
+}
+
+/* MiB/s of testing every sample of the data */
+static double run_case(const uint8_t *data) {
+  uint64_t samples = 0;
+  double t0, t;
+  int i, fail = 0;
+
+  t0 = now();
+  do {
+    for (i = 0; i < DATASIZE / RNDTEST_NBYTES; i++) {
+      fail |= rndtest_sample(data + i * RNDTEST_NBYTES);
+    }
+    samples += DATASIZE / RNDTEST_NBYTES;
+    t = now() - t0;
+  } while (t < seconds);
+  if (fail) {
+    fprintf(stderr, "rndtest: (failure %d)\n", fail);
+  }
+  return (double)samples * RNDTEST_NBYTES / t / 1048576;
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  uint8_t *data;
+  double mibs;
+  FILE *out;
+  size_t i;
+  int ch, first = 1;
+
+  while ((ch = getopt(argc, argv, "t:o:")) != -1) {
+    switch (ch) {
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  self_check();
+
+  /* random data, mostly passing the tests */
+  if ((data = malloc(DATASIZE)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  rng = UINT64_C(0x9E3779B97F4A7C15);
+  for (i = 0; i < DATASIZE; i++) {
+    data[i] = next();
+  }
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(out,
+          "{\n  \"benchmark\": \"rndtestbench\",\n  \"default_kernel\": \"%s\",\n"
+          "  \"sample_bytes\": %d,\n  \"seconds_per_case\": %.3f,\n"
+          "  \"results\": [",
+          rndtest_name(), RNDTEST_NBYTES, seconds);
+  for (i = 0; i < NKERNELS; i++) {
+    if (rndtest_select(kernels[i]) != 0) {
+      continue;
+    }
+    mibs = run_case(data);
+    fprintf(out, "%s\n    {\"kernel\": \"%s\", \"mib_per_s\": %.2f}",
+            first ? "" : ",", kernels[i], mibs);
+    first = 0;
+    fprintf(stderr, "rndtest %-6s: %9.1f MiB/s\n", kernels[i], mibs);
+  }
+  rndtest_select("auto");
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(data);
+  return 0;
+}
@@ -0,0 +1,518 @@
+/*
+ * Feeder for /dev/trng: EGD-style entropy server on a Unix domain socket
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The commands of the Entropy Gathering Daemon protocol:
+ *   0x00: the entropy available, 4 bytes of bits, MSB first:
+ *         the bits credited to the bytes in the pool by the sink
+ *   0x01 n: read up to n bytes without blocking; a count byte, then the bytes
+ *   0x02 n: read n bytes, blocking until all are available
+ *   0x03 bits(2) n data(n): add entropy; accepted and discarded
+ *   0x04: the process ID, a length byte, then the decimal string
+ * Any other command closes the connection.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "server.h"
+
+/* the udata of the listening socket and the pipe */
+#define LISTENER ((void *)1)
+#define INPUT ((void *)2)
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static size_t pool_used(const struct server *srv) {
+  return (size_t)(srv->head - srv->tail);
+}
+
+/*
+ * count the bits of entropy of the bytes read from the pipe since the last
+ * call: their share of the bits written into it and not read before,
+ * once the sink has counted writing them, which may be after they are read,
+ * and up to 8 per byte, as its two counters may be seen half updated;
+ * the pool keeps the share of those not handed out yet
+ */
+static void pool_settle(struct server *srv) {
+  uint64_t written, n = srv->head - srv->credited, bits;
+
+  if ((srv->inbits == NULL) || (n == 0) ||
+      ((written = STAT_GET(*srv->inbytes)) < srv->head)) {
+    return;
+  }
+  bits = STAT_GET(*srv->inbits) - srv->bitsin;
+  if (written - srv->credited > n) {
+    bits = bits * n / (written - srv->credited);
+  }
+  bits = MIN(bits, n * 8);
+  srv->bitsin += bits;
+  srv->credited = srv->head;
+  srv->bits += bits * MIN(n, pool_used(srv)) / n;
+}
+
+/* move n bytes from the pool to the output queue of the client */
+static void pool_take(struct server *srv, struct client *c, size_t n) {
+  size_t off = (size_t)srv->tail & (SERVER_POOLSIZE - 1);
+  size_t first = MIN(n, SERVER_POOLSIZE - off);
+
+  /* the bytes take their share of the bits with them */
+  pool_settle(srv);
+  srv->bits -= (n > 0) ? srv->bits * n / pool_used(srv) : 0;
+
+  memcpy(c->out + c->outoff + c->outlen, srv->pool + off, first);
+  memcpy(c->out + c->outoff + c->outlen + first, srv->pool, n - first);
+  c->outlen += (uint32_t)n;
+  srv->tail += n;
+  STAT_ADD(c->stats.bytes, n);
+  STAT_ADD(srv->stats.bytesout, n);
+}
+
+/* room in the output queue, moving the queued bytes to the front */
+static size_t client_room(struct client *c) {
+  if (c->outoff > 0) {
+    memmove(c->out, c->out + c->outoff, c->outlen);
+    c->outoff = 0;
+  }
+  return SERVER_OUTSIZE - c->outlen;
+}
+
+static void client_reply(struct client *c, const void *buf, size_t len) {
+  memcpy(c->out + c->outoff + c->outlen, buf, len);
+  c->outlen += (uint32_t)len;
+}
+
+static void client_close(struct server *srv, struct client *c) {
+  evl_set(srv->evl, c->fd, c->flags, 0, c);
+  close(c->fd);
+  c->fd = -1;
+  atomic_store_explicit(&c->stats.start, 0, memory_order_relaxed);
+  srv->nclients--;
+}
+
+/* the read is complete when its last byte is queued */
+static void client_queued(struct client *c) {
+  c->reqend = c->sent + c->outlen;
+  STAT_ADD(c->stats.requests, 1);
+}
+
+/*
+ * parse the commands in the input queue while their replies fit;
+ * returns -1 on a protocol error
+ */
+static int client_parse(struct server *srv, struct client *c) {
+  uint8_t reply[SERVER_MAXREPLY];
+  size_t n, used;
+  uint32_t bits;
+  int len;
+
+  while ((c->inlen > 0) && (c->want == 0) && (c->reqend == 0) &&
+         (client_room(c) >= SERVER_MAXREPLY)) {
+    used = 1;
+    switch (c->in[0]) {
+    case 0x00:
+      pool_settle(srv);
+      bits = (uint32_t)MIN(srv->bits, UINT32_MAX);
+      reply[0] = (uint8_t)(bits >> 24);
+      reply[1] = (uint8_t)(bits >> 16);
+      reply[2] = (uint8_t)(bits >> 8);
+      reply[3] = (uint8_t)bits;
+      client_reply(c, reply, 4);
+      break;
+    case 0x01:
+    case 0x02:
+      if (c->inlen < 2) {
+        return 0;
+      }
+      used = 2;
+      c->reqstart = now_ns();
+      if (c->in[0] == 0x02) {
+        /* queued by server_serve() in the turn of the client */
+        c->want = c->in[1];
+        STAT_ADD(c->stats.waiting, c->want);
+        break;
+      }
+      n = MIN(c->in[1], pool_used(srv));
+      reply[0] = (uint8_t)n;
+      client_reply(c, reply, 1);
+      pool_take(srv, c, n);
+      client_queued(c);
+      break;
+    case 0x03:
+      if ((c->inlen < 4) || (c->inlen < 4 + (uint32_t)c->in[3])) {
+        return 0;
+      }
+      used = 4 + c->in[3];
+      break;
+    case 0x04:
+      len = snprintf((char *)reply + 1, sizeof(reply) - 1, "%ld",
+                     (long)getpid());
+      reply[0] = (uint8_t)len;
+      client_reply(c, reply, 1 + (size_t)len);
+      break;
+    default:
+      return -1;
+    }
+    c->inlen -= (uint32_t)used;
+    memmove(c->in, c->in + used, c->inlen);
+  }
+  return 0;
+}
+
+/* send the output queue; returns -1 when the client is gone */
+static int client_flush(struct server *srv, struct client *c) {
+  ssize_t n;
+  uint64_t lat;
+
+  if (c->outlen > 0) {
+    if ((n = send(c->fd, c->out + c->outoff, c->outlen, MSG_NOSIGNAL)) == -1) {
+      return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+    }
+    c->outoff += (uint32_t)n;
+    c->outlen -= (uint32_t)n;
+    c->sent += (uint64_t)n;
+  }
+  if ((c->reqend != 0) && (c->sent >= c->reqend)) {
+    lat = now_ns() - c->reqstart;
+    STAT_ADD(c->stats.latency, lat);
+    if (lat > STAT_GET(c->stats.maxlatency)) {
+      atomic_store_explicit(&c->stats.maxlatency, lat, memory_order_relaxed);
+    }
+    c->reqend = 0;
+  }
+  if (c->outlen == 0) {
+    c->outoff = 0;
+  }
+  return 0;
+}
+
+/* read the commands of the client; returns -1 when the client is gone */
+static int client_read(struct client *c) {
+  ssize_t n;
+
+  if (c->inlen == SERVER_INSIZE) {
+    return 0;
+  }
+  if ((n = read(c->fd, c->in + c->inlen, SERVER_INSIZE - c->inlen)) == -1) {
+    return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+  }
+  if (n == 0) {
+    return -1;
+  }
+  c->inlen += (uint32_t)n;
+  return 0;
+}
+
+/* watch for the commands while there is room for them, and for the replies */
+static void client_watch(struct server *srv, struct client *c) {
+  int flags = ((c->inlen < SERVER_INSIZE) ? EVL_READ : 0) |
+              ((c->outlen > 0) ? EVL_WRITE : 0);
+
+  if (flags != c->flags) {
+    if (evl_set(srv->evl, c->fd, c->flags, flags, c) == -1) {
+      err(EX_OSERR, "cannot watch client");
+    }
+    c->flags = flags;
+  }
+}
+
+static void server_accept(struct server *srv) {
+  struct client *c;
+  int fd, i;
+
+  while ((fd = accept(srv->lfd, NULL, NULL)) != -1) {
+    if (srv->nclients == SERVER_MAXCLIENTS) {
+      close(fd);
+      STAT_ADD(srv->stats.rejected, 1);
+      continue;
+    }
+    for (i = 0; srv->clients[i].fd != -1; i++)
+      ;
+    c = &srv->clients[i];
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+      close(fd);
+      STAT_ADD(srv->stats.errors, 1);
+      continue;
+    }
+    c->fd = fd;
+    c->flags = 0;
+    c->inlen = c->outoff = c->outlen = c->want = 0;
+    c->sent = c->reqend = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
+    atomic_store_explicit(&c->stats.id, ++srv->seq, memory_order_relaxed);
+    atomic_store_explicit(&c->stats.start, now_ns(), memory_order_relaxed);
+    srv->nclients++;
+    STAT_ADD(srv->stats.accepted, 1);
+    client_watch(srv, c);
+  }
+  if ((errno != EAGAIN) && (errno != EINTR) && (errno != ECONNABORTED)) {
+    err(EX_OSERR, "cannot accept on %s", srv->path);
+  }
+}
+
+/* read the output of the sink into the free part of the pool */
+static void server_input(struct server *srv) {
+  size_t off = (size_t)srv->head & (SERVER_POOLSIZE - 1);
+  size_t n = MIN(SERVER_POOLSIZE - pool_used(srv), SERVER_POOLSIZE - off);
+  ssize_t rsize;
+
+  if (n == 0) {
+    return;
+  }
+  if ((rsize = read(srv->infd, srv->pool + off, n)) == -1) {
+    if ((errno == EAGAIN) || (errno == EINTR)) {
+      return;
+    }
+    err(EX_IOERR, "read from the pipeline failed");
+  }
+  if (rsize == 0) {
+    errx(EX_SOFTWARE, "the pipeline is closed");
+  }
+  srv->head += (uint64_t)rsize;
+  pool_settle(srv);
+  STAT_ADD(srv->stats.bytesin, rsize);
+  if (pool_used(srv) == SERVER_POOLSIZE) {
+    STAT_ADD(srv->stats.full, 1);
+  }
+}
+
+/*
+ * fair scheduling: give each client waiting for a blocking read
+ * up to SERVER_QUANTUM bytes in turn, starting from a different client
+ * in each call, until the pool is empty or no one is waiting
+ */
+static void server_serve(struct server *srv) {
+  struct client *c;
+  size_t n;
+  unsigned i, k;
+  int served;
+
+  do {
+    served = 0;
+    for (k = 0; (k < SERVER_MAXCLIENTS) && (pool_used(srv) > 0); k++) {
+      i = (srv->next + k) % SERVER_MAXCLIENTS;
+      c = &srv->clients[i];
+      if ((c->fd == -1) || (c->want == 0)) {
+        continue;
+      }
+      n = MIN(MIN(SERVER_QUANTUM, c->want),
+              MIN(pool_used(srv), client_room(c)));
+      if (n == 0) {
+        continue;
+      }
+      pool_take(srv, c, n);
+      c->want -= (uint32_t)n;
+      STAT_ADD(c->stats.waiting, -(uint_fast64_t)n);
+      if (c->want == 0) {
+        client_queued(c);
+      }
+      served = 1;
+    }
+  } while (served && (pool_used(srv) > 0));
+  srv->next = (srv->next + 1) % SERVER_MAXCLIENTS;
+}
+
+static void server_watch(struct server *srv) {
+  int lflags = (srv->nclients < SERVER_MAXCLIENTS) ? EVL_READ : 0;
+  int inflags = (pool_used(srv) < SERVER_POOLSIZE) ? EVL_READ : 0;
+
+  if (lflags != srv->lflags) {
+    if (evl_set(srv->evl, srv->lfd, srv->lflags, lflags, LISTENER) == -1) {
+      err(EX_OSERR, "cannot watch %s", srv->path);
+    }
+    srv->lflags = lflags;
+  }
+  if (inflags != srv->inflags) {
+    if (evl_set(srv->evl, srv->infd, srv->inflags, inflags, INPUT) == -1) {
+      err(EX_OSERR, "cannot watch the pipeline");
+    }
+    srv->inflags = inflags;
+  }
+}
+
+static void *server_main(void *arg) {
+  struct server *srv = arg;
+  struct evl_event ev[SERVER_MAXCLIENTS + 2];
+  struct client *c;
+  int i, n, timeout = -1;
+
+  while (1) {
+    server_watch(srv);
+    if ((n = evl_wait(srv->evl, ev, SERVER_MAXCLIENTS + 2, timeout)) == -1) {
+      err(EX_OSERR, "event loop wait failed");
+    }
+    for (i = 0; i < n; i++) {
+      if (ev[i].udata == LISTENER) {
+        server_accept(srv);
+      } else if (ev[i].udata == INPUT) {
+        server_input(srv);
+      } else if ((ev[i].flags & EVL_READ) &&
+                 (client_read(c = ev[i].udata) == -1)) {
+        client_close(srv, c);
+      }
+    }
+    /* parse, serve the blocking reads, then send as much as possible */
+    for (i = 0; i < SERVER_MAXCLIENTS; i++) {
+      c = &srv->clients[i];
+      if ((c->fd != -1) && (client_parse(srv, c) == -1)) {
+        STAT_ADD(srv->stats.errors, 1);
+        client_close(srv, c);
+      }
+    }
+    server_serve(srv);
+    timeout = -1;
+    for (i = 0; i < SERVER_MAXCLIENTS; i++) {
+      c = &srv->clients[i];
+      if (c->fd == -1) {
+        continue;
+      }
+      if ((client_flush(srv, c) == -1) || (client_parse(srv, c) == -1)) {
+        STAT_ADD(srv->stats.errors, 1);
+        client_close(srv, c);
+        continue;
+      }
+      client_watch(srv, c);
+      /* a read parsed after its previous one was sent */
+      if ((c->want > 0) && (pool_used(srv) > 0)) {
+        timeout = 0;
+      }
+    }
+  }
+  /* notreached */
+  return NULL;
+}
+
+int server_open(struct server *srv, const char *path) {
+  struct sockaddr_un sun;
+  struct stat st;
+  int fds[2], i;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if ((snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path) >=
+       (int)sizeof(sun.sun_path)) ||
+      (snprintf(srv->path, sizeof(srv->path), "%s", path) >=
+       (int)sizeof(srv->path))) {
+    errx(EX_USAGE, "socket path %s too long", path);
+  }
+  /* a socket left by the previous run */
+  if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+  if (((srv->lfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) ||
+      (bind(srv->lfd, (struct sockaddr *)&sun, sizeof(sun)) == -1) ||
+      (listen(srv->lfd, SOMAXCONN) == -1) ||
+      (fcntl(srv->lfd, F_SETFL, O_NONBLOCK) == -1)) {
+    err(EX_OSERR, "cannot listen on %s", path);
+  }
+  if (pipe(fds) == -1) {
+    err(EX_OSERR, "cannot open the pipe to the server");
+  }
+  srv->infd = fds[0];
+  if (fcntl(srv->infd, F_SETFL, O_NONBLOCK) == -1) {
+    err(EX_OSERR, "cannot open the pipe to the server");
+  }
+  if ((srv->evl = evl_open()) == -1) {
+    err(EX_OSERR, "cannot open event loop");
+  }
+  if ((srv->pool = malloc(SERVER_POOLSIZE)) == NULL) {
+    err(EX_OSERR, "cannot allocate the pool");
+  }
+  srv->lflags = srv->inflags = 0;
+  srv->head = srv->tail = 0;
+  srv->inbytes = srv->inbits = NULL;
+  srv->bitsin = srv->credited = srv->bits = 0;
+  srv->next = 0;
+  srv->nclients = 0;
+  srv->seq = 0;
+  for (i = 0; i < SERVER_MAXCLIENTS; i++) {
+    srv->clients[i].fd = -1;
+    memset(&srv->clients[i].stats, 0, sizeof(srv->clients[i].stats));
+  }
+  memset(&srv->stats, 0, sizeof(srv->stats));
+  return fds[1];
+}
+
+void server_credit(struct server *srv, const atomic_uint_fast64_t *bytes,
+                   const atomic_uint_fast64_t *bits) {
+  srv->inbytes = bytes;
+  srv->inbits = bits;
+}
+
+/* start the thread with all signals blocked, as the pipeline threads */
+void server_start(struct server *srv) {
+  sigset_t all, old;
+  int error;
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if ((error = pthread_create(&srv->tid, NULL, server_main, srv)) != 0) {
+    errno = error;
+    err(EX_OSERR, "cannot create server thread");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * the counters of each client, read while the server runs;
+ * a client connecting or leaving meanwhile may be shown half updated
+ */
+void server_stats(struct server *srv, FILE *fp) {
+  struct client_stats *cs;
+  uint_fast64_t start, requests, bytes;
+  double secs;
+  uint64_t t = now_ns();
+  int i;
+
+  fprintf(fp,
+          "feedtrng: server %s %" PRIuFAST64 " clients accepted %" PRIuFAST64
+          " rejected %" PRIuFAST64 " errors\n"
+          "feedtrng: server %" PRIuFAST64 " bytes in %" PRIuFAST64
+          " bytes out %" PRIuFAST64 " times full\n",
+          srv->path, STAT_GET(srv->stats.accepted),
+          STAT_GET(srv->stats.rejected), STAT_GET(srv->stats.errors),
+          STAT_GET(srv->stats.bytesin), STAT_GET(srv->stats.bytesout),
+          STAT_GET(srv->stats.full));
+  for (i = 0; i < SERVER_MAXCLIENTS; i++) {
+    cs = &srv->clients[i].stats;
+    if ((start = STAT_GET(cs->start)) == 0) {
+      continue;
+    }
+    requests = STAT_GET(cs->requests);
+    bytes = STAT_GET(cs->bytes);
+    secs = (t > start) ? (t - start) / 1e9 : 0;
+    fprintf(fp,
+            "feedtrng: client %" PRIuFAST64 " %.1f s %" PRIuFAST64
+            " reads %" PRIuFAST64 " bytes %.1f KiB/s latency mean %.3f ms"
+            " max %.3f ms %" PRIuFAST64 " bytes waiting\n",
+            STAT_GET(cs->id), secs, requests, bytes,
+            (secs > 0) ? bytes / secs / 1024 : 0,
+            (requests > 0) ? STAT_GET(cs->latency) / 1e6 / requests : 0,
+            STAT_GET(cs->maxlatency) / 1e6, STAT_GET(cs->waiting));
+  }
+  fflush(fp);
+}
+
+void server_close(struct server *srv) { unlink(srv->path); }
@@ -0,0 +1,121 @@
+/*
+ * Feeder for /dev/trng: EGD-style entropy server on a Unix domain socket
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_SERVER_H_
+#define _FEEDTRNG_SERVER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "ring.h"
+
+/* maximum number of clients connected at once */
+#define SERVER_MAXCLIENTS (64)
+
+/* conditioned bytes held for the clients; a power of 2 */
+#define SERVER_POOLSIZE (65536)
+
+/* bytes given to a waiting client per round */
+#define SERVER_QUANTUM (256)
+
+/* the input and output queue of a client */
+#define SERVER_INSIZE (512)
+#define SERVER_OUTSIZE (4096)
+
+/* the longest reply to a command: the count byte and 255 bytes */
+#define SERVER_MAXREPLY (256)
+
+/*
+ * per-client counters, written by the server thread only;
+ * start is 0 while the slot is free
+ */
+struct client_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t id;
+  atomic_uint_fast64_t start;    /* connected [ns, CLOCK_MONOTONIC] */
+  atomic_uint_fast64_t requests; /* read commands */
+  atomic_uint_fast64_t bytes;    /* entropy bytes sent */
+  atomic_uint_fast64_t latency;  /* total time of the reads [ns] */
+  atomic_uint_fast64_t maxlatency;
+  atomic_uint_fast64_t waiting; /* bytes of the read not yet queued */
+};
+
+/*
+ * A client; the commands are parsed one at a time,
+ * and a read command must be sent out before the next one is parsed,
+ * so that a client not reading its replies only stops itself
+ */
+struct client {
+  int fd; /* -1 when free */
+  int flags;
+  uint8_t in[SERVER_INSIZE];
+  uint32_t inlen;
+  uint8_t out[SERVER_OUTSIZE];
+  uint32_t outoff;
+  uint32_t outlen;
+  uint32_t want;     /* bytes of the blocking read yet to be queued */
+  uint64_t sent;     /* bytes sent */
+  uint64_t reqend;   /* sent at the end of the pending read, 0 if none */
+  uint64_t reqstart; /* when the pending read was parsed [ns] */
+  struct client_stats stats;
+};
+
+/* server totals, written by the server thread only */
+struct server_stats {
+  _Alignas(CACHELINE) atomic_uint_fast64_t accepted;
+  atomic_uint_fast64_t rejected; /* over SERVER_MAXCLIENTS */
+  atomic_uint_fast64_t errors;   /* protocol and socket errors */
+  atomic_uint_fast64_t bytesin;  /* from the pipeline */
+  atomic_uint_fast64_t bytesout; /* to the clients */
+  atomic_uint_fast64_t full;     /* times the pool was full */
+};
+
+/*
+ * The server thread reads the output of the sink from a pipe
+ * into the pool, and hands out each byte of the pool to one client only.
+ * The pipe is not read while the pool is full,
+ * so slow clients stall the pipeline as /dev/trng would.
+ */
+struct server {
+  char path[MAXPATHLEN];
+  int lfd;  /* listening socket */
+  int infd; /* the read end of the pipe from the sink */
+  int evl;
+  int lflags;
+  int inflags;
+  uint8_t *pool;
+  uint64_t head; /* bytes read into the pool */
+  uint64_t tail; /* bytes handed out */
+  /* the bytes and the bits of entropy written into the pipe by the sink */
+  const atomic_uint_fast64_t *inbytes;
+  const atomic_uint_fast64_t *inbits;
+  uint64_t bitsin;   /* of those, the bits of the bytes read */
+  uint64_t credited; /* the bytes read whose bits are counted */
+  uint64_t bits;     /* the bits of entropy in the pool */
+  unsigned next; /* the first client of the next round */
+  int nclients;
+  uint64_t seq;
+  struct client clients[SERVER_MAXCLIENTS];
+  struct server_stats stats;
+  pthread_t tid;
+};
+
+/*
+ * server_open() listens on path, and returns the write end of the pipe
+ * for the sink, whose counters of the bytes and the bits written into it
+ * are then given to server_credit(); server_start() runs the server thread;
+ * server_close() removes the socket
+ */
+extern int server_open(struct server *srv, const char *path);
+extern void server_credit(struct server *srv,
+                          const atomic_uint_fast64_t *bytes,
+                          const atomic_uint_fast64_t *bits);
+extern void server_start(struct server *srv);
+extern void server_stats(struct server *srv, FILE *fp);
+extern void server_close(struct server *srv);
+
+#endif /* _FEEDTRNG_SERVER_H_ */
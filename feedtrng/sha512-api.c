@@ -34,13 +34,9 @@
 #include <string.h>
 #include <time.h>
 
+#include "sha512.h"
 
-/* Function prototypes */
-
-void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]);
-
-// Link this program with an external C or x86 compression function
-extern void sha512_compress(uint64_t state[8], const uint8_t block[128]);
+// sha512_compress() is the runtime-selected backend in sha512-select.c
 
 /* Full message hasher */
 
@@ -77,3 +73,212 @@ void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]) {
 		block[128 - 1 - i] = (uint8_t)(longLen >> (i * 8));
 	sha512_compress(hash, block);
 }
+
+
+/* Incremental hasher */
+
+void sha512_init(sha512_ctx *ctx) {
+	ctx->state[0] = UINT64_C(0x6A09E667F3BCC908);
+	ctx->state[1] = UINT64_C(0xBB67AE8584CAA73B);
+	ctx->state[2] = UINT64_C(0x3C6EF372FE94F82B);
+	ctx->state[3] = UINT64_C(0xA54FF53A5F1D36F1);
+	ctx->state[4] = UINT64_C(0x510E527FADE682D1);
+	ctx->state[5] = UINT64_C(0x9B05688C2B3E6C1F);
+	ctx->state[6] = UINT64_C(0x1F83D9ABFB41BD6B);
+	ctx->state[7] = UINT64_C(0x5BE0CD19137E2179);
+	ctx->len = 0;
+	ctx->buflen = 0;
+}
+
+void sha512_update(sha512_ctx *ctx, const void *data, size_t len) {
+	const uint8_t *p = data;
+	size_t n;
+	
+	ctx->len += len;
+	if (ctx->buflen > 0) {
+		n = SHA512_BLOCK_LENGTH - ctx->buflen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->buf + ctx->buflen, p, n);
+		ctx->buflen += (uint32_t)n;
+		p += n;
+		len -= n;
+		if (ctx->buflen < SHA512_BLOCK_LENGTH)
+			return;
+		sha512_compress(ctx->state, ctx->buf);
+		ctx->buflen = 0;
+	}
+	// full blocks are compressed straight from the caller's buffer
+	for (; len >= SHA512_BLOCK_LENGTH; p += SHA512_BLOCK_LENGTH, len -= SHA512_BLOCK_LENGTH)
+		sha512_compress(ctx->state, p);
+	memcpy(ctx->buf, p, len);
+	ctx->buflen = (uint32_t)len;
+}
+
+void sha512_final(sha512_ctx *ctx, uint64_t hash[8]) {
+	uint32_t rem = ctx->buflen;
+	int i;
+	
+	ctx->buf[rem] = 0x80;
+	rem++;
+	if (128 - rem >= 16)
+		memset(ctx->buf + rem, 0, 120 - rem);
+	else {
+		memset(ctx->buf + rem, 0, 128 - rem);
+		sha512_compress(ctx->state, ctx->buf);
+		memset(ctx->buf, 0, 120);
+	}
+	
+	uint64_t longLen = ctx->len << 3;
+	for (i = 0; i < 8; i++)
+		ctx->buf[128 - 1 - i] = (uint8_t)(longLen >> (i * 8));
+	sha512_compress(ctx->state, ctx->buf);
+	memcpy(hash, ctx->state, sizeof(ctx->state));
+}
+
+
+/*
+ * Chained message hasher: hash of message || chain,
+ * where chain is appended as its host-order bytes.
+ * hash may be the same array as chain.
+ * When the message is a multiple of the block length
+ * and the chain fits in the final block with the padding,
+ * as in feedtrng (512 + 32 bytes), the message blocks are compressed
+ * in place and only the chain is copied into the final block;
+ * the fixed-length hashers below do so for their lengths
+ * with the padding precomputed.
+ */
+
+void sha512_hash_chain(const uint8_t *message, uint32_t len,
+		const uint64_t *chain, uint32_t chainwords, uint64_t hash[8]) {
+	uint32_t chainlen = chainwords * (uint32_t)sizeof(uint64_t);
+	sha512_fixed_fn *fixed;
+	
+	if (chainwords == SHA512_FIXED_CHAINWORDS && (fixed = sha512_fixed(len)) != NULL) {
+		fixed(message, chain, hash);
+		return;
+	}
+	if (len % SHA512_BLOCK_LENGTH == 0 && chainlen + 17 <= SHA512_BLOCK_LENGTH) {
+		uint64_t state[8] = {
+			UINT64_C(0x6A09E667F3BCC908), UINT64_C(0xBB67AE8584CAA73B),
+			UINT64_C(0x3C6EF372FE94F82B), UINT64_C(0xA54FF53A5F1D36F1),
+			UINT64_C(0x510E527FADE682D1), UINT64_C(0x9B05688C2B3E6C1F),
+			UINT64_C(0x1F83D9ABFB41BD6B), UINT64_C(0x5BE0CD19137E2179),
+		};
+		uint8_t block[128];
+		uint32_t i;
+		
+		for (i = 0; i < len; i += 128)
+			sha512_compress(state, message + i);
+		memcpy(block, chain, chainlen);
+		block[chainlen] = 0x80;
+		memset(block + chainlen + 1, 0, 120 - (chainlen + 1));
+		uint64_t longLen = ((uint64_t)len + chainlen) << 3;
+		for (i = 0; i < 8; i++)
+			block[128 - 1 - i] = (uint8_t)(longLen >> (i * 8));
+		sha512_compress(state, block);
+		memcpy(hash, state, sizeof(state));
+		return;
+	}
+	
+	sha512_ctx ctx;
+	sha512_init(&ctx);
+	sha512_update(&ctx, message, len);
+	sha512_update(&ctx, chain, chainlen);
+	sha512_final(&ctx, hash);
+}
+
+
+/*
+ * Fixed-length chained hashers
+ *
+ * Each hasher is specialized for a message of n blocks followed
+ * by a chain of SHA512_FIXED_CHAINWORDS words: the final block is
+ * the chain and a padding precomputed at compile time, with the
+ * message length in bits already encoded, and the loop of the
+ * message blocks has a constant count, fully unrolled up to 8 blocks.
+ * The backend is looked up once per message instead of once per block.
+ */
+
+#define SHA512_FIXED_CHAINLEN (SHA512_FIXED_CHAINWORDS * 8)
+#define SHA512_FIXED_PADLEN (SHA512_BLOCK_LENGTH - SHA512_FIXED_CHAINLEN)
+
+#if defined(__clang__)
+#define SHA512_UNROLL _Pragma("unroll 8")
+#elif defined(__GNUC__)
+#define SHA512_UNROLL _Pragma("GCC unroll 8")
+#else
+#define SHA512_UNROLL
+#endif
+
+static const uint64_t sha512_iv[8] = {
+	UINT64_C(0x6A09E667F3BCC908), UINT64_C(0xBB67AE8584CAA73B),
+	UINT64_C(0x3C6EF372FE94F82B), UINT64_C(0xA54FF53A5F1D36F1),
+	UINT64_C(0x510E527FADE682D1), UINT64_C(0x9B05688C2B3E6C1F),
+	UINT64_C(0x1F83D9ABFB41BD6B), UINT64_C(0x5BE0CD19137E2179),
+};
+
+static inline __attribute__((always_inline)) void sha512_chain_blocks(
+		const uint8_t *message, uint32_t nblocks, const uint64_t *chain,
+		const uint8_t pad[SHA512_FIXED_PADLEN], uint64_t hash[8]) {
+	sha512_compress_fn *compress = sha512_compressor();
+	uint64_t state[8];
+	uint8_t block[SHA512_BLOCK_LENGTH];
+	uint32_t i;
+	
+	memcpy(state, sha512_iv, sizeof(state));
+	SHA512_UNROLL
+	for (i = 0; i < nblocks; i++)
+		compress(state, message + i * SHA512_BLOCK_LENGTH);
+	// the chain is copied before hash is written, as hash may be chain
+	memcpy(block, chain, SHA512_FIXED_CHAINLEN);
+	memcpy(block + SHA512_FIXED_CHAINLEN, pad, SHA512_FIXED_PADLEN);
+	compress(state, block);
+	memcpy(hash, state, sizeof(state));
+}
+
+// byte i of the big-endian length in bits of n blocks and the chain
+#define SHA512_FIXED_LEN(n, i) \
+	((uint8_t)((((uint64_t)(n) * SHA512_BLOCK_LENGTH + SHA512_FIXED_CHAINLEN) << 3) >> (56 - (i) * 8)))
+
+#define SHA512_FIXED(n) \
+static void sha512_chain_##n(const uint8_t *message, const uint64_t *chain, \
+		uint64_t hash[8]) { \
+	static const uint8_t pad[SHA512_FIXED_PADLEN] = { \
+		0x80, \
+		[SHA512_FIXED_PADLEN - 8] = SHA512_FIXED_LEN(n, 0), SHA512_FIXED_LEN(n, 1), \
+		SHA512_FIXED_LEN(n, 2), SHA512_FIXED_LEN(n, 3), SHA512_FIXED_LEN(n, 4), \
+		SHA512_FIXED_LEN(n, 5), SHA512_FIXED_LEN(n, 6), SHA512_FIXED_LEN(n, 7), \
+	}; \
+	sha512_chain_blocks(message, n, chain, pad, hash); \
+}
+
+SHA512_FIXED(1)
+SHA512_FIXED(2)
+SHA512_FIXED(3)
+SHA512_FIXED(4)
+SHA512_FIXED(5)
+SHA512_FIXED(6)
+SHA512_FIXED(7)
+SHA512_FIXED(8)
+SHA512_FIXED(16)
+SHA512_FIXED(32)
+SHA512_FIXED(64)
+SHA512_FIXED(128)
+SHA512_FIXED(256)
+SHA512_FIXED(512)
+
+// indexed by the message blocks
+static sha512_fixed_fn *const sha512_fixed_tab[SHA512_FIXED_MAXBLOCKS + 1] = {
+	[1] = sha512_chain_1, [2] = sha512_chain_2, [3] = sha512_chain_3,
+	[4] = sha512_chain_4, [5] = sha512_chain_5, [6] = sha512_chain_6,
+	[7] = sha512_chain_7, [8] = sha512_chain_8, [16] = sha512_chain_16,
+	[32] = sha512_chain_32, [64] = sha512_chain_64, [128] = sha512_chain_128,
+	[256] = sha512_chain_256, [512] = sha512_chain_512,
+};
+
+sha512_fixed_fn *sha512_fixed(uint32_t len) {
+	if (len % SHA512_BLOCK_LENGTH != 0 || len / SHA512_BLOCK_LENGTH > SHA512_FIXED_MAXBLOCKS)
+		return NULL;
+	return sha512_fixed_tab[len / SHA512_BLOCK_LENGTH];
+}
@@ -0,0 +1,145 @@
+/* 
+ * SHA-512 compression with BMI2 and AVX2
+ * for feedtrng
+ * 
+ * The rounds are the same as in sha512.c by Project Nayuki (MIT License);
+ * see sha512.c for the notice. This version byte-swaps the message
+ * and computes the message schedule four words at a time with AVX2,
+ * adds the round constants to the schedule in the same vector pass,
+ * and leaves the rotations of the rounds to BMI2 RORX.
+ */
+
+#include <stdint.h>
+
+#include "sha512.h"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+static const uint64_t sha512_k[80] __attribute__((aligned(32))) = {
+	UINT64_C(0x428A2F98D728AE22), UINT64_C(0x7137449123EF65CD), UINT64_C(0xB5C0FBCFEC4D3B2F), UINT64_C(0xE9B5DBA58189DBBC),
+	UINT64_C(0x3956C25BF348B538), UINT64_C(0x59F111F1B605D019), UINT64_C(0x923F82A4AF194F9B), UINT64_C(0xAB1C5ED5DA6D8118),
+	UINT64_C(0xD807AA98A3030242), UINT64_C(0x12835B0145706FBE), UINT64_C(0x243185BE4EE4B28C), UINT64_C(0x550C7DC3D5FFB4E2),
+	UINT64_C(0x72BE5D74F27B896F), UINT64_C(0x80DEB1FE3B1696B1), UINT64_C(0x9BDC06A725C71235), UINT64_C(0xC19BF174CF692694),
+	UINT64_C(0xE49B69C19EF14AD2), UINT64_C(0xEFBE4786384F25E3), UINT64_C(0x0FC19DC68B8CD5B5), UINT64_C(0x240CA1CC77AC9C65),
+	UINT64_C(0x2DE92C6F592B0275), UINT64_C(0x4A7484AA6EA6E483), UINT64_C(0x5CB0A9DCBD41FBD4), UINT64_C(0x76F988DA831153B5),
+	UINT64_C(0x983E5152EE66DFAB), UINT64_C(0xA831C66D2DB43210), UINT64_C(0xB00327C898FB213F), UINT64_C(0xBF597FC7BEEF0EE4),
+	UINT64_C(0xC6E00BF33DA88FC2), UINT64_C(0xD5A79147930AA725), UINT64_C(0x06CA6351E003826F), UINT64_C(0x142929670A0E6E70),
+	UINT64_C(0x27B70A8546D22FFC), UINT64_C(0x2E1B21385C26C926), UINT64_C(0x4D2C6DFC5AC42AED), UINT64_C(0x53380D139D95B3DF),
+	UINT64_C(0x650A73548BAF63DE), UINT64_C(0x766A0ABB3C77B2A8), UINT64_C(0x81C2C92E47EDAEE6), UINT64_C(0x92722C851482353B),
+	UINT64_C(0xA2BFE8A14CF10364), UINT64_C(0xA81A664BBC423001), UINT64_C(0xC24B8B70D0F89791), UINT64_C(0xC76C51A30654BE30),
+	UINT64_C(0xD192E819D6EF5218), UINT64_C(0xD69906245565A910), UINT64_C(0xF40E35855771202A), UINT64_C(0x106AA07032BBD1B8),
+	UINT64_C(0x19A4C116B8D2D0C8), UINT64_C(0x1E376C085141AB53), UINT64_C(0x2748774CDF8EEB99), UINT64_C(0x34B0BCB5E19B48A8),
+	UINT64_C(0x391C0CB3C5C95A63), UINT64_C(0x4ED8AA4AE3418ACB), UINT64_C(0x5B9CCA4F7763E373), UINT64_C(0x682E6FF3D6B2B8A3),
+	UINT64_C(0x748F82EE5DEFB2FC), UINT64_C(0x78A5636F43172F60), UINT64_C(0x84C87814A1F0AB72), UINT64_C(0x8CC702081A6439EC),
+	UINT64_C(0x90BEFFFA23631E28), UINT64_C(0xA4506CEBDE82BDE9), UINT64_C(0xBEF9A3F7B2C67915), UINT64_C(0xC67178F2E372532B),
+	UINT64_C(0xCA273ECEEA26619C), UINT64_C(0xD186B8C721C0C207), UINT64_C(0xEADA7DD6CDE0EB1E), UINT64_C(0xF57D4F7FEE6ED178),
+	UINT64_C(0x06F067AA72176FBA), UINT64_C(0x0A637DC5A2C898A6), UINT64_C(0x113F9804BEF90DAE), UINT64_C(0x1B710B35131C471B),
+	UINT64_C(0x28DB77F523047D84), UINT64_C(0x32CAAB7B40C72493), UINT64_C(0x3C9EBE0A15C9BEBC), UINT64_C(0x431D67C49C100D4C),
+	UINT64_C(0x4CC5D4BECB3E42B6), UINT64_C(0x597F299CFC657E2A), UINT64_C(0x5FCB6FAB3AD6FAEC), UINT64_C(0x6C44198C4A475817),
+};
+
+
+__attribute__((target("bmi2,avx2")))
+void sha512_compress_avx2(uint64_t state[8], const uint8_t block[128]) {
+	// 64-bit right rotation, compiled to RORX
+	#define ROR(x, i)  \
+		(((x) << (64 - (i))) | ((x) >> (i)))
+	
+	// small sigma functions on two words
+	#define SMALL0(x)  _mm_xor_si128(_mm_xor_si128(  \
+		_mm_or_si128(_mm_srli_epi64((x), 1), _mm_slli_epi64((x), 63)),  \
+		_mm_or_si128(_mm_srli_epi64((x), 8), _mm_slli_epi64((x), 56))),  \
+		_mm_srli_epi64((x), 7))
+	#define SMALL0X4(x)  _mm256_xor_si256(_mm256_xor_si256(  \
+		_mm256_or_si256(_mm256_srli_epi64((x), 1), _mm256_slli_epi64((x), 63)),  \
+		_mm256_or_si256(_mm256_srli_epi64((x), 8), _mm256_slli_epi64((x), 56))),  \
+		_mm256_srli_epi64((x), 7))
+	#define SMALL1(x)  _mm_xor_si128(_mm_xor_si128(  \
+		_mm_or_si128(_mm_srli_epi64((x), 19), _mm_slli_epi64((x), 45)),  \
+		_mm_or_si128(_mm_srli_epi64((x), 61), _mm_slli_epi64((x), 3))),  \
+		_mm_srli_epi64((x), 6))
+	
+	// h is the only variable changed besides d;
+	// wk[i] holds the message schedule item plus k
+	#define ROUND(a, b, c, d, e, f, g, h, i) \
+		h += (ROR(e, 14) ^ ROR(e, 18) ^ ROR(e, 41)) + ((e & f) ^ (~e & g)) + wk[i];  \
+		d += h;  \
+		h += (ROR(a, 28) ^ ROR(a, 34) ^ ROR(a, 39)) + ((a & (b | c)) | (b & c));
+	
+	// SCHEDULE(i) to SCHEDULE(i + 3);
+	// schedule[i + 2] and schedule[i + 3] depend on
+	// schedule[i] and schedule[i + 1] through sigma1
+	#define SCHEDULE4(i)  {  \
+		__m256i x = _mm256_add_epi64(  \
+			_mm256_load_si256((const __m256i *)(schedule + (i) - 16)),  \
+			_mm256_loadu_si256((const __m256i *)(schedule + (i) - 7)));  \
+		x = _mm256_add_epi64(x, SMALL0X4(_mm256_loadu_si256((const __m256i *)(schedule + (i) - 15))));  \
+		__m128i lo = _mm_add_epi64(_mm256_castsi256_si128(x),  \
+			SMALL1(_mm_load_si128((const __m128i *)(schedule + (i) - 2))));  \
+		__m128i hi = _mm_add_epi64(_mm256_extracti128_si256(x, 1), SMALL1(lo));  \
+		x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);  \
+		_mm256_store_si256((__m256i *)(schedule + (i)), x);  \
+		_mm256_store_si256((__m256i *)(wk + (i)),  \
+			_mm256_add_epi64(x, _mm256_load_si256((const __m256i *)(sha512_k + (i)))));  \
+	}
+	
+	// eight rounds, interleaved with the schedule
+	// eight rounds ahead when sched is non-zero
+	#define ROUND8(i, sched)  \
+		if (sched) SCHEDULE4((i) + 16)  \
+		ROUND(a, b, c, d, e, f, g, h, (i) + 0)  \
+		ROUND(h, a, b, c, d, e, f, g, (i) + 1)  \
+		ROUND(g, h, a, b, c, d, e, f, (i) + 2)  \
+		ROUND(f, g, h, a, b, c, d, e, (i) + 3)  \
+		if (sched) SCHEDULE4((i) + 20)  \
+		ROUND(e, f, g, h, a, b, c, d, (i) + 4)  \
+		ROUND(d, e, f, g, h, a, b, c, (i) + 5)  \
+		ROUND(c, d, e, f, g, h, a, b, (i) + 6)  \
+		ROUND(b, c, d, e, f, g, h, a, (i) + 7)
+	
+	const __m256i bswap = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	uint64_t schedule[80] __attribute__((aligned(32)));
+	uint64_t wk[80] __attribute__((aligned(32)));
+	int i;
+	
+	// LOADSCHEDULE(0) to LOADSCHEDULE(15), four words at a time
+	for (i = 0; i < 16; i += 4) {
+		__m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(block + i * 8)), bswap);
+		_mm256_store_si256((__m256i *)(schedule + i), x);
+		_mm256_store_si256((__m256i *)(wk + i),
+			_mm256_add_epi64(x, _mm256_load_si256((const __m256i *)(sha512_k + i))));
+	}
+	
+	uint64_t a = state[0];
+	uint64_t b = state[1];
+	uint64_t c = state[2];
+	uint64_t d = state[3];
+	uint64_t e = state[4];
+	uint64_t f = state[5];
+	uint64_t g = state[6];
+	uint64_t h = state[7];
+	ROUND8( 0, 1)
+	ROUND8( 8, 1)
+	ROUND8(16, 1)
+	ROUND8(24, 1)
+	ROUND8(32, 1)
+	ROUND8(40, 1)
+	ROUND8(48, 1)
+	ROUND8(56, 1)
+	ROUND8(64, 0)
+	ROUND8(72, 0)
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+#endif /* __x86_64__ */
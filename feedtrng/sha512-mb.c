@@ -0,0 +1,470 @@
+/*
+ * Multi-buffer SHA-512 for feedtrng
+ * by Kenji Rikitake
+ *
+ * Hashes up to SHA512_MB_MAXLANES independent messages at once,
+ * one message per 64-bit SIMD lane:
+ * 4 lanes with AVX2, 8 lanes with AVX-512 (F and BW),
+ * and a scalar fallback calling sha512_compress().
+ * The backend is chosen at runtime by CPUID.
+ *
+ * The round function and the constants are the same as in sha512.c
+ * by Project Nayuki (MIT License); see sha512.c for the notice.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sha512.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA512_MB_X86
+#include <immintrin.h>
+#endif
+
+static const uint64_t sha512_k[80] = {
+	UINT64_C(0x428A2F98D728AE22), UINT64_C(0x7137449123EF65CD), UINT64_C(0xB5C0FBCFEC4D3B2F), UINT64_C(0xE9B5DBA58189DBBC),
+	UINT64_C(0x3956C25BF348B538), UINT64_C(0x59F111F1B605D019), UINT64_C(0x923F82A4AF194F9B), UINT64_C(0xAB1C5ED5DA6D8118),
+	UINT64_C(0xD807AA98A3030242), UINT64_C(0x12835B0145706FBE), UINT64_C(0x243185BE4EE4B28C), UINT64_C(0x550C7DC3D5FFB4E2),
+	UINT64_C(0x72BE5D74F27B896F), UINT64_C(0x80DEB1FE3B1696B1), UINT64_C(0x9BDC06A725C71235), UINT64_C(0xC19BF174CF692694),
+	UINT64_C(0xE49B69C19EF14AD2), UINT64_C(0xEFBE4786384F25E3), UINT64_C(0x0FC19DC68B8CD5B5), UINT64_C(0x240CA1CC77AC9C65),
+	UINT64_C(0x2DE92C6F592B0275), UINT64_C(0x4A7484AA6EA6E483), UINT64_C(0x5CB0A9DCBD41FBD4), UINT64_C(0x76F988DA831153B5),
+	UINT64_C(0x983E5152EE66DFAB), UINT64_C(0xA831C66D2DB43210), UINT64_C(0xB00327C898FB213F), UINT64_C(0xBF597FC7BEEF0EE4),
+	UINT64_C(0xC6E00BF33DA88FC2), UINT64_C(0xD5A79147930AA725), UINT64_C(0x06CA6351E003826F), UINT64_C(0x142929670A0E6E70),
+	UINT64_C(0x27B70A8546D22FFC), UINT64_C(0x2E1B21385C26C926), UINT64_C(0x4D2C6DFC5AC42AED), UINT64_C(0x53380D139D95B3DF),
+	UINT64_C(0x650A73548BAF63DE), UINT64_C(0x766A0ABB3C77B2A8), UINT64_C(0x81C2C92E47EDAEE6), UINT64_C(0x92722C851482353B),
+	UINT64_C(0xA2BFE8A14CF10364), UINT64_C(0xA81A664BBC423001), UINT64_C(0xC24B8B70D0F89791), UINT64_C(0xC76C51A30654BE30),
+	UINT64_C(0xD192E819D6EF5218), UINT64_C(0xD69906245565A910), UINT64_C(0xF40E35855771202A), UINT64_C(0x106AA07032BBD1B8),
+	UINT64_C(0x19A4C116B8D2D0C8), UINT64_C(0x1E376C085141AB53), UINT64_C(0x2748774CDF8EEB99), UINT64_C(0x34B0BCB5E19B48A8),
+	UINT64_C(0x391C0CB3C5C95A63), UINT64_C(0x4ED8AA4AE3418ACB), UINT64_C(0x5B9CCA4F7763E373), UINT64_C(0x682E6FF3D6B2B8A3),
+	UINT64_C(0x748F82EE5DEFB2FC), UINT64_C(0x78A5636F43172F60), UINT64_C(0x84C87814A1F0AB72), UINT64_C(0x8CC702081A6439EC),
+	UINT64_C(0x90BEFFFA23631E28), UINT64_C(0xA4506CEBDE82BDE9), UINT64_C(0xBEF9A3F7B2C67915), UINT64_C(0xC67178F2E372532B),
+	UINT64_C(0xCA273ECEEA26619C), UINT64_C(0xD186B8C721C0C207), UINT64_C(0xEADA7DD6CDE0EB1E), UINT64_C(0xF57D4F7FEE6ED178),
+	UINT64_C(0x06F067AA72176FBA), UINT64_C(0x0A637DC5A2C898A6), UINT64_C(0x113F9804BEF90DAE), UINT64_C(0x1B710B35131C471B),
+	UINT64_C(0x28DB77F523047D84), UINT64_C(0x32CAAB7B40C72493), UINT64_C(0x3C9EBE0A15C9BEBC), UINT64_C(0x431D67C49C100D4C),
+	UINT64_C(0x4CC5D4BECB3E42B6), UINT64_C(0x597F299CFC657E2A), UINT64_C(0x5FCB6FAB3AD6FAEC), UINT64_C(0x6C44198C4A475817),
+};
+
+/* Backend table */
+
+struct sha512_mb_backend {
+	const char *name;
+	int lanes;
+	void (*compress)(uint64_t *const state[], const uint8_t *const block[]);
+	int (*supported)(void);
+};
+
+static void sha512_compress_x1(uint64_t *const state[], const uint8_t *const block[]) {
+	sha512_compress(state[0], block[0]);
+}
+
+static int sha512_mb_always(void) {
+	return 1;
+}
+
+
+#ifdef SHA512_MB_X86
+
+/*
+ * The vector round is the same as ROUND() in sha512.c,
+ * with the working variables rotated by the caller.
+ * T1 is added to d and h, then T2 to h.
+ */
+
+#define MB_ROUND(a, b, c, d, e, f, g, h, i)  \
+	h = ADD(h, ADD(ADD(SIGMA1(e), CH(e, f, g)), ADD(SET1(sha512_k[i]), w[(i) & 15])));  \
+	d = ADD(d, h);  \
+	h = ADD(h, ADD(SIGMA0(a), MAJ(a, b, c)));
+
+#define MB_SCHEDULE(i)  \
+	w[(i) & 15] = ADD(ADD(w[(i) & 15], w[((i) - 7) & 15]),  \
+		ADD(SMALL0(w[((i) - 15) & 15]), SMALL1(w[((i) - 2) & 15])));
+
+#define MB_ROUNDS8(i)  \
+	MB_ROUND(a, b, c, d, e, f, g, h, (i) + 0)  \
+	MB_ROUND(h, a, b, c, d, e, f, g, (i) + 1)  \
+	MB_ROUND(g, h, a, b, c, d, e, f, (i) + 2)  \
+	MB_ROUND(f, g, h, a, b, c, d, e, (i) + 3)  \
+	MB_ROUND(e, f, g, h, a, b, c, d, (i) + 4)  \
+	MB_ROUND(d, e, f, g, h, a, b, c, (i) + 5)  \
+	MB_ROUND(c, d, e, f, g, h, a, b, (i) + 6)  \
+	MB_ROUND(b, c, d, e, f, g, h, a, (i) + 7)
+
+#define MB_SCHEDULE8(i)  \
+	MB_SCHEDULE((i) + 0) MB_SCHEDULE((i) + 1) MB_SCHEDULE((i) + 2) MB_SCHEDULE((i) + 3)  \
+	MB_SCHEDULE((i) + 4) MB_SCHEDULE((i) + 5) MB_SCHEDULE((i) + 6) MB_SCHEDULE((i) + 7)
+
+/* Rounds 0 to 15 use the loaded message, 16 to 79 the schedule */
+#define MB_ALLROUNDS  \
+	int r;  \
+	MB_ROUNDS8(0)  \
+	MB_ROUNDS8(8)  \
+	for (r = 16; r < 80; r += 16) {  \
+		MB_SCHEDULE8(r)  \
+		MB_ROUNDS8(r)  \
+		MB_SCHEDULE8(r + 8)  \
+		MB_ROUNDS8(r + 8)  \
+	}
+
+
+/* AVX2: 4 lanes of 64-bit words in a __m256i */
+
+#define ADD(x, y)  _mm256_add_epi64((x), (y))
+#define XOR(x, y)  _mm256_xor_si256((x), (y))
+#define SET1(x)    _mm256_set1_epi64x((long long)(x))
+#define SHR(x, n)  _mm256_srli_epi64((x), (n))
+#define ROR(x, n)  _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+#define CH(e, f, g)   XOR((g), _mm256_and_si256((e), XOR((f), (g))))
+#define MAJ(a, b, c)  _mm256_or_si256(_mm256_and_si256((a), _mm256_or_si256((b), (c))), _mm256_and_si256((b), (c)))
+#define SIGMA0(x)  XOR(XOR(ROR((x), 28), ROR((x), 34)), ROR((x), 39))
+#define SIGMA1(x)  XOR(XOR(ROR((x), 14), ROR((x), 18)), ROR((x), 41))
+#define SMALL0(x)  XOR(XOR(ROR((x), 1), ROR((x), 8)), SHR((x), 7))
+#define SMALL1(x)  XOR(XOR(ROR((x), 19), ROR((x), 61)), SHR((x), 6))
+
+/* transpose a 4x4 matrix of 64-bit words (its own inverse) */
+__attribute__((target("avx2")))
+static inline void transpose4(__m256i *r0, __m256i *r1, __m256i *r2, __m256i *r3) {
+	__m256i t0 = _mm256_unpacklo_epi64(*r0, *r1);
+	__m256i t1 = _mm256_unpackhi_epi64(*r0, *r1);
+	__m256i t2 = _mm256_unpacklo_epi64(*r2, *r3);
+	__m256i t3 = _mm256_unpackhi_epi64(*r2, *r3);
+	*r0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+	*r1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+	*r2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+	*r3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+__attribute__((target("avx2")))
+static void sha512_compress_x4_avx2(uint64_t *const state[], const uint8_t *const block[]) {
+	const __m256i bswap = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	__m256i w[16], s[8];
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		w[i + 0] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(block[0] + i * 8)), bswap);
+		w[i + 1] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(block[1] + i * 8)), bswap);
+		w[i + 2] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(block[2] + i * 8)), bswap);
+		w[i + 3] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(block[3] + i * 8)), bswap);
+		transpose4(&w[i + 0], &w[i + 1], &w[i + 2], &w[i + 3]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		s[i + 0] = _mm256_loadu_si256((const __m256i *)(state[0] + i));
+		s[i + 1] = _mm256_loadu_si256((const __m256i *)(state[1] + i));
+		s[i + 2] = _mm256_loadu_si256((const __m256i *)(state[2] + i));
+		s[i + 3] = _mm256_loadu_si256((const __m256i *)(state[3] + i));
+		transpose4(&s[i + 0], &s[i + 1], &s[i + 2], &s[i + 3]);
+	}
+
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+	MB_ALLROUNDS
+	s[0] = ADD(s[0], a); s[1] = ADD(s[1], b); s[2] = ADD(s[2], c); s[3] = ADD(s[3], d);
+	s[4] = ADD(s[4], e); s[5] = ADD(s[5], f); s[6] = ADD(s[6], g); s[7] = ADD(s[7], h);
+
+	for (i = 0; i < 8; i += 4) {
+		transpose4(&s[i + 0], &s[i + 1], &s[i + 2], &s[i + 3]);
+		_mm256_storeu_si256((__m256i *)(state[0] + i), s[i + 0]);
+		_mm256_storeu_si256((__m256i *)(state[1] + i), s[i + 1]);
+		_mm256_storeu_si256((__m256i *)(state[2] + i), s[i + 2]);
+		_mm256_storeu_si256((__m256i *)(state[3] + i), s[i + 3]);
+	}
+}
+
+#undef ADD
+#undef XOR
+#undef SET1
+#undef SHR
+#undef ROR
+#undef CH
+#undef MAJ
+
+
+/* AVX-512: 8 lanes of 64-bit words in a __m512i */
+
+#define ADD(x, y)  _mm512_add_epi64((x), (y))
+#define XOR(x, y)  _mm512_xor_si512((x), (y))
+#define SET1(x)    _mm512_set1_epi64((long long)(x))
+#define SHR(x, n)  _mm512_srli_epi64((x), (n))
+#define ROR(x, n)  _mm512_ror_epi64((x), (n))
+#define CH(e, f, g)   _mm512_ternarylogic_epi64((e), (f), (g), 0xCA)
+#define MAJ(a, b, c)  _mm512_ternarylogic_epi64((a), (b), (c), 0xE8)
+
+/* transpose an 8x8 matrix of 64-bit words (its own inverse) */
+__attribute__((target("avx512f")))
+static inline void transpose8(__m512i r[8]) {
+	__m512i t[8], u[8];
+	int i;
+	for (i = 0; i < 8; i += 2) {
+		t[i + 0] = _mm512_unpacklo_epi64(r[i], r[i + 1]);
+		t[i + 1] = _mm512_unpackhi_epi64(r[i], r[i + 1]);
+	}
+	u[0] = _mm512_shuffle_i64x2(t[0], t[2], 0x88);
+	u[1] = _mm512_shuffle_i64x2(t[0], t[2], 0xDD);
+	u[2] = _mm512_shuffle_i64x2(t[1], t[3], 0x88);
+	u[3] = _mm512_shuffle_i64x2(t[1], t[3], 0xDD);
+	u[4] = _mm512_shuffle_i64x2(t[4], t[6], 0x88);
+	u[5] = _mm512_shuffle_i64x2(t[4], t[6], 0xDD);
+	u[6] = _mm512_shuffle_i64x2(t[5], t[7], 0x88);
+	u[7] = _mm512_shuffle_i64x2(t[5], t[7], 0xDD);
+	r[0] = _mm512_shuffle_i64x2(u[0], u[4], 0x88);
+	r[4] = _mm512_shuffle_i64x2(u[0], u[4], 0xDD);
+	r[2] = _mm512_shuffle_i64x2(u[1], u[5], 0x88);
+	r[6] = _mm512_shuffle_i64x2(u[1], u[5], 0xDD);
+	r[1] = _mm512_shuffle_i64x2(u[2], u[6], 0x88);
+	r[5] = _mm512_shuffle_i64x2(u[2], u[6], 0xDD);
+	r[3] = _mm512_shuffle_i64x2(u[3], u[7], 0x88);
+	r[7] = _mm512_shuffle_i64x2(u[3], u[7], 0xDD);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void sha512_compress_x8_avx512(uint64_t *const state[], const uint8_t *const block[]) {
+	const __m512i bswap = _mm512_broadcast_i32x4(_mm_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+	__m512i w[16], s[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = _mm512_shuffle_epi8(_mm512_loadu_si512(block[i]), bswap);
+		w[i + 8] = _mm512_shuffle_epi8(_mm512_loadu_si512(block[i] + 64), bswap);
+		s[i] = _mm512_loadu_si512(state[i]);
+	}
+	transpose8(&w[0]);
+	transpose8(&w[8]);
+	transpose8(s);
+
+	__m512i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m512i e = s[4], f = s[5], g = s[6], h = s[7];
+	MB_ALLROUNDS
+	s[0] = ADD(s[0], a); s[1] = ADD(s[1], b); s[2] = ADD(s[2], c); s[3] = ADD(s[3], d);
+	s[4] = ADD(s[4], e); s[5] = ADD(s[5], f); s[6] = ADD(s[6], g); s[7] = ADD(s[7], h);
+
+	transpose8(s);
+	for (i = 0; i < 8; i++)
+		_mm512_storeu_si512(state[i], s[i]);
+}
+
+#undef ADD
+#undef XOR
+#undef SET1
+#undef SHR
+#undef ROR
+#undef CH
+#undef MAJ
+#undef SIGMA0
+#undef SIGMA1
+#undef SMALL0
+#undef SMALL1
+
+static int sha512_mb_has_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int sha512_mb_has_avx512(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+#endif /* SHA512_MB_X86 */
+
+
+/* widest first */
+static const struct sha512_mb_backend sha512_mb_backends[] = {
+#ifdef SHA512_MB_X86
+	{"avx512", 8, sha512_compress_x8_avx512, sha512_mb_has_avx512},
+	{"avx2", 4, sha512_compress_x4_avx2, sha512_mb_has_avx2},
+#endif
+	{"scalar", 1, sha512_compress_x1, sha512_mb_always},
+};
+
+#define NBACKENDS (sizeof(sha512_mb_backends) / sizeof(sha512_mb_backends[0]))
+
+static const struct sha512_mb_backend *sha512_mb_current = NULL;
+
+static const struct sha512_mb_backend *sha512_mb_backend(void) {
+	size_t i;
+	if (sha512_mb_current == NULL) {
+		for (i = 0; i < NBACKENDS; i++) {
+			if (sha512_mb_backends[i].supported()) {
+				sha512_mb_current = &sha512_mb_backends[i];
+				break;
+			}
+		}
+	}
+	return sha512_mb_current;
+}
+
+int sha512_mb_select(const char *name) {
+	size_t i;
+	if (name == NULL || strcmp(name, "auto") == 0) {
+		sha512_mb_current = NULL;
+		sha512_mb_backend();
+		return 0;
+	}
+	for (i = 0; i < NBACKENDS; i++) {
+		if (strcmp(name, sha512_mb_backends[i].name) == 0) {
+			if (!sha512_mb_backends[i].supported())
+				return -1;
+			sha512_mb_current = &sha512_mb_backends[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *sha512_mb_name(void) {
+	return sha512_mb_backend()->name;
+}
+
+int sha512_mb_lanes(void) {
+	return sha512_mb_backend()->lanes;
+}
+
+
+/* Compress n independent (state, block) pairs */
+
+void sha512_compress_xN(uint64_t *const state[], const uint8_t *const block[], size_t n) {
+	const struct sha512_mb_backend *be = sha512_mb_backend();
+	size_t lanes = (size_t)be->lanes;
+	size_t i, j;
+
+	for (i = 0; i + lanes <= n; i += lanes)
+		be->compress(state + i, block + i);
+	if (i == n)
+		return;
+	if (n - i == 1) {
+		sha512_compress(state[i], block[i]);
+		return;
+	}
+	/* fill the unused lanes with dummy work */
+	uint64_t dummy[SHA512_MB_MAXLANES][8];
+	uint64_t *st[SHA512_MB_MAXLANES];
+	const uint8_t *blk[SHA512_MB_MAXLANES];
+	for (j = 0; j < lanes; j++) {
+		if (i + j < n) {
+			st[j] = state[i + j];
+			blk[j] = block[i + j];
+		} else {
+			st[j] = dummy[j];
+			blk[j] = block[i];
+		}
+	}
+	be->compress(st, blk);
+}
+
+
+/* Full message hasher for n independent messages */
+
+struct sha512_mb_lane {
+	const uint8_t *message;  // next full message block
+	const uint8_t *padp;     // next padding block
+	uint64_t *hash;
+	uint32_t full;           // number of full message blocks left
+	uint32_t tail;           // number of padding blocks left (1 or 2)
+	uint8_t pad[SHA512_BLOCK_LENGTH * 2];
+};
+
+static void sha512_mb_lane_start(struct sha512_mb_lane *ln,
+		const uint8_t *message, uint32_t len, uint64_t hash[8]) {
+	uint32_t rem = len % SHA512_BLOCK_LENGTH;
+	uint64_t longLen = ((uint64_t)len) << 3;
+	int i;
+
+	hash[0] = UINT64_C(0x6A09E667F3BCC908);
+	hash[1] = UINT64_C(0xBB67AE8584CAA73B);
+	hash[2] = UINT64_C(0x3C6EF372FE94F82B);
+	hash[3] = UINT64_C(0xA54FF53A5F1D36F1);
+	hash[4] = UINT64_C(0x510E527FADE682D1);
+	hash[5] = UINT64_C(0x9B05688C2B3E6C1F);
+	hash[6] = UINT64_C(0x1F83D9ABFB41BD6B);
+	hash[7] = UINT64_C(0x5BE0CD19137E2179);
+
+	ln->message = message;
+	ln->padp = ln->pad;
+	ln->hash = hash;
+	ln->full = len / SHA512_BLOCK_LENGTH;
+	ln->tail = (SHA512_BLOCK_LENGTH - rem >= 17) ? 1 : 2;
+	memset(ln->pad, 0, sizeof(ln->pad));
+	memcpy(ln->pad, message + len - rem, rem);
+	ln->pad[rem] = 0x80;
+	for (i = 0; i < 8; i++)
+		ln->pad[ln->tail * SHA512_BLOCK_LENGTH - 1 - i] = (uint8_t)(longLen >> (i * 8));
+}
+
+/* returns the next block of the lane, or NULL when the lane is done */
+static const uint8_t *sha512_mb_lane_next(struct sha512_mb_lane *ln) {
+	const uint8_t *p;
+	if (ln->full > 0) {
+		ln->full--;
+		p = ln->message;
+		ln->message += SHA512_BLOCK_LENGTH;
+		return p;
+	}
+	if (ln->tail > 0) {
+		ln->tail--;
+		p = ln->padp;
+		ln->padp += SHA512_BLOCK_LENGTH;
+		return p;
+	}
+	return NULL;
+}
+
+void sha512_hash_many(const uint8_t *const message[], const uint32_t len[],
+		uint64_t (*hash)[8], size_t n) {
+	const struct sha512_mb_backend *be = sha512_mb_backend();
+	int lanes = be->lanes;
+	struct sha512_mb_lane ln[SHA512_MB_MAXLANES];
+	uint64_t dummy[SHA512_MB_MAXLANES][8];
+	uint64_t *st[SHA512_MB_MAXLANES];
+	const uint8_t *blk[SHA512_MB_MAXLANES];
+	size_t next = 0;
+	int j, nactive;
+
+	for (j = 0; j < lanes && next < n; j++, next++)
+		sha512_mb_lane_start(&ln[j], message[next], len[next], hash[next]);
+	nactive = j;
+	for (; j < lanes; j++)
+		blk[j] = NULL;
+	for (j = 0; j < nactive; j++)
+		blk[j] = sha512_mb_lane_next(&ln[j]);
+
+	while (nactive > 1 || next < n) {
+		for (j = 0; j < lanes; j++) {
+			if (blk[j] != NULL) {
+				st[j] = ln[j].hash;
+			} else {
+				/* an idle lane computes garbage */
+				st[j] = dummy[j];
+				blk[j] = ln[0].pad;
+			}
+		}
+		be->compress(st, blk);
+		for (j = 0; j < lanes; j++) {
+			if (st[j] == dummy[j]) {
+				blk[j] = NULL;
+				continue;
+			}
+			if ((blk[j] = sha512_mb_lane_next(&ln[j])) != NULL)
+				continue;
+			/* the lane is done: refill it */
+			if (next < n) {
+				sha512_mb_lane_start(&ln[j], message[next], len[next], hash[next]);
+				next++;
+				blk[j] = sha512_mb_lane_next(&ln[j]);
+			} else {
+				nactive--;
+			}
+		}
+	}
+	/* finish the last message with the scalar code */
+	for (j = 0; j < lanes && nactive > 0; j++) {
+		if (blk[j] == NULL)
+			continue;
+		do
+			sha512_compress(ln[j].hash, blk[j]);
+		while ((blk[j] = sha512_mb_lane_next(&ln[j])) != NULL);
+	}
+}
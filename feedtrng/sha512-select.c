@@ -0,0 +1,106 @@
+/*
+ * Runtime selection of the SHA-512 compression function
+ * for feedtrng
+ * by Kenji Rikitake
+ * License: MIT License (see sha512.c)
+ *
+ * sha512_compress() calls the backend chosen at the first call
+ * by CPU feature detection, in the following order of preference:
+ * "avx2" (BMI2 and AVX2, sha512-avx2.c),
+ * "x8664" (x86-64 assembly, sha512-x8664.S),
+ * and "c" (portable C, sha512.c).
+ * sha512_select() overrides the choice.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sha512.h"
+
+#if defined(__x86_64__) && defined(SHA512_X8664)
+#define SHA512_HAVE_X8664
+#endif
+
+static int sha512_always(void) {
+	return 1;
+}
+
+#if defined(__x86_64__)
+static int sha512_has_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+#endif
+
+static const struct sha512_backend {
+	const char *name;
+	void (*compress)(uint64_t state[8], const uint8_t block[128]);
+	int (*supported)(void);
+} sha512_backends[] = {
+#if defined(__x86_64__)
+	{"avx2", sha512_compress_avx2, sha512_has_avx2},
+#endif
+#if defined(SHA512_HAVE_X8664)
+	{"x8664", sha512_compress_x8664, sha512_always},
+#endif
+	{"c", sha512_compress_c, sha512_always},
+};
+
+#define NBACKENDS (sizeof(sha512_backends) / sizeof(sha512_backends[0]))
+
+static const struct sha512_backend *sha512_current = NULL;
+
+static const struct sha512_backend *sha512_backend(void) {
+	size_t i;
+	if (sha512_current == NULL) {
+		for (i = 0; i < NBACKENDS; i++) {
+			if (sha512_backends[i].supported()) {
+				sha512_current = &sha512_backends[i];
+				break;
+			}
+		}
+	}
+	return sha512_current;
+}
+
+void sha512_compress(uint64_t state[8], const uint8_t block[128]) {
+	sha512_backend()->compress(state, block);
+}
+
+sha512_compress_fn *sha512_compressor(void) {
+	return sha512_backend()->compress;
+}
+
+int sha512_select(const char *name) {
+	size_t i;
+	if (name == NULL || strcmp(name, "auto") == 0) {
+		sha512_current = NULL;
+		sha512_backend();
+		return 0;
+	}
+	for (i = 0; i < NBACKENDS; i++) {
+		if (strcmp(name, sha512_backends[i].name) == 0) {
+			if (!sha512_backends[i].supported())
+				return -1;
+			sha512_current = &sha512_backends[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *sha512_name(void) {
+	return sha512_backend()->name;
+}
+
+const char *sha512_names(void) {
+	return ""
+#if defined(__x86_64__)
+		"avx2 "
+#endif
+#if defined(SHA512_HAVE_X8664)
+		"x8664 "
+#endif
+		"c";
+}
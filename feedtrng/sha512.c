@@ -24,8 +24,10 @@
 
 #include <stdint.h>
 
+#include "sha512.h"
 
-void sha512_compress(uint64_t state[8], const uint8_t block[128]) {
+
+void sha512_compress_c(uint64_t state[8], const uint8_t block[128]) {
 	// 64-bit right rotation
 	#define ROR(x, i)  \
 		(((x) << (64 - (i))) | ((x) >> (i)))
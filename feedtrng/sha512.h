@@ -0,0 +1,111 @@
+/*
+ * SHA-512 function prototypes for feedtrng
+ * by Kenji Rikitake
+ * License: MIT License (see sha512.c and sha512-api.c)
+ */
+
+#ifndef _FEEDTRNG_SHA512_H_
+#define _FEEDTRNG_SHA512_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* SHA-512 block length in bytes */
+#define SHA512_BLOCK_LENGTH (128)
+/* SHA-512 digest length in bytes */
+#define SHA512_DIGEST_LENGTH (64)
+
+/* maximum number of lanes of the multi-buffer backends */
+#define SHA512_MB_MAXLANES (8)
+
+/* Single-stream compression and full message hasher */
+
+extern void sha512_compress(uint64_t state[8], const uint8_t block[128]);
+extern void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]);
+
+/*
+ * Incremental hashing (sha512-api.c)
+ *
+ * sha512_init(), sha512_update() and sha512_final() compute the same
+ * digest as sha512_hash() over the concatenation of the updates.
+ * The digest is given as host-order words, as in sha512_hash().
+ * sha512_hash_chain() hashes message || chain in one call,
+ * where chain is taken as its host-order bytes.
+ */
+
+typedef struct sha512_ctx {
+	uint64_t state[8];
+	uint64_t len;                           /* total bytes so far */
+	uint8_t buf[SHA512_BLOCK_LENGTH];       /* pending partial block */
+	uint32_t buflen;
+} sha512_ctx;
+
+extern void sha512_init(sha512_ctx *ctx);
+extern void sha512_update(sha512_ctx *ctx, const void *data, size_t len);
+extern void sha512_final(sha512_ctx *ctx, uint64_t hash[8]);
+extern void sha512_hash_chain(const uint8_t *message, uint32_t len,
+                              const uint64_t *chain, uint32_t chainwords,
+                              uint64_t hash[8]);
+
+/*
+ * Fixed-length chained hashers (sha512-api.c)
+ *
+ * sha512_fixed() returns the hasher of message || chain specialized
+ * at compile time for a message of len bytes and a chain of
+ * SHA512_FIXED_CHAINWORDS words, as feedtrng chains its blocks,
+ * or NULL when none is compiled in for len.
+ * The hashers are compiled in for the messages of 1 to 8 blocks
+ * and of the powers of two up to 512 blocks;
+ * sha512_hash_chain() calls them when they fit.
+ */
+
+#define SHA512_FIXED_CHAINWORDS (4)
+#define SHA512_FIXED_MAXBLOCKS (512)
+
+typedef void sha512_fixed_fn(const uint8_t *message, const uint64_t *chain,
+                             uint64_t hash[8]);
+
+extern sha512_fixed_fn *sha512_fixed(uint32_t len);
+
+/*
+ * Single-stream compression backends (sha512-select.c)
+ *
+ * sha512_compress() calls the fastest backend supported by the CPU,
+ * chosen at the first call, and sha512_compressor() returns it
+ * for calling it directly. sha512_select() overrides the choice by name
+ * ("avx2", "x8664", "c" or "auto"), and returns -1
+ * when the backend is unknown or not supported.
+ * sha512_names() lists the backends compiled in.
+ */
+
+typedef void sha512_compress_fn(uint64_t state[8], const uint8_t block[128]);
+
+extern void sha512_compress_c(uint64_t state[8], const uint8_t block[128]);
+extern void sha512_compress_x8664(uint64_t state[8], const uint8_t block[128]);
+extern void sha512_compress_avx2(uint64_t state[8], const uint8_t block[128]);
+extern sha512_compress_fn *sha512_compressor(void);
+extern int sha512_select(const char *name);
+extern const char *sha512_name(void);
+extern const char *sha512_names(void);
+
+/*
+ * Multi-buffer compression and hashing (sha512-mb.c)
+ *
+ * sha512_compress_xN() compresses n independent (state, block) pairs.
+ * sha512_hash_many() hashes n independent messages of any lengths.
+ * The widest backend supported by the CPU is chosen at the first call;
+ * sha512_mb_select() overrides the choice by name
+ * ("scalar", "avx2", "avx512" or "auto"), and returns -1
+ * when the backend is unknown or not supported.
+ */
+
+extern void sha512_compress_xN(uint64_t *const state[],
+                               const uint8_t *const block[], size_t n);
+extern void sha512_hash_many(const uint8_t *const message[],
+                             const uint32_t len[], uint64_t (*hash)[8],
+                             size_t n);
+extern int sha512_mb_select(const char *name);
+extern const char *sha512_mb_name(void);
+extern int sha512_mb_lanes(void);
+
+#endif /* _FEEDTRNG_SHA512_H_ */
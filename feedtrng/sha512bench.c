@@ -0,0 +1,352 @@
+/*
+ * SHA-512 conditioner benchmark for feedtrng
+ * by Kenji Rikitake
+ * License: MIT License (see sha512.c)
+ *
+ * For each compression backend and message size, reports
+ * throughput (MiB/s), cycles per byte (rdtsc on x86),
+ * and p50/p99 latency per call; then the fixed-length chained hashers
+ * against the generic hasher on the same messages (block + 32 bytes),
+ * the multi-buffer backends with their lanes and the MiB/s per lane,
+ * both sha512_compress_xN() on single blocks and sha512_hash_many(),
+ * and the multi-thread scaling
+ * of the feedtrng chained message.
+ *
+ * To compile (on amd64):
+ * cc -O2 -DSHA512_X8664 -o sha512bench sha512bench.c sha512.c sha512-avx2.c \
+ *   sha512-x8664.S sha512-select.c sha512-mb.c sha512-api.c -lpthread
+ *
+ * Usage: sha512bench [-j max-threads] [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "sha512.h"
+
+/* the feedtrng chained message: 512-byte block + 32 bytes of hash */
+#define CHAINLEN (512)
+#define CHAINWORDS (4)
+
+/* latency samples per case */
+#define NSAMPLES (20000)
+
+static const char *impls[] = {"c", "x8664", "avx2"};
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const char *mbimpls[] = {"scalar", "avx2", "avx512"};
+#define NMBIMPLS (sizeof(mbimpls) / sizeof(mbimpls[0]))
+
+static const uint32_t sizes[] = {64, 128, 544, 1024, 4096, 65536, 1048576};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* the message blocks of the fixed-length chained hashers compared */
+static const uint32_t fixedsizes[] = {128, 512, 1024, 4096, 65536};
+#define NFIXEDSIZES (sizeof(fixedsizes) / sizeof(fixedsizes[0]))
+
+/* messages per sha512_hash_many() call, blocks per sha512_compress_xN() */
+#define MBBATCH (64)
+
+/* the hashing of a case */
+#define MODE_SINGLE (0)	/* sha512_hash(), or sha512_hash_chain() for 544 bytes */
+#define MODE_MULTI (1)	/* sha512_hash_many() */
+#define MODE_GENERIC (2)	/* sha512_hash() of block + chain */
+#define MODE_FIXED (3)	/* the fixed-length hasher of block + chain */
+#define MODE_COMPRESS (4)	/* sha512_compress_xN() of 128-byte blocks */
+
+static double seconds = 0.5;
+static uint8_t *message;
+static FILE *out;
+static int first;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int cmpdouble(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* one hash of size bytes; size == CHAINLEN + 32 is the chained message */
+static void hash_once(uint32_t size, int mode, uint64_t hash[8]) {
+	if (mode == MODE_FIXED)
+		sha512_fixed(size - CHAINWORDS * sizeof(uint64_t))(message, hash, hash);
+	else if (mode == MODE_SINGLE && size == CHAINLEN + CHAINWORDS * sizeof(uint64_t))
+		sha512_hash_chain(message, CHAINLEN, hash, CHAINWORDS, hash);
+	else
+		sha512_hash(message, size, hash);
+}
+
+struct result {
+	double mibs;
+	double cpb;
+	double p50;
+	double p99;
+	uint64_t calls;
+};
+
+/* the multi-buffer messages and states, MBBATCH of each */
+static const uint8_t *msgs[MBBATCH];
+static uint32_t lens[MBBATCH];
+static uint64_t mbhash[MBBATCH][8];
+static uint64_t *states[MBBATCH];
+
+/* one call of the mode on size bytes, or on MBBATCH messages of size bytes */
+static void call_once(uint32_t size, int mode, uint64_t hash[8]) {
+	if (mode == MODE_MULTI)
+		sha512_hash_many(msgs, lens, mbhash, MBBATCH);
+	else if (mode == MODE_COMPRESS)
+		sha512_compress_xN(states, msgs, MBBATCH);
+	else
+		hash_once(size, mode, hash);
+}
+
+/* throughput over the whole run, then per-call latency */
+static void run_case(uint32_t size, int mode, struct result *r) {
+	static double samples[NSAMPLES];
+	uint64_t hash[8] = {0};
+	uint64_t calls = 0, c0;
+	double t0, t, bytes;
+	int i, n;
+
+	for (i = 0; i < MBBATCH; i++) {
+		msgs[i] = message;
+		lens[i] = size;
+		states[i] = mbhash[i];
+	}
+	t0 = now();
+	c0 = cycles();
+	do {
+		for (i = 0; i < 16; i++)
+			call_once(size, mode, hash);
+		calls += 16;
+		t = now() - t0;
+	} while (t < seconds);
+	bytes = (double)calls * size *
+	    ((mode == MODE_MULTI || mode == MODE_COMPRESS) ? MBBATCH : 1);
+	r->calls = calls;
+	r->mibs = bytes / t / 1048576;
+	r->cpb = (double)(cycles() - c0) / bytes;
+
+	n = (calls < NSAMPLES) ? (int)calls : NSAMPLES;
+	for (i = 0; i < n; i++) {
+		t0 = now();
+		call_once(size, mode, hash);
+		samples[i] = (now() - t0) * 1e9;
+	}
+	qsort(samples, n, sizeof(double), cmpdouble);
+	r->p50 = samples[n / 2];
+	r->p99 = samples[n * 99 / 100];
+}
+
+static void print_result(const char *section, const char *impl, uint32_t size, const struct result *r) {
+	fprintf(out, "%s\n    {\"section\": \"%s\", \"impl\": \"%s\", \"size\": %u, "
+		"\"calls\": %llu, \"mib_per_s\": %.2f, \"cycles_per_byte\": %.3f, "
+		"\"p50_ns\": %.0f, \"p99_ns\": %.0f}",
+		first ? "" : ",", section, impl, size, (unsigned long long)r->calls,
+		r->mibs, r->cpb, r->p50, r->p99);
+	first = 0;
+	fprintf(stderr, "%-6s %-7s %8u B: %9.1f MiB/s %7.2f cpb p50 %9.0f ns p99 %9.0f ns\n",
+		section, impl, size, r->mibs, r->cpb, r->p50, r->p99);
+}
+
+/* a multi-buffer case, with the lanes of the backend and the MiB/s per lane */
+static void print_lanes(const char *section, const char *impl, uint32_t size, const struct result *r) {
+	int lanes = sha512_mb_lanes();
+
+	fprintf(out, "%s\n    {\"section\": \"%s\", \"impl\": \"%s\", \"size\": %u, "
+		"\"lanes\": %d, \"calls\": %llu, \"mib_per_s\": %.2f, "
+		"\"mib_per_s_per_lane\": %.2f, \"cycles_per_byte\": %.3f, "
+		"\"p50_ns\": %.0f, \"p99_ns\": %.0f}",
+		first ? "" : ",", section, impl, size, lanes,
+		(unsigned long long)r->calls, r->mibs, r->mibs / lanes, r->cpb,
+		r->p50, r->p99);
+	first = 0;
+	fprintf(stderr, "%-8s %-7s %8u B: %d lanes, %.1f MiB/s total, %.1f MiB/s per lane, "
+		"p50 %.0f ns p99 %.0f ns\n",
+		section, impl, size, lanes, r->mibs, r->mibs / lanes, r->p50, r->p99);
+}
+
+
+/* Multi-thread scaling of the chained message */
+
+struct worker {
+	pthread_t tid;
+	pthread_barrier_t *barrier;
+	uint64_t calls;
+};
+
+static atomic_int stop;
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	uint8_t buf[CHAINLEN];
+	uint64_t hash[8] = {0};
+
+	memcpy(buf, message, sizeof(buf));
+	pthread_barrier_wait(w->barrier);
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		sha512_hash_chain(buf, CHAINLEN, hash, CHAINWORDS, hash);
+		w->calls++;
+	}
+	buf[0] = (uint8_t)hash[0];
+	return NULL;
+}
+
+static double run_threads(int nthreads) {
+	struct worker *w = calloc(nthreads, sizeof(*w));
+	pthread_barrier_t barrier;
+	uint64_t calls = 0;
+	double t0, t;
+	int i;
+
+	if (w == NULL)
+		err(EX_OSERR, "calloc");
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	atomic_store(&stop, 0);
+	for (i = 0; i < nthreads; i++) {
+		w[i].barrier = &barrier;
+		if (pthread_create(&w[i].tid, NULL, worker_main, &w[i]) != 0)
+			errx(EX_OSERR, "pthread_create");
+	}
+	pthread_barrier_wait(&barrier);
+	t0 = now();
+	usleep((useconds_t)(seconds * 1e6));
+	atomic_store(&stop, 1);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(w[i].tid, NULL);
+		calls += w[i].calls;
+	}
+	t = now() - t0;
+	pthread_barrier_destroy(&barrier);
+	free(w);
+	return (double)calls * (CHAINLEN + CHAINWORDS * sizeof(uint64_t)) / t / 1048576;
+}
+
+
+int main(int argc, char **argv) {
+	const char *outname = NULL;
+	long maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct result r, g;
+	uint32_t size;
+	size_t i, j;
+	int ch, t;
+
+	while ((ch = getopt(argc, argv, "j:t:o:")) != -1) {
+		switch (ch) {
+		case 'j':
+			maxthreads = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'o':
+			outname = optarg;
+			break;
+		default:
+			errx(EX_USAGE, "Usage: %s [-j max-threads] [-t seconds-per-case] [-o output.json]", argv[0]);
+		}
+	}
+	if (maxthreads < 1)
+		maxthreads = 1;
+	if (seconds <= 0)
+		errx(EX_USAGE, "seconds-per-case must be positive");
+	if ((message = malloc(sizes[NSIZES - 1])) == NULL)
+		err(EX_OSERR, "malloc");
+	for (i = 0; i < sizes[NSIZES - 1]; i++)
+		message[i] = (uint8_t)(i * 7 + 1);
+	out = stdout;
+	if (outname != NULL && (out = fopen(outname, "w")) == NULL)
+		err(EX_CANTCREAT, "%s", outname);
+
+	sha512_select("auto");
+	fprintf(out, "{\n  \"benchmark\": \"sha512bench\",\n  \"default_impl\": \"%s\",\n"
+		"  \"rdtsc\": %s,\n  \"seconds_per_case\": %.3f,\n  \"results\": [",
+		sha512_name(),
+#ifdef HAVE_RDTSC
+		"true",
+#else
+		"false",
+#endif
+		seconds);
+	first = 1;
+	for (i = 0; i < NIMPLS; i++) {
+		if (sha512_select(impls[i]) != 0)
+			continue;
+		for (j = 0; j < NSIZES; j++) {
+			run_case(sizes[j], MODE_SINGLE, &r);
+			print_result("single", impls[i], sizes[j], &r);
+		}
+	}
+	for (i = 0; i < NIMPLS; i++) {
+		if (sha512_select(impls[i]) != 0)
+			continue;
+		for (j = 0; j < NFIXEDSIZES; j++) {
+			size = fixedsizes[j] + CHAINWORDS * sizeof(uint64_t);
+			run_case(size, MODE_GENERIC, &g);
+			print_result("generic", impls[i], size, &g);
+			run_case(size, MODE_FIXED, &r);
+			print_result("fixed", impls[i], size, &r);
+			fprintf(stderr, "fixed  %-7s %8u B: x%.3f of generic\n",
+				impls[i], size, r.mibs / g.mibs);
+		}
+	}
+	sha512_select("auto");
+	for (i = 0; i < NMBIMPLS; i++) {
+		if (sha512_mb_select(mbimpls[i]) != 0)
+			continue;
+		run_case(SHA512_BLOCK_LENGTH, MODE_COMPRESS, &r);
+		print_lanes("compress", mbimpls[i], SHA512_BLOCK_LENGTH, &r);
+		for (j = 0; j < NSIZES; j++) {
+			if (sizes[j] > 65536)
+				continue;
+			run_case(sizes[j], MODE_MULTI, &r);
+			print_lanes("multi", mbimpls[i], sizes[j], &r);
+		}
+	}
+	sha512_mb_select("auto");
+	fprintf(out, "\n  ],\n  \"threads\": [");
+	double base = 0;
+	for (t = 1; t <= maxthreads; t = (t < maxthreads && t * 2 > maxthreads) ? (int)maxthreads : t * 2) {
+		double mibs = run_threads(t);
+		if (t == 1)
+			base = mibs;
+		fprintf(out, "%s\n    {\"impl\": \"%s\", \"size\": %zu, \"threads\": %d, "
+			"\"mib_per_s\": %.2f, \"scaling\": %.3f}",
+			t == 1 ? "" : ",", sha512_name(), CHAINLEN + CHAINWORDS * sizeof(uint64_t),
+			t, mibs, mibs / base);
+		fprintf(stderr, "threads %3d: %9.1f MiB/s (x%.2f)\n", t, mibs, mibs / base);
+		if (t == maxthreads)
+			break;
+	}
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+	free(message);
+	return 0;
+}
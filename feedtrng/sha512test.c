@@ -26,36 +26,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
+#include "sha512.h"
+
+/*
+ * To compile with all the backends (on amd64):
+ * cc -O2 -DSHA512_X8664 -o sha512test sha512test.c sha512.c sha512-avx2.c \
+ *   sha512-x8664.S sha512-select.c sha512-mb.c sha512-api.c
+ */
 
 /* Function prototypes */
 
 static int self_check(void);
-void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]);
+static int self_check_ctx(void);
+static int self_check_mb(void);
+static int self_check_fixed(void);
 
-// Link this program with an external C or x86 compression function
-extern void sha512_compress(uint64_t state[8], const uint8_t block[128]);
+// Link this program with the compression backends selected by sha512-select.c,
+// the multi-buffer code in sha512-mb.c and the message hashers in sha512-api.c
+
+static const char *backends[] = {"c", "x8664", "avx2"};
+#define NBACKENDS (sizeof(backends) / sizeof(backends[0]))
 
 
 /* Main program */
 
 int main(int argc, char **argv) {
-	if (!self_check()) {
-		printf("Self-check failed\n");
+	int b;
+	for (b = 0; b < (int)NBACKENDS; b++) {
+		if (sha512_select(backends[b]) != 0) {
+			printf("%s: not supported\n", backends[b]);
+			continue;
+		}
+		if (!self_check()) {
+			printf("%s: Self-check failed\n", backends[b]);
+			return 1;
+		}
+		printf("%s: Self-check passed\n", backends[b]);
+	}
+	sha512_select("auto");
+	printf("Selected: %s\n", sha512_name());
+	
+	if (!self_check_ctx()) {
+		printf("Incremental self-check failed\n");
 		return 1;
 	}
-	printf("Self-check passed\n");
+	printf("Incremental self-check passed\n");
 	
-	// Benchmark speed
-	uint64_t state[8] = {};
-	uint64_t block[16] = {};
-	const int N = 3000000;
-	clock_t start_time = clock();
-	int i;
-	for (i = 0; i < N; i++)
-		sha512_compress(state, (uint8_t *)block);  // Type-punning
-	printf("Speed: %.1f MiB/s\n", (double)N * sizeof(block) / (clock() - start_time) * CLOCKS_PER_SEC / 1048576);
+	if (!self_check_mb()) {
+		printf("Multi-buffer self-check failed (%s)\n", sha512_mb_name());
+		return 1;
+	}
+	printf("Multi-buffer self-check passed\n");
+	
+	if (!self_check_fixed()) {
+		printf("Fixed-length self-check failed\n");
+		return 1;
+	}
+	printf("Fixed-length self-check passed\n");
+	
+	// See sha512bench.c for the benchmarks
 	
 	return 0;
 }
@@ -92,38 +122,124 @@ static int self_check(void) {
 }
 
 
-/* Full message hasher */
+/* Incremental and chained hasher self-check */
 
-void sha512_hash(const uint8_t *message, uint32_t len, uint64_t hash[8]) {
-	hash[0] = UINT64_C(0x6A09E667F3BCC908);
-	hash[1] = UINT64_C(0xBB67AE8584CAA73B);
-	hash[2] = UINT64_C(0x3C6EF372FE94F82B);
-	hash[3] = UINT64_C(0xA54FF53A5F1D36F1);
-	hash[4] = UINT64_C(0x510E527FADE682D1);
-	hash[5] = UINT64_C(0x9B05688C2B3E6C1F);
-	hash[6] = UINT64_C(0x1F83D9ABFB41BD6B);
-	hash[7] = UINT64_C(0x5BE0CD19137E2179);
-	
-	uint32_t i;
-	for (i = 0; len - i >= 128; i += 128)
-		sha512_compress(hash, message + i);
+static int self_check_ctx(void) {
+	uint8_t data[700];
+	uint64_t ref[8], hash[8], chain[8];
+	sha512_ctx ctx;
+	uint32_t len, step, i;
 	
-	uint8_t block[128];
-	uint32_t rem = len - i;
-	memcpy(block, message + i, rem);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)(i * 13 + 5);
+	// updates of every size from 1 to 129 bytes
+	for (len = 0; len <= 300; len++) {
+		sha512_hash(data, len, ref);
+		for (step = 1; step <= 129; step++) {
+			sha512_init(&ctx);
+			for (i = 0; i < len; i += step)
+				sha512_update(&ctx, data + i, (len - i < step) ? len - i : step);
+			sha512_final(&ctx, hash);
+			if (memcmp(hash, ref, sizeof(ref)) != 0)
+				return 0;
+		}
+	}
+	// chained messages as in feedtrng, with the chain in the output array
+	for (len = 0; len <= 640; len += 64) {
+		for (i = 0; i <= 8; i++) {
+			sha512_hash(data + 1, 64, chain);
+			memcpy(data + len, chain, i * sizeof(uint64_t));
+			sha512_hash(data, len + i * (uint32_t)sizeof(uint64_t), ref);
+			memcpy(hash, chain, sizeof(chain));
+			sha512_hash_chain(data, len, hash, i, hash);
+			if (memcmp(hash, ref, sizeof(ref)) != 0)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Multi-buffer self-check */
+
+static const char *mbBackends[] = {"scalar", "avx2", "avx512"};
+#define NMBBACKENDS (sizeof(mbBackends) / sizeof(mbBackends[0]))
+
+static int self_check_mb(void) {
+	const int NTC = sizeof(testCases) / sizeof(testCases[0]);
+	// Known answers, then messages of every length up to 300 bytes
+	// to cross the padding boundaries at different offsets per lane
+	const int NLEN = 301;
+	const uint8_t *msgs[NTC + NLEN];
+	uint32_t lens[NTC + NLEN];
+	uint64_t (*hashes)[8] = malloc(sizeof(uint64_t) * 8 * (NTC + NLEN));
+	uint8_t data[300];
+	uint64_t ref[8];
+	int i, b, ok = 1;
 	
-	block[rem] = 0x80;
-	rem++;
-	if (128 - rem >= 16)
-		memset(block + rem, 0, 120 - rem);
-	else {
-		memset(block + rem, 0, 128 - rem);
-		sha512_compress(hash, block);
-		memset(block, 0, 120);
+	for (i = 0; i < (int)sizeof(data); i++)
+		data[i] = (uint8_t)(i * 7 + 1);
+	for (i = 0; i < NTC; i++) {
+		msgs[i] = testCases[i].message;
+		lens[i] = strlen((const char *)testCases[i].message);
 	}
+	for (i = 0; i < NLEN; i++) {
+		msgs[NTC + i] = data;
+		lens[NTC + i] = (uint32_t)(NLEN - 1 - i);
+	}
+	for (b = 0; b < (int)NMBBACKENDS; b++) {
+		if (sha512_mb_select(mbBackends[b]) != 0)
+			continue;
+		memset(hashes, 0, sizeof(uint64_t) * 8 * (NTC + NLEN));
+		sha512_hash_many(msgs, lens, hashes, NTC + NLEN);
+		for (i = 0; i < NTC; i++) {
+			if (memcmp(hashes[i], testCases[i].answer, sizeof(testCases[i].answer)) != 0)
+				ok = 0;
+		}
+		for (i = 0; i < NLEN; i++) {
+			sha512_hash(msgs[NTC + i], lens[NTC + i], ref);
+			if (memcmp(hashes[NTC + i], ref, sizeof(ref)) != 0)
+				ok = 0;
+		}
+		if (!ok)
+			break;
+	}
+	free(hashes);
+	return ok;
+}
+
+
+/* Fixed-length chained hasher self-check */
+
+static int self_check_fixed(void) {
+	const uint32_t chainlen = SHA512_FIXED_CHAINWORDS * sizeof(uint64_t);
+	const uint32_t maxlen = SHA512_FIXED_MAXBLOCKS * SHA512_BLOCK_LENGTH;
+	uint8_t *data = malloc(maxlen + chainlen);
+	uint64_t ref[8], hash[8];
+	sha512_fixed_fn *fixed;
+	uint32_t len, i;
+	int b, n = 0, ok = 1;
 	
-	uint64_t longLen = ((uint64_t)len) << 3;
-	for (i = 0; i < 8; i++)
-		block[128 - 1 - i] = (uint8_t)(longLen >> (i * 8));
-	sha512_compress(hash, block);
+	for (i = 0; i < maxlen; i++)
+		data[i] = (uint8_t)(i * 11 + 3);
+	// every hasher compiled in, with each backend, against the generic hasher
+	for (len = SHA512_BLOCK_LENGTH; ok && len <= maxlen; len += SHA512_BLOCK_LENGTH) {
+		if ((fixed = sha512_fixed(len)) == NULL)
+			continue;
+		n++;
+		sha512_hash(data + 1, 64, hash);
+		memcpy(data + len, hash, chainlen);
+		sha512_hash(data, len + chainlen, ref);
+		for (b = 0; b < (int)NBACKENDS; b++) {
+			if (sha512_select(backends[b]) != 0)
+				continue;
+			sha512_hash(data + 1, 64, hash);
+			fixed(data, hash, hash);
+			if (memcmp(hash, ref, sizeof(ref)) != 0)
+				ok = 0;
+		}
+	}
+	sha512_select("auto");
+	free(data);
+	return ok && n > 0 && sha512_fixed(SHA512_BLOCK_LENGTH * 9) == NULL;
 }
@@ -0,0 +1,216 @@
+/*
+ * TRNG simulator on pseudo-terminals, for testing feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/* the largest packet */
+#define SIM_MAXPACKET (4096)
+
+/*
+ * The devices listed in README.md; the USB serial devices
+ * send full speed bulk packets of 64 bytes
+ * (62 bytes of data on FTDI, after the two status bytes)
+ * when the host polls, so the reads come in bursts
+ */
+const struct sim_profile sim_profiles[] = {
+    /* Arduino with FTDI: 16ms latency timer */
+    {"avrhwrng", "avrhwrng on Arduino Duemilanove", 10000, 62, 3, 0.2, 0, 0},
+    {"truerng", "TrueRNG 2", 43500, 64, 8, 0.1, 0, 0},
+    /* the generator pauses when the pool is reseeded */
+    {"onerng", "OneRNG", 44000, 64, 4, 0.1, 0.01, 50},
+    {"neug", "NeuG", 80000, 64, 16, 0.05, 0, 0},
+    /* a serial port at 115200bps, 14-byte FIFO trigger level */
+    {"uart", "16550 UART at 115200bps", 11520, 14, 1, 0.05, 0, 0},
+    /* for the stress test */
+    {"max", "as fast as the pty takes", 0, 4096, 1, 0, 0, 0},
+};
+const int sim_nprofiles = sizeof(sim_profiles) / sizeof(sim_profiles[0]);
+
+const struct sim_profile *sim_find(const char *name) {
+  int i;
+
+  for (i = 0; i < sim_nprofiles; i++) {
+    if (strcmp(sim_profiles[i].name, name) == 0) {
+      return &sim_profiles[i];
+    }
+  }
+  return NULL;
+}
+
+uint64_t sim_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64*, enough to pass the health tests of feedtrng */
+static uint64_t sim_rand(struct sim_device *d) {
+  d->rng ^= d->rng >> 12;
+  d->rng ^= d->rng << 25;
+  d->rng ^= d->rng >> 27;
+  return d->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in [0, 1) */
+static double sim_uniform(struct sim_device *d) {
+  return (sim_rand(d) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void sim_fill(struct sim_device *d, uint8_t *buf, size_t len) {
+  uint64_t r;
+  size_t i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    r = sim_rand(d);
+    memcpy(buf + i, &r, 8);
+  }
+  if (i < len) {
+    r = sim_rand(d);
+    memcpy(buf + i, &r, len - i);
+  }
+}
+
+void sim_open(struct sim_device *d, const struct sim_profile *p, uint64_t seed,
+              int log) {
+  struct termios t;
+  const char *name;
+
+  memset(d, 0, sizeof(*d));
+  d->prof = p;
+  d->rng = (seed != 0) ? seed : 1;
+  if (((d->master = posix_openpt(O_RDWR | O_NOCTTY)) == -1) ||
+      (grantpt(d->master) == -1) || (unlockpt(d->master) == -1) ||
+      ((name = ptsname(d->master)) == NULL)) {
+    err(EX_OSERR, "cannot open a pty");
+  }
+  snprintf(d->name, sizeof(d->name), "%s", name);
+  /* not blocked on a full pty when stopped */
+  if (fcntl(d->master, F_SETFL, O_NONBLOCK) == -1) {
+    err(EX_OSERR, "fcntl on the pty failed");
+  }
+  /* raw from the start: no echo back into the master */
+  if ((d->slave = open(d->name, O_RDWR | O_NOCTTY)) == -1) {
+    err(EX_OSERR, "cannot open %s", d->name);
+  }
+  if (tcgetattr(d->slave, &t) == -1) {
+    err(EX_OSERR, "tcgetattr on %s failed", d->name);
+  }
+  cfmakeraw(&t);
+  if (tcsetattr(d->slave, TCSANOW, &t) == -1) {
+    err(EX_OSERR, "tcsetattr on %s failed", d->name);
+  }
+  if (log) {
+    d->maxlog = 4096;
+    if ((d->log = malloc(d->maxlog * sizeof(*d->log))) == NULL) {
+      err(EX_OSERR, "cannot allocate the write log");
+    }
+  }
+}
+
+static void sim_log(struct sim_device *d, uint64_t end) {
+  if (d->log == NULL) {
+    return;
+  }
+  if (d->nlog == d->maxlog) {
+    d->maxlog *= 2;
+    if ((d->log = realloc(d->log, d->maxlog * sizeof(*d->log))) == NULL) {
+      err(EX_OSERR, "cannot allocate the write log");
+    }
+  }
+  d->log[d->nlog].end = end;
+  d->log[d->nlog].t = sim_now();
+  d->nlog++;
+}
+
+static void *sim_main(void *arg) {
+  struct sim_device *d = arg;
+  const struct sim_profile *p = d->prof;
+  uint8_t buf[SIM_MAXPACKET];
+  uint64_t next, total = 0, interval;
+  struct pollfd pfd = {.fd = d->master, .events = POLLOUT};
+  struct timespec ts;
+  uint32_t k;
+  ssize_t n;
+  size_t off;
+
+  next = sim_now();
+  while (!atomic_load(&d->stop)) {
+    for (k = 0; k < p->burst; k++) {
+      sim_fill(d, buf, p->packet);
+      /* a full pty is the backpressure of a real tty */
+      for (off = 0; off < p->packet; off += (size_t)n) {
+        if (atomic_load(&d->stop)) {
+          return NULL;
+        }
+        if ((n = write(d->master, buf + off, p->packet - off)) == -1) {
+          if ((errno != EAGAIN) && (errno != EINTR)) {
+            err(EX_IOERR, "write to the master of %s failed", d->name);
+          }
+          n = 0;
+          poll(&pfd, 1, 100);
+        }
+      }
+      total += p->packet;
+      atomic_store(&d->written, total);
+      sim_log(d, total);
+    }
+    if (p->rate == 0) {
+      continue;
+    }
+    interval = (uint64_t)(1e9 * p->packet * p->burst / p->rate *
+                          (1.0 + p->jitter * (2.0 * sim_uniform(d) - 1.0)));
+    if ((p->pause > 0) && (sim_uniform(d) < p->pause)) {
+      interval += (uint64_t)p->pausems * 1000000;
+    }
+    next += interval;
+    /* a device late by more than a second does not catch up in a burst */
+    if (sim_now() > next + 1000000000) {
+      next = sim_now();
+    }
+    ts.tv_sec = (time_t)(next / 1000000000);
+    ts.tv_nsec = (long)(next % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+  }
+  return NULL;
+}
+
+void sim_start(struct sim_device *d) {
+  int error;
+
+  if ((error = pthread_create(&d->tid, NULL, sim_main, d)) != 0) {
+    errno = error;
+    err(EX_OSERR, "cannot start the simulator of %s", d->name);
+  }
+}
+
+void sim_stop(struct sim_device *d) {
+  atomic_store(&d->stop, 1);
+  pthread_join(d->tid, NULL);
+}
+
+void sim_close(struct sim_device *d) {
+  close(d->slave);
+  close(d->master);
+  free(d->log);
+  d->log = NULL;
+}
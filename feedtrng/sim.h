@@ -0,0 +1,69 @@
+/*
+ * TRNG simulator on pseudo-terminals, for testing feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ */
+
+#ifndef _FEEDTRNG_SIM_H_
+#define _FEEDTRNG_SIM_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A device emulated: the average rate, and how the output arrives;
+ * a USB serial device sends packets of up to packet bytes,
+ * which are the fragments seen by read(2), in bursts
+ */
+struct sim_profile {
+  const char *name;
+  const char *device;
+  double rate;     /* bytes/s, 0 for as fast as the pty takes */
+  uint32_t packet; /* bytes per write(2) */
+  uint32_t burst;  /* packets written back to back */
+  double jitter;   /* of the time between the bursts, relative */
+  double pause;    /* probability of a pause after a burst */
+  uint32_t pausems;
+};
+
+/* a write(2) to the pty: the bytes written so far after it, and when */
+struct sim_write {
+  uint64_t end;
+  uint64_t t; /* [ns, CLOCK_MONOTONIC] */
+};
+
+struct sim_device {
+  const struct sim_profile *prof;
+  int master;
+  int slave; /* kept open, so that the pty stays up */
+  char name[64];
+  uint64_t rng;
+  atomic_uint_fast64_t written;
+  atomic_int stop;
+  /* the log of the writes, when asked by sim_open() */
+  struct sim_write *log;
+  size_t nlog;
+  size_t maxlog;
+  pthread_t tid;
+};
+
+extern const struct sim_profile sim_profiles[];
+extern const int sim_nprofiles;
+
+extern const struct sim_profile *sim_find(const char *name);
+extern uint64_t sim_now(void);
+
+/*
+ * sim_open() opens a raw pty for the device, with the pseudo-random
+ * output from seed; sim_start() and sim_stop() run and stop the thread
+ * writing into it
+ */
+extern void sim_open(struct sim_device *d, const struct sim_profile *p,
+                     uint64_t seed, int log);
+extern void sim_start(struct sim_device *d);
+extern void sim_stop(struct sim_device *d);
+extern void sim_close(struct sim_device *d);
+
+#endif /* _FEEDTRNG_SIM_H_ */
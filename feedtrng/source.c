@@ -0,0 +1,310 @@
+/*
+ * Feeder for /dev/trng: TRNG input sources
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The backends of the input, by the prefix of the argument of -d:
+ * tty: (or none) a serial port, set to raw mode at the speed given;
+ * fd: a descriptor inherited, such as a pipe from a vendor tool;
+ * fifo: a named pipe, waiting for the writer to open it;
+ * file: a regular file, read to its end;
+ * hwrng: a character device such as /dev/hwrng, which cannot be watched
+ * by the event loop, opened non-blocking and read again a tick later
+ * when it has nothing to read.
+ * The end of a pipe or a file ends the input; that of a tty
+ * or a character device is an error.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sysexits.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "feedtrng.h"
+
+/* the pipe buffer asked for on Linux, for the bursts of fast sources */
+#define SOURCE_PIPESIZE (1048576)
+
+static void tty_open(struct source *s);
+static void fd_open(struct source *s);
+static void fifo_open(struct source *s);
+static void file_open(struct source *s);
+static void hwrng_open(struct source *s);
+
+static const struct source_backend source_backends[] = {
+    {"tty", SRC_POLL | SRC_AVAIL, tty_open},
+    {"fd", SRC_POLL | SRC_AVAIL | SRC_EOF | SRC_ASYNC, fd_open},
+    {"fifo", SRC_POLL | SRC_AVAIL | SRC_EOF | SRC_ASYNC, fifo_open},
+    {"file", SRC_EOF | SRC_ASYNC, file_open},
+    {"hwrng", SRC_ASYNC, hwrng_open},
+};
+
+#define NBACKENDS (sizeof(source_backends) / sizeof(source_backends[0]))
+
+/*
+ * Set the device name and the speed of a tty source
+ * from the argument of -d: device[:speed]
+ * On FreeBSD, only cua[.+] and /dev/cua[.+] are accepted,
+ * and only the basename(3) part is used and attached to /dev/.
+ * On Linux, a path under /dev/ or a name relative to /dev/
+ * (such as ttyUSB0 or pts/3) is accepted.
+ */
+static void tty_name(struct source *s, const char *arg, long speed) {
+  char *input;
+  char *colon;
+  char *inputbase;
+
+  if ((input = strndup(arg, MAXPATHLEN)) == NULL) {
+    errx(EX_USAGE, "device input string error");
+  }
+  s->speed = speed;
+  if ((colon = strrchr(input, ':')) != NULL) {
+    *colon = '\0';
+    s->speed = source_speed(colon + 1);
+  }
+#ifdef __linux__
+  if (strstr(input, "..") != NULL) {
+    errx(EX_USAGE, "illegal path in %s", input);
+  }
+  inputbase = input;
+  if (strncmp(input, "/dev/", 5) == 0) {
+    inputbase += 5;
+  }
+  if ((*inputbase == '/') || (*inputbase == '.') || (*inputbase == '\0')) {
+    errx(EX_USAGE, "illegal path in %s", input);
+  }
+#else
+  if ((inputbase = basename(input)) == NULL) {
+    errx(EX_OSERR, "device input basename failed");
+  }
+  if ((*inputbase == '/') || (*inputbase == '.')) {
+    errx(EX_USAGE, "illegal path in inputbase");
+  }
+  if (strnlen(inputbase, 4) < 4) {
+    errx(EX_USAGE, "input basename less than four letters");
+  }
+  if ((inputbase[0] != 'c') || (inputbase[1] != 'u') ||
+      (inputbase[2] != 'a')) {
+    errx(EX_USAGE, "not a /dev/cua* device");
+  }
+#endif
+  if (snprintf(s->devname, sizeof(s->devname), "/dev/%s", inputbase) >=
+      (int)sizeof(s->devname)) {
+    errx(EX_USAGE, "device name too long");
+  }
+  free(input);
+}
+
+/*
+ * Set the backend and the name of a source from the argument of -d:
+ * [tty:]device[:speed], fd:number, fifo:path, file:path or hwrng:path
+ */
+void source_name(struct source *s, const char *arg, long speed) {
+  const struct source_backend *be;
+  size_t i, n;
+
+  for (i = 0; i < NBACKENDS; i++) {
+    be = &source_backends[i];
+    n = strlen(be->name);
+    if ((strncmp(arg, be->name, n) == 0) && (arg[n] == ':')) {
+      break;
+    }
+  }
+  if ((i == 0) || (i == NBACKENDS)) {
+    s->be = &source_backends[0];
+    tty_name(s, (i == 0) ? arg + n + 1 : arg, speed);
+    return;
+  }
+  s->be = be;
+  s->speed = 0;
+  if (arg[n + 1] == '\0') {
+    errx(EX_USAGE, "no path in %s", arg);
+  }
+  /* the fd: prefix is kept in the name, the others are paths */
+  if (snprintf(s->devname, sizeof(s->devname), "%s",
+               (be->open == fd_open) ? arg : arg + n + 1) >=
+      (int)sizeof(s->devname)) {
+    errx(EX_USAGE, "device name too long");
+  }
+}
+
+/* parse and check a tty speed */
+long source_speed(const char *arg) {
+  long speedval;
+
+  errno = 0;
+  speedval = strtol(arg, NULL, 10);
+  if (errno > 0) {
+    err(EX_OSERR, "strtol for speedval failed");
+  }
+  if ((speedval < 9600) || (speedval > 1000000)) {
+    errx(EX_USAGE, "speedval %ld out of range", speedval);
+  }
+  return speedval;
+}
+
+#ifdef __linux__
+/* Linux termios takes Bxxx constants instead of the speed in bps */
+static speed_t source_bspeed(long speedval) {
+  static const struct {
+    long bps;
+    speed_t b;
+  } speeds[] = {{9600, B9600},     {19200, B19200},     {38400, B38400},
+                {57600, B57600},   {115200, B115200},   {230400, B230400},
+                {460800, B460800}, {500000, B500000},   {576000, B576000},
+                {921600, B921600}, {1000000, B1000000}};
+  size_t i;
+
+  for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+    if (speeds[i].bps == speedval) {
+      return speeds[i].b;
+    }
+  }
+  errx(EX_USAGE, "speedval %ld not supported", speedval);
+}
+#endif
+
+/* open the source with its backend */
+void source_open(struct source *s) {
+#ifdef DEBUG
+  fprintf(stderr, "feedtrng: device name: %s (%s)\n", s->devname,
+          s->be->name);
+  fflush(stderr);
+#endif
+  s->eof = 0;
+  s->be->open(s);
+}
+
+/* the type of the file of the source, which must be of the backend */
+static void source_check(struct source *s, mode_t type, const char *what) {
+  struct stat st;
+
+  if (fstat(s->fd, &st) == -1) {
+    err(EX_IOERR, "cannot stat %s", s->devname);
+  }
+  if ((st.st_mode & S_IFMT) != type) {
+    errx(EX_USAGE, "%s not %s", s->devname, what);
+  }
+}
+
+/* ask for a larger pipe buffer where supported, as a hint only */
+static void source_pipesize(struct source *s) {
+#ifdef F_SETPIPE_SZ
+  (void)fcntl(s->fd, F_SETPIPE_SZ, SOURCE_PIPESIZE);
+#else
+  (void)s;
+#endif
+}
+
+/* an inherited descriptor; a regular file is read as with file: */
+static void fd_open(struct source *s) {
+  struct stat st;
+  char *end;
+  long fd;
+
+  errno = 0;
+  fd = strtol(s->devname + 3, &end, 10);
+  if ((errno > 0) || (*end != '\0') || (fd < 0) || (fd > INT_MAX)) {
+    errx(EX_USAGE, "illegal descriptor in %s", s->devname);
+  }
+  s->fd = (int)fd;
+  if (fstat(s->fd, &st) == -1) {
+    err(EX_IOERR, "cannot use %s", s->devname);
+  }
+  if (S_ISREG(st.st_mode)) {
+    s->be = &source_backends[3]; /* file: */
+  } else if (S_ISFIFO(st.st_mode)) {
+    source_pipesize(s);
+  }
+}
+
+/* a named pipe; open(2) waits until a writer has opened it */
+static void fifo_open(struct source *s) {
+  if ((s->fd = open(s->devname, O_RDONLY)) == -1) {
+    err(EX_IOERR, "cannot open FIFO %s", s->devname);
+  }
+  source_check(s, S_IFIFO, "a FIFO");
+  source_pipesize(s);
+}
+
+static void file_open(struct source *s) {
+  if ((s->fd = open(s->devname, O_RDONLY)) == -1) {
+    err(EX_IOERR, "cannot open file %s", s->devname);
+  }
+  source_check(s, S_IFREG, "a regular file");
+  (void)posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/*
+ * a device read directly between the waits of the event loop,
+ * which must not wait for the device there
+ */
+static void hwrng_open(struct source *s) {
+  if ((s->fd = open(s->devname, O_RDONLY | O_NONBLOCK)) == -1) {
+    err(EX_IOERR, "cannot open device %s", s->devname);
+  }
+  source_check(s, S_IFCHR, "a character device");
+}
+
+/* open the TRNG tty and set the line discipline */
+static void tty_open(struct source *s) {
+  struct termios ttyconfig;
+
+  /* open TRNG tty */
+  if ((s->fd = open(s->devname, O_RDONLY)) == -1) {
+    err(EX_IOERR, "cannot open tty file %s", s->devname);
+  }
+  /* check if really a tty */
+  if (0 == isatty(s->fd)) {
+    err(EX_IOERR, "input %s not a tty", s->devname);
+  }
+  /* set exclusive access */
+  if (-1 == ioctl(s->fd, TIOCEXCL, 0)) {
+    err(EX_IOERR, "input ioctl(TIOCEXCL) failed");
+  }
+  /* get tty discipline */
+  if (-1 == tcgetattr(s->fd, &ttyconfig)) {
+    err(EX_IOERR, "input tcgetattr failed");
+  }
+  /* set RAW mode (see cfmakeraw(4)) */
+  /* and set all transparency flags */
+  /* no CTS/RTS flow control */
+  /* CLOCAL cleared (modem control enabled) */
+  ttyconfig.c_iflag &= ~(IMAXBEL | IXOFF | INPCK | BRKINT | PARMRK | ISTRIP |
+                         INLCR | IGNCR | ICRNL | IXON | IGNPAR);
+  ttyconfig.c_iflag |= IGNBRK;
+  ttyconfig.c_oflag &= ~OPOST;
+  ttyconfig.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHOKE | ECHOCTL | ECHONL |
+                         ICANON | ISIG | IEXTEN | NOFLSH | TOSTOP | PENDIN);
+#ifdef CRTS_IFLOW
+  ttyconfig.c_cflag &= ~(CSIZE | PARENB | CRTS_IFLOW | CCTS_OFLOW | MDMBUF);
+#else
+  ttyconfig.c_cflag &= ~(CSIZE | PARENB | CRTSCTS);
+#endif
+  ttyconfig.c_cflag |= CS8 | CREAD;
+  ttyconfig.c_cflag &= ~CLOCAL;
+  ttyconfig.c_cc[VMIN] = 1;
+  ttyconfig.c_cc[VTIME] = 0;
+  /* set speed */
+#ifdef __linux__
+  if (-1 == cfsetspeed(&ttyconfig, source_bspeed(s->speed))) {
+#else
+  if (-1 == cfsetspeed(&ttyconfig, (speed_t)s->speed)) {
+#endif
+    err(EX_IOERR, "input cfsetspeed to %ld failed", s->speed);
+  }
+  if (-1 == tcsetattr(s->fd, TCSANOW, &ttyconfig)) {
+    err(EX_IOERR, "input tcsetattr for raw and speed %ld failed", s->speed);
+  }
+}
@@ -0,0 +1,500 @@
+/*
+ * Offline conditioner of raw TRNG input, in parallel lanes
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Conditions a file of raw input, or the input of a device
+ * in a feedtrng capture (-W), into what feedtrng -o writes for it
+ * with the same -b, -c, -C and -N: the blocks are split into segments,
+ * and segment k is chained in lane k % lanes (see conditioner.h).
+ * The file is read in place through mmap(2), and the lanes are hashed
+ * by a thread per CPU; with sha512 and segments of whole SHA-512 blocks,
+ * the lanes of a thread are also hashed together in the SIMD lanes
+ * of sha512_compress_xN().
+ * The output is that of feedtrng -o -P capture -F with the same options
+ * when no block of the device fails the health tests, which feedtrng
+ * drops without chaining and this does not run.
+ * The input after the last whole block is left out.
+ *
+ * With -S, conditions the input (or -s MiB of pseudo-random bytes
+ * without a file) with 1, 2, 4, ... threads up to -j instead,
+ * checks that the output is the same for each,
+ * and reports the throughput and the speedup over a thread
+ * and over the single chain of feedtrng as JSON.
+ *
+ * To compile (on amd64; add -D_GNU_SOURCE on Linux):
+ * cc -O2 -DSHA512_X8664 -o trngcond trngcond.c conditioner.c capture.c \
+ *   blake2b.c sha512.c sha512-avx2.c sha512-x8664.S sha512-select.c \
+ *   sha512-mb.c sha512-api.c -lpthread
+ *
+ * Usage: trngcond [-b block-size] [-c output-size] [-C conditioner]
+ *   [-K keyfile] [-N lanes] [-j threads] [-d device] [-o output] file
+ *        trngcond -S [-s MiB] [options] [file]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "conditioner.h"
+#include "sha512.h"
+
+/* the defaults of feedtrng, but for the lanes */
+#define BLOCKSIZE (512)
+#define OUTPUTSIZE (64)
+#define LANES (COND_MAXLANES)
+
+#define MAXTHREADS (256)
+
+/* the conditioning of an input, shared by the threads */
+struct job {
+  const struct conditioner *cd;
+  const uint8_t *in;
+  uint8_t *out;
+  uint64_t nblocks;
+  uint32_t bsize;  /* input bytes per block */
+  uint32_t osize;  /* output bytes per block */
+  uint32_t nseg;   /* segments per block */
+  uint32_t seg;    /* bytes per segment, the last one takes the rest */
+  unsigned nlanes;
+  unsigned nthreads;
+  int multi; /* the lanes of a thread go through sha512_compress_xN() */
+};
+
+/* a thread, hashing the lanes l with l % nthreads == id */
+struct worker {
+  pthread_t tid;
+  const struct job *job;
+  unsigned id;
+};
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+  errx(EX_USAGE,
+       "Usage: trngcond [-b block-size] [-c output-size] [-C conditioner]\n"
+       "         [-K keyfile] [-N lanes] [-j threads] [-d device]\n"
+       "         [-o output] file\n"
+       "       trngcond -S [-s MiB] [options] [file]\n"
+       "Conditioners for -C: %s (default: %s)\n"
+       "-K: the key file of hmac-sha512, which has no default here\n"
+       "Lanes: 1 to %d (default: %d); feedtrng -N must be the same\n"
+       "-d: the device of a capture, from 0 (default: 0)\n"
+       "-S: report the scaling with the threads as JSON",
+       cond_names(), COND_DEFAULT, COND_MAXLANES, LANES);
+}
+
+static long number(const char *arg, const char *what, long min, long max) {
+  char *end;
+  long val = strtol(arg, &end, 10);
+
+  if ((end == arg) || (*end != '\0') || (val < min) || (val > max)) {
+    errx(EX_USAGE, "%s %s out of range (%ld to %ld)", what, arg, min, max);
+  }
+  return val;
+}
+
+static void readkey(const char *keyfile) {
+  uint8_t key[4096];
+  ssize_t len;
+  int fd;
+
+  if ((fd = open(keyfile, O_RDONLY)) == -1) {
+    err(EX_NOINPUT, "cannot open %s", keyfile);
+  }
+  if ((len = read(fd, key, sizeof(key))) == -1) {
+    err(EX_IOERR, "cannot read %s", keyfile);
+  }
+  close(fd);
+  if (cond_setkey(key, (size_t)len) != 0) {
+    errx(EX_DATAERR, "key file %s is empty", keyfile);
+  }
+  memset(key, 0, sizeof(key));
+}
+
+/* segment k: its input, its length, and where its output goes */
+static void segment(const struct job *j, uint64_t k, const uint8_t **in,
+                    uint32_t *len, uint8_t **out, uint32_t *outlen) {
+  uint64_t blk = k / j->nseg;
+  uint32_t i = (uint32_t)(k % j->nseg);
+
+  *in = j->in + blk * j->bsize + (uint64_t)i * j->seg;
+  *len = (i == j->nseg - 1) ? j->bsize - i * j->seg : j->seg;
+  *out = j->out + blk * j->osize + (uint64_t)i * j->cd->outlen;
+  *outlen = MIN(j->cd->outlen, j->osize - i * j->cd->outlen);
+}
+
+/*
+ * one round of the lanes of a thread with sha512:
+ * the segments, all j->seg bytes of whole blocks, are compressed
+ * in place side by side, then the final blocks with the chains,
+ * as sha512_hash_chain() does for one
+ */
+static void round_multi(const struct job *j, uint64_t k0, const unsigned *lane,
+                        unsigned n, uint64_t (*chain)[8]) {
+  static const uint64_t iv[8] = {
+      0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL,
+      0xA54FF53A5F1D36F1ULL, 0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+      0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+  uint64_t state[COND_MAXLANES][8];
+  uint64_t *st[COND_MAXLANES];
+  const uint8_t *blk[COND_MAXLANES];
+  uint8_t pad[COND_MAXLANES][SHA512_BLOCK_LENGTH];
+  uint8_t *out[COND_MAXLANES];
+  uint32_t outlen[COND_MAXLANES], len, off;
+  uint64_t bits = ((uint64_t)j->seg + COND_CHAINLEN) << 3;
+  unsigned i, b;
+
+  for (i = 0; i < n; i++) {
+    segment(j, k0 + lane[i], &blk[i], &len, &out[i], &outlen[i]);
+    memcpy(state[i], iv, sizeof(iv));
+    st[i] = state[i];
+  }
+  for (off = 0; off < j->seg; off += SHA512_BLOCK_LENGTH) {
+    sha512_compress_xN(st, blk, n);
+    for (i = 0; i < n; i++) {
+      blk[i] += SHA512_BLOCK_LENGTH;
+    }
+  }
+  for (i = 0; i < n; i++) {
+    memcpy(pad[i], chain[lane[i]], COND_CHAINLEN);
+    pad[i][COND_CHAINLEN] = 0x80;
+    memset(pad[i] + COND_CHAINLEN + 1, 0,
+           SHA512_BLOCK_LENGTH - COND_CHAINLEN - 1);
+    for (b = 0; b < 8; b++) {
+      pad[i][SHA512_BLOCK_LENGTH - 1 - b] = (uint8_t)(bits >> (b * 8));
+    }
+    blk[i] = pad[i];
+  }
+  sha512_compress_xN(st, blk, n);
+  for (i = 0; i < n; i++) {
+    memcpy(chain[lane[i]], state[i], sizeof(state[i]));
+    memcpy(out[i], state[i], outlen[i]);
+  }
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  const struct job *j = w->job;
+  uint64_t chain[COND_MAXLANES][8];
+  uint64_t nsegs = j->nblocks * j->nseg, k0;
+  unsigned lane[COND_MAXLANES];
+  unsigned i, n, nmine = 0;
+  const uint8_t *in;
+  uint8_t *out;
+  uint32_t len, outlen;
+
+  cond_lanes(chain, j->nlanes);
+  for (i = w->id; i < j->nlanes; i += j->nthreads) {
+    lane[nmine++] = i;
+  }
+  /* round k0: the segments k0 to k0 + nlanes - 1, one per lane */
+  for (k0 = 0; k0 < nsegs; k0 += j->nlanes) {
+    /* the lanes with a segment in the round, the first n in order */
+    for (n = 0; (n < nmine) && (k0 + lane[n] < nsegs); n++)
+      ;
+    if (j->multi) {
+      round_multi(j, k0, lane, n, chain);
+      continue;
+    }
+    for (i = 0; i < n; i++) {
+      segment(j, k0 + lane[i], &in, &len, &out, &outlen);
+      cond_hash(j->cd, in, len, chain[lane[i]]);
+      memcpy(out, chain[lane[i]], outlen);
+    }
+  }
+  return NULL;
+}
+
+/* condition the job with nthreads threads; returns the seconds taken */
+static double condition(struct job *j, unsigned nthreads) {
+  static struct worker w[MAXTHREADS];
+  double t0 = now();
+  unsigned i;
+  int error;
+
+  j->nthreads = nthreads;
+  for (i = 0; i < nthreads; i++) {
+    w[i].job = j;
+    w[i].id = i;
+    if ((error = pthread_create(&w[i].tid, NULL, worker_main, &w[i])) != 0) {
+      errno = error;
+      err(EX_OSERR, "cannot create thread");
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(w[i].tid, NULL);
+  }
+  return now() - t0;
+}
+
+/* the input of a device of a capture, copied out of the records */
+static uint8_t *capture_input(const char *path, unsigned dev, size_t *len) {
+  static struct capture cap;
+  struct cap_read r;
+  uint8_t *buf;
+  size_t n = 0;
+
+  cap_open(&cap, path);
+  if (dev >= cap.hdr->nsources) {
+    errx(EX_USAGE, "%s has no device %u (%u devices)", path, dev,
+         cap.hdr->nsources);
+  }
+  if ((buf = malloc(MAX(cap.hdr->bytes, 1))) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  while (cap_next(&cap, &r)) {
+    if (r.src == dev) {
+      memcpy(buf + n, r.data, r.len);
+      n += r.len;
+    }
+  }
+  fprintf(stderr, "trngcond: device %u of %s: %s, %zu bytes\n", dev, path,
+          cap.hdr->src[dev].name, n);
+  *len = n;
+  return buf;
+}
+
+/* the input file, mapped, or the input of a device in a capture */
+static const uint8_t *input(const char *path, unsigned dev, size_t *len) {
+  struct stat st;
+  void *map;
+  char magic[sizeof(CAP_MAGIC)];
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    err(EX_NOINPUT, "cannot open %s", path);
+  }
+  if (fstat(fd, &st) == -1) {
+    err(EX_IOERR, "cannot stat %s", path);
+  }
+  if ((pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)) &&
+      (memcmp(magic, CAP_MAGIC, sizeof(magic)) == 0)) {
+    close(fd);
+    return capture_input(path, dev, len);
+  }
+  *len = (size_t)st.st_size;
+  if (*len == 0) {
+    errx(EX_DATAERR, "%s is empty", path);
+  }
+  if ((map = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    err(EX_IOERR, "cannot mmap %s", path);
+  }
+  /* read through once, in order */
+  madvise(map, *len, MADV_SEQUENTIAL);
+  close(fd);
+  return map;
+}
+
+/* pseudo-random input for -S without a file (xorshift64*) */
+static uint8_t *generate(size_t len) {
+  uint64_t x = 1, v;
+  uint8_t *buf;
+  size_t i;
+
+  if ((buf = malloc(len)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  for (i = 0; i < len; i += sizeof(v)) {
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    v = x * UINT64_C(0x2545F4914F6CDD1D);
+    memcpy(buf + i, &v, MIN(sizeof(v), len - i));
+  }
+  return buf;
+}
+
+static void scaling(struct job *j, unsigned maxthreads, long cpus) {
+  struct job serial = *j;
+  uint8_t *first;
+  size_t outlen = (size_t)j->nblocks * j->osize;
+  double bytes = (double)j->nblocks * j->bsize, t, t1 = 0, ts;
+  unsigned n;
+  int last = 0;
+
+  if ((first = malloc(outlen)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  /* the single chain of feedtrng by default, for comparison */
+  serial.nlanes = 1;
+  ts = condition(&serial, 1);
+  fprintf(stderr, "trngcond:   a single chain %9.1f MiB/s\n",
+          bytes / ts / 1048576);
+  printf("{\n  \"benchmark\": \"trngcond\",\n  \"conditioner\": \"%s\",\n"
+         "  \"sha512_impl\": \"%s\",\n  \"sha512_mb\": \"%s\",\n"
+         "  \"multi_buffer\": %s,\n  \"cpus\": %ld,\n  \"lanes\": %u,\n"
+         "  \"block_size\": %u,\n  \"output_size\": %u,\n"
+         "  \"input_bytes\": %.0f,\n  \"single_chain_mib_per_s\": %.1f,\n"
+         "  \"results\": [",
+         j->cd->name, sha512_name(), sha512_mb_name(),
+         j->multi ? "true" : "false", cpus, j->nlanes, j->bsize, j->osize,
+         bytes, bytes / ts / 1048576);
+  for (n = 1; !last; n *= 2) {
+    if (n >= maxthreads) {
+      n = maxthreads;
+      last = 1;
+    }
+    t = condition(j, n);
+    if (n == 1) {
+      t1 = t;
+      memcpy(first, j->out, outlen);
+    } else if (memcmp(first, j->out, outlen) != 0) {
+      errx(EX_SOFTWARE, "the output with %u threads differs", n);
+    }
+    printf("%s\n    {\"threads\": %u, \"seconds\": %.3f, \"mib_per_s\": %.1f, "
+           "\"speedup\": %.2f, \"over_single_chain\": %.2f}",
+           (n == 1) ? "" : ",", n, t, bytes / t / 1048576, t1 / t, ts / t);
+    fprintf(stderr, "trngcond: %3u threads %9.1f MiB/s (x%.2f)\n", n,
+            bytes / t / 1048576, t1 / t);
+  }
+  printf("\n  ]\n}\n");
+  free(first);
+}
+
+int main(int argc, char *argv[]) {
+  static struct job job;
+  const char *keyfile = NULL, *outfile = NULL;
+  const uint8_t *in;
+  size_t len, outlen, off;
+  ssize_t n;
+  long bsize = BLOCKSIZE, osize = OUTPUTSIZE, lanes = LANES, threads = 0;
+  long cpus, mib = 256;
+  unsigned dev = 0;
+  int ch, fd, bench = 0;
+  double t;
+
+  job.cd = cond_find(COND_DEFAULT);
+  while ((ch = getopt(argc, argv, "b:c:C:K:N:j:d:o:Ss:")) != -1) {
+    switch (ch) {
+    case 'b':
+      bsize = number(optarg, "block size", SHA512_BLOCK_LENGTH, 65536);
+      if ((bsize % SHA512_BLOCK_LENGTH) != 0) {
+        errx(EX_USAGE, "block size %ld is not a multiple of %d", bsize,
+             SHA512_BLOCK_LENGTH);
+      }
+      break;
+    case 'c':
+      osize = number(optarg, "output size", 1, 65536);
+      break;
+    case 'C':
+      if ((job.cd = cond_find(optarg)) == NULL) {
+        errx(EX_USAGE, "conditioner %s not supported", optarg);
+      }
+      break;
+    case 'K':
+      keyfile = optarg;
+      break;
+    case 'N':
+      lanes = number(optarg, "lanes", 1, COND_MAXLANES);
+      break;
+    case 'j':
+      threads = number(optarg, "threads", 1, MAXTHREADS);
+      break;
+    case 'd':
+      dev = (unsigned)number(optarg, "device", 0, CAP_MAXSOURCES - 1);
+      break;
+    case 'o':
+      outfile = optarg;
+      break;
+    case 'S':
+      bench = 1;
+      break;
+    case 's':
+      mib = number(optarg, "MiB", 1, 65536);
+      break;
+    default:
+      usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if ((argc > 1) || ((argc == 0) && !bench)) {
+    usage();
+  }
+  if (osize > bsize) {
+    errx(EX_USAGE, "output size %ld larger than block size %ld", osize, bsize);
+  }
+  if (strcmp(job.cd->name, "hmac-sha512") == 0) {
+    if (keyfile == NULL) {
+      errx(EX_USAGE, "hmac-sha512 needs the key file of feedtrng (-K)");
+    }
+    readkey(keyfile);
+  } else if (keyfile != NULL) {
+    errx(EX_USAGE, "-K is only for hmac-sha512");
+  }
+  if (argc == 1) {
+    in = input(argv[0], dev, &len);
+  } else {
+    len = (size_t)mib << 20;
+    in = generate(len);
+  }
+  if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+    cpus = 1;
+  }
+  if (threads == 0) {
+    threads = MIN(cpus, MAXTHREADS);
+  }
+  threads = MIN(threads, lanes);
+
+  /* as conditioner_main() of feedtrng splits a block */
+  job.in = in;
+  job.bsize = (uint32_t)bsize;
+  job.osize = (uint32_t)osize;
+  job.nblocks = len / job.bsize;
+  job.nseg = (job.osize + job.cd->outlen - 1) / job.cd->outlen;
+  job.seg = job.bsize / job.nseg;
+  job.nlanes = (unsigned)lanes;
+  job.multi = (strcmp(job.cd->name, "sha512") == 0) &&
+              (job.seg % SHA512_BLOCK_LENGTH == 0) &&
+              (job.seg * job.nseg == job.bsize);
+  if (job.nblocks == 0) {
+    errx(EX_DATAERR, "the input is shorter than a block");
+  }
+  outlen = (size_t)job.nblocks * job.osize;
+  if ((job.out = malloc(outlen)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  if (bench) {
+    scaling(&job, (unsigned)threads, cpus);
+    return 0;
+  }
+
+  t = condition(&job, (unsigned)threads);
+  fprintf(stderr,
+          "trngcond: %ju bytes into %zu in %.3f s (%.1f MiB/s), "
+          "%ld lanes, %ld threads\n",
+          (uintmax_t)job.nblocks * job.bsize, outlen, t,
+          (double)job.nblocks * job.bsize / t / 1048576, lanes, threads);
+  fd = STDOUT_FILENO;
+  if ((outfile != NULL) &&
+      ((fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)) {
+    err(EX_CANTCREAT, "cannot create %s", outfile);
+  }
+  for (off = 0; off < outlen; off += (size_t)n) {
+    if ((n = write(fd, job.out + off, outlen - off)) == -1) {
+      err(EX_IOERR, "write failed");
+    }
+  }
+  if ((outfile != NULL) && (close(fd) == -1)) {
+    err(EX_IOERR, "cannot close %s", outfile);
+  }
+  return 0;
+}
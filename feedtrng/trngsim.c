@@ -0,0 +1,113 @@
+/*
+ * TRNG simulator on pseudo-terminals, for testing feedtrng
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * Opens a pty per simulated device, prints the names of the tty side,
+ * one per line, and writes pseudo-random bytes into them
+ * at the rate and in the bursts of the device, until killed
+ * or for the seconds given; feedtrng reads the ttys as the real devices:
+ *   feedtrng -o -d /dev/pts/3 -d /dev/pts/4 > /dev/null
+ * The bytes written are reported at the end on stderr.
+ *
+ * To compile (add -D_GNU_SOURCE on Linux):
+ * cc -O2 -o trngsim trngsim.c sim.c -lpthread
+ *
+ * Usage: trngsim [-l] [-n devices] [-p profile] [-s seed] [-t seconds]
+ */
+
+#include <err.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+#define MAXDEVICES (16)
+
+static void usage(void) {
+  fprintf(stderr, "usage: trngsim [-l] [-n devices] [-p profile] [-s seed] "
+                  "[-t seconds]\n");
+  exit(EX_USAGE);
+}
+
+static void list(void) {
+  const struct sim_profile *p;
+  int i;
+
+  for (i = 0; i < sim_nprofiles; i++) {
+    p = &sim_profiles[i];
+    printf("%-10s %7.0f bytes/s, %4u-byte writes, %2u per burst: %s\n",
+           p->name, p->rate, p->packet, p->burst, p->device);
+  }
+  exit(EX_OK);
+}
+
+int main(int argc, char *argv[]) {
+  static struct sim_device dev[MAXDEVICES];
+  const struct sim_profile *p = sim_find("truerng");
+  uint64_t seed = 1, total = 0;
+  unsigned seconds = 0;
+  sigset_t set;
+  int ch, i, n = 1, sig;
+
+  while ((ch = getopt(argc, argv, "ln:p:s:t:")) != -1) {
+    switch (ch) {
+    case 'l':
+      list();
+      break;
+    case 'n':
+      n = atoi(optarg);
+      if ((n < 1) || (n > MAXDEVICES)) {
+        errx(EX_USAGE, "devices must be from 1 to %d", MAXDEVICES);
+      }
+      break;
+    case 'p':
+      if ((p = sim_find(optarg)) == NULL) {
+        errx(EX_USAGE, "unknown profile %s (see trngsim -l)", optarg);
+      }
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      seconds = (unsigned)atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc) {
+    usage();
+  }
+  /* the simulators do not get the signals */
+  sigemptyset(&set);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  for (i = 0; i < n; i++) {
+    sim_open(&dev[i], p, seed + (uint64_t)i, 0);
+    printf("%s\n", dev[i].name);
+  }
+  fflush(stdout);
+  for (i = 0; i < n; i++) {
+    sim_start(&dev[i]);
+  }
+  if (seconds > 0) {
+    alarm(seconds);
+  }
+  sigwait(&set, &sig);
+  for (i = 0; i < n; i++) {
+    sim_stop(&dev[i]);
+    total += atomic_load(&dev[i].written);
+    sim_close(&dev[i]);
+  }
+  fprintf(stderr, "trngsim: %d %s devices wrote %ju bytes\n", n, p->name,
+          (uintmax_t)total);
+  return EX_OK;
+}
@@ -0,0 +1,185 @@
+/*
+ * Feeder for /dev/trng: asynchronous reads over io_uring(7)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * The rings are shared with the kernel: the tail of the submission
+ * queue and the head of the completion queue are written here
+ * with release stores, and the other ends read with acquire loads.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOAD(p) atomic_load_explicit((_Atomic unsigned *)(p), memory_order_acquire)
+#define STORE(p, v)                                                            \
+  atomic_store_explicit((_Atomic unsigned *)(p), (v), memory_order_release)
+
+int uring_open(struct uring *u, unsigned entries) {
+  struct io_uring_params p;
+  uint8_t *sq, *cq;
+
+  memset(u, 0, sizeof(*u));
+  memset(&p, 0, sizeof(p));
+  if ((u->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) == -1) {
+    return -1;
+  }
+  u->entries = p.sq_entries;
+  u->sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->sqsize = u->cqsize = (u->sqsize > u->cqsize) ? u->sqsize : u->cqsize;
+  }
+  if ((u->sqmap = mmap(NULL, u->sqsize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING)) ==
+      MAP_FAILED) {
+    goto fail;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cqmap = u->sqmap;
+  } else if ((u->cqmap = mmap(NULL, u->cqsize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, u->fd,
+                              IORING_OFF_CQ_RING)) == MAP_FAILED) {
+    goto fail;
+  }
+  u->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+  if ((u->sqes = mmap(NULL, u->sqesize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES)) ==
+      MAP_FAILED) {
+    goto fail;
+  }
+  sq = u->sqmap;
+  cq = u->cqmap;
+  u->sqhead = (unsigned *)(sq + p.sq_off.head);
+  u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+  u->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sqarray = (unsigned *)(sq + p.sq_off.array);
+  u->cqhead = (unsigned *)(cq + p.cq_off.head);
+  u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+  u->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = cq + p.cq_off.cqes;
+  return u->fd;
+
+fail:
+  uring_close(u);
+  return -1;
+}
+
+int uring_read(struct uring *u, int fd, void *buf, size_t len, void *udata) {
+  struct io_uring_sqe *sqe;
+  unsigned tail = *u->sqtail, i;
+
+  if (tail - LOAD(u->sqhead) >= u->entries) {
+    return -1;
+  }
+  i = tail & *u->sqmask;
+  sqe = (struct io_uring_sqe *)u->sqes + i;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  /* at the file position, as read(2) */
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = (uint64_t)(uintptr_t)udata;
+  u->sqarray[i] = i;
+  STORE(u->sqtail, tail + 1);
+  u->queued++;
+  return 0;
+}
+
+int uring_submit(struct uring *u) {
+  int n, calls = 0;
+
+  while (u->queued > 0) {
+    calls++;
+    if ((n = (int)syscall(__NR_io_uring_enter, u->fd, u->queued, 0, 0, NULL,
+                          0)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    u->queued -= (unsigned)n;
+  }
+  return calls;
+}
+
+int uring_reap(struct uring *u, void **udata, int *res) {
+  struct io_uring_cqe *cqe;
+  unsigned head = *u->cqhead;
+
+  if (head == LOAD(u->cqtail)) {
+    return 0;
+  }
+  cqe = (struct io_uring_cqe *)u->cqes + (head & *u->cqmask);
+  *udata = (void *)(uintptr_t)cqe->user_data;
+  *res = cqe->res;
+  STORE(u->cqhead, head + 1);
+  return 1;
+}
+
+void uring_close(struct uring *u) {
+  if ((u->sqes != NULL) && (u->sqes != MAP_FAILED)) {
+    munmap(u->sqes, u->sqesize);
+  }
+  if ((u->cqmap != NULL) && (u->cqmap != MAP_FAILED) &&
+      (u->cqmap != u->sqmap)) {
+    munmap(u->cqmap, u->cqsize);
+  }
+  if ((u->sqmap != NULL) && (u->sqmap != MAP_FAILED)) {
+    munmap(u->sqmap, u->sqsize);
+  }
+  if (u->fd >= 0) {
+    close(u->fd);
+  }
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
+
+#else /* !__linux__ */
+
+int uring_open(struct uring *u, unsigned entries) {
+  (void)entries;
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_read(struct uring *u, int fd, void *buf, size_t len, void *udata) {
+  (void)u;
+  (void)fd;
+  (void)buf;
+  (void)len;
+  (void)udata;
+  return -1;
+}
+
+int uring_submit(struct uring *u) {
+  (void)u;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_reap(struct uring *u, void **udata, int *res) {
+  (void)u;
+  (void)udata;
+  (void)res;
+  return 0;
+}
+
+void uring_close(struct uring *u) { u->fd = -1; }
+
+#endif /* __linux__ */
@@ -0,0 +1,57 @@
+/*
+ * Feeder for /dev/trng: asynchronous reads over io_uring(7)
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see LICENSE)
+ *
+ * A minimal submission and completion queue over the raw system calls,
+ * without liburing: only reads at the file position are queued.
+ * Elsewhere than on Linux, uring_open() fails with ENOSYS.
+ */
+
+#ifndef _FEEDTRNG_URING_H_
+#define _FEEDTRNG_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct uring {
+  int fd;
+  unsigned entries;
+  unsigned queued; /* entries not yet submitted */
+  /* the submission queue ring */
+  unsigned *sqhead;
+  unsigned *sqtail;
+  unsigned *sqmask;
+  unsigned *sqarray;
+  void *sqes;
+  /* the completion queue ring */
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned *cqmask;
+  void *cqes;
+  /* the mappings */
+  void *sqmap;
+  size_t sqsize;
+  void *cqmap;
+  size_t cqsize;
+  size_t sqesize;
+};
+
+/*
+ * uring_open() sets up a ring of entries reads, and returns its descriptor,
+ * readable for the event loop when a read has completed, or -1.
+ * uring_read() queues a read of len bytes from fd into buf,
+ * and returns -1 when the queue is full.
+ * uring_submit() submits the reads queued, and returns the io_uring_enter(2)
+ * calls made, or -1 on error.
+ * uring_reap() takes a completed read: its udata, and its result
+ * as of read(2) with -errno for an error; returns 0 when none is left.
+ */
+extern int uring_open(struct uring *u, unsigned entries);
+extern int uring_read(struct uring *u, int fd, void *buf, size_t len,
+                      void *udata);
+extern int uring_submit(struct uring *u);
+extern int uring_reap(struct uring *u, void **udata, int *res);
+extern void uring_close(struct uring *u);
+
+#endif /* _FEEDTRNG_URING_H_ */
@@ -2,48 +2,501 @@
  * Testing /dev/random
  * by TestU01 BigCrush test
  *
+ * The random numbers are served out of MiB-sized buffers filled in bulk
+ * from /dev/random, a device or a pipe (- for stdin, such as the output
+ * of feedtrng -o), or a file mapped with mmap(2).
+ * The tests of the battery are run in worker processes on all CPUs,
+ * one test per process at a time, each with its own input:
+ * the workers read their own bytes of a device or a pipe,
+ * and each test reads a file from its start, as bbattery_*File() does.
+ * The p-values of all tests are merged into a single report on stdout,
+ * with those outside [0.001, 0.999] flagged as in the TestU01 summary.
+ *
  * To compile (on FreeBSD Port math/testu01):
  * cc -O3 -o randomtest randomtest.c -I/usr/local/include/TestU01 -L/usr/local/lib -ltestu01 -lprobdist -lmylib -lm
+ *
+ * Usage: randomtest [-b small|crush|big] [-j workers] [-t tests]
+ *                   [-B MiB] [-l logdir] [input]
+ *   -b: the battery (default: big)
+ *   -j: worker processes (default: the number of CPUs)
+ *   -t: the tests to run, such as 1,3,10-20 (default: all)
+ *   -B: the input buffer of each worker (default: 4 MiB)
+ *   -l: write the full output of test n into logdir/battery-n.txt
+ *   input: a device, a file, or - for stdin (default: /dev/random)
  */
 
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
 #include "gdef.h"
 #include "swrite.h"
 #include "bbattery.h"
 #include "unif01.h"
 
-FILE *fp;
+/* tests in the largest battery, BigCrush */
+#define MAXTESTS (106)
+/* statistics of a test, and the length of their names */
+#define MAXSTATS (16)
+#define NAMELEN (64)
+/* the p-values flagged, as gofw_Suspectp of TestU01 */
+#define SUSPECTP (0.001)
+
+struct battery {
+    const char *name;
+    const char *title;
+    int ntests;
+    void (*repeat)(unif01_Gen *gen, int rep[]);
+};
+
+static const struct battery batteries[] = {
+    {"small", "SmallCrush", 10, bbattery_RepeatSmallCrush},
+    {"crush", "Crush", 96, bbattery_RepeatCrush},
+    {"big", "BigCrush", 106, bbattery_RepeatBigCrush},
+};
+#define NBATTERIES (sizeof(batteries) / sizeof(batteries[0]))
+
+/* the result of a test, from its worker */
+struct result {
+    int nstats;
+    char name[MAXSTATS][NAMELEN];
+    double pval[MAXSTATS];
+    int wraps;      /* times a file input was read through */
+    int failed;     /* the worker did not finish */
+    double seconds; /* wall clock */
+    double cpu;     /* user and system */
+};
+
+/* a running worker */
+struct worker {
+    pid_t pid;
+    int test;
+    int fd;
+    struct timespec start;
+};
+
+/* the input of a worker */
+static const char *inname = "/dev/random";
+static int infd = -1;
+static const uint32_t *map; /* a file, mapped by the parent */
+static size_t mapwords;
+static uint32_t *buf;       /* a device or a pipe */
+static size_t bufwords = (4 << 20) / sizeof(uint32_t);
+static size_t pos, end;
+static int wraps;
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+/* open the input in the parent; a regular file is mapped for all workers */
+static void open_input(void)
+{
+    struct stat st;
+    void *m;
 
-void open_random(void) {
-    if ((fp = fopen("/dev/random", "r")) == NULL) {
-        perror("open_random(): failed to open /dev/random");
-        exit(-1);
+    if (strcmp(inname, "-") == 0) {
+        infd = STDIN_FILENO;
+        inname = "stdin";
+        return;
+    }
+    if ((infd = open(inname, O_RDONLY)) == -1) {
+        err(EX_NOINPUT, "cannot open %s", inname);
+    }
+    if (fstat(infd, &st) == -1) {
+        err(EX_IOERR, "cannot stat %s", inname);
     }
-    return;
+    if (!S_ISREG(st.st_mode)) {
+        /* a device: each worker opens its own */
+        close(infd);
+        infd = -1;
+        return;
+    }
+    if ((mapwords = (size_t)st.st_size / sizeof(uint32_t)) == 0) {
+        errx(EX_DATAERR, "%s is shorter than a number", inname);
+    }
+    if ((m = mmap(NULL, mapwords * sizeof(uint32_t), PROT_READ, MAP_SHARED,
+                  infd, 0)) == MAP_FAILED) {
+        err(EX_IOERR, "cannot mmap %s", inname);
+    }
+    madvise(m, mapwords * sizeof(uint32_t), MADV_SEQUENTIAL);
+    map = m;
+    close(infd);
+    infd = -1;
 }
 
-unsigned int get_devrandom(void) {
-    unsigned int y;
-    int num;
+/* fill the buffer of the worker with whole numbers */
+static void fill(void)
+{
+    size_t len = 0;
+    ssize_t n;
 
-    if ((num = fread(&y, sizeof(unsigned int), 1, fp)) == 0) {
-        perror("get_devrandom(): failed to fread");
-        exit(-1);
+    if (map != NULL) {
+        /* read through the file: start over */
+        wraps++;
+        pos = 0;
+        return;
+    }
+    while (len < bufwords * sizeof(uint32_t)) {
+        if ((n = read(infd, (uint8_t *)buf + len,
+                      bufwords * sizeof(uint32_t) - len)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(EX_IOERR, "read from %s failed", inname);
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
     }
-    return y;
+    if ((end = len / sizeof(uint32_t)) == 0) {
+        errx(EX_DATAERR, "%s ended", inname);
+    }
+    pos = 0;
 }
 
-int main (void)
+static unsigned int get_buffered(void)
 {
-    unif01_Gen *gen;
+    if (map != NULL) {
+        if (pos == mapwords) {
+            fill();
+        }
+        return map[pos++];
+    }
+    if (pos == end) {
+        fill();
+    }
+    return buf[pos++];
+}
 
-    open_random();
+/* run a test of the battery in a worker, and write its p-values to fd */
+static void run_test(const struct battery *bt, int test, int fd,
+                     const char *logdir)
+{
+    unif01_Gen *gen;
+    int rep[MAXTESTS + 1];
+    char path[1024];
+    FILE *out;
+    int j;
 
-    gen = unif01_CreateExternGenBits("devrandom", get_devrandom);
-    bbattery_BigCrush(gen);
+    if ((infd == -1) && (map == NULL) &&
+        ((infd = open(inname, O_RDONLY)) == -1)) {
+        err(EX_NOINPUT, "cannot open %s", inname);
+    }
+    if ((map == NULL) && ((buf = malloc(bufwords * sizeof(uint32_t))) == NULL)) {
+        err(EX_OSERR, "malloc");
+    }
+    pos = end = 0;
+    /* the full output of the test goes to the log, or nowhere */
+    if (logdir != NULL) {
+        snprintf(path, sizeof(path), "%s/%s-%d.txt", logdir, bt->name, test);
+    } else {
+        snprintf(path, sizeof(path), "/dev/null");
+    }
+    if (freopen(path, "w", stdout) == NULL) {
+        err(EX_CANTCREAT, "cannot open %s", path);
+    }
+    memset(rep, 0, sizeof(rep));
+    rep[test] = 1;
+    gen = unif01_CreateExternGenBits((char *)inname, get_buffered);
+    bt->repeat(gen, rep);
     unif01_DeleteExternGenBits(gen);
+    fflush(stdout);
+    if ((out = fdopen(fd, "w")) == NULL) {
+        err(EX_OSERR, "fdopen");
+    }
+    for (j = 0; j < bbattery_NTests; j++) {
+        fprintf(out, "%.17g\t%s\n", bbattery_pVal[j], bbattery_TestNames[j]);
+    }
+    fprintf(out, "%d\twraps\n", wraps);
+    fclose(out);
+    _exit(0);
+}
+
+static void start(struct worker *w, const struct battery *bt, int test,
+                  const char *logdir)
+{
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+        err(EX_OSERR, "pipe");
+    }
+    fflush(stdout);
+    w->test = test;
+    clock_gettime(CLOCK_MONOTONIC, &w->start);
+    if ((w->pid = fork()) == -1) {
+        err(EX_OSERR, "fork");
+    }
+    if (w->pid == 0) {
+        close(fds[0]);
+        run_test(bt, test, fds[1], logdir);
+    }
+    close(fds[1]);
+    w->fd = fds[0];
+}
+
+/* the p-values of a worker which has exited */
+static void finish(struct worker *w, int status, const struct rusage *ru,
+                   struct result *r)
+{
+    char line[NAMELEN + 64], *tab, *nl;
+    FILE *in;
+
+    r->seconds = elapsed(&w->start);
+    r->cpu = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec * 1e-6 +
+             ru->ru_stime.tv_sec + ru->ru_stime.tv_usec * 1e-6;
+    if ((in = fdopen(w->fd, "r")) == NULL) {
+        err(EX_OSERR, "fdopen");
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if ((tab = strchr(line, '\t')) == NULL) {
+            continue;
+        }
+        *tab++ = '\0';
+        if ((nl = strchr(tab, '\n')) != NULL) {
+            *nl = '\0';
+        }
+        if (strcmp(tab, "wraps") == 0) {
+            r->wraps = atoi(line);
+        } else if (r->nstats < MAXSTATS) {
+            r->pval[r->nstats] = strtod(line, NULL);
+            snprintf(r->name[r->nstats], NAMELEN, "%s", tab);
+            r->nstats++;
+        }
+    }
+    fclose(in);
+    r->failed = !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ||
+                (r->nstats == 0);
+    w->pid = 0;
+}
+
+/* a p-value as in the summary of TestU01 */
+static void pvalue(double p, char *s, size_t len)
+{
+    if (p < 1.0e-300) {
+        snprintf(s, len, "eps");
+    } else if (p < 1.0e-15) {
+        snprintf(s, len, "eps1");
+    } else if (p < 0.01) {
+        snprintf(s, len, "%.1e", p);
+    } else if (p >= 1.0 - 1.0e-15) {
+        snprintf(s, len, "1 - eps1");
+    } else if (p > 0.99) {
+        snprintf(s, len, "1 - %.1e", 1.0 - p);
+    } else {
+        snprintf(s, len, "%.2f", p);
+    }
+}
+
+static void report(const struct battery *bt, const int *tests, int ntests,
+                   const struct result *res, int jobs, double seconds)
+{
+    const struct result *r;
+    char p[32];
+    double cpu = 0;
+    int i, j, nstats = 0, nsuspect = 0, nfailed = 0, nwrapped = 0;
+
+    printf("========= Summary results of %s =========\n\n", bt->title);
+    printf(" Generator:             %s\n", inname);
+    printf(" Workers:               %d\n", jobs);
+    printf("\n       Test                          p-value    seconds\n");
+    printf(" --------------------------------------------------------\n");
+    for (i = 0; i < ntests; i++) {
+        r = &res[tests[i]];
+        cpu += r->cpu;
+        if (r->failed) {
+            printf(" %3d  (not finished)%38.1f\n", tests[i], r->seconds);
+            nfailed++;
+            continue;
+        }
+        nwrapped += (r->wraps > 0);
+        for (j = 0; j < r->nstats; j++) {
+            pvalue(r->pval[j], p, sizeof(p));
+            printf(" %3d  %-30.30s%-11s%s", tests[i], r->name[j], p,
+                   ((r->pval[j] < SUSPECTP) || (r->pval[j] > 1 - SUSPECTP))
+                       ? "*"
+                       : " ");
+            if (j == 0) {
+                printf("%9.1f", r->seconds);
+            }
+            printf("\n");
+            nstats++;
+            nsuspect += (r->pval[j] < SUSPECTP) || (r->pval[j] > 1 - SUSPECTP);
+        }
+    }
+    printf(" --------------------------------------------------------\n");
+    printf(" Number of statistics:  %d\n", nstats);
+    printf(" Total CPU time:        %.1f s\n", cpu);
+    printf(" Elapsed time:          %.1f s (about %.2f times one worker)\n",
+           seconds, (seconds > 0) ? cpu / seconds : 0);
+    if ((nsuspect == 0) && (nfailed == 0)) {
+        printf("\n All tests were passed\n");
+    } else if (nsuspect > 0) {
+        printf("\n %d p-values were outside [%.3f, %.3f] (marked *)\n",
+               nsuspect, SUSPECTP, 1 - SUSPECTP);
+    }
+    if (nfailed > 0) {
+        printf("\n %d tests did not finish\n", nfailed);
+    }
+    if (nwrapped > 0) {
+        printf(" %d tests read %s through more than once;"
+               " their p-values are not valid\n", nwrapped, inname);
+    }
+    printf("\n");
+}
 
-    fcloseall();
+/* parse a list of tests such as 1,3,10-20 */
+static int parse_tests(const char *arg, int ntests, int *tests)
+{
+    char *s, *tok, *dash, *save;
+    int a, b, n = 0, seen[MAXTESTS + 1];
+
+    memset(seen, 0, sizeof(seen));
+    if ((s = strdup(arg)) == NULL) {
+        err(EX_OSERR, "strdup");
+    }
+    for (tok = strtok_r(s, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        a = b = atoi(tok);
+        if ((dash = strchr(tok, '-')) != NULL) {
+            b = atoi(dash + 1);
+        }
+        if ((a < 1) || (b > ntests) || (a > b)) {
+            errx(EX_USAGE, "tests %s out of 1 to %d", tok, ntests);
+        }
+        for (; a <= b; a++) {
+            if (!seen[a]) {
+                seen[a] = 1;
+                tests[n++] = a;
+            }
+        }
+    }
+    free(s);
+    return n;
+}
+
+static void usage(void)
+{
+    errx(EX_USAGE, "Usage: randomtest [-b small|crush|big] [-j workers] "
+                   "[-t tests] [-B MiB] [-l logdir] [input]");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct result res[MAXTESTS + 1];
+    static struct worker workers[256];
+    const struct battery *bt = &batteries[NBATTERIES - 1];
+    const char *logdir = NULL, *testarg = NULL;
+    int tests[MAXTESTS];
+    int ch, i, ntests, next, running, status, jobs = 0;
+    struct timespec t0;
+    struct rusage ru;
+    size_t k;
+    long mib;
+    pid_t pid;
+
+    while ((ch = getopt(argc, argv, "b:j:t:B:l:")) != -1) {
+        switch (ch) {
+        case 'b':
+            for (k = 0; k < NBATTERIES; k++) {
+                if (strcmp(optarg, batteries[k].name) == 0) {
+                    break;
+                }
+            }
+            if (k == NBATTERIES) {
+                errx(EX_USAGE, "unknown battery %s", optarg);
+            }
+            bt = &batteries[k];
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if ((jobs < 1) || (jobs > 256)) {
+                errx(EX_USAGE, "workers must be from 1 to 256");
+            }
+            break;
+        case 't':
+            testarg = optarg;
+            break;
+        case 'B':
+            mib = atol(optarg);
+            if ((mib < 1) || (mib > 1024)) {
+                errx(EX_USAGE, "buffer must be from 1 to 1024 MiB");
+            }
+            bufwords = ((size_t)mib << 20) / sizeof(uint32_t);
+            break;
+        case 'l':
+            logdir = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind > 1) {
+        usage();
+    }
+    if (argc - optind == 1) {
+        inname = argv[optind];
+    }
+    if (testarg != NULL) {
+        ntests = parse_tests(testarg, bt->ntests, tests);
+    } else {
+        for (ntests = 0; ntests < bt->ntests; ntests++) {
+            tests[ntests] = ntests + 1;
+        }
+    }
+    if (jobs == 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = (jobs < 1) ? 1 : (jobs > 256) ? 256 : jobs;
+    }
+    if (jobs > ntests) {
+        jobs = ntests;
+    }
+    open_input();
+
+    /* a test to each free worker, until all are done */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (next = 0, running = 0; (next < ntests) || (running > 0);) {
+        for (i = 0; (i < jobs) && (next < ntests); i++) {
+            if (workers[i].pid == 0) {
+                start(&workers[i], bt, tests[next++], logdir);
+                running++;
+            }
+        }
+        if ((pid = wait4(-1, &status, 0, &ru)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(EX_OSERR, "wait4");
+        }
+        for (i = 0; i < jobs; i++) {
+            if (workers[i].pid == pid) {
+                finish(&workers[i], status, &ru, &res[workers[i].test]);
+                fprintf(stderr, "randomtest: %s test %d done in %.1f s%s\n",
+                        bt->title, workers[i].test,
+                        res[workers[i].test].seconds,
+                        res[workers[i].test].failed ? " (failed)" : "");
+                running--;
+                break;
+            }
+        }
+    }
+    report(bt, tests, ntests, res, jobs, elapsed(&t0));
     return 0;
 }
@@ -0,0 +1,404 @@
+/*
+ * Userspace emulation of the mmap ring of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * A producer process (as feedtrng -m) and a consumer process
+ * (as the driver) share the ring of trng_ring.h by an anonymous
+ * shared mapping; TRNGIOC_DRAIN is emulated by a request and a reply
+ * over a pair of pipes. The producer writes a pseudo-random stream
+ * in pieces of 64 to 1024 bytes, and the consumer checks every byte
+ * in order. The cases, written as JSON:
+ *   write: write(2) of 1024-byte batches into a pipe, as without -m
+ *   ring: drain when the ring is half full or full, as feedtrng -m
+ *   ring-poll: the consumer also drains all the time,
+ *              to stress the indices from both sides
+ *
+ * To compile (on Linux or FreeBSD):
+ * cc -O2 -o ringbench ringbench.c
+ *
+ * Usage: ringbench [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trng_ring.h"
+
+/* the batch size of the write(2) path */
+#define WRITESIZE (1024)
+
+/* the range of the piece sizes */
+#define MINPIECE (64)
+#define MAXPIECE (1024)
+
+enum { WRITE, RING, RINGPOLL, NCASES };
+static const char *casenames[NCASES] = {"write", "ring", "ring-poll"};
+
+static double seconds = 1.0;
+
+/* The stream: the byte at pos is a byte of splitmix64(pos / 8) */
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static void stream_fill(uint8_t *buf, uint64_t pos, size_t len) {
+  uint64_t w = splitmix64(pos >> 3);
+  size_t i;
+
+  for (i = 0; i < len; i++, pos++) {
+    if ((i > 0) && ((pos & 7) == 0)) {
+      w = splitmix64(pos >> 3);
+    }
+    buf[i] = (uint8_t)(w >> ((pos & 7) * 8));
+  }
+}
+
+/* the consumer state */
+struct consumer {
+  uint64_t pos;    /* bytes checked */
+  uint64_t errors; /* bytes differing from the stream */
+  uint64_t drains;
+};
+
+/* the emulated random_harvest_fast(9): check the bytes */
+static void consumer_check(void *arg, const uint8_t *buf, size_t len) {
+  struct consumer *c = arg;
+  uint8_t expect[MAXPIECE];
+  size_t off, n, i;
+
+  for (off = 0; off < len; off += n) {
+    n = MIN(len - off, sizeof(expect));
+    stream_fill(expect, c->pos, n);
+    if (memcmp(expect, buf + off, n) != 0) {
+      for (i = 0; i < n; i++) {
+        c->errors += (expect[i] != buf[off + i]);
+      }
+    }
+    c->pos += n;
+  }
+}
+
+/* The ring, shared by the processes */
+static struct trng_ring *ring;
+static uint8_t *ringdata;
+
+/* the pipes: requests from the producer, replies from the consumer */
+static int req[2], rep[2];
+
+static void xwrite(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, p, len)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(EX_IOERR, "write");
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+static int xread(int fd, void *buf, size_t len) {
+  uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = read(fd, p, len)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(EX_IOERR, "read");
+    }
+    if (n == 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * the emulated driver: drain on each request, and also all the time
+ * for ring-poll; the reply of the last request ('S') is the state
+ */
+static void consumer_ring(int poll_all) {
+  struct consumer c = {0, 0, 0};
+  struct pollfd pfd;
+  uint64_t tail = 0;
+  char cmd;
+
+  pfd.fd = req[0];
+  pfd.events = POLLIN;
+  while (1) {
+    if (poll_all && (poll(&pfd, 1, 0) == 0)) {
+      if (trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) < 0) {
+        c.errors++;
+      }
+      continue;
+    }
+    if (xread(req[0], &cmd, 1) != 0) {
+      errx(EX_SOFTWARE, "producer gone");
+    }
+    if (trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) < 0) {
+      c.errors++;
+    }
+    c.drains++;
+    if (cmd == 'S') {
+      xwrite(rep[1], &c, sizeof(c));
+      return;
+    }
+    xwrite(rep[1], &cmd, 1);
+  }
+}
+
+/* the former path: read(2) what the producer writes */
+static void consumer_write(void) {
+  struct consumer c = {0, 0, 0};
+  uint8_t buf[WRITESIZE * 16];
+  ssize_t n;
+
+  while ((n = read(req[0], buf, sizeof(buf))) != 0) {
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(EX_IOERR, "read");
+    }
+    consumer_check(&c, buf, (size_t)n);
+    c.drains++;
+  }
+  xwrite(rep[1], &c, sizeof(c));
+}
+
+/* the emulated TRNGIOC_DRAIN, or the last one ('S') */
+static void drain(char cmd, struct consumer *c) {
+  char r;
+
+  xwrite(req[1], &cmd, 1);
+  if (cmd == 'S') {
+    if (xread(rep[0], c, sizeof(*c)) != 0) {
+      errx(EX_SOFTWARE, "consumer gone");
+    }
+  } else if (xread(rep[0], &r, 1) != 0) {
+    errx(EX_SOFTWARE, "consumer gone");
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct result {
+  double mibs;
+  uint64_t bytes;
+  double syscalls; /* write(2) or drain requests per KiB */
+};
+
+/* the producer: the pieces of the stream, as the sink of feedtrng */
+static void run_case(int kind, struct result *r) {
+  uint8_t piece[MAXPIECE], stage[WRITESIZE];
+  struct consumer c;
+  uint64_t pos = 0, calls = 0, rnd = 1;
+  size_t len, off, n, staged = 0;
+  double t0, t;
+  pid_t pid;
+
+  memset(ring, 0, TRNG_RING_HDRSIZE);
+  ring->version = TRNG_RING_VERSION;
+  ring->size = TRNG_RING_SIZE;
+  if ((pipe(req) == -1) || (pipe(rep) == -1)) {
+    err(EX_OSERR, "pipe");
+  }
+  if ((pid = fork()) == -1) {
+    err(EX_OSERR, "fork");
+  }
+  if (pid == 0) {
+    close(req[1]);
+    close(rep[0]);
+    if (kind == WRITE) {
+      consumer_write();
+    } else {
+      consumer_ring(kind == RINGPOLL);
+    }
+    _exit(0);
+  }
+  close(req[0]);
+  close(rep[1]);
+  t0 = now();
+  while (now() - t0 < seconds) {
+    rnd = splitmix64(rnd);
+    len = MINPIECE + rnd % (MAXPIECE - MINPIECE + 1);
+    stream_fill(piece, pos, len);
+    pos += len;
+    if (kind == WRITE) {
+      for (off = 0; off < len; off += n) {
+        n = MIN(len - off, WRITESIZE - staged);
+        memcpy(stage + staged, piece + off, n);
+        if ((staged += n) == WRITESIZE) {
+          xwrite(req[1], stage, WRITESIZE);
+          calls++;
+          staged = 0;
+        }
+      }
+      continue;
+    }
+    for (off = 0; off < len; off += n) {
+      if ((n = trng_ring_produce(ring, ringdata, piece + off, len - off)) <
+          len - off) {
+        /* full */
+        drain('D', &c);
+        calls++;
+      }
+    }
+    if (trng_ring_used(ring) >= TRNG_RING_SIZE / 2) {
+      drain('D', &c);
+      calls++;
+    }
+  }
+  if (kind == WRITE) {
+    if (staged > 0) {
+      xwrite(req[1], stage, staged);
+      calls++;
+    }
+    close(req[1]);
+    if (xread(rep[0], &c, sizeof(c)) != 0) {
+      errx(EX_SOFTWARE, "consumer gone");
+    }
+  } else {
+    drain('S', &c);
+    calls++;
+    close(req[1]);
+  }
+  t = now() - t0;
+  close(rep[0]);
+  waitpid(pid, NULL, 0);
+  if ((c.pos != pos) || (c.errors != 0)) {
+    errx(EX_SOFTWARE, "%s: %ju of %ju bytes checked, %ju errors",
+         casenames[kind], (uintmax_t)c.pos, (uintmax_t)pos,
+         (uintmax_t)c.errors);
+  }
+  r->bytes = pos;
+  r->mibs = pos / t / 1048576;
+  r->syscalls = calls * 1024.0 / pos;
+}
+
+/* the wrap-around, a full ring, and a broken head, in one process */
+static void self_check(void) {
+  struct consumer c = {0, 0, 0};
+  uint8_t buf[TRNG_RING_SIZE];
+  uint64_t tail = 0;
+
+  memset(ring, 0, TRNG_RING_HDRSIZE);
+  stream_fill(buf, 0, sizeof(buf));
+  /* move the indices near the end of the ring */
+  ring->head = ring->tail = tail = c.pos = TRNG_RING_SIZE - 100;
+  stream_fill(buf, c.pos, sizeof(buf));
+  if ((trng_ring_produce(ring, ringdata, buf, 1000) != 1000) ||
+      (trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) != 1000) ||
+      (c.errors != 0) || (ring->tail != TRNG_RING_SIZE + 900)) {
+    errx(EX_SOFTWARE, "wrap-around failed");
+  }
+  stream_fill(buf, c.pos, sizeof(buf));
+  if ((trng_ring_produce(ring, ringdata, buf, sizeof(buf)) != sizeof(buf)) ||
+      (trng_ring_produce(ring, ringdata, buf, 1) != 0) ||
+      (trng_ring_used(ring) != TRNG_RING_SIZE)) {
+    errx(EX_SOFTWARE, "full ring accepted data");
+  }
+  if ((trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) !=
+       TRNG_RING_SIZE) ||
+      (c.errors != 0)) {
+    errx(EX_SOFTWARE, "full ring not consumed");
+  }
+  /* a producer moving head back, or too far ahead */
+  ring->head = tail - 1;
+  if ((trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) != -1) ||
+      (tail != ring->head) || (ring->tail != tail)) {
+    errx(EX_SOFTWARE, "head behind tail not detected");
+  }
+  ring->head = tail + TRNG_RING_SIZE + 1;
+  if ((trng_ring_consume(ring, ringdata, &tail, consumer_check, &c) != -1) ||
+      (tail != ring->head)) {
+    errx(EX_SOFTWARE, "head beyond the ring not detected");
+  }
+  fprintf(stderr, "ringbench: self-check passed\n");
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  struct result r;
+  FILE *out;
+  void *map;
+  int ch, kind;
+
+  while ((ch = getopt(argc, argv, "t:o:")) != -1) {
+    switch (ch) {
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE, "Usage: %s [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if ((map = mmap(NULL, TRNG_RING_MAPSIZE, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANON, -1, 0)) == MAP_FAILED) {
+    err(EX_OSERR, "mmap");
+  }
+  ring = map;
+  ringdata = (uint8_t *)map + TRNG_RING_HDRSIZE;
+  self_check();
+
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(out,
+          "{\n  \"benchmark\": \"ringbench\",\n  \"ring_size\": %d,\n"
+          "  \"write_size\": %d,\n  \"seconds_per_case\": %.3f,\n"
+          "  \"results\": [",
+          TRNG_RING_SIZE, WRITESIZE, seconds);
+  for (kind = 0; kind < NCASES; kind++) {
+    run_case(kind, &r);
+    fprintf(out,
+            "%s\n    {\"path\": \"%s\", \"bytes\": %ju, \"mib_per_s\": %.2f, "
+            "\"syscalls_per_kib\": %.4f}",
+            (kind == 0) ? "" : ",", casenames[kind], (uintmax_t)r.bytes,
+            r.mibs, r.syscalls);
+    fprintf(stderr, "%-9s %12ju bytes checked: %9.1f MiB/s %8.4f calls/KiB\n",
+            casenames[kind], (uintmax_t)r.bytes, r.mibs, r.syscalls);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  munmap(map, TRNG_RING_MAPSIZE);
+  return 0;
+}
@@ -52,15 +52,24 @@
 #include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/param.h>
+#include <sys/sysctl.h>
 #include <sys/systm.h>
 #include <sys/uio.h>
 
 #include <sys/random.h>
 
+#include <vm/vm.h>
+
+#include "trng_bulk.h"
+#include "trng_ring.h"
+#include "trng_stats.h"
+
 /* Function prototypes */
 static d_open_t trng_open;
 static d_close_t trng_close;
 static d_write_t trng_write;
+static d_ioctl_t trng_ioctl;
+static d_mmap_single_t trng_mmap_single;
 
 /* Character device entry points */
 static struct cdevsw trng_cdevsw = {
@@ -68,12 +77,18 @@ static struct cdevsw trng_cdevsw = {
     .d_open = trng_open,
     .d_close = trng_close,
     .d_write = trng_write,
+    .d_ioctl = trng_ioctl,
+    .d_mmap_single = trng_mmap_single,
     .d_name = "trng",
 };
 
 struct trng_softc {
   device_t device;
   struct cdev *cdev;
+  struct trng_bulk bulk;
+  struct trng_stats stats;
+  struct trng_ringbuf ring;
+  struct sysctl_ctx_list sysctl; /* for dev.trng.<unit>.stats */
 };
 
 static devclass_t trng_devclass;
@@ -97,10 +112,24 @@ static int trng_attach(device_t dev) {
   int error = 0;
 
   sc->device = dev;
+  trng_stats_init(&sc->stats);
+  trng_bulk_init(&sc->bulk, &sc->stats);
+  error = trng_ring_init(&sc->ring, &sc->stats);
+  if (error != 0) {
+    trng_bulk_destroy(&sc->bulk);
+    trng_stats_destroy(&sc->stats);
+    return (error);
+  }
   error = make_dev_p(MAKEDEV_CHECKNAME | MAKEDEV_WAITOK, &(sc->cdev),
                      &trng_cdevsw, 0, UID_UUCP, GID_DIALER, 0660, "trng");
   if (error == 0) {
     sc->cdev->si_drv1 = sc;
+    sysctl_ctx_init(&sc->sysctl);
+    trng_stats_sysctl(&sc->stats, &sc->sysctl, device_get_sysctl_tree(dev));
+  } else {
+    trng_ring_destroy(&sc->ring);
+    trng_bulk_destroy(&sc->bulk);
+    trng_stats_destroy(&sc->stats);
   }
   return (error);
 }
@@ -109,6 +138,12 @@ static int trng_detach(device_t dev) {
   struct trng_softc *sc = device_get_softc(dev);
 
   destroy_dev(sc->cdev);
+  /* flush the staged data and the ring */
+  trng_ring_destroy(&sc->ring);
+  trng_bulk_destroy(&sc->bulk);
+  /* remove the stats sysctl nodes before the counters */
+  sysctl_ctx_free(&sc->sysctl);
+  trng_stats_destroy(&sc->stats);
   return (0);
 }
 
@@ -132,58 +167,63 @@ static int trng_close(struct cdev *dev __unused, int fflag __unused,
   return (0);
 }
 
-/* this buffer size is small */
-/* see random_harvest(9) */
-#define BUFFERSIZE (16)
-
-/* maximum uio_resid size */
-#define MAXUIOSIZE (1024)
-
 /*
  * trng_write takes in a character string and
  * feeds the string to random_harvest(9),
  * as the pure random number sequence.
+ * The string is staged and fed in batches by trng_bulk_write();
+ * see trng_bulk.c.
  */
 static int trng_write(struct cdev *dev __unused, struct uio *uio,
                       int ioflag __unused) {
   struct trng_softc *sc;
-  size_t amt;
+  uint64_t t0;
+  ssize_t resid;
   int error;
-  uint8_t buf[BUFFERSIZE];
 
   sc = dev->si_drv1;
 #ifdef DEBUG
   printf("trng_write: uio->uio_resid: %zd\n", uio->uio_resid);
 #endif /* DEBUG */
   /* check uio_resid size */
-  if ((uio->uio_resid < 0) || (uio->uio_resid > MAXUIOSIZE)) {
+  if (uio->uio_resid < 0) {
 #ifdef DEBUG
     printf("trng_write: invalid uio->uio_resid\n");
 #endif /* DEBUG */
+    counter_u64_add(sc->stats.rejected, 1);
     return (EIO);
   }
-  /* Copy the string to kernel memory */
-  while (uio->uio_resid > 0) {
-    amt = MIN(uio->uio_resid, BUFFERSIZE);
-    error = uiomove(buf, amt, uio);
-    if (error != 0) {
-      /* error exit */
-      return error;
-    }
-    /* Enter the obtained data into random_harvest(9) */
-    /* 11.x and later only */
-    /* Caution: treated as a PURE random number sequence */
-    /* TODO: must add a new class */
-    /* for 11.x, use
-       random_harvest_fast(buf, amt, amt * NBBY / 2, RANDOM_NET_ETHER);
-    */
-    random_harvest_fast(buf, amt, RANDOM_NET_ETHER);
-#ifdef DEBUG
-    printf("trng_write: put %zu bytes\n", amt);
-#endif /* DEBUG */
+  t0 = cpu_ticks();
+  resid = uio->uio_resid;
+  error = trng_bulk_write(&sc->bulk, uio);
+  trng_stats_write(&sc->stats, resid - uio->uio_resid, cpu_ticks() - t0,
+                   error);
+  return (error);
+}
+
+/*
+ * TRNGIOC_DRAIN harvests the data in the mmap ring;
+ * see trng_ring.h.
+ */
+static int trng_ioctl(struct cdev *dev, u_long cmd, caddr_t data __unused,
+                      int fflag __unused, struct thread *td __unused) {
+  struct trng_softc *sc = dev->si_drv1;
+
+  switch (cmd) {
+  case TRNGIOC_DRAIN:
+    trng_ring_drain(&sc->ring);
+    return (0);
+  default:
+    return (ENOTTY);
   }
-  /* normal exit */
-  return 0;
+}
+
+static int trng_mmap_single(struct cdev *dev, vm_ooffset_t *offset,
+                            vm_size_t size, struct vm_object **object,
+                            int nprot) {
+  struct trng_softc *sc = dev->si_drv1;
+
+  return (trng_ring_mmap(&sc->ring, offset, size, object, nprot));
 }
 
 /* Adding to bus "nexus" looks appropriate */
@@ -0,0 +1,153 @@
+/*
+ * Bulk harvest path of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ */
+
+#ifdef _KERNEL
+#include <sys/types.h>
+
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/param.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/random.h>
+#include <sys/smp.h>
+#include <sys/systm.h>
+#endif
+
+#include "trng_bulk.h"
+
+#ifdef _KERNEL
+static MALLOC_DEFINE(M_TRNG, "trng", "trng staging areas");
+#endif
+
+/*
+ * Enter the staged data into random_harvest(9)
+ * in TRNG_HARVESTSIZE pieces; the caller holds the lock
+ */
+static void trng_stage_flush(struct trng_stage *st) {
+  size_t off, amt;
+
+  for (off = 0; off < st->len; off += amt) {
+    amt = MIN(st->len - off, TRNG_HARVESTSIZE);
+    /* 11.x and later only */
+    /* Caution: treated as a PURE random number sequence */
+    /* TODO: must add a new class */
+    /* for 11.x, use
+       random_harvest_fast(buf, amt, amt * NBBY / 2, RANDOM_NET_ETHER);
+    */
+    random_harvest_fast(st->buf + off, amt, RANDOM_NET_ETHER);
+  }
+  counter_u64_add(st->stats->harvested, st->len);
+  counter_u64_add(st->stats->harvests, howmany(st->len, TRNG_HARVESTSIZE));
+#ifdef DEBUG
+  printf("trng_stage_flush: put %zu bytes\n", st->len);
+#endif /* DEBUG */
+  st->len = 0;
+}
+
+/* the flush task, in the taskqueue thread */
+static void trng_stage_task(void *arg, int pending __unused) {
+  struct trng_stage *st = arg;
+
+  sx_xlock(&st->lock);
+  st->scheduled = 0;
+  if (st->len > 0) {
+    counter_u64_add(st->stats->timeouts, 1);
+    trng_stage_flush(st);
+  }
+  sx_xunlock(&st->lock);
+}
+
+/* the callout cannot sleep for the lock, so defer it to the task */
+static void trng_stage_timeout(void *arg) {
+  struct trng_stage *st = arg;
+
+  taskqueue_enqueue(taskqueue_thread, &st->task);
+}
+
+void trng_bulk_init(struct trng_bulk *tb, struct trng_stats *stats) {
+  struct trng_stage *st;
+  int i;
+
+  tb->nstages = mp_maxid + 1;
+  tb->stage = malloc(sizeof(struct trng_stage) * tb->nstages, M_TRNG,
+                     M_WAITOK | M_ZERO);
+  for (i = 0; i < tb->nstages; i++) {
+    st = &tb->stage[i];
+    st->stats = stats;
+    sx_init(&st->lock, "trng stage");
+    callout_init(&st->callout, 1);
+    TASK_INIT(&st->task, 0, trng_stage_task, st);
+  }
+}
+
+/* flush all the staging areas now */
+void trng_bulk_flush(struct trng_bulk *tb) {
+  struct trng_stage *st;
+  int i;
+
+  for (i = 0; i < tb->nstages; i++) {
+    st = &tb->stage[i];
+    sx_xlock(&st->lock);
+    trng_stage_flush(st);
+    sx_xunlock(&st->lock);
+  }
+}
+
+void trng_bulk_destroy(struct trng_bulk *tb) {
+  struct trng_stage *st;
+  int i;
+
+  for (i = 0; i < tb->nstages; i++) {
+    st = &tb->stage[i];
+    callout_drain(&st->callout);
+    taskqueue_drain(taskqueue_thread, &st->task);
+  }
+  trng_bulk_flush(tb);
+  for (i = 0; i < tb->nstages; i++) {
+    sx_destroy(&tb->stage[i].lock);
+  }
+  free(tb->stage, M_TRNG);
+  tb->stage = NULL;
+}
+
+/*
+ * Move the written data into the staging area of the current CPU,
+ * up to the free space of the area per uiomove(9);
+ * a thread migrating to another CPU only means less locality.
+ * Writes of any size are accepted, with a preemption point
+ * after each uiomove(9).
+ */
+int trng_bulk_write(struct trng_bulk *tb, struct uio *uio) {
+  struct trng_stage *st;
+  ssize_t resid;
+  size_t amt;
+  int error = 0;
+
+  while (uio->uio_resid > 0) {
+    st = &tb->stage[curcpu];
+    sx_xlock(&st->lock);
+    amt = MIN((size_t)uio->uio_resid, TRNG_STAGESIZE - st->len);
+    resid = uio->uio_resid;
+    error = uiomove(st->buf + st->len, amt, uio);
+    /* keep what was moved before an error */
+    amt = resid - uio->uio_resid;
+    st->len += amt;
+    if (st->len == TRNG_STAGESIZE) {
+      counter_u64_add(st->stats->flushes, 1);
+      trng_stage_flush(st);
+    } else if ((st->len > 0) && !st->scheduled) {
+      st->scheduled = 1;
+      callout_reset(&st->callout, TRNG_FLUSHDELAY, trng_stage_timeout, st);
+    }
+    sx_xunlock(&st->lock);
+    if (error != 0) {
+      break;
+    }
+    maybe_yield();
+  }
+  return (error);
+}
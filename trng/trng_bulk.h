@@ -0,0 +1,65 @@
+/*
+ * Bulk harvest path of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * The written data is moved by a single uiomove(9) per staging area
+ * into a per-CPU staging area, and fed to random_harvest_fast(9)
+ * when the staging area is full, or from a callout
+ * after TRNG_FLUSHDELAY of the first byte staged.
+ * The code is shared with a userspace harness,
+ * which builds it against the mocks of trng_mock.h.
+ */
+
+#ifndef _TRNG_BULK_H_
+#define _TRNG_BULK_H_
+
+#ifdef _KERNEL
+#include <sys/types.h>
+
+#include <sys/callout.h>
+#include <sys/lock.h>
+#include <sys/param.h>
+#include <sys/sx.h>
+#include <sys/taskqueue.h>
+#include <sys/uio.h>
+#else
+#include "trng_mock.h"
+#endif
+
+#include "trng_stats.h"
+
+/* bytes per random_harvest_fast(9) call; see random_harvest(9) */
+#define TRNG_HARVESTSIZE (16)
+
+/* bytes of each per-CPU staging area */
+#define TRNG_STAGESIZE (4096)
+
+/* maximum time for the staged bytes to wait [ticks] */
+#define TRNG_FLUSHDELAY (hz / 10)
+
+/*
+ * A per-CPU staging area;
+ * the lock is sleepable, for uiomove(9) into the buffer
+ */
+struct trng_stage {
+  struct sx lock;
+  size_t len;
+  int scheduled; /* the callout or the flush task is pending */
+  struct callout callout;
+  struct task task;
+  struct trng_stats *stats;
+  uint8_t buf[TRNG_STAGESIZE];
+} __aligned(CACHE_LINE_SIZE);
+
+struct trng_bulk {
+  struct trng_stage *stage;
+  int nstages; /* mp_maxid + 1 */
+};
+
+extern void trng_bulk_init(struct trng_bulk *tb, struct trng_stats *stats);
+extern void trng_bulk_destroy(struct trng_bulk *tb);
+extern int trng_bulk_write(struct trng_bulk *tb, struct uio *uio);
+extern void trng_bulk_flush(struct trng_bulk *tb);
+
+#endif /* _TRNG_BULK_H_ */
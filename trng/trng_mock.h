@@ -0,0 +1,124 @@
+/*
+ * Userspace mocks of the kernel interfaces used by trng_bulk.c
+ * and trng_stats.c
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * Only for building trng_bulk.c in the userspace harness (trngbench.c);
+ * the definitions are in trngbench.c.
+ */
+
+#ifndef _TRNG_MOCK_H_
+#define _TRNG_MOCK_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/types.h>
+
+#define CACHE_LINE_SIZE (64)
+#ifndef __aligned
+#define __aligned(x) __attribute__((aligned(x)))
+#endif
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+/* uiomove(9): a single user buffer */
+struct uio {
+  const uint8_t *uio_base;
+  ssize_t uio_resid;
+};
+extern int uiomove(void *cp, int n, struct uio *uio);
+
+/* random_harvest_fast(9) */
+enum random_entropy_source { RANDOM_NET_ETHER };
+extern void random_harvest_fast(const void *entropy, unsigned size,
+                                enum random_entropy_source origin);
+
+/* sx(9) */
+struct sx {
+  pthread_mutex_t m;
+};
+#define sx_init(sx, name) pthread_mutex_init(&(sx)->m, NULL)
+#define sx_destroy(sx) pthread_mutex_destroy(&(sx)->m)
+#define sx_xlock(sx) pthread_mutex_lock(&(sx)->m)
+#define sx_xunlock(sx) pthread_mutex_unlock(&(sx)->m)
+
+/* callout(9), fired by mock_softclock() */
+struct callout {
+  void (*fn)(void *);
+  void *arg;
+  atomic_int pending;
+  atomic_long expire; /* in ticks */
+};
+extern void callout_init(struct callout *c, int mpsafe);
+extern int callout_reset(struct callout *c, int ticks, void (*fn)(void *),
+                         void *arg);
+extern int callout_drain(struct callout *c);
+extern void mock_softclock(struct callout *c);
+
+/* taskqueue(9), run at once */
+struct task {
+  void (*fn)(void *, int);
+  void *arg;
+};
+#define TASK_INIT(t, pri, f, a) ((t)->fn = (f), (t)->arg = (a))
+#define taskqueue_thread (NULL)
+extern int taskqueue_enqueue(void *tq, struct task *t);
+#define taskqueue_drain(tq, t) ((void)(tq), (void)(t))
+
+/* CPUs, ticks and scheduling */
+extern __thread int mock_curcpu;
+#define curcpu (mock_curcpu)
+extern int mp_maxid;
+extern int hz;
+extern void maybe_yield(void);
+
+/* malloc(9) */
+#define M_WAITOK (0x0002)
+#define M_ZERO (0x0100)
+extern void *mock_malloc(size_t size);
+#define malloc(size, type, flags) mock_malloc(size)
+#define free(p, type) (free)(p)
+
+/*
+ * counter(9): a cache line per CPU, each written only by its own
+ * (mock) CPU, with relaxed loads and stores instead of atomic additions
+ */
+#define MOCK_COUNTER_STRIDE (CACHE_LINE_SIZE / sizeof(uint64_t))
+typedef uint64_t *counter_u64_t;
+extern counter_u64_t counter_u64_alloc(int flags);
+extern void counter_u64_free(counter_u64_t c);
+extern uint64_t counter_u64_fetch(counter_u64_t c);
+extern void counter_u64_zero(counter_u64_t c);
+static inline void counter_u64_add(counter_u64_t c, int64_t v) {
+  uint64_t *p = &c[mock_curcpu * MOCK_COUNTER_STRIDE];
+
+  __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v,
+                   __ATOMIC_RELAXED);
+}
+
+/* cpu_ticks(9): the TSC on amd64 as in the kernel, otherwise nanoseconds */
+#ifdef __x86_64__
+#define cpu_ticks() (__builtin_ia32_rdtsc())
+#else
+extern uint64_t cpu_ticks(void);
+#endif
+extern uint64_t cputick2usec(uint64_t tick);
+
+/* flsll(3) */
+#ifdef __FreeBSD__
+#include <strings.h>
+#else
+static inline int flsll(long long mask) {
+  return ((mask == 0) ? 0 : 64 - __builtin_clzll((unsigned long long)mask));
+}
+#endif
+
+#endif /* _TRNG_MOCK_H_ */
@@ -0,0 +1,123 @@
+/*
+ * Shared-memory ring of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * The ring is a wired OBJT_PHYS VM object, mapped in the kernel map
+ * for the driver, and handed out to mmap(2) by d_mmap_single;
+ * each mapping holds a reference, so the pages stay valid
+ * until the last mapping goes away, even after the detach.
+ */
+
+#include <sys/types.h>
+
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/random.h>
+#include <sys/rwlock.h>
+#include <sys/sx.h>
+#include <sys/systm.h>
+
+#include <vm/vm.h>
+#include <vm/vm_extern.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+#include <vm/vm_pager.h>
+#include <vm/vm_param.h>
+
+#include "trng_bulk.h"
+#include "trng_ring.h"
+
+int trng_ring_init(struct trng_ringbuf *rb, struct trng_stats *stats) {
+  int error;
+
+  rb->stats = stats;
+  rb->tail = 0;
+  rb->obj = vm_pager_allocate(OBJT_PHYS, NULL, TRNG_RING_MAPSIZE,
+                              VM_PROT_DEFAULT, 0, NULL);
+  if (rb->obj == NULL) {
+    return (ENOMEM);
+  }
+  /* the kernel map holds its own reference */
+  vm_object_reference(rb->obj);
+  rb->kva = vm_map_min(kernel_map);
+  error = vm_map_find(kernel_map, rb->obj, 0, &rb->kva, TRNG_RING_MAPSIZE, 0,
+                      VMFS_OPTIMAL_SPACE, VM_PROT_READ | VM_PROT_WRITE,
+                      VM_PROT_READ | VM_PROT_WRITE, 0);
+  if (error != KERN_SUCCESS) {
+    vm_object_deallocate(rb->obj);
+    vm_object_deallocate(rb->obj);
+    return (ENOMEM);
+  }
+  error = vm_map_wire(kernel_map, rb->kva, rb->kva + TRNG_RING_MAPSIZE,
+                      VM_MAP_WIRE_SYSTEM | VM_MAP_WIRE_NOHOLES);
+  if (error != KERN_SUCCESS) {
+    vm_map_remove(kernel_map, rb->kva, rb->kva + TRNG_RING_MAPSIZE);
+    vm_object_deallocate(rb->obj);
+    return (ENOMEM);
+  }
+  rb->ring = (struct trng_ring *)rb->kva;
+  rb->data = (uint8_t *)rb->kva + TRNG_RING_HDRSIZE;
+  rb->ring->version = TRNG_RING_VERSION;
+  rb->ring->size = TRNG_RING_SIZE;
+  sx_init(&rb->lock, "trng ring");
+  return (0);
+}
+
+void trng_ring_destroy(struct trng_ringbuf *rb) {
+  /* harvest what is left, then drop the references of the driver */
+  trng_ring_drain(rb);
+  sx_destroy(&rb->lock);
+  vm_map_remove(kernel_map, rb->kva, rb->kva + TRNG_RING_MAPSIZE);
+  vm_object_deallocate(rb->obj);
+  rb->ring = NULL;
+  rb->data = NULL;
+}
+
+/* d_mmap_single: the whole ring or a part of it, from offset 0 */
+int trng_ring_mmap(struct trng_ringbuf *rb, vm_ooffset_t *offset,
+                   vm_size_t size, struct vm_object **object,
+                   int nprot __unused) {
+  if ((*offset >= TRNG_RING_MAPSIZE) ||
+      (size > TRNG_RING_MAPSIZE - *offset)) {
+    return (EINVAL);
+  }
+  vm_object_reference(rb->obj);
+  *object = rb->obj;
+  return (0);
+}
+
+/* feed a piece of the ring in TRNG_HARVESTSIZE pieces */
+static void trng_ring_harvest(void *arg, const uint8_t *buf, size_t len) {
+  struct trng_ringbuf *rb = arg;
+  size_t off, amt;
+
+  for (off = 0; off < len; off += amt) {
+    amt = MIN(len - off, TRNG_HARVESTSIZE);
+    /* Caution: treated as a PURE random number sequence */
+    random_harvest_fast(buf + off, amt, RANDOM_NET_ETHER);
+  }
+  counter_u64_add(rb->stats->harvested, len);
+  counter_u64_add(rb->stats->harvests, howmany(len, TRNG_HARVESTSIZE));
+}
+
+/* TRNGIOC_DRAIN: harvest all the bytes produced so far, in one batch */
+void trng_ring_drain(struct trng_ringbuf *rb) {
+  ssize_t n;
+
+  sx_xlock(&rb->lock);
+  n = trng_ring_consume(rb->ring, rb->data, &rb->tail, trng_ring_harvest, rb);
+  sx_xunlock(&rb->lock);
+  counter_u64_add(rb->stats->drains, 1);
+  if (n < 0) {
+    counter_u64_add(rb->stats->ringerrors, 1);
+  } else {
+    counter_u64_add(rb->stats->ringbytes, n);
+  }
+#ifdef DEBUG
+  printf("trng_ring_drain: put %zd bytes\n", n);
+#endif /* DEBUG */
+}
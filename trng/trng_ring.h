@@ -0,0 +1,142 @@
+/*
+ * Shared-memory ring of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * /dev/trng exports a ring of TRNG_RING_SIZE bytes by mmap(2):
+ * a page of struct trng_ring at offset 0, then the data.
+ * A single producer (feedtrng -m) copies the data into the ring and
+ * advances head; the driver harvests the bytes between its own tail
+ * and head on TRNGIOC_DRAIN, then advances tail.
+ * Both indices count bytes from the start and never wrap;
+ * the driver trusts neither index in the shared page,
+ * so a broken producer only loses its own data.
+ * The protocol is shared with feedtrng and the userspace emulation
+ * in ringbench.c.
+ */
+
+#ifndef _TRNG_RING_H_
+#define _TRNG_RING_H_
+
+#ifdef _KERNEL
+#include <sys/types.h>
+
+#include <sys/ioccom.h>
+#include <sys/lock.h>
+#include <sys/param.h>
+#include <sys/sx.h>
+#include <sys/systm.h>
+#include <machine/atomic.h>
+
+#include <vm/vm.h>
+
+#include "trng_stats.h"
+#else
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#endif
+
+#define TRNG_RING_VERSION (1)
+
+/* bytes of the index page, and of the data; a power of 2 */
+#define TRNG_RING_HDRSIZE (4096)
+#define TRNG_RING_SIZE (65536)
+#define TRNG_RING_MAPSIZE (TRNG_RING_HDRSIZE + TRNG_RING_SIZE)
+
+/* harvest the produced bytes, and return when done */
+#define TRNGIOC_DRAIN _IO('R', 1)
+
+/* the index page; head and tail on separate cache lines */
+struct trng_ring {
+  uint32_t version; /* TRNG_RING_VERSION */
+  uint32_t size;    /* TRNG_RING_SIZE */
+  uint64_t head __attribute__((aligned(64))); /* bytes produced */
+  uint64_t tail __attribute__((aligned(64))); /* bytes consumed */
+};
+
+#ifdef _KERNEL
+#define TRNG_RING_LOAD(p) atomic_load_acq_64((volatile uint64_t *)(p))
+#define TRNG_RING_STORE(p, v) atomic_store_rel_64((volatile uint64_t *)(p), v)
+#else
+#define TRNG_RING_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define TRNG_RING_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
+
+/* bytes produced and not yet consumed */
+static inline size_t trng_ring_used(struct trng_ring *r) {
+  return (size_t)(TRNG_RING_LOAD(&r->head) - TRNG_RING_LOAD(&r->tail));
+}
+
+/*
+ * Producer: copy up to len bytes into the ring, as much as free;
+ * returns the bytes copied
+ */
+static inline size_t trng_ring_produce(struct trng_ring *r, uint8_t *data,
+                                       const uint8_t *buf, size_t len) {
+  uint64_t head = r->head;
+  size_t n, off, first;
+
+  n = MIN(len, TRNG_RING_SIZE - (size_t)(head - TRNG_RING_LOAD(&r->tail)));
+  off = (size_t)head & (TRNG_RING_SIZE - 1);
+  first = MIN(n, TRNG_RING_SIZE - off);
+  memcpy(data + off, buf, first);
+  memcpy(data, buf + first, n - first);
+  TRNG_RING_STORE(&r->head, head + n);
+  return (n);
+}
+
+/*
+ * Consumer: pass the produced bytes to fn in at most two pieces,
+ * then free them; *tail is the consumer's own copy of the tail.
+ * Returns the bytes consumed, or -1 when head is out of range,
+ * after skipping to head.
+ */
+static inline ssize_t
+trng_ring_consume(struct trng_ring *r, const uint8_t *data, uint64_t *tail,
+                  void (*fn)(void *, const uint8_t *, size_t), void *arg) {
+  uint64_t head = TRNG_RING_LOAD(&r->head);
+  size_t n, off, first;
+
+  if (head - *tail > TRNG_RING_SIZE) {
+    *tail = head;
+    TRNG_RING_STORE(&r->tail, head);
+    return (-1);
+  }
+  n = (size_t)(head - *tail);
+  off = (size_t)*tail & (TRNG_RING_SIZE - 1);
+  first = MIN(n, TRNG_RING_SIZE - off);
+  if (first > 0) {
+    fn(arg, data + off, first);
+  }
+  if (n > first) {
+    fn(arg, data, n - first);
+  }
+  *tail = head;
+  TRNG_RING_STORE(&r->tail, head);
+  return ((ssize_t)n);
+}
+
+#ifdef _KERNEL
+/* The ring of a device, mapped in the kernel */
+struct trng_ringbuf {
+  struct sx lock; /* for the consumer */
+  vm_object_t obj;
+  vm_offset_t kva;
+  struct trng_ring *ring;
+  uint8_t *data;
+  uint64_t tail;
+  struct trng_stats *stats;
+};
+
+extern int trng_ring_init(struct trng_ringbuf *rb, struct trng_stats *stats);
+extern void trng_ring_destroy(struct trng_ringbuf *rb);
+extern int trng_ring_mmap(struct trng_ringbuf *rb, vm_ooffset_t *offset,
+                          vm_size_t size, struct vm_object **object,
+                          int nprot);
+extern void trng_ring_drain(struct trng_ringbuf *rb);
+#endif /* _KERNEL */
+
+#endif /* _TRNG_RING_H_ */
@@ -0,0 +1,185 @@
+/*
+ * Statistics of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ */
+
+#ifdef _KERNEL
+#include <sys/types.h>
+
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/param.h>
+#include <sys/sbuf.h>
+#include <sys/systm.h>
+#endif
+
+#include "trng_stats.h"
+
+/* the scalar counters, in the order of struct trng_stats */
+#define TRNG_NSCALARS (12)
+
+static counter_u64_t *trng_stats_scalar(struct trng_stats *st, int i) {
+  counter_u64_t *c[TRNG_NSCALARS] = {
+      &st->writes,   &st->bytes,     &st->errors,    &st->rejected,
+      &st->ticks,    &st->harvested, &st->harvests,  &st->flushes,
+      &st->timeouts, &st->drains,    &st->ringbytes, &st->ringerrors};
+
+  return (c[i]);
+}
+
+void trng_stats_init(struct trng_stats *st) {
+  int i;
+
+  for (i = 0; i < TRNG_NSCALARS; i++) {
+    *trng_stats_scalar(st, i) = counter_u64_alloc(M_WAITOK);
+  }
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    st->hist[i] = counter_u64_alloc(M_WAITOK);
+  }
+}
+
+void trng_stats_destroy(struct trng_stats *st) {
+  int i;
+
+  for (i = 0; i < TRNG_NSCALARS; i++) {
+    counter_u64_free(*trng_stats_scalar(st, i));
+  }
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    counter_u64_free(st->hist[i]);
+  }
+}
+
+/* sum up the counters; not a consistent snapshot while written */
+void trng_stats_fetch(struct trng_stats *st,
+                      struct trng_stats_snapshot *snap) {
+  int i;
+
+  snap->writes = counter_u64_fetch(st->writes);
+  snap->bytes = counter_u64_fetch(st->bytes);
+  snap->errors = counter_u64_fetch(st->errors);
+  snap->rejected = counter_u64_fetch(st->rejected);
+  snap->ticks = counter_u64_fetch(st->ticks);
+  snap->harvested = counter_u64_fetch(st->harvested);
+  snap->harvests = counter_u64_fetch(st->harvests);
+  snap->flushes = counter_u64_fetch(st->flushes);
+  snap->timeouts = counter_u64_fetch(st->timeouts);
+  snap->drains = counter_u64_fetch(st->drains);
+  snap->ringbytes = counter_u64_fetch(st->ringbytes);
+  snap->ringerrors = counter_u64_fetch(st->ringerrors);
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    snap->hist[i] = counter_u64_fetch(st->hist[i]);
+  }
+}
+
+void trng_stats_zero(struct trng_stats *st) {
+  int i;
+
+  for (i = 0; i < TRNG_NSCALARS; i++) {
+    counter_u64_zero(*trng_stats_scalar(st, i));
+  }
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    counter_u64_zero(st->hist[i]);
+  }
+}
+
+#ifdef _KERNEL
+/* dev.trng.<unit>.stats.write_time: time in trng_write() [us] */
+static int trng_stats_time_sysctl(SYSCTL_HANDLER_ARGS) {
+  struct trng_stats *st = arg1;
+  uint64_t usec;
+
+  usec = cputick2usec(counter_u64_fetch(st->ticks));
+  return (sysctl_handle_64(oidp, &usec, 0, req));
+}
+
+/* dev.trng.<unit>.stats.write_sizes: the write size histogram */
+static int trng_stats_hist_sysctl(SYSCTL_HANDLER_ARGS) {
+  struct trng_stats *st = arg1;
+  struct sbuf sb;
+  uint64_t lo, hi;
+  int error, i;
+
+  error = sysctl_wire_old_buffer(req, 0);
+  if (error != 0) {
+    return (error);
+  }
+  sbuf_new_for_sysctl(&sb, NULL, 128, req);
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    lo = (i == 0) ? 0 : (1ULL << (i - 1));
+    hi = (i == 0) ? 0 : (1ULL << i) - 1;
+    if (i == TRNG_HISTSIZE - 1) {
+      sbuf_printf(&sb, "\n%6ju-      : %ju", (uintmax_t)lo,
+                  (uintmax_t)counter_u64_fetch(st->hist[i]));
+    } else {
+      sbuf_printf(&sb, "\n%6ju-%-6ju: %ju", (uintmax_t)lo, (uintmax_t)hi,
+                  (uintmax_t)counter_u64_fetch(st->hist[i]));
+    }
+  }
+  error = sbuf_finish(&sb);
+  sbuf_delete(&sb);
+  return (error);
+}
+
+/* dev.trng.<unit>.stats.reset: write a non-zero value to zero the counters */
+static int trng_stats_reset_sysctl(SYSCTL_HANDLER_ARGS) {
+  struct trng_stats *st = arg1;
+  int error, reset = 0;
+
+  error = sysctl_handle_int(oidp, &reset, 0, req);
+  if ((error != 0) || (req->newptr == NULL)) {
+    return (error);
+  }
+  if (reset != 0) {
+    trng_stats_zero(st);
+  }
+  return (0);
+}
+
+/* Add the stats node under the device sysctl tree */
+void trng_stats_sysctl(struct trng_stats *st, struct sysctl_ctx_list *ctx,
+                       struct sysctl_oid *tree) {
+  struct sysctl_oid_list *child;
+  struct sysctl_oid *node;
+
+  node = SYSCTL_ADD_NODE(ctx, SYSCTL_CHILDREN(tree), OID_AUTO, "stats",
+                         CTLFLAG_RD, NULL, "trng statistics");
+  child = SYSCTL_CHILDREN(node);
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "writes", CTLFLAG_RD,
+                         &st->writes, "Write operations");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "bytes", CTLFLAG_RD,
+                         &st->bytes, "Bytes written");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "errors", CTLFLAG_RD,
+                         &st->errors, "Writes failed in uiomove(9)");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "rejected", CTLFLAG_RD,
+                         &st->rejected, "Writes with an invalid size");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "harvested", CTLFLAG_RD,
+                         &st->harvested,
+                         "Bytes fed to random_harvest_fast(9)");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "harvests", CTLFLAG_RD,
+                         &st->harvests, "random_harvest_fast(9) calls");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "flushes", CTLFLAG_RD,
+                         &st->flushes, "Staging areas flushed when full");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "timeouts", CTLFLAG_RD,
+                         &st->timeouts,
+                         "Staging areas flushed by the callout");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "drains", CTLFLAG_RD,
+                         &st->drains, "Drains of the mmap ring");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "ringbytes", CTLFLAG_RD,
+                         &st->ringbytes, "Bytes harvested from the mmap ring");
+  SYSCTL_ADD_COUNTER_U64(ctx, child, OID_AUTO, "ringerrors", CTLFLAG_RD,
+                         &st->ringerrors,
+                         "Out-of-range heads of the mmap ring");
+  SYSCTL_ADD_PROC(ctx, child, OID_AUTO, "write_time",
+                  CTLTYPE_U64 | CTLFLAG_RD | CTLFLAG_MPSAFE, st, 0,
+                  trng_stats_time_sysctl, "QU",
+                  "Time spent in trng_write() [us]");
+  SYSCTL_ADD_PROC(ctx, child, OID_AUTO, "write_sizes",
+                  CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, st, 0,
+                  trng_stats_hist_sysctl, "A",
+                  "Histogram of write sizes [bytes]");
+  SYSCTL_ADD_PROC(ctx, child, OID_AUTO, "reset",
+                  CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, st, 0,
+                  trng_stats_reset_sysctl, "I", "Zero the counters");
+}
+#endif /* _KERNEL */
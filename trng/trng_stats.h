@@ -0,0 +1,97 @@
+/*
+ * Statistics of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * The counters are counter(9) per-CPU counters, updated without
+ * atomic operations or locks, and summed only when read
+ * through the sysctl tree dev.trng.<unit>.stats.
+ * The code is shared with a userspace harness,
+ * which builds it against the mocks of trng_mock.h.
+ */
+
+#ifndef _TRNG_STATS_H_
+#define _TRNG_STATS_H_
+
+#ifdef _KERNEL
+#include <sys/types.h>
+
+#include <sys/counter.h>
+#include <sys/libkern.h>
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#else
+#include "trng_mock.h"
+#endif
+
+/*
+ * Buckets of the write size histogram:
+ * 0 bytes, 1 byte, then [2^(i-1), 2^i) bytes for the bucket i,
+ * and the last bucket for 64KiB and more
+ */
+#define TRNG_HISTSIZE (18)
+
+struct trng_stats {
+  counter_u64_t writes;     /* write operations */
+  counter_u64_t bytes;      /* bytes written */
+  counter_u64_t errors;     /* writes failed in uiomove(9) */
+  counter_u64_t rejected;   /* writes with an invalid size */
+  counter_u64_t ticks;      /* time in trng_write() [cpu_ticks()] */
+  counter_u64_t harvested;  /* bytes fed to random_harvest_fast(9) */
+  counter_u64_t harvests;   /* random_harvest_fast(9) calls */
+  counter_u64_t flushes;    /* staging areas flushed when full */
+  counter_u64_t timeouts;   /* staging areas flushed by the callout */
+  counter_u64_t drains;     /* TRNGIOC_DRAIN of the mmap ring */
+  counter_u64_t ringbytes;  /* bytes harvested from the mmap ring */
+  counter_u64_t ringerrors; /* out-of-range heads of the mmap ring */
+  counter_u64_t hist[TRNG_HISTSIZE];
+};
+
+/* The counter values, summed over the CPUs */
+struct trng_stats_snapshot {
+  uint64_t writes;
+  uint64_t bytes;
+  uint64_t errors;
+  uint64_t rejected;
+  uint64_t ticks;
+  uint64_t harvested;
+  uint64_t harvests;
+  uint64_t flushes;
+  uint64_t timeouts;
+  uint64_t drains;
+  uint64_t ringbytes;
+  uint64_t ringerrors;
+  uint64_t hist[TRNG_HISTSIZE];
+};
+
+/* the histogram bucket of a write size */
+static inline int trng_stats_bucket(size_t len) {
+  int i = flsll((long long)len);
+
+  return (MIN(i, TRNG_HISTSIZE - 1));
+}
+
+/* Account a write which moved len bytes in the given cpu_ticks() */
+static inline void trng_stats_write(struct trng_stats *st, size_t len,
+                                    uint64_t ticks, int error) {
+  counter_u64_add(st->writes, 1);
+  counter_u64_add(st->bytes, len);
+  counter_u64_add(st->ticks, ticks);
+  counter_u64_add(st->hist[trng_stats_bucket(len)], 1);
+  if (error != 0) {
+    counter_u64_add(st->errors, 1);
+  }
+}
+
+extern void trng_stats_init(struct trng_stats *st);
+extern void trng_stats_destroy(struct trng_stats *st);
+extern void trng_stats_fetch(struct trng_stats *st,
+                             struct trng_stats_snapshot *snap);
+extern void trng_stats_zero(struct trng_stats *st);
+#ifdef _KERNEL
+extern void trng_stats_sysctl(struct trng_stats *st,
+                              struct sysctl_ctx_list *ctx,
+                              struct sysctl_oid *tree);
+#endif
+
+#endif /* _TRNG_STATS_H_ */
@@ -0,0 +1,561 @@
+/*
+ * Userspace harness for the bulk harvest path of the "trng" device driver
+ * by Kenji Rikitake
+ * License: BSD 2-clause (see trng.c)
+ *
+ * Builds trng_bulk.c and trng_stats.c against the mocks of trng_mock.h,
+ * checks that every written byte is harvested once and in order,
+ * and that the counters and the write size histogram add up,
+ * then compares the throughput and the number of uiomove(9) and
+ * random_harvest_fast(9) calls of the former 16-byte write path,
+ * of the bulk path, and of the bulk path with the counters of trng_write(),
+ * for each write size and number of threads (one mock CPU per thread),
+ * written as JSON with the counter values over the benchmark.
+ *
+ * To compile (on Linux or FreeBSD):
+ * cc -O2 -o trngbench trngbench.c trng_bulk.c trng_stats.c -lpthread
+ *
+ * Usage: trngbench [-j max-threads] [-t seconds-per-case] [-o output.json]
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trng_bulk.h"
+
+/* the former trng_write() limits */
+#define LEGACY_BUFFERSIZE (16)
+#define LEGACY_MAXUIOSIZE (1024)
+
+static const size_t sizes[] = {64, 1024, 4096, 65536};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* the write paths */
+enum { LEGACY, BULK, STATS, NPATHS };
+static const char *pathnames[NPATHS] = {"legacy", "bulk", "stats"};
+
+static double seconds = 0.5;
+
+/* Mocks */
+
+__thread int mock_curcpu;
+int mp_maxid;
+int hz = 1000;
+
+/* per-thread counters, summed by the benchmark */
+static __thread uint64_t uiomoves, harvests, yields, accumulator;
+
+/* the harvested bytes, when capturing */
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *capture;
+static size_t capture_len, capture_size;
+
+int uiomove(void *cp, int n, struct uio *uio) {
+  if ((n < 0) || (n > uio->uio_resid)) {
+    return (EINVAL);
+  }
+  memcpy(cp, uio->uio_base, n);
+  uio->uio_base += n;
+  uio->uio_resid -= n;
+  uiomoves++;
+  return (0);
+}
+
+/* the cost of random_harvest_fast(9): a hash of the entropy */
+void random_harvest_fast(const void *entropy, unsigned size,
+                         enum random_entropy_source origin __unused) {
+  const uint8_t *p = entropy;
+  uint32_t h = (uint32_t)accumulator;
+  unsigned i;
+
+  for (i = 0; i < size; i++) {
+    h += p[i];
+    h += h << 10;
+    h ^= h >> 6;
+  }
+  accumulator = h;
+  harvests++;
+  if (capture != NULL) {
+    pthread_mutex_lock(&capture_lock);
+    if (capture_len + size <= capture_size) {
+      memcpy(capture + capture_len, p, size);
+    }
+    capture_len += size;
+    pthread_mutex_unlock(&capture_lock);
+  }
+}
+
+static long mock_ticks(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * hz + ts.tv_nsec / (1000000000 / hz);
+}
+
+void callout_init(struct callout *c, int mpsafe __unused) {
+  c->fn = NULL;
+  atomic_init(&c->pending, 0);
+  atomic_init(&c->expire, 0);
+}
+
+int callout_reset(struct callout *c, int ticks, void (*fn)(void *),
+                  void *arg) {
+  c->fn = fn;
+  c->arg = arg;
+  atomic_store(&c->expire, mock_ticks() + ticks);
+  return atomic_exchange(&c->pending, 1);
+}
+
+int callout_drain(struct callout *c) { return atomic_exchange(&c->pending, 0); }
+
+/* fire the callout when expired */
+void mock_softclock(struct callout *c) {
+  if (atomic_load(&c->pending) && (mock_ticks() >= atomic_load(&c->expire)) &&
+      atomic_exchange(&c->pending, 0)) {
+    c->fn(c->arg);
+  }
+}
+
+int taskqueue_enqueue(void *tq __unused, struct task *t) {
+  t->fn(t->arg, 1);
+  return (0);
+}
+
+void maybe_yield(void) { yields++; }
+
+void *mock_malloc(size_t size) {
+  void *p = aligned_alloc(CACHE_LINE_SIZE,
+                          (size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+
+  if (p == NULL) {
+    err(EX_OSERR, "aligned_alloc");
+  }
+  memset(p, 0, size);
+  return p;
+}
+
+counter_u64_t counter_u64_alloc(int flags __unused) {
+  return mock_malloc((mp_maxid + 1) * CACHE_LINE_SIZE);
+}
+
+void counter_u64_free(counter_u64_t c) { (free)(c); }
+
+uint64_t counter_u64_fetch(counter_u64_t c) {
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i <= mp_maxid; i++) {
+    sum += __atomic_load_n(&c[i * MOCK_COUNTER_STRIDE], __ATOMIC_RELAXED);
+  }
+  return sum;
+}
+
+void counter_u64_zero(counter_u64_t c) {
+  int i;
+
+  for (i = 0; i <= mp_maxid; i++) {
+    __atomic_store_n(&c[i * MOCK_COUNTER_STRIDE], 0, __ATOMIC_RELAXED);
+  }
+}
+
+static uint64_t mock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef __x86_64__
+/* cpu_ticks() per second, measured by calibrate_ticks() */
+static double tickrate;
+
+static void calibrate_ticks(void) {
+  uint64_t ns = mock_ns(), tick = cpu_ticks();
+
+  usleep(100000);
+  tickrate = (cpu_ticks() - tick) * 1e9 / (mock_ns() - ns);
+}
+
+uint64_t cputick2usec(uint64_t tick) { return (uint64_t)(tick * 1e6 / tickrate); }
+#else
+static void calibrate_ticks(void) {}
+
+uint64_t cpu_ticks(void) { return mock_ns(); }
+
+uint64_t cputick2usec(uint64_t tick) { return tick / 1000; }
+#endif
+
+/* The former trng_write() */
+static int legacy_write(struct uio *uio) {
+  size_t amt;
+  int error;
+  uint8_t buf[LEGACY_BUFFERSIZE];
+
+  if ((uio->uio_resid < 0) || (uio->uio_resid > LEGACY_MAXUIOSIZE)) {
+    return (EIO);
+  }
+  while (uio->uio_resid > 0) {
+    amt = MIN(uio->uio_resid, LEGACY_BUFFERSIZE);
+    error = uiomove(buf, amt, uio);
+    if (error != 0) {
+      return error;
+    }
+    random_harvest_fast(buf, amt, RANDOM_NET_ETHER);
+  }
+  return 0;
+}
+
+/* The accounting of trng_write() around trng_bulk_write() */
+static int stats_write(struct uio *uio);
+
+/* The harness */
+
+static struct trng_bulk tb;
+static struct trng_stats stats;
+static atomic_int stop;
+
+static void *softclock_main(void *arg __unused) {
+  int i;
+
+  while (!atomic_load(&stop)) {
+    for (i = 0; i < tb.nstages; i++) {
+      mock_softclock(&tb.stage[i].callout);
+    }
+    usleep(1000000 / hz);
+  }
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int stats_write(struct uio *uio) {
+  uint64_t t0;
+  ssize_t resid;
+  int error;
+
+  if (uio->uio_resid < 0) {
+    counter_u64_add(stats.rejected, 1);
+    return (EIO);
+  }
+  t0 = cpu_ticks();
+  resid = uio->uio_resid;
+  error = trng_bulk_write(&tb, uio);
+  trng_stats_write(&stats, resid - uio->uio_resid, cpu_ticks() - t0, error);
+  return (error);
+}
+
+static int do_write(int path, const uint8_t *buf, size_t len) {
+  struct uio uio;
+
+  uio.uio_base = buf;
+  uio.uio_resid = (ssize_t)len;
+  switch (path) {
+  case LEGACY:
+    return legacy_write(&uio);
+  case BULK:
+    return trng_bulk_write(&tb, &uio);
+  default:
+    return stats_write(&uio);
+  }
+}
+
+/* the histogram bucket, by counting the bits */
+static int check_bucket(size_t len) {
+  int i = 0;
+
+  while ((len > 0) && (i < TRNG_HISTSIZE - 1)) {
+    len >>= 1;
+    i++;
+  }
+  return i;
+}
+
+/* the counters add up for the writes of the self-check */
+static void check_stats(const size_t *pieces, size_t npieces, size_t total) {
+  static const size_t edges[] = {0,    1,     2,     3,       4,
+                                 1023, 1024,  32767, 32768,   65535,
+                                 65536, 65537, 1 << 20, SIZE_MAX};
+  struct trng_stats_snapshot snap;
+  uint64_t hist[TRNG_HISTSIZE];
+  size_t i;
+
+  for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+    if (trng_stats_bucket(edges[i]) != check_bucket(edges[i])) {
+      errx(EX_SOFTWARE, "bucket of %zu bytes: %d, not %d", edges[i],
+           trng_stats_bucket(edges[i]), check_bucket(edges[i]));
+    }
+  }
+  memset(hist, 0, sizeof(hist));
+  for (i = 0; i < npieces * 3; i++) {
+    hist[check_bucket(pieces[i / 3])]++;
+  }
+  /* one more for the rejected write */
+  trng_stats_fetch(&stats, &snap);
+  if ((snap.writes != npieces * 3) || (snap.bytes != total) ||
+      (snap.errors != 0) || (snap.rejected != 1) ||
+      (snap.harvested != total) || (snap.harvests != harvests) ||
+      (snap.flushes != total / TRNG_STAGESIZE) || (snap.timeouts != 0) ||
+      (memcmp(snap.hist, hist, sizeof(hist)) != 0)) {
+    errx(EX_SOFTWARE,
+         "counters: %ju writes %ju bytes %ju errors %ju rejected "
+         "%ju harvested %ju harvests %ju flushes %ju timeouts",
+         (uintmax_t)snap.writes, (uintmax_t)snap.bytes,
+         (uintmax_t)snap.errors, (uintmax_t)snap.rejected,
+         (uintmax_t)snap.harvested, (uintmax_t)snap.harvests,
+         (uintmax_t)snap.flushes, (uintmax_t)snap.timeouts);
+  }
+  trng_stats_zero(&stats);
+  trng_stats_fetch(&stats, &snap);
+  if ((snap.writes != 0) || (snap.hist[0] != 0)) {
+    errx(EX_SOFTWARE, "counters not zeroed");
+  }
+}
+
+/* every byte is harvested once, in order, for a single thread */
+static void self_check(void) {
+  static const size_t pieces[] = {1, 15, 16, 17, 1000, 1024, 4095, 4096,
+                                  4097, 65536, 100003};
+  size_t total = 0, i, j;
+  struct uio uio;
+  uint8_t *data;
+
+  for (i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+    total += pieces[i] * 3;
+  }
+  if (((data = (malloc)(total)) == NULL) ||
+      ((capture = (malloc)(total)) == NULL)) {
+    err(EX_OSERR, "malloc");
+  }
+  for (i = 0; i < total; i++) {
+    data[i] = (uint8_t)(i * 131 + (i >> 8));
+  }
+  capture_size = total;
+  capture_len = 0;
+  mock_curcpu = 0;
+  harvests = 0;
+  for (i = 0, j = 0; i < sizeof(pieces) / sizeof(pieces[0]) * 3; i++) {
+    if (do_write(STATS, data + j, pieces[i / 3]) != 0) {
+      errx(EX_SOFTWARE, "bulk write of %zu bytes failed", pieces[i / 3]);
+    }
+    j += pieces[i / 3];
+  }
+  trng_bulk_flush(&tb);
+  if ((capture_len != total) || (memcmp(capture, data, total) != 0)) {
+    errx(EX_SOFTWARE, "harvested %zu bytes differ from %zu bytes written",
+         capture_len, total);
+  }
+  uio.uio_base = data;
+  uio.uio_resid = -1;
+  if (stats_write(&uio) != EIO) {
+    errx(EX_SOFTWARE, "write of a negative size accepted");
+  }
+  check_stats(pieces, sizeof(pieces) / sizeof(pieces[0]), total);
+  /* the former path rejects the writes over 1024 bytes */
+  if (do_write(LEGACY, data, LEGACY_MAXUIOSIZE + 1) != EIO) {
+    errx(EX_SOFTWARE, "legacy write of %d bytes accepted",
+         LEGACY_MAXUIOSIZE + 1);
+  }
+  (free)(capture);
+  capture = NULL;
+  (free)(data);
+  fprintf(stderr, "trngbench: self-check passed\n");
+}
+
+struct worker {
+  pthread_t tid;
+  int cpu;
+  int path;
+  size_t size;
+  uint64_t writes, bytes, uiomoves, harvests;
+};
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  uint8_t *buf;
+  size_t i;
+
+  if ((buf = (malloc)(w->size)) == NULL) {
+    err(EX_OSERR, "malloc");
+  }
+  for (i = 0; i < w->size; i++) {
+    buf[i] = (uint8_t)(i * 7 + w->cpu);
+  }
+  mock_curcpu = w->cpu;
+  uiomoves = harvests = 0;
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    if (do_write(w->path, buf, w->size) != 0) {
+      errx(EX_SOFTWARE, "write failed");
+    }
+    w->writes++;
+    w->bytes += w->size;
+  }
+  w->uiomoves = uiomoves;
+  w->harvests = harvests;
+  (free)(buf);
+  return NULL;
+}
+
+struct result {
+  double mibs;
+  double uiomoves; /* per KiB */
+  double harvests; /* per KiB */
+  double ns;       /* thread time per write */
+};
+
+static void run_case(int path, size_t size, int nthreads, struct result *r) {
+  struct worker w[nthreads];
+  pthread_t softclock;
+  uint64_t writes = 0, bytes = 0, moves = 0, harvs = 0;
+  double t0, t;
+  int i;
+
+  atomic_store(&stop, 0);
+  if (pthread_create(&softclock, NULL, softclock_main, NULL) != 0) {
+    errx(EX_OSERR, "pthread_create");
+  }
+  t0 = now();
+  for (i = 0; i < nthreads; i++) {
+    memset(&w[i], 0, sizeof(w[i]));
+    w[i].cpu = i;
+    w[i].path = path;
+    w[i].size = size;
+    if (pthread_create(&w[i].tid, NULL, worker_main, &w[i]) != 0) {
+      errx(EX_OSERR, "pthread_create");
+    }
+  }
+  usleep((useconds_t)(seconds * 1e6));
+  atomic_store(&stop, 1);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(w[i].tid, NULL);
+    writes += w[i].writes;
+    bytes += w[i].bytes;
+    moves += w[i].uiomoves;
+    harvs += w[i].harvests;
+  }
+  t = now() - t0;
+  pthread_join(softclock, NULL);
+  /* the staged bytes are harvested by this thread */
+  trng_bulk_flush(&tb);
+  r->mibs = bytes / t / 1048576;
+  r->uiomoves = moves * 1024.0 / bytes;
+  r->harvests = harvs * 1024.0 / bytes;
+  r->ns = t * 1e9 * nthreads / writes;
+}
+
+/*
+ * The counters over the benchmark, as JSON;
+ * the write counters are of the stats cases only,
+ * the harvest counters are of both the bulk and the stats cases
+ */
+static void print_stats(FILE *out) {
+  struct trng_stats_snapshot snap;
+  int i;
+
+  trng_stats_fetch(&stats, &snap);
+  fprintf(out,
+          "  \"stats\": {\"writes\": %ju, \"bytes\": %ju, \"errors\": %ju, "
+          "\"rejected\": %ju, \"write_time_us\": %ju, \"harvested\": %ju, "
+          "\"harvests\": %ju, \"flushes\": %ju, \"timeouts\": %ju,\n"
+          "    \"write_sizes\": [",
+          (uintmax_t)snap.writes, (uintmax_t)snap.bytes,
+          (uintmax_t)snap.errors, (uintmax_t)snap.rejected,
+          (uintmax_t)cputick2usec(snap.ticks), (uintmax_t)snap.harvested,
+          (uintmax_t)snap.harvests, (uintmax_t)snap.flushes,
+          (uintmax_t)snap.timeouts);
+  for (i = 0; i < TRNG_HISTSIZE; i++) {
+    fprintf(out, "%s%ju", (i == 0) ? "" : ", ", (uintmax_t)snap.hist[i]);
+  }
+  fprintf(out, "]}\n");
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  long maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct result r;
+  FILE *out;
+  size_t i;
+  int ch, path, t, first = 1;
+
+  while ((ch = getopt(argc, argv, "j:t:o:")) != -1) {
+    switch (ch) {
+    case 'j':
+      maxthreads = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      errx(EX_USAGE,
+           "Usage: %s [-j max-threads] [-t seconds-per-case] [-o output.json]",
+           argv[0]);
+    }
+  }
+  if (maxthreads < 1) {
+    maxthreads = 1;
+  }
+  if (seconds <= 0) {
+    errx(EX_USAGE, "seconds-per-case must be positive");
+  }
+  mp_maxid = (int)maxthreads - 1;
+  calibrate_ticks();
+  trng_stats_init(&stats);
+  trng_bulk_init(&tb, &stats);
+  self_check();
+
+  out = stdout;
+  if ((outname != NULL) && ((out = fopen(outname, "w")) == NULL)) {
+    err(EX_CANTCREAT, "%s", outname);
+  }
+  fprintf(out,
+          "{\n  \"benchmark\": \"trngbench\",\n  \"stage_size\": %d,\n"
+          "  \"harvest_size\": %d,\n  \"seconds_per_case\": %.3f,\n"
+          "  \"results\": [",
+          TRNG_STAGESIZE, TRNG_HARVESTSIZE, seconds);
+  for (t = 1; t <= maxthreads;
+       t = ((t < maxthreads) && (t * 2 > maxthreads)) ? (int)maxthreads
+                                                       : t * 2) {
+    for (i = 0; i < NSIZES; i++) {
+      for (path = 0; path < NPATHS; path++) {
+        if ((path == LEGACY) && (sizes[i] > LEGACY_MAXUIOSIZE)) {
+          continue;
+        }
+        run_case(path, sizes[i], t, &r);
+        fprintf(out,
+                "%s\n    {\"path\": \"%s\", \"size\": %zu, \"threads\": %d, "
+                "\"mib_per_s\": %.2f, \"uiomove_per_kib\": %.3f, "
+                "\"harvest_per_kib\": %.3f, \"ns_per_write\": %.1f}",
+                first ? "" : ",", pathnames[path], sizes[i], t, r.mibs,
+                r.uiomoves, r.harvests, r.ns);
+        first = 0;
+        fprintf(stderr,
+                "%-6s %6zu B x %2d: %9.1f MiB/s %8.3f uiomove/KiB "
+                "%8.3f harvest/KiB %8.1f ns/write\n",
+                pathnames[path], sizes[i], t, r.mibs, r.uiomoves, r.harvests,
+                r.ns);
+      }
+    }
+    if (t == maxthreads) {
+      break;
+    }
+  }
+  fprintf(out, "\n  ],\n");
+  print_stats(out);
+  fprintf(out, "}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  trng_bulk_destroy(&tb);
+  trng_stats_destroy(&stats);
+  return 0;
+}